@@ -0,0 +1,75 @@
+/* tftp-bench.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_BENCH_H
+#define TFTP_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "tftp-session.h"
+#include "tftp-storage.h"
+
+#define BENCH_MAX_BLKSIZES 8
+#define BENCH_DEFAULT_BLKSIZES "512,1432,8192,65464" // Default, PXE over Ethernet MTU, large and maximal
+#define BENCH_DEFAULT_MS 200
+#define BENCH_WARMUP_OPS 2000 // Caches, branch predictors and lazily allocated buffers are warm before measuring
+#define BENCH_BATCH 256 // Operations between reads of the clock
+#define BENCH_FILE_BLOCKS 64 // Source file of sender is this many blocks, reads wrap around it
+#define BENCH_LINE_LEN 40 // Text for netascii has line end every this many bytes
+
+struct bench_config {
+    int blksizes[BENCH_MAX_BLKSIZES];
+    int blksize_count;
+    int time_ms; // Measured time of every benchmark
+    const char *filter; // Only benchmarks with name containing it run, NULL for all
+};
+
+// Buffers and sessions of one blksize, allocated before measuring
+struct bench_ctx {
+    int blksize;
+    char *file; // Text with line ends, source of payloads
+    size_t file_len;
+    struct storage_file source; // File over the buffer, read the same way as server reads storage
+    off_t offset;
+    char *packet; // DATA packet being built or received
+    char *copy; // Payload restored before in-place conversion
+    char *encoded;
+    size_t encoded_len;
+    char rq[MAX_RQ_PACKET_SIZE];
+    size_t rq_len;
+    char oack[MAX_RQ_PACKET_SIZE];
+    size_t oack_len;
+    char ack[ACK_PACKET_SIZE];
+    struct buffer_pool pool;
+    struct tftp_session session;
+    uint16_t last_block; // Block of the last DATA sent by sender session
+    FILE *null_stream; // Printing goes to /dev/null
+    uint64_t sink; // Results are accumulated, so the compiler can't drop the work
+};
+
+// Benchmark of one operation, run returns payload bytes processed (0 if it has none)
+struct bench {
+    const char *name;
+    bool sized; // Runs for every blksize, otherwise once
+    void (*setup)(struct bench_ctx *ctx);
+    size_t (*run)(struct bench_ctx *ctx);
+    void (*teardown)(struct bench_ctx *ctx);
+};
+
+void printError(char *error, bool exit_failure);
+void printUsage(char **argv);
+void handleArguments(int argc, char **argv, struct bench_config *config);
+void runBench(const struct bench *bench, struct bench_ctx *ctx, int time_ms);
+
+#endif /* TFTP_BENCH_H */
@@ -19,26 +19,41 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
-#define DEFAULT_BLKSIZE 512
-#define DEFAULT_TIMEOUT 5
-#define TFTP_SERVER_PORT 69
+#include "tftp-session.h"
+#include "tftp-libclient.h"
+#include "tftp-lowlat.h"
+#include "tftp-trace.h"
 
-#define RRQ_OPCODE 1
-#define WRQ_OPCODE 2
-#define DATA_OPCODE 3
-#define ACK_OPCODE 4
-#define ERROR_OPCODE 5
-#define OACK_OPCODE 6
+#define CLIENT_MAX_SCORES 256
+#define CLIENT_SCORE_WEIGHT 0.125 // Weight of new response time in smoothed one (as SRTT of RFC 6298)
+#define CLIENT_HEDGE_FACTOR 2 // The fastest server gets head start of twice its response time
+#define CLIENT_MIN_HEDGE_MS 10
 
-#define OPCODE_SIZE 2
-#define BLOCK_NUMBER_SIZE 2
-#define EEROR_CODE_SIZE 2
-#define ACK_PACKET_SIZE 4
+// State of transfer shared with callbacks of the client
+struct transfer {
+    bool download;
+    char *dest_file;
+    FILE *dest; // Destination file if the download is compressed
+    char *stdin_data; // Data to upload
+    int stdin_data_len;
+    int stdin_data_pos;
+};
 
-#define MIN_BLKSIZE 8
-#define MAX_BLKSIZE 65464
-#define MIN_TIMEOUT 1
-#define MAX_TIMEOUT 255
+// Response time of server remembered between runs (-R), servers that didn't answer count as the timeout
+struct server_score {
+    struct in_addr addr;
+    double rtt_ms; // Smoothed time from RQ to the first answer
+    unsigned long samples;
+};
+
+// Received packet and state of the session before it, for latency statistics
+struct received_packet {
+    char head[DATA_HEADER_SIZE];
+    size_t len; // 0 if the packet wasn't passed to the session
+    uint16_t block;
+    enum tftp_session_state state;
+    long long sent_us;
+};
 
 void printError(char *error, bool exit_failure);
 void printUsage(char **argv);
@@ -48,19 +63,20 @@ void printDataPacket(char *src_ip, int src_port, int dest_port, int block_id);
 void printErrorPacket(char *src_ip, int src_port, int dest_port, int code, char *message);
 void printPacket(char *packet, int size);
 
-void handleArguments(int argc, char **argv, char **host, int *server_port, char **filepath, char **dest_file);
-void createUDPSocket(int *sockfd);
-void closeUDPSocket();
-void configureServerAddress(char *host, int server_port);
-void openFile(char *dest_file);
-int receiveOackPacket(int *blksize, int *timeout);
-int sendRqPacket(uint16_t opcode, char *filename, char *mode, int *blksize, int *timeout);
-int sendErrorPacket(uint16_t error_code, char *error_msg);
-void handleErrorPacket(char *packet);
-int sendDataPacket(uint16_t block, uint16_t blksize, char *stdin_data, int stdin_data_index);
-int receiveDataPacket(uint16_t expected_block, uint16_t blksize);
-int sendAckPacket(uint16_t block);
-int receiveAckPacket(uint16_t expected_block);
-int handleTimeout(int timeout);
+void handleArguments(int argc, char **argv, char **host, int *server_port, char **filepath, char **dest_file, bool *compress, bool *resume, int *windowsize, bool *sack, int *fec);
+void openFile(char *dest_file, bool append);
+void findResumeOffset(char *dest_file, long *resume, uint32_t *resume_crc);
+void compressStdinData(char **stdin_data, int *stdin_data_len);
+void finishDecompression(FILE *dest, const char *dest_file);
+int clientOnOack(struct tftp_client *c, bool received);
+int clientSend(struct tftp_client *c, const char *packet, size_t len);
+int transferRead(void *user, char *dst, size_t cap);
+int transferWrite(void *user, const char *data, size_t len);
+void clientOnPacket(struct tftp_client *c, const char *packet, size_t len);
+void loadScores(const char *path);
+void orderServers(struct tftp_client *c);
+void saveScores(struct tftp_client *c, const char *path);
+void runSession(struct tftp_client *c);
+int handleTimeout(long long timeout);
 
 #endif /* TFTP_CLIENT_H */
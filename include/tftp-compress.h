@@ -0,0 +1,36 @@
+/* tftp-compress.h ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_COMPRESS_H
+#define TFTP_COMPRESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#define COMPRESS_OPT "compress"
+#define COMPRESS_CODEC "lz4"
+#define COMPRESS_SIDECAR_EXT ".lz4" // Sidecar of administrator next to the file
+#define COMPRESS_CACHE_AREA "lz4" // Sidecars made by the server, in private directory of the root
+
+#define COMPRESS_CHUNK_SIZE 65536
+#define COMPRESS_HEADER_SIZE 8
+#define COMPRESS_STORED_FLAG 0x80000000U
+
+int compressBound(int src_len);
+int compressBlock(const char *src, int src_len, char *dst, int dst_cap);
+int decompressBlock(const char *src, int src_len, char *dst, int dst_cap);
+int compressStream(FILE *in, FILE *out);
+int decompressStream(FILE *in, FILE *out);
+int compressCheckFile(int fd, off_t size, bool decode, off_t *raw_size);
+
+#endif /* TFTP_COMPRESS_H */
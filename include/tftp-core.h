@@ -0,0 +1,113 @@
+/* tftp-core.h **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_CORE_H
+#define TFTP_CORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define DEFAULT_BLKSIZE 512
+#define DEFAULT_TIMEOUT 5
+#define TFTP_SERVER_PORT 69
+
+#define RRQ_OPCODE 1
+#define WRQ_OPCODE 2
+#define DATA_OPCODE 3
+#define ACK_OPCODE 4
+#define ERROR_OPCODE 5
+#define OACK_OPCODE 6
+
+#define OPCODE_SIZE 2
+#define BLOCK_NUMBER_SIZE 2
+#define EEROR_CODE_SIZE 2
+#define ACK_PACKET_SIZE 4
+#define SACK_RANGE_SIZE 4 // Extended ACK (sack option) appends first and last block of every range received after a gap
+#define DATA_HEADER_SIZE (OPCODE_SIZE + BLOCK_NUMBER_SIZE)
+
+#define MIN_BLKSIZE 8
+#define MAX_BLKSIZE 65464
+#define MIN_TIMEOUT 1
+#define MAX_TIMEOUT 255
+#define DEFAULT_WINDOWSIZE 1
+#define MIN_WINDOWSIZE 1
+#define MAX_WINDOWSIZE 64 // RFC 7440 allows 65535, sender keeps every block of the window in a buffer
+
+#define MAX_PACKET_SIZE (DATA_HEADER_SIZE + MAX_BLKSIZE)
+#define MAX_RQ_PACKET_SIZE 1024
+#define MAX_ERROR_PACKET_SIZE 512
+
+#define BLKSIZE_OPT "blksize"
+#define TIMEOUT_OPT "timeout"
+#define WINDOWSIZE_OPT "windowsize"
+#define SACK_OPT "sack"
+#define CWND_OPT "cwnd"
+
+// Bits set in the seen mask by tftpParseOptions
+#define OPT_SEEN_BLKSIZE 0x01
+#define OPT_SEEN_TIMEOUT 0x02
+#define OPT_SEEN_COMPRESS 0x04
+#define OPT_SEEN_RESUME 0x08
+#define OPT_SEEN_CRC32C 0x10
+#define OPT_SEEN_WINDOWSIZE 0x20
+#define OPT_SEEN_SACK 0x40
+#define OPT_SEEN_FEC 0x80
+#define OPT_SEEN_CWND 0x100
+
+// Options of RQ and OACK packets, values equal to defaults are not encoded
+struct tftp_options {
+    int blksize;
+    int timeout;
+    int windowsize; // Blocks sent before waiting for ACK (RFC 7440)
+    bool sack; // ACK carries ranges of blocks received after a gap, meaningful only with windowsize > 1
+    int fec; // Blocks of parity group, 0 without parity
+    bool cwnd; // Receiver acknowledges incomplete windows, so sender may keep fewer blocks than windowsize in flight
+    bool compress;
+    long resume; // -1 if not resuming
+    uint32_t resume_crc;
+};
+
+void tftpOptionsInit(struct tftp_options *opts);
+bool tftpHasOptions(const struct tftp_options *opts);
+
+// Packets are in network byte order, opcode and block number are written byte by byte
+static inline void tftpPrepareHeader(char *packet, uint16_t opcode) {
+    packet[0] = opcode >> 8;
+    packet[1] = opcode & 0xff;
+}
+
+static inline void tftpSetBlock(char *packet, uint16_t block) {
+    packet[2] = block >> 8;
+    packet[3] = block & 0xff;
+}
+
+static inline uint16_t tftpGetOpcode(const char *packet) {
+    return ((uint8_t)packet[0] << 8) | (uint8_t)packet[1];
+}
+
+static inline uint16_t tftpGetBlock(const char *packet) {
+    return ((uint8_t)packet[2] << 8) | (uint8_t)packet[3];
+}
+
+int tftpEncodeOptions(char *buffer, size_t cap, const struct tftp_options *opts);
+int tftpEncodeRq(char *buffer, size_t cap, uint16_t opcode, const char *filename, const char *mode, const struct tftp_options *opts);
+int tftpEncodeOack(char *buffer, size_t cap, const struct tftp_options *opts);
+int tftpEncodeError(char *buffer, size_t cap, uint16_t error_code, const char *error_msg);
+
+int tftpDecodeRq(const char *packet, size_t len, const char **filename, const char **mode, size_t *options_offset);
+int tftpDecodeError(const char *packet, size_t len, uint16_t *error_code, const char **error_msg);
+int tftpParseOptions(const char *packet, size_t len, size_t offset, struct tftp_options *opts, unsigned *seen);
+
+size_t tftpNetasciiEncode(const char *src, size_t src_len, size_t *src_used, char *dst, size_t dst_cap, int *pending);
+size_t tftpNetasciiDecode(char *data, size_t len, bool *cr_pending);
+
+#endif /* TFTP_CORE_H */
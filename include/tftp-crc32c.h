@@ -0,0 +1,26 @@
+/* tftp-crc32c.h ********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_CRC32C_H
+#define TFTP_CRC32C_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define RESUME_OPT "resume"
+#define CRC32C_OPT "crc32c"
+
+uint32_t crc32cUpdate(uint32_t crc, const char *data, size_t len);
+int crc32cStream(FILE *stream, long len, uint32_t *crc);
+int crc32cFile(int fd, off_t len, uint32_t *crc);
+
+#endif /* TFTP_CRC32C_H */
@@ -0,0 +1,91 @@
+/* tftp-dedup.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_DEDUP_H
+#define TFTP_DEDUP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tftp-storage.h"
+
+// Content-defined chunking (FastCDC with normalized chunking around the average size)
+#define DEDUP_MIN_CHUNK 2048
+#define DEDUP_AVG_CHUNK 8192
+#define DEDUP_MAX_CHUNK 65536
+#define DEDUP_MASK_S 0x0003590703530000ULL // 15 bits, boundary is less likely before the average size
+#define DEDUP_MASK_L 0x0000d90003530000ULL // 11 bits, boundary is more likely after it
+
+#define DEDUP_HASH_SIZE 16
+#define DEDUP_MAX_VARIANTS 16 // Different chunks with the same hash are stored as variants
+#define DEDUP_CHUNK_DIR ".chunks"
+#define DEDUP_MAGIC "TFTPDDP1"
+#define DEDUP_NAME_LEN 1024
+
+// Chunk reference of manifest
+struct dedup_entry {
+    uint32_t len;
+    uint16_t variant;
+    uint16_t reserved;
+    unsigned char hash[DEDUP_HASH_SIZE];
+};
+
+// Uploaded file is stored as manifest, header followed by entries (host byte order)
+struct dedup_manifest_header {
+    char magic[8];
+    uint64_t size;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// Upload being chunked, data wait in buffer until a chunk boundary is found
+struct dedup_writer {
+    int manifest_fd; // Temporary manifest, linked under the name by commit
+    char tmp_name[DEDUP_NAME_LEN];
+    char name[DEDUP_NAME_LEN];
+    bool committed;
+    uint64_t size;
+    uint32_t count;
+    size_t buffered;
+    size_t scan_pos; // Data before it were already searched for boundary
+    uint64_t fingerprint;
+    unsigned char buffer[DEDUP_MAX_CHUNK];
+};
+
+// Manifest being read, chunk files are opened one at a time
+struct dedup_reader {
+    struct dedup_entry *entries;
+    uint32_t count;
+    int chunk_fd;
+    long chunk_entry; // Entry of open chunk, -1 if none
+};
+
+// Store in root directory, files that aren't manifests are served as they are
+struct dedup_store {
+    int root_fd;
+    unsigned long writers; // Uploads opened by this process, they number temporary manifests
+    unsigned long chunks; // Chunks of uploads written by this process
+    unsigned long new_chunks; // Chunks that weren't in the store
+    unsigned long long new_bytes;
+    unsigned char compare[DEDUP_MAX_CHUNK];
+};
+
+extern const struct storage_ops dedup_storage_ops;
+
+void dedupHash(const char *data, size_t len, unsigned char *hash);
+size_t dedupCut(const unsigned char *data, size_t len, size_t *pos, uint64_t *fingerprint, bool final);
+int storageCreateDedup(struct storage *storage, const char *root_dirpath);
+
+#endif /* TFTP_DEDUP_H */
@@ -0,0 +1,46 @@
+/* tftp-demux.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_DEMUX_H
+#define TFTP_DEMUX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define DEMUX_MAX_SESSIONS 16384
+#define DEMUX_MAX_SOCKETS 16
+#define DEMUX_EMPTY UINT32_MAX
+
+// Slot of the table, key is address and port of the client (TID) in network byte order
+struct demux_slot {
+    uint32_t addr;
+    uint16_t port;
+    uint16_t reserved;
+    uint32_t session; // DEMUX_EMPTY if the slot is empty
+};
+
+// Open-addressing table with linear probing, 12-byte slots keep a probe sequence in one or two cache lines.
+// Removal shifts following slots back, so there are no tombstones and lookups never slow down with churn
+struct demux_table {
+    struct demux_slot *slots;
+    uint32_t mask; // Capacity - 1, capacity is a power of two at least twice the maximum of sessions
+    uint32_t count;
+    unsigned long lookups;
+    unsigned long probes; // Slots visited by lookups
+};
+
+int demuxInit(struct demux_table *table, uint32_t max_sessions);
+uint32_t demuxLookup(struct demux_table *table, const struct sockaddr_in *addr);
+int demuxInsert(struct demux_table *table, const struct sockaddr_in *addr, uint32_t session);
+void demuxRemove(struct demux_table *table, const struct sockaddr_in *addr);
+void demuxDestroy(struct demux_table *table);
+
+#endif /* TFTP_DEMUX_H */
@@ -0,0 +1,52 @@
+/* tftp-fdcache.h *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_FDCACHE_H
+#define TFTP_FDCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FD_CACHE_SIZE 64
+#define FD_CACHE_NAME_LEN 1024
+#define FD_CACHE_REVALIDATE_SEC 1 // Cached fd is checked against the directory at most once per second
+
+// Read-only descriptor of a file in the root directory
+struct fd_cache_entry {
+    char name[FD_CACHE_NAME_LEN];
+    int fd; // -1 if the entry is empty
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    time_t checked; // Time of the last revalidation
+    unsigned long last_used; // For LRU eviction
+};
+
+struct fd_cache {
+    int root_fd; // Root directory, every lookup is relative to it
+    unsigned long uses;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long reopens; // File was replaced or changed since it was cached
+    struct fd_cache_entry entries[FD_CACHE_SIZE];
+};
+
+int fdCacheInit(struct fd_cache *cache, const char *root_dirpath);
+const char *fdCacheRelative(const char *filename);
+int fdCacheOpen(struct fd_cache *cache, const char *filename, time_t now);
+void fdCacheDestroy(struct fd_cache *cache);
+
+#endif /* TFTP_FDCACHE_H */
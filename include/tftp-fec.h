@@ -0,0 +1,51 @@
+/* tftp-fec.h ***********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_FEC_H
+#define TFTP_FEC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FEC_OPT "fec"
+#define FEC_OPCODE 7
+#define MIN_FEC_GROUP 2
+#define MAX_FEC_GROUP 16
+
+// PARITY packet: opcode, first block of the group, blocks in the group, XOR of their payload lengths and
+// XOR of their payloads padded with zeros to blksize
+#define FEC_HEADER_SIZE 8
+
+static inline void fecSetHeader(char *packet, uint16_t first, uint16_t count, uint16_t len_xor) {
+    packet[0] = FEC_OPCODE >> 8;
+    packet[1] = FEC_OPCODE & 0xff;
+    packet[2] = first >> 8;
+    packet[3] = first & 0xff;
+    packet[4] = count >> 8;
+    packet[5] = count & 0xff;
+    packet[6] = len_xor >> 8;
+    packet[7] = len_xor & 0xff;
+}
+
+static inline uint16_t fecGetFirst(const char *packet) {
+    return ((uint8_t)packet[2] << 8) | (uint8_t)packet[3];
+}
+
+static inline uint16_t fecGetCount(const char *packet) {
+    return ((uint8_t)packet[4] << 8) | (uint8_t)packet[5];
+}
+
+static inline uint16_t fecGetLenXor(const char *packet) {
+    return ((uint8_t)packet[6] << 8) | (uint8_t)packet[7];
+}
+
+void fecXor(char *dst, const char *src, size_t len);
+
+#endif /* TFTP_FEC_H */
@@ -0,0 +1,126 @@
+/* tftp-libclient.h *****************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_LIBCLIENT_H
+#define TFTP_LIBCLIENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "tftp-session.h"
+#include "tftp-pool.h"
+
+#define TFTP_CLIENT_MAX_SERVERS 8
+
+struct tftp_client;
+
+// Receives downloaded data in order, return 0 or -1 to stop the transfer
+typedef int (*tftp_client_sink)(void *user, const char *data, size_t len);
+// Fills up to cap bytes of data to upload, return bytes (less than cap at the end) or -1
+typedef int (*tftp_client_source)(void *user, char *dst, size_t cap);
+
+// Optional callbacks of the application, all get the client and its user pointer
+struct tftp_client_hooks {
+    // Options were checked against the requested ones (received is false if the server ignored them),
+    // return -1 (after tftpClientAbort) to stop the transfer
+    int (*on_oack)(struct tftp_client *c, bool received);
+    // Packet from the server, called before it is processed
+    void (*on_packet)(struct tftp_client *c, const char *packet, size_t len);
+    // Replaces sending of packets (to measure it), the packet is sent by tftpClientSendPacket
+    int (*send)(struct tftp_client *c, const char *packet, size_t len);
+    // Transfer ended, successfully or not, called once
+    void (*on_done)(struct tftp_client *c);
+};
+
+// Server of download race, all servers hold the same files and the first to answer serves the transfer
+struct tftp_client_server {
+    struct sockaddr_in addr;
+    bool asked; // RQ was sent to the server
+    long long asked_ms; // Time RQ was sent, servers after the first one are asked later if they are hedged
+    bool failed; // Server answered with ERROR
+    long long answer_ms; // Time of the first answer, -1 if none arrived
+};
+
+// One transfer with one server, everything the transfer needs is here, so clients of one process are independent.
+// Functions never exit, errors end the transfer and are kept in the session
+struct tftp_client {
+    int sockfd; // Socket of the transfer, the caller can poll it in its own event loop, receiving never blocks
+    struct sockaddr_in server_addr; // Port changes to transfer port of the server with the first answer
+
+    // Download with more servers sends RQ to all of them, answers of the others are refused with ERROR
+    struct tftp_client_server servers[TFTP_CLIENT_MAX_SERVERS];
+    int server_count;
+    int winner; // Server that answered first, -1 until then
+    long long hedge_ms; // Servers after the first get RQ only if it doesn't answer in this time, 0 asks all at once
+    long long hedge_at; // Time to ask the rest, TIMER_NEVER if there is nobody left to ask
+    bool connected; // Socket is connected to transfer port of the server, the kernel drops packets of other TIDs
+    struct sockaddr_in recv_addr; // Source of the last received packet
+    struct sockaddr_in local_addr;
+
+    struct tftp_session session;
+    struct buffer_pool pool;
+    struct tftp_options requested;
+
+    bool download;
+    tftp_client_sink sink;
+    tftp_client_source source;
+    void *user;
+
+    // Download into buffer of the caller instead of sink
+    char *buffer;
+    size_t buffer_cap;
+    size_t buffer_len;
+
+    const struct tftp_client_hooks *hooks;
+    bool done; // on_done was called
+    char error_msg[SESSION_ERROR_MSG_LEN]; // Error before the transfer started
+};
+
+int tftpClientInit(struct tftp_client *c, const char *host, int port);
+int tftpClientInitRace(struct tftp_client *c, const char *hosts, int port, bool all_addresses);
+void tftpClientSetHedge(struct tftp_client *c, long long hedge_ms);
+void tftpClientSetHooks(struct tftp_client *c, const struct tftp_client_hooks *hooks, void *user);
+int tftpClientStartFetch(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, tftp_client_sink sink, void *user);
+int tftpClientStartFetchBuffer(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, char *buffer, size_t cap);
+int tftpClientStartUpload(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, tftp_client_source source, void *user);
+int tftpClientSendPacket(struct tftp_client *c, const char *packet, size_t len);
+int tftpClientReceive(struct tftp_client *c, long long now);
+void tftpClientOnReadable(struct tftp_client *c, long long now);
+void tftpClientOnTimer(struct tftp_client *c, long long now);
+int tftpClientRun(struct tftp_client *c);
+void tftpClientAbort(struct tftp_client *c, uint16_t error_code, const char *error_msg);
+const char *tftpClientError(const struct tftp_client *c);
+void tftpClientClose(struct tftp_client *c);
+long tftpClientFetch(const char *host, int port, const char *filename, const struct tftp_options *opts, char *buffer, size_t cap, char *error, size_t error_cap);
+
+static inline int tftpClientFd(const struct tftp_client *c) {
+    return c->sockfd;
+}
+
+static inline long long tftpClientDeadline(const struct tftp_client *c) {
+    long long deadline = tftpSessionDeadline(&c->session);
+    return c->hedge_at < deadline ? c->hedge_at : deadline;
+}
+
+static inline bool tftpClientFinished(const struct tftp_client *c) {
+    return tftpSessionFinished(&c->session);
+}
+
+static inline struct tftp_client *tftpClientOf(struct tftp_session *session) {
+    return session->ctx;
+}
+
+#endif /* TFTP_LIBCLIENT_H */
@@ -0,0 +1,143 @@
+/* tftp-loadgen.h *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_LOADGEN_H
+#define TFTP_LOADGEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "tftp-session.h"
+#include "tftp-lowlat.h"
+
+#define LOADGEN_MAX_STEPS 16
+#define LOADGEN_MAX_CHOICES 8
+#define LOADGEN_NAME_LEN 256
+#define LOADGEN_MAX_EVENTS 256
+#define LOADGEN_MAX_ERROR_CODE 8
+#define LOADGEN_SATURATION_FACTOR 10 // Admission p99 this many times over the first p50 marks saturation
+#define LOADGEN_MIN_BASELINE_US 100
+#define LOADGEN_DEFAULT_SCRIPT "?pxelinux.cfg/01-%m,?pxelinux.cfg/%x,pxelinux.cfg/default,vmlinuz"
+
+// One request of the script, probe expects the file to be missing
+struct loadgen_step {
+    char name[LOADGEN_NAME_LEN]; // %i index of client, %x its IP in hex, %m its MAC, %% percent sign
+    bool probe;
+};
+
+struct loadgen_config {
+    char *host;
+    int port;
+    int clients;
+    int concurrency; // Maximum number of clients running at the same time
+    double rate; // Clients started per second, 0 starts them all at once
+    double ramp; // Seconds until the start rate grows from 0 to rate
+    struct loadgen_step steps[LOADGEN_MAX_STEPS];
+    int step_count;
+    int blksizes[LOADGEN_MAX_CHOICES]; // Every request picks one of the values randomly
+    int blksize_count;
+    int timeouts[LOADGEN_MAX_CHOICES];
+    int timeout_count;
+    uint64_t seed;
+};
+
+struct loadgen;
+
+// Simulated PXE client, runs steps of the script one after another on a new port each
+struct loadgen_client {
+    struct loadgen *lg;
+    int id;
+    int step;
+    int sockfd;
+    struct sockaddr_in peer; // Server, port is latched from the first answer
+    struct tftp_session session;
+    struct tftp_timer timer; // Retransmission timer of the session
+    long long rq_us;
+    bool admitted; // Server answered RQ of the current step
+    unsigned long long bytes; // Downloaded in the current step
+    long long start_us;
+    unsigned long long total_bytes;
+};
+
+// Activity in one second of the run
+struct loadgen_second {
+    unsigned long started;
+    unsigned long finished;
+    unsigned long failed;
+    unsigned long peak_active;
+    unsigned long long bytes;
+};
+
+struct loadgen_sample {
+    long long at_ms; // Time since start of the run
+    long long value_us;
+};
+
+struct loadgen {
+    const struct loadgen_config *config;
+    struct sockaddr_in server_addr;
+    int epfd;
+    struct timer_wheel wheel;
+    struct buffer_pool pool;
+    struct loadgen_client *clients;
+    uint64_t rng;
+    long long start_ms;
+
+    int started;
+    int active;
+    int finished;
+
+    unsigned long requests;
+    unsigned long clients_ok;
+    unsigned long probes;
+    unsigned long downloads;
+    unsigned long timeouts;
+    unsigned long local_errors;
+    unsigned long error_codes[LOADGEN_MAX_ERROR_CODE + 2]; // Last item counts unknown codes
+    unsigned long long bytes;
+
+    struct loadgen_sample *admissions; // RQ sent until the first answer
+    size_t admission_count;
+    size_t admission_cap;
+    double *throughputs; // KiB/s of every client that finished its script
+    size_t throughput_count;
+    size_t throughput_cap;
+    struct loadgen_second *seconds;
+    size_t second_count;
+    size_t second_used;
+};
+
+void printError(char *error, bool exit_failure);
+void printUsage(char **argv);
+void handleArguments(int argc, char **argv, struct loadgen_config *config);
+
+int loadgenSend(struct tftp_session *session, const char *packet, size_t len);
+int loadgenRead(struct tftp_session *session, char *dst, size_t cap);
+int loadgenWrite(struct tftp_session *session, char *data, size_t len);
+void loadgenOnPacket(struct tftp_session *session, const char *packet, size_t len);
+
+void loadgenStartStep(struct loadgen_client *client, long long now);
+void loadgenEndStep(struct loadgen_client *client, long long now);
+void loadgenOnReadable(struct loadgen_client *client);
+void loadgenStartClients(struct loadgen *lg, long long now);
+long long loadgenNextStart(struct loadgen *lg);
+void loadgenReport(struct loadgen *lg, double wall_ms);
+
+#endif /* TFTP_LOADGEN_H */
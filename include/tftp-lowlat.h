@@ -0,0 +1,63 @@
+/* tftp-lowlat.h ********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_LOWLAT_H
+#define TFTP_LOWLAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#define LOWLAT_MAX_CPUS 64
+#define LOWLAT_BUSY_POLL_USEC 50 // SO_BUSY_POLL, time the kernel polls the device queue on blocking receive
+#define LOWLAT_SPIN_USEC 2000 // Time of spinning on non-blocking receive before falling back to select()
+#define LOWLAT_SOCK_PRIORITY 6 // Highest priority allowed without CAP_NET_ADMIN
+#define LOWLAT_SOCKBUF_PACKETS 16 // Socket buffers hold this many packets of negotiated blksize
+#define LOWLAT_PACKET_OVERHEAD 64 // IP and UDP headers and skb bookkeeping per packet
+
+// CPUs to pin the process or its workers to
+struct lowlat_cpus {
+    int cpus[LOWLAT_MAX_CPUS];
+    int count;
+};
+
+// Per-block round trip times and time to first DATA packet
+struct latency_stats {
+    long long start_us; // Start of the transfer (RQ sent by client, RQ received by server)
+    long long ttfb_us; // -1 until the first DATA packet is sent or received
+    long long last_tx_us; // First transmission of the last packet, -1 if it was retransmitted (Karn's algorithm)
+    long long *samples;
+    size_t count;
+    size_t cap;
+};
+
+static inline long long lowlatClockUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int lowlatParseCpus(const char *list, struct lowlat_cpus *cpus);
+int lowlatPin(const struct lowlat_cpus *cpus, int worker);
+void lowlatTuneSocket(int sockfd, int blksize);
+int lowlatWait(int sockfd, long long timeout_ms);
+
+void latencyInit(struct latency_stats *stats, long long start_us);
+void latencyOnSend(struct latency_stats *stats, const char *packet, size_t len, bool retransmit, long long now_us);
+void latencyOnReceive(struct latency_stats *stats, const char *packet, size_t len, long long sent_us, long long now_us);
+void latencyPrint(struct latency_stats *stats);
+void latencyDestroy(struct latency_stats *stats);
+
+#endif /* TFTP_LOWLAT_H */
@@ -0,0 +1,63 @@
+/* tftp-memstore.h ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_MEMSTORE_H
+#define TFTP_MEMSTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tftp-storage.h"
+
+#define MEMSTORE_MAX_FILES 4096 // Power of two, size of open addressing table
+#define MEMSTORE_NAME_LEN 256
+#define MEMSTORE_EXTENT_SIZE 4096 // Files are chains of extents, small config files waste little memory
+#define MEMSTORE_NO_EXTENT UINT32_MAX
+#define MEMSTORE_DEFAULT_SPARE (64 * 1024 * 1024) // Memory for uploads when size isn't given
+
+enum memstore_state {
+    MEMSTORE_FREE,
+    MEMSTORE_WRITING, // Upload in progress, invisible to readers
+    MEMSTORE_READY,
+    MEMSTORE_DELETED, // Discarded upload, lookups continue past it
+};
+
+struct memstore_entry {
+    char name[MEMSTORE_NAME_LEN];
+    int state; // enum memstore_state
+    off_t size;
+    time_t mtime;
+    uint32_t first; // First extent, MEMSTORE_NO_EXTENT if the file is empty
+    uint32_t last;
+};
+
+// Files kept in memory shared by the listener and all children, followed by extent links and extent data
+struct memstore {
+    pthread_mutex_t lock;
+    size_t mapping_size;
+    size_t data_offset; // Offset of the first extent in the mapping
+    uint32_t extent_count;
+    uint32_t free_extent; // Head of list of free extents
+    uint32_t free_count;
+    int files; // Ready files
+    struct memstore_entry entries[MEMSTORE_MAX_FILES];
+};
+
+extern const struct storage_ops memory_storage_ops;
+
+int storageCreateMemory(struct storage *storage, const char *root_dirpath, size_t capacity);
+
+#endif /* TFTP_MEMSTORE_H */
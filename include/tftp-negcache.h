@@ -0,0 +1,58 @@
+/* tftp-negcache.h ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_NEGCACHE_H
+#define TFTP_NEGCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define NEG_CACHE_SETS 256
+#define NEG_CACHE_WAYS 4
+#define NEG_CACHE_NAME_LEN 256 // Longer names are not cached
+#define NEG_CACHE_TTL_SEC 30
+#define NEG_CACHE_MAX_WATCHES 64
+#define NEG_CACHE_WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Name of file that wasn't found, valid until expires or until its directory changes
+struct neg_cache_entry {
+    char name[NEG_CACHE_NAME_LEN];
+    time_t expires; // 0 if the entry is empty
+    int watch; // Index of watch of the closest existing directory of the file
+};
+
+// Watched directory relative to root ("" is root itself)
+struct neg_cache_watch {
+    int wd; // -1 if the directory is no longer watched
+    char dir[NEG_CACHE_NAME_LEN];
+};
+
+struct neg_cache {
+    int inotify_fd; // -1 if inotify isn't available, the cache is disabled then
+    const char *root_dirpath;
+    int watch_count;
+    struct neg_cache_watch watches[NEG_CACHE_MAX_WATCHES];
+    struct neg_cache_entry entries[NEG_CACHE_SETS][NEG_CACHE_WAYS];
+    unsigned long hits;
+    unsigned long inserts;
+    unsigned long invalidations;
+};
+
+int negCacheInit(struct neg_cache *cache, const char *root_dirpath);
+void negCacheProcessEvents(struct neg_cache *cache);
+bool negCacheLookup(struct neg_cache *cache, const char *filename, time_t now);
+void negCacheInsert(struct neg_cache *cache, const char *filename, time_t now);
+void negCacheDestroy(struct neg_cache *cache);
+
+#endif /* TFTP_NEGCACHE_H */
@@ -0,0 +1,48 @@
+/* tftp-pack.h **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_PACK_H
+#define TFTP_PACK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "tftp-packstore.h"
+
+#define PACK_COPY_SIZE 65536
+
+// Regular file of the packed tree
+struct pack_file {
+    char *name; // Path relative to the root
+    off_t size;
+    time_t mtime;
+    uint64_t offset; // Offset of data in archive
+};
+
+struct pack_list {
+    struct pack_file *files;
+    size_t count;
+    size_t cap;
+    const char *failed; // File that couldn't be copied
+};
+
+void printError(char *error, bool exit_failure);
+void printUsage(char **argv);
+void handleArguments(int argc, char **argv, char **archive_path, char **root_dirpath);
+int collectFiles(struct pack_list *list, int dir_fd, char *path, size_t path_len);
+int writeArchive(struct pack_list *list, int root_fd, int archive_fd);
+
+#endif /* TFTP_PACK_H */
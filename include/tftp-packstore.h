@@ -0,0 +1,78 @@
+/* tftp-packstore.h *****************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_PACKSTORE_H
+#define TFTP_PACKSTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tftp-storage.h"
+
+#define PACK_MAGIC "TFTPPAK1"
+#define PACK_ALIGN 4096 // Files of a page or more start at a page boundary, smaller ones don't cross it
+#define PACK_NAME_LEN 1024
+#define PACK_NO_ENTRY UINT32_MAX
+#define PACK_CHECK_INTERVAL 1 // Seconds between checks whether the archive was replaced
+
+// Archive made by tftp-pack: header, index entries sorted by name, hash table of entries, names and file data.
+// Integers are in host byte order, the archive is made on the machine of the server
+struct pack_header {
+    char magic[8];
+    uint32_t count; // Entries right after the header
+    uint32_t slot_count; // Power of two at least twice the count, slots follow the entries
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t size; // Size of the whole archive, truncated archive is refused
+};
+
+struct pack_entry {
+    uint64_t offset; // Offset of data in archive
+    uint64_t size;
+    int64_t mtime;
+    uint32_t name; // Offset of name in names, names end with '\0'
+    uint32_t hash;
+};
+
+// One mapped archive. Replaced archive stays mapped until its last open file is closed
+struct pack_archive {
+    const char *map;
+    size_t size;
+    const struct pack_entry *entries;
+    const uint32_t *slots; // Entry of every slot, PACK_NO_ENTRY if the slot is empty
+    const char *names;
+    uint32_t count;
+    uint32_t mask;
+    dev_t dev;
+    ino_t ino;
+    unsigned long refs; // Open files
+    bool retired;
+};
+
+// Read-only store of the archive at path, lookups never touch the file system
+struct packstore {
+    char path[PATH_MAX];
+    struct pack_archive *current;
+    time_t checked; // Last check of the path for a new archive
+};
+
+extern const struct storage_ops pack_storage_ops;
+
+uint32_t packHash(const char *name);
+int storageCreatePack(struct storage *storage, const char *archive_path);
+
+#endif /* TFTP_PACKSTORE_H */
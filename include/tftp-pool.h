@@ -0,0 +1,65 @@
+/* tftp-pool.h **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_POOL_H
+#define TFTP_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define POOL_CLASSES 8 // Payload classes 512, 1024, ... 65536 bytes
+#define POOL_MIN_CLASS 512
+#define POOL_SLACK 16 // Packet header and terminating byte fit into buffer of every class
+#define POOL_ALIGN 64
+#define POOL_SLAB_SIZE (64 * 1024) // Slabs of small classes hold more buffers, large classes one buffer per slab
+#define POOL_MAX_SIZE ((POOL_MIN_CLASS << (POOL_CLASSES - 1)) + POOL_SLACK)
+
+// Free buffer is linked through its first bytes, header before data keeps class of the buffer
+struct pool_buffer {
+    struct pool_buffer *next;
+    uint8_t cls;
+    char pad[POOL_ALIGN - sizeof(struct pool_buffer *) - sizeof(uint8_t)];
+};
+
+struct pool_slab {
+    struct pool_slab *next;
+};
+
+struct pool_class {
+    size_t size; // Usable bytes of buffer
+    size_t stride; // Bytes of buffer with header in slab
+    struct pool_buffer *free;
+    unsigned long slabs;
+    unsigned long buffers;
+    unsigned long in_use;
+    unsigned long peak;
+};
+
+// Size classed pool of packet buffers, buffers are reused and slabs are released only by poolDestroy
+struct buffer_pool {
+    struct pool_class classes[POOL_CLASSES];
+    struct pool_slab *slabs;
+    size_t max_bytes; // Limit of slab memory, 0 without limit
+    size_t reserved; // Bytes of all slabs
+    size_t in_use; // Usable bytes of allocated buffers
+    size_t peak;
+    unsigned long allocs;
+    unsigned long reuses; // Allocations served from free list without new slab
+    unsigned long failures;
+};
+
+void poolInit(struct buffer_pool *pool, size_t max_bytes);
+size_t poolCapacity(size_t size);
+void *poolAlloc(struct buffer_pool *pool, size_t size, size_t *cap);
+void poolFree(struct buffer_pool *pool, void *buffer);
+void poolPrintStats(const struct buffer_pool *pool, FILE *stream);
+void poolDestroy(struct buffer_pool *pool);
+
+#endif /* TFTP_POOL_H */
@@ -0,0 +1,92 @@
+/* tftp-sched.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_SCHED_H
+#define TFTP_SCHED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "tftp-core.h"
+
+#define SCHED_MAX_FLOWS 1024
+#define SCHED_MAX_BUCKETS 256
+#define SCHED_QUANTUM 1500 // Bytes added to deficit of a waiting flow in every round
+#define SCHED_NEW_FLOW_BYTES (64 * 1024) // Flows that sent less are served first, small boot files keep low latency
+#define SCHED_OVERHEAD 28 // IPv4 and UDP headers are counted to the rate
+#define SCHED_MAX_PACKET (MAX_BLKSIZE + DATA_HEADER_SIZE + SCHED_OVERHEAD)
+#define SCHED_BURST_MS 10 // Bucket holds tokens for this time at full rate, but at least one packet of any size
+#define SCHED_MAX_WAIT_NS 100000000LL
+
+enum sched_list_id {
+    SCHED_LIST_NONE = -1,
+    SCHED_LIST_NEW,
+    SCHED_LIST_OLD,
+};
+
+// Token bucket, rate 0 means unlimited
+struct sched_bucket {
+    uint32_t key; // Subnet of clients sharing the bucket
+    int flows; // Flows using the bucket, 0 if the slot is free
+    double rate; // Bytes per second
+    double burst;
+    double tokens;
+    long long last_ns;
+};
+
+// Transfer of one child process, it has at most one packet waiting for transmission
+struct sched_flow {
+    pid_t pid; // 0 if the slot is free
+    int bucket; // Index of bucket of the client subnet, -1 without per-client cap
+    size_t pending; // Bytes of waiting packet
+    bool granted;
+    long long deficit;
+    unsigned long long sent;
+    int list; // enum sched_list_id
+    int prev;
+    int next;
+};
+
+struct sched_list {
+    int head; // -1 if empty
+    int tail;
+    int count;
+};
+
+// Deficit round robin over flows waiting to send, kept in memory shared by the listener and all children
+struct sched {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Broadcast when packets are granted
+    struct sched_bucket global;
+    double client_rate; // Cap of every client subnet, 0 without cap
+    int prefix; // Length of subnet prefix sharing one client cap
+    struct sched_bucket buckets[SCHED_MAX_BUCKETS];
+    struct sched_flow flows[SCHED_MAX_FLOWS];
+    struct sched_list lists[2]; // New flows are served before old ones
+    unsigned long grants;
+    unsigned long waits; // Grants that had to wait for their turn or tokens
+};
+
+int schedParseRate(const char *arg, double *rate);
+int schedParseClientRate(const char *arg, double *rate, int *prefix);
+struct sched *schedCreate(double global_rate, double client_rate, int prefix);
+int schedOpen(struct sched *sched, struct in_addr addr, pid_t pid);
+void schedAcquire(struct sched *sched, int flow, size_t bytes);
+void schedClose(struct sched *sched, int flow);
+void schedDestroy(struct sched *sched);
+
+#endif /* TFTP_SCHED_H */
@@ -18,27 +18,48 @@
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
 
-#define DEFAULT_BLKSIZE 512
-#define TFTP_SERVER_PORT 69
-#define DEFAULT_TIMEOUT 5
+#include "tftp-session.h"
+#include "tftp-storage.h"
+#include "tftp-vfile.h"
+#include "tftp-negcache.h"
+#include "tftp-lowlat.h"
+#include "tftp-trace.h"
+#include "tftp-sched.h"
+#include "tftp-demux.h"
 
-#define RRQ_OPCODE 1
-#define WRQ_OPCODE 2
-#define DATA_OPCODE 3
-#define ACK_OPCODE 4
-#define ERROR_OPCODE 5
-#define OACK_OPCODE 6
+#define MAX_FILENAME_LEN 1024
+#define MAX_MODE_LEN 128
+#define DEMUX_NETASCII_BUFFER 4096
+#define DEMUX_RECV_BATCH 64 // Packets received from one socket before the others get their turn
+#define DEMUX_MAX_EVENTS 16
 
-#define OPCODE_SIZE 2
-#define BLOCK_NUMBER_SIZE 2
-#define EEROR_CODE_SIZE 2
-#define ACK_PACKET_SIZE 4
+// State of netascii conversion of file being sent or received
+struct netascii_state {
+    char *buffer; // File data waiting for conversion
+    size_t cap;
+    size_t pos;
+    size_t len;
+    int pending; // Second byte of converted sequence that didn't fit, -1 if none
+    bool cr_pending; // Received data ended with CR
+};
 
-#define MIN_BLKSIZE 8
-#define MAX_BLKSIZE 65464
-#define MIN_TIMEOUT 1
-#define MAX_TIMEOUT 255
+// Transfer of demultiplexing mode, the listener runs it on the socket the request arrived on
+struct demux_transfer {
+    uint32_t index;
+    int sockfd;
+    struct sockaddr_in peer;
+    struct storage_file file;
+    off_t offset; // Offset of the next read of file being sent
+    bool netascii_mode;
+    struct netascii_state netascii; // Buffer exists only when netascii file is sent
+    struct tftp_session session;
+    struct tftp_timer timer; // Retransmission timer of the session
+};
 
 void printError(char *error, bool exit_failure);
 void printUsage(char **argv);
@@ -52,15 +73,38 @@ void createUDPSocket(int *sockfd);
 void closeUDPSocket(int *sockfd);
 void configureServerAddress(int server_port);
 void sendErrorPacket(uint16_t error_code, char *error_msg, bool exit_failure);
-void handleErrorPacket(char *packet);
-void openFile(char *root_dirpath, char *filename, bool send_file);
-int sendOackPacket(int blksize, int timeout);
-void handleOptions(char *rq_packet, size_t bytes_rx, int *blksize, int *timeout);
-int receiveRqPacket(char *mode, char *filename, bool *send_file, int *blksize, int *timeout);
-int sendDataPacket(uint16_t block, int blksize, bool is_retransmit, char *mode);
-int receiveDataPacket(uint16_t expected_block, int blksize, char *mode);
-int sendAckPacket(uint16_t block);
-int receiveAckPacket(uint16_t expected_block);
-int handleTimeout(int timeout);
+void handleErrorPacket(char *packet, int len);
+uint16_t storageErrorCode(char **error_msg);
+void sendStorageError(char *error_msg);
+void openFile(char *filename, bool send_file, struct tftp_options *opts);
+int openSidecar(int root_fd, const char *sidecar_name, const struct stat *file_stat, bool generated);
+void openCompressedFile(char *filename);
+int finishDecompression();
+void abortCommit(struct tftp_session *session);
+int sessionFinish(struct tftp_session *session);
+void closeTransferFile();
+int encodeOackPacket(struct tftp_options *opts);
+int handleOptions(char *rq_packet, size_t bytes_rx, size_t options_offset, struct tftp_options *opts);
+int receiveRqPacket(char *mode, char *filename, bool *send_file, struct tftp_options *opts);
+int parseRqPacket(int bytes_rx, char *mode, char *filename, bool *send_file, struct tftp_options *opts);
+int prepareRequest(char *filename, bool send_file, struct tftp_options *opts, bool *has_options, time_t now);
+int readNetascii(struct storage_file *file, off_t *offset, struct netascii_state *state, char *dst, int cap);
+int sessionSend(struct tftp_session *session, const char *packet, size_t len);
+int sessionRead(struct tftp_session *session, char *dst, size_t cap);
+int sessionWrite(struct tftp_session *session, char *data, size_t len);
+void sessionPrintPacket(struct tftp_session *session, const char *packet, size_t len);
+bool sameTid(const struct sockaddr_in *a, const struct sockaddr_in *b);
+void runSession(struct tftp_session *session);
+void flushTrace();
+void closeSchedFlow();
+int handleTimeout(long long timeout);
+int demuxSend(struct tftp_session *session, const char *packet, size_t len);
+int demuxRead(struct tftp_session *session, char *dst, size_t cap);
+int demuxWrite(struct tftp_session *session, char *data, size_t len);
+int demuxFinish(struct tftp_session *session);
+void demuxStart(int socket, int bytes_rx, long long now);
+void demuxEnd(struct demux_transfer *transfer);
+void demuxOnReadable(int socket);
+void runDemux();
 
 #endif /* TFTP_SERVER_H */
\ No newline at end of file
@@ -0,0 +1,189 @@
+/* tftp-session.h *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_SESSION_H
+#define TFTP_SESSION_H
+
+#include <time.h>
+
+#include "tftp-core.h"
+#include "tftp-timer.h"
+#include "tftp-pool.h"
+
+#define DEFAULT_MAX_RETRANSMITS 3
+#define SESSION_ERROR_MSG_LEN 128
+#define SESSION_INITIAL_CWND 4 // Blocks of the first round of windowed transfer with cwnd option
+#define SESSION_DUP_ACKS 3 // Duplicate ACKs of one block that report a gap with cwnd option (TCP dupthresh)
+#define SESSION_MIN_ACK_DELAY_MS 1 // Receiver waits at least this long for the rest of the window before acknowledging
+
+// Sender sends DATA and receives ACK, receiver the other way around
+enum tftp_session_role {
+    TFTP_ROLE_SENDER,
+    TFTP_ROLE_RECEIVER
+};
+
+enum tftp_session_state {
+    TFTP_SESSION_IDLE,
+    TFTP_SESSION_WAIT_FIRST, // Initial packet (RQ or OACK) was sent, waiting for OACK, ACK 0 or DATA 1
+    TFTP_SESSION_TRANSFER,
+    TFTP_SESSION_DONE,
+    TFTP_SESSION_FAILED
+};
+
+struct tftp_session;
+
+// Callbacks of the session, the session itself never touches sockets, files or clock
+struct tftp_session_io {
+    // Send packet to the peer, negative return value fails the session
+    int (*send)(struct tftp_session *s, const char *packet, size_t len);
+    // Sender: fill up to cap bytes of the next DATA payload, return bytes or -1
+    int (*read)(struct tftp_session *s, char *dst, size_t cap);
+    // Receiver: store payload of DATA packet (it can be converted in place), return 0 or -1
+    int (*write)(struct tftp_session *s, char *data, size_t len);
+    // Optional, receiver: called after the last DATA was written and before it is acknowledged, so the peer
+    // learns whether the file was stored. Return -1 to send ERROR instead of the last ACK
+    int (*finish)(struct tftp_session *s);
+    // Optional, called once when the first answer arrives. received is false if the peer ignored
+    // the options, s->opts then holds defaults. Return -1 (after tftpSessionAbort) to stop the session
+    int (*on_oack)(struct tftp_session *s, bool received, unsigned seen);
+    // Optional, called for every received packet before it is processed (used for printing)
+    void (*on_packet)(struct tftp_session *s, const char *packet, size_t len);
+};
+
+struct tftp_window_slot {
+    char *packet;
+    size_t cap;
+    size_t len;
+};
+
+struct tftp_session_stats {
+    unsigned long packets_sent;
+    unsigned long packets_received;
+    unsigned long retransmits;
+    unsigned long timeouts;
+    unsigned long duplicates; // Duplicate or stale packets that were ignored or acknowledged again
+    unsigned long losses; // Sender: rounds cut by timeout, by ACK reporting a gap or by ACK of incomplete window
+    unsigned long rounds; // Sender: rounds acknowledged completely, cwnd blocks each
+    unsigned long sacked; // Sender: blocks skipped when going back because ranges of ACK reported them
+    unsigned long parity; // PARITY packets sent or received
+    unsigned long recovered; // Receiver: lost blocks rebuilt from PARITY
+    unsigned long long cwnd_sum; // Sender: sum of congestion window over rounds, for average
+    int cwnd_max;
+    unsigned long long bytes; // Payload bytes sent or received, retransmissions not counted
+    long long start_ms;
+    long long end_ms;
+};
+
+struct tftp_session {
+    enum tftp_session_role role;
+    enum tftp_session_state state;
+    const struct tftp_session_io *io;
+    void *ctx; // Owner of the session, used by callbacks
+
+    struct tftp_options opts; // blksize and timeout of the transfer, set to acknowledged options by OACK
+    bool wait_oack; // Options were requested, first answer should be OACK
+    int max_retransmits;
+
+    uint16_t block; // Sender: block of last DATA sent, receiver: block of last DATA received in order
+    uint16_t acked; // Sender: block acknowledged by the peer, receiver: block of last ACK sent
+    bool last_block; // Sender: last DATA read was shorter than blksize
+
+    // Last sent packet, retransmitted as is when the timer fires
+    char *tx_packet;
+    size_t tx_cap;
+    size_t tx_len;
+
+    // Sender keeps DATA packets of blocks acked + 1 ... read_block for retransmission, block acked + 1 + i is
+    // in slot (window_head + i) % window. Slot 0 is tx_packet, others exist only with pool
+    struct tftp_window_slot slots[MAX_WINDOWSIZE];
+    int window; // Slots in use, negotiated windowsize (1 without pool)
+    int window_head;
+    uint16_t read_block;
+
+    // Selective acknowledgement (sack option), bit i is block acked + 1 + i on sender (reported by ranges of ACK)
+    // and block + 1 + i on receiver (stored in slot (window_head + i) % (window - 1) + 1 until the gap is filled)
+    uint64_t sacked;
+    uint64_t resent; // Sender: gaps sent again after ranges reported them, each once until timeout
+
+    // Forward error correction (fec option), sender sends PARITY of every group of fec blocks after its last DATA,
+    // receiver keeps parity of written blocks of the current group and rebuilds one lost block of a group. Buffer
+    // exists only with pool
+    char *fec_packet; // PARITY header and parity of the current group
+    size_t fec_cap;
+    int fec_count; // Blocks of the current group read (sender) or written (receiver)
+    uint16_t fec_first;
+    uint16_t fec_len_xor;
+
+    // AIMD congestion control of sender (cwnd option), blocks sent per round grow on acknowledged rounds and are
+    // cut on loss. Without the option the peer acknowledges only complete windows and cwnd stays at windowsize
+    int cwnd;
+    int ssthresh; // Slow start doubles cwnd up to this value, then it grows by one block per round
+    int round_acked; // Blocks acknowledged since the round started, cwnd of them complete the round
+    int dup_acks; // Duplicate ACKs of the last acknowledged block since it was acknowledged
+
+    // Receiver acknowledges when the window is complete, on gap, on the last block or when DATA stop arriving
+    bool ack_pending;
+    long long last_data_ms;
+    long long data_gap_ms; // Smoothed gap between DATA of one round
+    long long last_ack_ms;
+    long long ack_sent_ms; // Time of the last ACK, -1 after the next DATA measured the round trip
+    long long rtt_ms; // Smoothed time from ACK to the next DATA received in order, 0 until measured
+
+    // Optional, with pool the session owns TX and RX buffers sized from blksize (tftpSessionSetPool)
+    struct buffer_pool *pool;
+    char *rx_packet; // Owner receives packets of the session here
+    size_t rx_cap;
+    bool refit_rx; // RX buffer shrinks to negotiated blksize before the next packet
+
+    long long deadline; // Time of retransmission (ms)
+    int retries;
+    struct timer_wheel *wheel; // Optional, retransmission timer is armed in it and fires tftpSessionOnTimer
+    struct tftp_timer timer;
+
+    uint16_t error_code;
+    bool remote_error; // Session was ended by ERROR packet from the peer
+    char error_msg[SESSION_ERROR_MSG_LEN];
+
+    struct tftp_session_stats stats;
+};
+
+void tftpSessionInit(struct tftp_session *s, enum tftp_session_role role, const struct tftp_session_io *io, void *ctx, char *tx_buffer, size_t tx_cap);
+void tftpSessionSetWheel(struct tftp_session *s, struct timer_wheel *wheel);
+void tftpSessionSetPool(struct tftp_session *s, struct buffer_pool *pool);
+char *tftpSessionRxBuffer(struct tftp_session *s, size_t *cap);
+void tftpSessionRelease(struct tftp_session *s);
+int tftpSessionStart(struct tftp_session *s, const char *initial, size_t len, bool wait_oack, long long now);
+int tftpSessionOnPacket(struct tftp_session *s, char *packet, size_t len, long long now);
+int tftpSessionOnTimer(struct tftp_session *s, long long now);
+void tftpSessionAbort(struct tftp_session *s, uint16_t error_code, const char *error_msg);
+void tftpSessionPrintStats(const struct tftp_session *s, FILE *stream);
+
+static inline bool tftpSessionFinished(const struct tftp_session *s) {
+    return s->state == TFTP_SESSION_DONE || s->state == TFTP_SESSION_FAILED;
+}
+
+// Memory of buffers taken from pool by the session
+static inline size_t tftpSessionBufferBytes(const struct tftp_session *s) {
+    if (s->pool == NULL) return 0;
+
+    size_t bytes = s->tx_cap + s->rx_cap + s->fec_cap;
+    for (int i = 1; i < s->window; i++) bytes += s->slots[i].cap;
+    return bytes;
+}
+
+static inline long long tftpSessionDeadline(const struct tftp_session *s) {
+    return s->deadline;
+}
+
+// Monotonic clock in milliseconds for driving sessions with real time
+static inline long long tftpClockMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif /* TFTP_SESSION_H */
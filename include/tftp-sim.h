@@ -0,0 +1,112 @@
+/* tftp-sim.h ***********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_SIM_H
+#define TFTP_SIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <limits.h>
+
+#include "tftp-session.h"
+
+#define SIM_MAX_IN_FLIGHT 256
+#define SIM_MAX_SCENARIOS 32
+#define SIM_CLIENT 0
+#define SIM_SERVER 1
+
+// Packet travelling through the virtual network
+struct sim_packet {
+    bool used;
+    int to; // SIM_CLIENT or SIM_SERVER
+    long long deliver_at; // Virtual time of delivery (ms)
+    unsigned long seq; // Packets delivered at the same time keep order of sending
+    size_t len;
+    char data[MAX_PACKET_SIZE];
+};
+
+// Client or server side of simulated transfer
+struct sim_endpoint {
+    struct sim *sim;
+    int id;
+    struct tftp_session session;
+    bool started;
+    const char *src; // Sender: data to send
+    size_t src_len;
+    size_t src_pos;
+    char *dst; // Receiver: received data
+    size_t dst_len;
+};
+
+// Parameters of the virtual network and transfers
+struct sim_config {
+    int sessions;
+    uint64_t seed;
+    double loss[SIM_MAX_SCENARIOS]; // Loss probability of every scenario (0..1)
+    int scenarios;
+    double duplicate; // Probability that a packet is delivered twice
+    int delay; // One way delay (ms)
+    int jitter; // Maximum random delay added to delay (ms)
+    int blksize;
+    int timeout;
+    int windowsize;
+    bool sack;
+    int fec;
+    double rate; // Bandwidth of bottleneck link in every direction (bytes per ms), 0 without bottleneck
+    int queue; // Packets waiting for the bottleneck link, more are dropped
+    size_t file_size;
+    bool upload;
+    double max_retransmits; // Exit with failure if a scenario retransmits more per session or has failed sessions, -1 to never fail
+};
+
+struct sim {
+    const struct sim_config *config;
+    double loss; // Loss probability of the current scenario
+    uint64_t rng;
+    long long now;
+    unsigned long seq;
+    struct timer_wheel wheel; // Retransmission timers of both sessions
+    struct buffer_pool pool; // Buffers of sessions, reused by the next session
+    struct sim_packet packets[SIM_MAX_IN_FLIGHT];
+    struct sim_endpoint endpoints[2];
+    unsigned long dropped;
+    unsigned long duplicated;
+    double link_free[2]; // Time when the bottleneck link towards the endpoint is free (ms)
+};
+
+// Outcome of one simulated session
+struct sim_result {
+    bool ok;
+    long long duration; // Virtual time until client finished (ms)
+    unsigned long retransmits;
+    unsigned long packets;
+    unsigned long dropped;
+    size_t buffer_bytes; // Buffers of client and server session
+    unsigned long rounds; // Windows acknowledged by the receiver
+    unsigned long long cwnd_sum;
+};
+
+void printError(char *error, bool exit_failure);
+void printUsage(char **argv);
+void handleArguments(int argc, char **argv, struct sim_config *config);
+
+uint64_t simRandom(struct sim *sim);
+double simRandomUnit(struct sim *sim);
+void simDeliver(struct sim *sim, int to, const char *packet, size_t len);
+int simSend(struct tftp_session *session, const char *packet, size_t len);
+int simRead(struct tftp_session *session, char *dst, size_t cap);
+int simWrite(struct tftp_session *session, char *data, size_t len);
+void simServerRq(struct sim *sim, char *packet, size_t len);
+void runSimSession(struct sim *sim, uint64_t seed, char *file_data, char *received, struct sim_result *result);
+bool runScenario(const struct sim_config *config, double loss);
+
+#endif /* TFTP_SIM_H */
@@ -0,0 +1,124 @@
+/* tftp-storage.h *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_STORAGE_H
+#define TFTP_STORAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/file.h>
+
+#include "tftp-fdcache.h"
+#include "tftp-crc32c.h"
+
+#define STORAGE_READ 0x1
+#define STORAGE_WRITE 0x2 // Create new file, fails with EEXIST if it exists
+#define STORAGE_APPEND 0x4 // With STORAGE_WRITE, continue partial upload left by the backend or start it
+#define STORAGE_DISCARD 0x8 // With STORAGE_WRITE, uncommitted upload is removed at close instead of kept
+
+#define STORAGE_PRIVATE_DIR ".tftp" // Directory of posix root with partial uploads and caches, never served
+#define STORAGE_PARTIAL_AREA "partial"
+
+#define STORAGE_CRC_CHUNK 65536
+
+struct storage_file;
+
+struct storage_stat {
+    off_t size;
+    time_t mtime;
+};
+
+// Operations of storage backend, all return -1 with errno set on error
+struct storage_ops {
+    const char *name;
+    bool resumable; // Partial uploads are kept and can be continued with STORAGE_APPEND
+    int (*open)(void *backend, const char *name, int flags, struct storage_file *file);
+    int (*stat)(void *backend, const char *name, struct storage_stat *stat);
+    ssize_t (*read)(struct storage_file *file, char *dst, size_t len, off_t offset);
+    ssize_t (*write)(struct storage_file *file, const char *data, size_t len); // Appends to the end of file
+    int (*commit)(struct storage_file *file); // Upload is complete, it becomes visible to readers
+    void (*close)(struct storage_file *file); // Uncommitted upload is kept or discarded by the backend
+    void (*destroy)(void *backend);
+};
+
+// Backend selected by the server, files are looked up by name relative to its root
+struct storage {
+    const struct storage_ops *ops;
+    void *backend;
+};
+
+// Open file of a backend, fields not used by the backend are left as initialized by storageOpen
+struct storage_file {
+    const struct storage_ops *ops; // NULL if the file isn't open
+    void *backend;
+    off_t size; // Size when opened, grows with writes
+    bool writable;
+    int fd; // Descriptor of posix file or archive, -1 if there is none
+    FILE *stream; // Buffered writer of posix file
+    bool owned; // Descriptor is closed with the file, cached descriptors are owned by the cache
+    long entry; // Index of the file in backend's table
+    off_t base; // Offset of the file data in archive
+    const char *data; // Contents of file kept in memory outside of any backend
+    void *state; // State of file allocated by backend
+    long cursor; // Chunk of the last read, sequential reads don't walk the file from its start
+    off_t cursor_offset; // Offset of the cursor chunk in the file
+};
+
+// Posix backend, files are opened relative to the root directory
+struct posix_store {
+    struct fd_cache cache;
+};
+
+// Upload of posix backend, written to partial file in the private directory and linked under its name by commit
+struct posix_upload {
+    char part_name[PATH_MAX];
+    char name[PATH_MAX];
+    bool discard;
+    bool committed;
+};
+
+extern const struct storage_ops posix_storage_ops;
+
+int storageCreate(struct storage *storage, const char *backend, const char *root);
+int storageCreatePosix(struct storage *storage, const char *root_dirpath);
+int storageParseSize(const char *arg, size_t *size);
+int storageOpen(struct storage *storage, const char *filename, int flags, struct storage_file *file);
+int storageStat(struct storage *storage, const char *filename, struct storage_stat *stat);
+ssize_t storageRead(struct storage_file *file, char *dst, size_t len, off_t offset);
+ssize_t storageWrite(struct storage_file *file, const char *data, size_t len);
+int storageCommit(struct storage_file *file);
+void storageClose(struct storage_file *file);
+void storageDestroy(struct storage *storage);
+int storageFileFromFd(struct storage_file *file, int fd);
+int storageFileFromStream(struct storage_file *file, FILE *stream);
+void storageFileFromBuffer(struct storage_file *file, const char *data, size_t len);
+int storageDetach(struct storage_file *file);
+int storageCrc32c(struct storage_file *file, off_t len, uint32_t *crc);
+FILE *storageStream(struct storage_file *file, const char *mode);
+int storagePosixRoot(const struct storage *storage);
+bool storageNameInDir(const char *name, const char *dir);
+int storagePrivateName(const struct storage *storage, const char *area, const char *filename, char *dst, size_t cap);
+
+static inline bool storageResumable(const struct storage *storage) {
+    return storage->ops->resumable;
+}
+
+static inline bool storageIsOpen(const struct storage_file *file) {
+    return file->ops != NULL;
+}
+
+#endif /* TFTP_STORAGE_H */
@@ -0,0 +1,46 @@
+/* tftp-tarstore.h ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_TARSTORE_H
+#define TFTP_TARSTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tftp-storage.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_LEN 1024 // Longer names (GNU or pax) are skipped
+
+// File of the archive, the index is sorted by name
+struct tarstore_entry {
+    char *name;
+    off_t offset; // Offset of data in archive
+    off_t size;
+    time_t mtime;
+};
+
+// Read-only archive, index is built once when the server starts and shared by children after fork
+struct tarstore {
+    int fd;
+    struct tarstore_entry *entries;
+    size_t count;
+    size_t cap;
+};
+
+extern const struct storage_ops tar_storage_ops;
+
+int storageCreateTar(struct storage *storage, const char *archive_path);
+
+#endif /* TFTP_TARSTORE_H */
@@ -0,0 +1,65 @@
+/* tftp-timer.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_TIMER_H
+#define TFTP_TIMER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS) // 64 slots of 1 ms, 64 ms, 4 s and 262 s
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE (1LL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) // Longer timers wait in the last level
+#define TIMER_NEVER LLONG_MAX
+
+struct tftp_timer;
+
+typedef void (*tftp_timer_fn)(struct tftp_timer *timer, long long now);
+
+// Timer embedded in its owner, linked into slot of the wheel while it is armed
+struct tftp_timer {
+    struct tftp_timer *next;
+    struct tftp_timer **pprev; // NULL if the timer isn't armed
+    long long expires; // ms
+    uint8_t level;
+    uint8_t slot;
+    tftp_timer_fn fn;
+    void *ctx;
+};
+
+// Hierarchical timer wheel with 1 ms resolution, arming and cancelling is O(1)
+struct timer_wheel {
+    long long now; // Next tick to be processed
+    struct tftp_timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS]; // Bit per non-empty slot
+    size_t count;
+};
+
+static inline void timerInit(struct tftp_timer *timer, tftp_timer_fn fn, void *ctx) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = TIMER_NEVER;
+    timer->fn = fn;
+    timer->ctx = ctx;
+}
+
+static inline bool timerArmed(const struct tftp_timer *timer) {
+    return timer->pprev != NULL;
+}
+
+void timerWheelInit(struct timer_wheel *wheel, long long now);
+void timerWheelArm(struct timer_wheel *wheel, struct tftp_timer *timer, long long expires);
+void timerWheelCancel(struct timer_wheel *wheel, struct tftp_timer *timer);
+long long timerWheelNext(const struct timer_wheel *wheel);
+size_t timerWheelAdvance(struct timer_wheel *wheel, long long now);
+
+#endif /* TFTP_TIMER_H */
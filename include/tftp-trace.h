@@ -0,0 +1,78 @@
+/* tftp-trace.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_TRACE_H
+#define TFTP_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TRACE_MAX_EVENTS 1024 // Events are kept in memory and written when the buffer is full or at the end
+#define TRACE_WRITE_SIZE 65536
+#define TRACE_LABEL_LEN 256
+
+// Event in Chrome trace format, names are static strings
+struct trace_event {
+    const char *name;
+    char phase; // 'X' complete event, 'i' instant event
+    long long ts_ns;
+    long long dur_ns;
+    long block; // -1 if the event has no block
+};
+
+// Trace file shared by all processes, every process appends whole lines of its sampled session
+struct trace {
+    int fd; // -1 if tracing is off
+    bool enabled; // Current session is traced
+    int pid;
+    char label[TRACE_LABEL_LEN]; // Name of the session shown in the viewer
+    bool label_written;
+    struct trace_event events[TRACE_MAX_EVENTS];
+    size_t count;
+};
+
+static inline long long traceClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void traceFlush(struct trace *trace);
+
+// Record event, only a store into the buffer unless the buffer is full
+static inline void traceEvent(struct trace *trace, const char *name, char phase, long long ts_ns, long long dur_ns, long block) {
+    if (!trace->enabled) return;
+    if (trace->count == TRACE_MAX_EVENTS) traceFlush(trace);
+
+    struct trace_event *event = &trace->events[trace->count++];
+    event->name = name;
+    event->phase = phase;
+    event->ts_ns = ts_ns;
+    event->dur_ns = dur_ns;
+    event->block = block;
+}
+
+static inline void traceComplete(struct trace *trace, const char *name, long long start_ns, long long end_ns, long block) {
+    traceEvent(trace, name, 'X', start_ns, end_ns - start_ns, block);
+}
+
+static inline void traceInstant(struct trace *trace, const char *name, long long ts_ns, long block) {
+    traceEvent(trace, name, 'i', ts_ns, 0, block);
+}
+
+void traceInit(struct trace *trace);
+int traceOpen(struct trace *trace, const char *path);
+void traceStart(struct trace *trace, const char *program, const char *filename);
+void traceClose(struct trace *trace);
+
+#endif /* TFTP_TRACE_H */
@@ -0,0 +1,80 @@
+/* tftp-vfile.h *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#ifndef TFTP_VFILE_H
+#define TFTP_VFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "tftp-storage.h"
+
+#define VFILE_MAX_RULES 64
+#define VFILE_NAME_LEN 256
+#define VFILE_VAR_NAME_LEN 32
+#define VFILE_VALUE_LEN 256
+#define VFILE_MAX_VARS 32
+#define VFILE_MAX_TEMPLATE (64 * 1024)
+#define VFILE_CACHE_SIZE 256
+#define VFILE_REVALIDATE_SEC 1 // Template of cached file is checked for change at most once per second
+#define VFILE_LINE_LEN 1024
+
+// Virtual file name pattern, {var} matches a non-empty part of name without '/' and sets the variable
+struct vfile_rule {
+    char pattern[VFILE_NAME_LEN];
+    char template_name[VFILE_NAME_LEN]; // Template in storage
+};
+
+// Variables of a client from host table, key is MAC (aa:bb:cc:dd:ee:ff) or IP address
+struct vfile_host {
+    char key[VFILE_VALUE_LEN];
+    char *vars; // "name=value name=value" as in the table
+};
+
+struct vfile_var {
+    char name[VFILE_VAR_NAME_LEN];
+    char value[VFILE_VALUE_LEN];
+};
+
+// Rendered file of a client, rendered output depends on the name and the client address
+struct vfile_cache_entry {
+    char name[VFILE_NAME_LEN];
+    struct in_addr addr;
+    char *data; // NULL if the entry is empty
+    size_t len;
+    int rule;
+    time_t template_mtime;
+    time_t checked; // Time of the last revalidation
+    unsigned long last_used; // For LRU eviction
+};
+
+struct vfiles {
+    int rule_count;
+    struct vfile_rule rules[VFILE_MAX_RULES];
+    struct vfile_host *hosts; // Sorted by key
+    size_t host_count;
+    unsigned long uses;
+    unsigned long hits;
+    unsigned long renders;
+    struct vfile_cache_entry entries[VFILE_CACHE_SIZE];
+};
+
+void vfileInit(struct vfiles *vfiles);
+int vfileLoadRules(struct vfiles *vfiles, const char *path);
+int vfileLoadHosts(struct vfiles *vfiles, const char *path);
+int vfileRender(const char *template, size_t template_len, const struct vfile_var *vars, int var_count, char **out, size_t *out_len);
+int vfileOpen(struct vfiles *vfiles, struct storage *storage, const char *filename, struct in_addr addr, time_t now, struct storage_file *file);
+void vfileDestroy(struct vfiles *vfiles);
+
+#endif /* TFTP_VFILE_H */
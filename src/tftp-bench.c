@@ -0,0 +1,395 @@
+/* tftp-bench.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-bench.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_HAS_CYCLES 0
+#endif
+
+// Allocations of the benchmark and of libtftpcore, counted by linking with --wrap (allocations inside libc
+// itself, e.g. by fopen, aren't seen)
+unsigned long bench_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    bench_allocs++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    bench_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+    bench_allocs++;
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+static inline long long benchClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Time stamp counter ticks at a constant rate, close to core cycles unless the frequency scales
+static inline uint64_t benchCycles(void) {
+#if BENCH_HAS_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Function for printing error messages and terminating process if exit_failure
+void printError(char *error, bool exit_failure) {
+    fprintf(stdout, "Local error: %s\n", error);
+    fflush(stdout);
+    if (exit_failure) exit(EXIT_FAILURE);
+}
+
+// Function for printing usage and terminating process
+void printUsage(char **argv) {
+    fprintf(stdout, "Usage: %s [-b blksize[,blksize...]] [-t time_ms] [-f filter]\n", argv[0]);
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+// Function for handling arguments
+void handleArguments(int argc, char **argv, struct bench_config *config) {
+    static char default_blksizes[] = BENCH_DEFAULT_BLKSIZES;
+    char *blksizes = default_blksizes;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:t:f:")) != -1) {
+        switch (option) {
+        case 'b':
+            blksizes = optarg;
+            break;
+        case 't':
+            config->time_ms = atoi(optarg);
+            break;
+        case 'f':
+            config->filter = optarg;
+            break;
+        default:
+            printUsage(argv);
+            break;
+        }
+    }
+    if (config->time_ms <= 0) printUsage(argv);
+
+    for (char *value = strtok(blksizes, ","); value != NULL; value = strtok(NULL, ",")) {
+        int blksize = atoi(value);
+        if (config->blksize_count == BENCH_MAX_BLKSIZES || blksize < MIN_BLKSIZE || blksize > MAX_BLKSIZE) printError("invalid blksize", true);
+        config->blksizes[config->blksize_count++] = blksize;
+    }
+    if (config->blksize_count == 0) printUsage(argv);
+}
+
+// Payload of the next block, the source file wraps around
+static size_t benchReadSource(struct bench_ctx *ctx, char *dst, size_t cap) {
+    if (ctx->offset + (off_t)cap > (off_t)ctx->file_len) ctx->offset = 0;
+    ssize_t bytes_read = storageRead(&ctx->source, dst, cap, ctx->offset);
+    ctx->offset += bytes_read;
+    return bytes_read;
+}
+
+static int benchSend(struct tftp_session *session, const char *packet, size_t len) {
+    struct bench_ctx *ctx = session->ctx;
+    if (tftpGetOpcode(packet) == DATA_OPCODE) ctx->last_block = tftpGetBlock(packet);
+    ctx->sink += len;
+    return len;
+}
+
+static int benchRead(struct tftp_session *session, char *dst, size_t cap) {
+    return benchReadSource(session->ctx, dst, cap);
+}
+
+static int benchWrite(struct tftp_session *session, char *data, size_t len) {
+    struct bench_ctx *ctx = session->ctx;
+    memcpy(ctx->copy, data, len);
+    return 0;
+}
+
+static const struct tftp_session_io bench_io = {
+    .send = benchSend,
+    .read = benchRead,
+    .write = benchWrite,
+};
+
+// Baseline, the cheapest way to move one payload
+static size_t benchPayloadCopy(struct bench_ctx *ctx) {
+    memcpy(ctx->copy, ctx->file, ctx->blksize);
+    ctx->sink += ctx->copy[0];
+    return ctx->blksize;
+}
+
+// DATA packet as the server builds it without socket: payload read from storage behind the header
+static size_t benchDataBuild(struct bench_ctx *ctx) {
+    tftpPrepareHeader(ctx->packet, DATA_OPCODE);
+    tftpSetBlock(ctx->packet, ++ctx->last_block);
+    size_t len = benchReadSource(ctx, &ctx->packet[DATA_HEADER_SIZE], ctx->blksize);
+    ctx->sink += len;
+    return len;
+}
+
+static size_t benchAckDecode(struct bench_ctx *ctx) {
+    tftpSetBlock(ctx->ack, ++ctx->last_block);
+    uint16_t opcode = tftpGetOpcode(ctx->ack);
+    ctx->sink += opcode == ACK_OPCODE ? tftpGetBlock(ctx->ack) : 0;
+    return 0;
+}
+
+static void benchSessionStart(struct bench_ctx *ctx, enum tftp_session_role role) {
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    opts.blksize = ctx->blksize;
+
+    tftpSessionInit(&ctx->session, role, &bench_io, ctx, NULL, 0);
+    tftpSessionSetPool(&ctx->session, &ctx->pool);
+    ctx->session.opts = opts;
+    ctx->last_block = 0;
+    tftpSessionStart(&ctx->session, NULL, 0, false, 0);
+}
+
+static void benchSenderSetup(struct bench_ctx *ctx) {
+    benchSessionStart(ctx, TFTP_ROLE_SENDER);
+    tftpPrepareHeader(ctx->ack, ACK_OPCODE);
+}
+
+// Sender gets ACK of the last DATA, parses it and builds and sends the next DATA
+static size_t benchSessionAck(struct bench_ctx *ctx) {
+    tftpSetBlock(ctx->ack, ctx->last_block);
+    tftpSessionOnPacket(&ctx->session, ctx->ack, ACK_PACKET_SIZE, 0);
+    return ctx->blksize;
+}
+
+static void benchReceiverSetup(struct bench_ctx *ctx) {
+    benchSessionStart(ctx, TFTP_ROLE_RECEIVER);
+    tftpPrepareHeader(ctx->packet, DATA_OPCODE);
+    memcpy(&ctx->packet[DATA_HEADER_SIZE], ctx->file, ctx->blksize);
+}
+
+// Receiver gets full DATA of the next block, stores its payload and sends ACK
+static size_t benchSessionData(struct bench_ctx *ctx) {
+    tftpSetBlock(ctx->packet, ++ctx->last_block);
+    tftpSessionOnPacket(&ctx->session, ctx->packet, DATA_HEADER_SIZE + ctx->blksize, 0);
+    return ctx->blksize;
+}
+
+static void benchSessionTeardown(struct bench_ctx *ctx) {
+    if (ctx->session.state == TFTP_SESSION_FAILED) printError(ctx->session.error_msg, true);
+    tftpSessionRelease(&ctx->session);
+}
+
+// Server side of RQ: name, mode and options of a PXE client request
+static size_t benchOptionParse(struct bench_ctx *ctx) {
+    const char *filename;
+    const char *mode;
+    size_t options_offset;
+    struct tftp_options opts;
+    unsigned seen = 0;
+
+    tftpOptionsInit(&opts);
+    if (tftpDecodeRq(ctx->rq, ctx->rq_len, &filename, &mode, &options_offset) < 0) printError("invalid RQ", true);
+    if (tftpParseOptions(ctx->rq, ctx->rq_len, options_offset, &opts, &seen) < 0) printError("invalid options", true);
+    ctx->sink += opts.blksize + seen;
+    return ctx->rq_len;
+}
+
+static size_t benchOackEncode(struct bench_ctx *ctx) {
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    opts.blksize = ctx->blksize;
+    opts.windowsize = 16;
+    int len = tftpEncodeOack(ctx->oack, sizeof(ctx->oack), &opts);
+    ctx->sink += len;
+    return len;
+}
+
+// Client side of OACK
+static size_t benchOackParse(struct bench_ctx *ctx) {
+    struct tftp_options opts;
+    unsigned seen = 0;
+
+    tftpOptionsInit(&opts);
+    if (tftpParseOptions(ctx->oack, ctx->oack_len, OPCODE_SIZE, &opts, &seen) < 0) printError("invalid OACK", true);
+    ctx->sink += opts.blksize + seen;
+    return ctx->oack_len;
+}
+
+static size_t benchNetasciiEncode(struct bench_ctx *ctx) {
+    size_t used = 0;
+    int pending = -1;
+    if (ctx->offset + (off_t)ctx->blksize > (off_t)ctx->file_len) ctx->offset = 0;
+    size_t len = tftpNetasciiEncode(&ctx->file[ctx->offset], ctx->file_len - ctx->offset, &used, &ctx->packet[DATA_HEADER_SIZE], ctx->blksize, &pending);
+    ctx->offset += used;
+    ctx->sink += len;
+    return used;
+}
+
+// Decoding is in place, the payload is restored first (payload_copy shows the cost of that)
+static size_t benchNetasciiDecode(struct bench_ctx *ctx) {
+    bool cr_pending = false;
+    memcpy(ctx->copy, ctx->encoded, ctx->encoded_len);
+    size_t len = tftpNetasciiDecode(ctx->copy, ctx->encoded_len, &cr_pending);
+    ctx->sink += len;
+    return ctx->encoded_len;
+}
+
+// Line printed for every DATA packet, the same calls as printDataPacket of client and server
+static size_t benchPrintData(struct bench_ctx *ctx) {
+    struct in_addr addr = {.s_addr = htonl(INADDR_LOOPBACK)};
+    fprintf(ctx->null_stream, "DATA %s:%d:%d %d", inet_ntoa(addr), 69, 50000, ++ctx->last_block);
+    fprintf(ctx->null_stream, "\n");
+    fflush(ctx->null_stream);
+    return 0;
+}
+
+static const struct bench benches[] = {
+    {"payload_copy", true, NULL, benchPayloadCopy, NULL},
+    {"data_build", true, NULL, benchDataBuild, NULL},
+    {"ack_decode", false, NULL, benchAckDecode, NULL},
+    {"session_ack", true, benchSenderSetup, benchSessionAck, benchSessionTeardown},
+    {"session_data", true, benchReceiverSetup, benchSessionData, benchSessionTeardown},
+    {"option_parse", true, NULL, benchOptionParse, NULL},
+    {"oack_encode", true, NULL, benchOackEncode, NULL},
+    {"oack_parse", true, NULL, benchOackParse, NULL},
+    {"netascii_encode", true, NULL, benchNetasciiEncode, NULL},
+    {"netascii_decode", true, NULL, benchNetasciiDecode, NULL},
+    {"print_data", false, NULL, benchPrintData, NULL},
+};
+
+/**
+ * @brief Measure benchmark for time_ms after warm-up and print one row of results
+ *
+ * @param bench benchmark
+ * @param ctx buffers of blksize
+ * @param time_ms measured time
+ */
+void runBench(const struct bench *bench, struct bench_ctx *ctx, int time_ms) {
+    if (bench->setup) bench->setup(ctx);
+    for (int i = 0; i < BENCH_WARMUP_OPS; i++) bench->run(ctx);
+
+    unsigned long long ops = 0;
+    unsigned long long bytes = 0;
+    unsigned long allocs = bench_allocs;
+    long long start_ns = benchClockNs();
+    uint64_t start_cycles = benchCycles();
+    long long end_ns;
+    do {
+        for (int i = 0; i < BENCH_BATCH; i++) bytes += bench->run(ctx);
+        ops += BENCH_BATCH;
+        end_ns = benchClockNs();
+    } while (end_ns - start_ns < time_ms * 1000000LL);
+    uint64_t cycles = benchCycles() - start_cycles;
+    allocs = bench_allocs - allocs;
+
+    if (bench->teardown) bench->teardown(ctx);
+
+    char blksize[16] = "-";
+    char cycles_op[16] = "-";
+    char bytes_cycle[16] = "-";
+    if (bench->sized) snprintf(blksize, sizeof(blksize), "%d", ctx->blksize);
+    if (BENCH_HAS_CYCLES) snprintf(cycles_op, sizeof(cycles_op), "%.1f", (double)cycles / ops);
+    if (BENCH_HAS_CYCLES && bytes > 0) snprintf(bytes_cycle, sizeof(bytes_cycle), "%.2f", (double)bytes / cycles);
+    fprintf(stdout, "%-16s %8s %10.1f %10s %12s %10.3f\n", bench->name, blksize, (double)(end_ns - start_ns) / ops, cycles_op, bytes_cycle, (double)allocs / ops);
+    fflush(stdout);
+}
+
+// Allocate buffers of blksize and prepare packets
+static void benchInit(struct bench_ctx *ctx, int blksize) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->blksize = blksize;
+    ctx->file_len = (size_t)blksize * BENCH_FILE_BLOCKS;
+    ctx->file = malloc(ctx->file_len);
+    ctx->packet = malloc(MAX_PACKET_SIZE);
+    ctx->copy = malloc(MAX_PACKET_SIZE);
+    ctx->encoded = malloc(blksize);
+    ctx->null_stream = fopen("/dev/null", "w");
+    if (!ctx->file || !ctx->packet || !ctx->copy || !ctx->encoded || !ctx->null_stream) printError("out of memory", true);
+
+    // Text lines, netascii doubles the line ends
+    for (size_t i = 0; i < ctx->file_len; i++) ctx->file[i] = (i + 1) % BENCH_LINE_LEN == 0 ? '\n' : 'a' + i % 26;
+    storageFileFromBuffer(&ctx->source, ctx->file, ctx->file_len);
+
+    // Payload of one netascii DATA packet
+    size_t used = 0;
+    int pending = -1;
+    ctx->encoded_len = tftpNetasciiEncode(ctx->file, ctx->file_len, &used, ctx->encoded, blksize, &pending);
+
+    // RRQ of PXE firmware asks for blksize and tsize, tsize isn't supported and is skipped
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    opts.blksize = blksize;
+    opts.windowsize = 16;
+    int len = tftpEncodeRq(ctx->rq, sizeof(ctx->rq) - 8, RRQ_OPCODE, "pxelinux.cfg/01-aa-bb-cc-dd-ee-ff", "octet", &opts);
+    if (len < 0) printError("couldn't encode RQ", true);
+    memcpy(&ctx->rq[len], "tsize\0" "0\0", 8);
+    ctx->rq_len = len + 8;
+
+    len = tftpEncodeOack(ctx->oack, sizeof(ctx->oack), &opts);
+    if (len < 0) printError("couldn't encode OACK", true);
+    ctx->oack_len = len;
+
+    poolInit(&ctx->pool, 0);
+}
+
+static void benchDestroy(struct bench_ctx *ctx) {
+    poolDestroy(&ctx->pool);
+    storageClose(&ctx->source);
+    fclose(ctx->null_stream);
+    free(ctx->file);
+    free(ctx->packet);
+    free(ctx->copy);
+    free(ctx->encoded);
+}
+
+static bool benchSelected(const struct bench_config *config, const struct bench *bench) {
+    return config->filter == NULL || strstr(bench->name, config->filter) != NULL;
+}
+
+int main(int argc, char **argv) {
+    struct bench_config config = {
+        .time_ms = BENCH_DEFAULT_MS,
+        .filter = NULL,
+    };
+    struct bench_ctx ctx;
+
+    handleArguments(argc, argv, &config);
+
+    fprintf(stdout, "time=%dms warmup=%d ops, cycles are %s\n", config.time_ms, BENCH_WARMUP_OPS, BENCH_HAS_CYCLES ? "TSC ticks" : "not available");
+    fprintf(stdout, "%-16s %8s %10s %10s %12s %10s\n", "benchmark", "blksize", "ns/op", "cycles/op", "bytes/cycle", "allocs/op");
+
+    int count = sizeof(benches) / sizeof(benches[0]);
+    for (int i = 0; i < count; i++) {
+        const struct bench *bench = &benches[i];
+        if (!benchSelected(&config, bench)) continue;
+
+        for (int j = 0; j < (bench->sized ? config.blksize_count : 1); j++) {
+            benchInit(&ctx, config.blksizes[j]);
+            runBench(bench, &ctx, config.time_ms);
+            benchDestroy(&ctx);
+        }
+    }
+
+    return ctx.sink == 42 ? 1 : 0;
+}
@@ -6,27 +6,47 @@
  */
 
 #include "../include/tftp-client.h"
+#include "../include/tftp-compress.h"
+#include "../include/tftp-crc32c.h"
+#include "../include/tftp-fec.h"
 
-int sockfd = -1;
-struct sockaddr_in server_addr, recv_addr, src_addr;
-socklen_t recv_len = sizeof(recv_addr);
+// Transfer with the server, socket and session buffers are owned by the client library
+struct tftp_client client;
 
 FILE *file = NULL;
 
+// Low-latency mode (-L), CPUs to pin to (-P) and measured latency
+bool low_latency = false;
+struct lowlat_cpus lowlat_cpus;
+struct latency_stats latency;
+
+// Trace of the transfer (-T)
+struct trace trace;
+
+// Servers of download race (-h with more hosts, -A every address of host) and their response times (-R)
+bool all_addresses = false;
+char *score_path = NULL;
+struct server_score scores[CLIENT_MAX_SCORES];
+int score_count = 0;
+
+// State of the session before the last received packet, for latency statistics
+struct received_packet rx_state;
+
 // Function for printing error messages and terminating process if exit_failure
 void printError(char *error, bool exit_failure) {
     fprintf(stdout, "Local error: %s\n", error);
     fflush(stdout);
     if (exit_failure) {
         if (file) fclose(file);
-        closeUDPSocket();
+        tftpClientClose(&client);
+        traceClose(&trace);
         exit(EXIT_FAILURE);
     }
 }
 
 // Function for printing usage and terminating process
 void printUsage(char **argv) {
-    fprintf(stdout, "Usage: %s -h <hostname> [-p port] [-f filepath] -t <dest_filepath>\n", argv[0]);
+    fprintf(stdout, "Usage: %s -h <hostname[,hostname...]> [-A] [-R score_file] [-p port] [-f filepath] -t <dest_filepath> [-c] [-r] [-w windowsize] [-s] [-F fec_group] [-L] [-P cpus] [-T trace_file]\n", argv[0]);
     exit(EXIT_FAILURE);
 }
 
@@ -57,29 +77,12 @@ void printRqPacket(char *rq_opcode, char *src_ip, int src_port, char *filepath,
 
 // Function for printing ACK and OACK packet (OACK is when block_id == -1)
 void printAckPacket(char *scr_ip, int src_port, int block_id, int blksize, int timeout) {
-    // Format OPTS output to be appended after OACK packet
-    char opts[1024];
-    bzero(opts, sizeof(opts));
-    char blksize_val[1024];
-    bzero(blksize_val, sizeof(blksize_val));
-    sprintf(blksize_val, "%d", blksize);
-    char timeout_val[1024];
-    bzero(timeout_val, sizeof(timeout_val));
-    sprintf(timeout_val, "%d", timeout);
-
-    if (atoi(blksize_val) != DEFAULT_BLKSIZE) {
-        strcat(opts, "blksize=");
-        strcat(opts, blksize_val);
-        strcat(opts, " ");
-    }
-    if (atoi(timeout_val) != DEFAULT_TIMEOUT) {
-        strcat(opts, "timeout=");
-        strcat(opts, timeout_val);
-        strcat(opts, " ");
-    }
-
     if (block_id == -1) {
-        fprintf(stderr, "OACK %s:%d %s", scr_ip, src_port, opts);
+        fprintf(stderr, "OACK %s:%d ", scr_ip, src_port);
+
+        // Append OPTS output after OACK packet
+        if (blksize != DEFAULT_BLKSIZE) fprintf(stderr, "blksize=%d ", blksize);
+        if (timeout != DEFAULT_TIMEOUT) fprintf(stderr, "timeout=%d ", timeout);
     } else {
         fprintf(stderr, "ACK %s:%d %d", scr_ip, src_port, block_id);
     }
@@ -112,9 +115,9 @@ void printPacket(char *packet, int size) {
 }
 
 // Function for handling arguments
-void handleArguments(int argc, char **argv, char **host, int *server_port, char **filepath, char **dest_file) {
+void handleArguments(int argc, char **argv, char **host, int *server_port, char **filepath, char **dest_file, bool *compress, bool *resume, int *windowsize, bool *sack, int *fec) {
     char option;
-    while ((option = getopt(argc, argv, "h:p:f:t:")) != -1) {
+    while ((option = getopt(argc, argv, "h:p:f:t:crw:sF:LP:T:AR:")) != -1) {
         switch (option) {
         case 'h':
             *host = optarg;
@@ -127,7 +130,39 @@ void handleArguments(int argc, char **argv, char **host, int *server_port, char
             break;
         case 't':
             *dest_file = optarg;
-            break;    
+            break;
+        case 'c':
+            *compress = true;
+            break;
+        case 'r':
+            *resume = true;
+            break;
+        case 'w':
+            *windowsize = atoi(optarg);
+            if (*windowsize < MIN_WINDOWSIZE || *windowsize > MAX_WINDOWSIZE) printUsage(argv);
+            break;
+        case 's':
+            *sack = true;
+            break;
+        case 'F':
+            *fec = atoi(optarg);
+            if (*fec < MIN_FEC_GROUP || *fec > MAX_FEC_GROUP) printUsage(argv);
+            break;
+        case 'L':
+            low_latency = true;
+            break;
+        case 'P':
+            if (lowlatParseCpus(optarg, &lowlat_cpus) < 0) printUsage(argv);
+            break;
+        case 'T':
+            if (traceOpen(&trace, optarg) < 0) printError("couldn't open trace file", true);
+            break;
+        case 'A':
+            all_addresses = true;
+            break;
+        case 'R':
+            score_path = optarg;
+            break;
         default:
             printUsage(argv);
             break;
@@ -138,395 +173,409 @@ void handleArguments(int argc, char **argv, char **host, int *server_port, char
     if (*dest_file == NULL) printUsage(argv);
 }
 
-// Function for creating udp socket and saving the fd to sockfd
-void createUDPSocket(int *sockfd) {
-    *sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (*sockfd < 0) printError("couldn't create scoket", true);
-}
-
-// Function for closing socket fd
-void closeUDPSocket() {
-    if (sockfd == -1) return;
-    close(sockfd);
-    sockfd = -1;
-}
-
-// Configure address to IPv4, set address obtained from host name and set port
-void configureServerAddress(char *host, int server_port) {
-    // Resolve host
-    struct hostent *host_info = gethostbyname(host);
-    if (host_info == NULL) printError("no such host", true);
-
-    bzero(&server_addr, sizeof(server_addr));
-
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
-    memcpy(&server_addr.sin_addr.s_addr, host_info->h_addr_list[0], host_info->h_length);
-}
-
 /**
  * @brief Open file for write
  *
  * @param dest_file destination path, open file on this path
+ * @param append append to partially downloaded file instead of truncating it
  */
-void openFile(char *dest_file) {
-    file = fopen(dest_file, "wb");
+void openFile(char *dest_file, bool append) {
+    file = fopen(dest_file, append ? "ab" : "wb");
     if (file == NULL) printError("creating file", true);
 }
 
 /**
- * @brief Send error packet. Set opcode, error code and error message
+ * @brief Find offset to resume download from. Offset is size of partially downloaded file
  *
- * @param error_code error packet
- * @param error_msg error message
+ * @param dest_file destination path
+ * @param resume to set resume offset, stays -1 if there is nothing to resume
+ * @param resume_crc to set CRC32C of partially downloaded data
  */
-int sendErrorPacket(uint16_t error_code, char *error_msg) {
-    uint16_t opcode = ERROR_OPCODE;
-
-    opcode = htons(opcode);
-    error_code = htons(error_code);
-
-    // Set error packet
-    int packet_buffer_len = OPCODE_SIZE + EEROR_CODE_SIZE + strlen(error_msg) + 1;
-    char packet_buffer[packet_buffer_len];
-    bzero(packet_buffer, sizeof(packet_buffer));
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &error_code, 2);
-    memcpy(&packet_buffer[4], error_msg, strlen(error_msg));
-
-    // Send error packet
-    int bytes_tx = sendto(sockfd, packet_buffer, packet_buffer_len, 0, (struct sockaddr *) &server_addr, sizeof(server_addr));
-    if (bytes_tx < 0) printError("sendto not successful", true);
+void findResumeOffset(char *dest_file, long *resume, uint32_t *resume_crc) {
+    FILE *partial = fopen(dest_file, "rb");
+    if (partial == NULL) return;
 
-    // Print local error
-    if (error_code == 5) printError(error_msg, false);
-    else printError(error_msg, true);
+    fseek(partial, 0, SEEK_END);
+    long size = ftell(partial);
+    rewind(partial);
 
-    return bytes_tx;
+    if (size > 0 && crc32cStream(partial, size, resume_crc) == 0) *resume = size;
+    fclose(partial);
 }
 
 /**
- * @brief Handler for error packet. If error code isn't 5 terminate process
+ * @brief Compress data loaded from stdin, replaces the buffer with compressed stream
  *
- * @param packet error packet
+ * @param stdin_data pointer to data from stdin
+ * @param stdin_data_len pointer to length of stdin_data
  */
-void handleErrorPacket(char *packet) {
-    uint16_t error_code;
+void compressStdinData(char **stdin_data, int *stdin_data_len) {
+    char *compressed_data = NULL;
+    size_t compressed_len = 0;
 
-    // Get code and message
-    memcpy(&error_code, &packet[2], 2);
-    error_code = ntohs(error_code);
-    char *error_msg = &packet[4];
+    // Compressed empty stream is empty
+    if (*stdin_data_len == 0) return;
 
-    // Print ERROR packet
-    printErrorPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), error_code, error_msg);
+    FILE *in = fmemopen(*stdin_data, *stdin_data_len, "rb");
+    FILE *out = open_memstream(&compressed_data, &compressed_len);
+    if (in == NULL || out == NULL) printError("memory allocation error", true);
 
-    // Print local error
-    if (error_code == 5) printError(error_msg, false);
-    else printError(error_msg, true);
+    if (compressStream(in, out) < 0) printError("compressing data failed", true);
+    fclose(in);
+    fclose(out);
+
+    free(*stdin_data);
+    *stdin_data = compressed_data;
+    *stdin_data_len = compressed_len;
 }
 
 /**
- * @brief Receive OACK packet with blksize and timeout
+ * @brief Decompress downloaded stream from temporary file into destination file, destination that couldn't be
+ * decompressed completely is removed and the client ends with error
  *
- * @param blksize get blksize if in options
- * @param timeout get timeout if in options
- * 
- * @return bytes received
+ * @param dest destination file
+ * @param dest_file path of destination file
  */
-int receiveOackPacket(int *blksize, int *timeout) {
-    char packet_buffer[DEFAULT_BLKSIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
-
-    // Receive OACK packet
-    int bytes_rx = recvfrom(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
-    if (bytes_rx < 0) perror("recvfrom not succesful");
-    if (bytes_rx < 2) sendErrorPacket(4, "Illegal TFTP operation.");
-
-    // Get opcode
-    uint16_t opcode;
-    memcpy(&opcode, &packet_buffer[0], 2);
-    opcode = ntohs(opcode);
-
-    // Check opcode
-    if (opcode == ERROR_OPCODE) handleErrorPacket(packet_buffer);
-    else if (opcode != OACK_OPCODE) sendErrorPacket(4, "Illegal TFTP operation.");
-
-    char blksize_opt[] = "blksize";
-    int blksize_val = DEFAULT_BLKSIZE;
-
-    char timeout_opt[] = "timeout";
-    int timeout_val = DEFAULT_TIMEOUT;
-
-    int bytes_processed = OPCODE_SIZE;
-
-    char *option;
-    char *value;
-
-    // Loop through pairs of option and value and save them if recognized
-    while (bytes_processed < bytes_rx) {
-        option = &packet_buffer[bytes_processed];
-        bytes_processed += strlen(option) + 1;
-        value = &packet_buffer[bytes_processed];
-        bytes_processed += strlen(value) + 1;
-
-        if (!strcmp(option, blksize_opt)) {
-            blksize_val = atoi(value);
-            *blksize = blksize_val;
-            if (*blksize < MIN_BLKSIZE || *blksize > MAX_BLKSIZE) {
-                printError("invalid value for blksize option", true);
-            }
-        } else if (!strcmp(option, timeout_opt)) {
-            timeout_val = atoi(value);
-            *timeout = timeout_val;
-            if (*timeout < MIN_TIMEOUT || *timeout > MAX_TIMEOUT) {
-                printError("invalid value for timeout option", true);
-            }
-        }
+void finishDecompression(FILE *dest, const char *dest_file) {
+    rewind(file);
+    int result = decompressStream(file, dest);
+    fclose(file);
+    file = dest;
+
+    if (result < 0) {
+        fclose(file);
+        file = NULL;
+        unlink(dest_file);
+        printError("decompressing received file failed", true);
     }
+}
 
-    printAckPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), -1, *blksize, *timeout);
 
-    return bytes_rx;
-}
 
 /**
- * @brief Send RQ packet, set opcode (RRQ/WRQ), set filename, set mode and append options if any
+ * @brief Handler for the first answer of server, options were checked by the client library. Open destination
+ * file and prepare data to send
  *
- * @param opcode RRQ or WRQ opcode
- * @param filename name of file
- * @param mode mode to be set in rq packet
- * @param blksize set blksize if any in options
- * @param timeout set timeout if any in options
+ * @param c client of the transfer, its user pointer is struct transfer
+ * @param received OACK was received, otherwise server ignored options and defaults are used
  * 
- * @return bytes sent
+ * @return 0 on success, -1 if the transfer can't continue
  */
-int sendRqPacket(uint16_t opcode, char *filename, char *mode, int *blksize, int *timeout) {
-    opcode = htons(opcode);
-
-    int opts_len = 0;
-
-    // For formating blksize option
-    char blksize_opt[] = "blksize";
-    char blksize_val[64];
-    bzero(blksize_val, sizeof(blksize_val));
-    sprintf(blksize_val, "%d", *blksize);
-
-    // For formating timeout option
-    char timeout_opt[] = "timeout";
-    char timeout_val[64];
-    bzero(timeout_val, sizeof(timeout_val));
-    sprintf(timeout_val, "%d", *timeout);
-
-    // Calculate length of options
-    if (*blksize != DEFAULT_BLKSIZE) opts_len += strlen(blksize_opt) + 1 + strlen(blksize_val) + 1;
-    if (*timeout != DEFAULT_TIMEOUT) opts_len += strlen(timeout_opt) + 1 + strlen(timeout_val) + 1;
-
-    // Create packet
-    int packet_buffer_len = 2 + strlen(filename) + 1 + strlen(mode) + 1 + opts_len;
-    char packet_buffer[packet_buffer_len];
-    bzero(packet_buffer, sizeof(packet_buffer));
-
-    // Set packet
-    int curr_byte = 0;
-    memcpy(&packet_buffer[curr_byte], &opcode, 2);
-    curr_byte += 2;
-    memcpy(&packet_buffer[curr_byte], filename, strlen(filename));
-    curr_byte += strlen(filename) + 1;
-    memcpy(&packet_buffer[curr_byte], mode, strlen(mode));
-    curr_byte += strlen(mode) + 1;
-
-    // Set options if any
-    if (*blksize != DEFAULT_BLKSIZE) {
-        memcpy(&packet_buffer[curr_byte], &blksize_opt, strlen(blksize_opt));
-        curr_byte += strlen(blksize_opt) + 1;
-        memcpy(&packet_buffer[curr_byte], &blksize_val, strlen(blksize_val));
-        curr_byte += strlen(blksize_val) + 1;
-    }
-    if (*timeout != DEFAULT_TIMEOUT) {
-        memcpy(&packet_buffer[curr_byte], &timeout_opt, strlen(timeout_opt));
-        curr_byte += strlen(timeout_opt) + 1;
-        memcpy(&packet_buffer[curr_byte], &timeout_val, strlen(timeout_val));
-        curr_byte += strlen(timeout_val) + 1;
+int clientOnOack(struct tftp_client *c, bool received) {
+    struct transfer *transfer = c->user;
+    struct tftp_options *opts = &c->session.opts;
+
+    if (received) printAckPacket(inet_ntoa(c->recv_addr.sin_addr), ntohs(c->recv_addr.sin_port), -1, opts->blksize, opts->timeout);
+
+    // Socket buffers are sized for the negotiated blksize
+    if (low_latency) lowlatTuneSocket(tftpClientFd(c), opts->blksize);
+
+    if (transfer->download) {
+        // Append to partially downloaded file if server accepted resume offset
+        long long open_ns = traceClockNs();
+        openFile(transfer->dest_file, opts->resume > 0);
+        traceComplete(&trace, "open", open_ns, traceClockNs(), -1);
+
+        // Compressed stream is received into temporary file and decompressed after the last block
+        if (opts->compress) {
+            transfer->dest = file;
+            file = tmpfile();
+            if (file == NULL) printError("creating file", true);
+        }
+    } else {
+        // Server accepted compression, send compressed stream instead of raw data
+        if (opts->compress) compressStdinData(&transfer->stdin_data, &transfer->stdin_data_len);
+
+        // Server already has data before resume offset, check it is the same data
+        if (opts->resume > 0) {
+            if (opts->resume > transfer->stdin_data_len || crc32cUpdate(0, transfer->stdin_data, opts->resume) != opts->resume_crc) {
+                tftpClientAbort(c, 8, "Resume checksum mismatch");
+                return -1;
+            }
+            transfer->stdin_data_pos = opts->resume;
+        }
     }
 
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &server_addr, sizeof(server_addr));
-    if (bytes_tx < 0) printError("rq packet sendto failed", true);
-
-    return bytes_tx;
+    return 0;
 }
 
 /**
- * @brief Send DATA packet, set opcode, read blksize bytes of data and set it in packet
+ * @brief Send packet to the server, measured for trace and latency statistics
  *
- * @param block expected block number of data
- * @param blksize size of payload data
- * @param stdin_data string containing data from stdin
- * @param stdin_data_index from what index in stdin_data should be sent blksize bytes of data
+ * @param c client sending the packet
+ * @param packet packet to send
+ * @param len length of packet
  * 
  * @return bytes sent
  */
-int sendDataPacket(uint16_t block, uint16_t blksize, char *stdin_data, int stdin_data_index) {
-    uint16_t opcode = DATA_OPCODE;
-
-    // Create DATA packet
-    char packet_buffer[OPCODE_SIZE + BLOCK_NUMBER_SIZE + blksize];
-    bzero(packet_buffer, sizeof(packet_buffer));
-
-    opcode = htons(opcode);
-    block = htons(block);
+int clientSend(struct tftp_client *c, const char *packet, size_t len) {
+    if (low_latency) latencyOnSend(&latency, packet, len, c->session.retries > 0, lowlatClockUs());
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
 
-    // Set opcode and block number
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &block, 2);
-
-    // Set data
-    int bytes_read = strlen(&stdin_data[stdin_data_index]);
-    if (bytes_read > blksize) bytes_read = blksize;
-    memcpy(&packet_buffer[4], &stdin_data[stdin_data_index], bytes_read);
-
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, bytes_read + OPCODE_SIZE + BLOCK_NUMBER_SIZE, 0, (struct sockaddr *) &server_addr, sizeof(server_addr));
+    int bytes_tx = tftpClientSendPacket(c, packet, len);
     if (bytes_tx < 0) printError("sendto not successful", true);
 
+    if (trace.enabled) {
+        uint16_t opcode = tftpGetOpcode(packet);
+        long block = (opcode == DATA_OPCODE || opcode == ACK_OPCODE) && len >= DATA_HEADER_SIZE ? tftpGetBlock(packet) : -1;
+        traceComplete(&trace, c->session.retries > 0 ? "retransmit" : "send", start_ns, traceClockNs(), block);
+    }
+
     return bytes_tx;
 }
 
 /**
- * @brief Receive DATA packet, check opcode, receive blksize bytes of payload data and write it to file
+ * @brief Source of upload, read payload of the next DATA packet from data loaded from stdin
  *
- * @param expected_block expected block number of data
- * @param blksize size of payload data
+ * @param user struct transfer
+ * @param dst destination for data
+ * @param cap maximum number of bytes (blksize)
  * 
- * @return bytes received
+ * @return bytes read
  */
-int receiveDataPacket(uint16_t expected_block, uint16_t blksize) {
-    // Create packet
-    char packet_buffer[blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
-    
-    // Receive packet
-    int bytes_rx = recvfrom(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
-    if (bytes_rx < 0) printError("data packet recvfrom failed", true);    
-    if (bytes_rx < 4) printError("too little bytes in data packet recvfrom", true);
-
-    uint16_t opcode;
-    uint16_t block;
-
-    // Get opcode and block number
-    memcpy(&opcode, &packet_buffer[0], 2);
-    memcpy(&block, &packet_buffer[2], 2);
-
-    opcode = ntohs(opcode);
-    block = ntohs(block);
-
-    // Check opcode and block
-    if (opcode == ERROR_OPCODE) handleErrorPacket(packet_buffer);
-    else if (opcode != DATA_OPCODE) sendErrorPacket(4, "Illegal TFTP operation.");
-
-    if (block != expected_block) sendErrorPacket(4, "Illegal TFTP operation.");
-
-    // Write data to a file
-    char data[blksize + 1];
-    bzero(data, sizeof(data));
-    memcpy(data, &packet_buffer[4], bytes_rx - 4);
-    if (fprintf(file, "%s", data) < 0) sendErrorPacket(3, "Disk full or allocation exceeded");
-
-    // Print DATA packet
-    printDataPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), block);
-
-    return bytes_rx;
+int transferRead(void *user, char *dst, size_t cap) {
+    struct transfer *transfer = user;
+
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
+    int bytes_read = transfer->stdin_data_len - transfer->stdin_data_pos;
+    if (bytes_read > (int)cap) bytes_read = cap;
+    if (bytes_read < 0) bytes_read = 0;
+    memcpy(dst, &transfer->stdin_data[transfer->stdin_data_pos], bytes_read);
+    transfer->stdin_data_pos += bytes_read;
+    if (trace.enabled) traceComplete(&trace, "read", start_ns, traceClockNs(), client.session.block);
+
+    return bytes_read;
 }
 
 /**
- * @brief Send ACK packet, set opcode and set block number with block param
+ * @brief Sink of download, write payload of received DATA packet to file
  *
- * @param block block number to send the ack for
+ * @param user struct transfer
+ * @param data payload of DATA packet
+ * @param len length of payload
  * 
- * @return bytes sent
+ * @return 0 on success, -1 if data couldn't be written
  */
-int sendAckPacket(uint16_t block) {
-    uint16_t opcode = ACK_OPCODE;
+int transferWrite(void *user, const char *data, size_t len) {
+    (void)user;
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
+    if (fwrite(data, sizeof(char), len, file) != len) return -1;
+    if (trace.enabled) traceComplete(&trace, "write", start_ns, traceClockNs(), (uint16_t)(client.session.block + 1));
 
-    // Create ACK packet
-    char packet_buffer[ACK_PACKET_SIZE];
-    bzero(packet_buffer, 4);
+    return 0;
+}
 
-    opcode = htons(opcode);
-    block = htons(block);
+/**
+ * @brief Print packet received from the server, OACK is printed by clientOnOack. State before the packet
+ * is kept for latency statistics
+ *
+ * @param c client that received the packet
+ * @param packet received packet
+ * @param len length of packet
+ */
+void clientOnPacket(struct tftp_client *c, const char *packet, size_t len) {
+    struct sockaddr_in *recv_addr = &c->recv_addr;
+    rx_state.block = c->session.block;
+    rx_state.state = c->session.state;
+    rx_state.sent_us = latency.last_tx_us;
+    rx_state.len = len;
+    memcpy(rx_state.head, packet, len < DATA_HEADER_SIZE ? len : DATA_HEADER_SIZE);
+
+    if (len < OPCODE_SIZE) return;
+
+    uint16_t opcode = tftpGetOpcode(packet);
+    if (opcode == ERROR_OPCODE) {
+        uint16_t error_code = 0;
+        const char *error_msg = "";
+        tftpDecodeError(packet, len, &error_code, &error_msg);
+        printErrorPacket(inet_ntoa(recv_addr->sin_addr), ntohs(recv_addr->sin_port), ntohs(c->local_addr.sin_port), error_code, (char *)error_msg);
+        return;
+    }
+    if (len < DATA_HEADER_SIZE) return;
 
-    // Set ACK packet
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &block, 2);
+    if (opcode == DATA_OPCODE) {
+        printDataPacket(inet_ntoa(recv_addr->sin_addr), ntohs(recv_addr->sin_port), ntohs(c->local_addr.sin_port), tftpGetBlock(packet));
+    } else if (opcode == ACK_OPCODE) {
+        printAckPacket(inet_ntoa(recv_addr->sin_addr), ntohs(recv_addr->sin_port), tftpGetBlock(packet), -1, -1);
+    }
+}
+
+/**
+ * @brief Load response times of servers from previous runs, missing file means no scores
+ *
+ * @param path score file, lines "address rtt_ms samples"
+ */
+void loadScores(const char *path) {
+    FILE *scores_file = fopen(path, "r");
+    if (scores_file == NULL) return;
+
+    char line[128];
+    char addr[INET_ADDRSTRLEN];
+    while (score_count < CLIENT_MAX_SCORES && fgets(line, sizeof(line), scores_file) != NULL) {
+        struct server_score *score = &scores[score_count];
+        if (sscanf(line, "%15s %lf %lu", addr, &score->rtt_ms, &score->samples) == 3 && inet_pton(AF_INET, addr, &score->addr) == 1) {
+            score_count++;
+        }
+    }
+    fclose(scores_file);
+}
 
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, ACK_PACKET_SIZE, 0, (struct sockaddr *) &server_addr, sizeof(server_addr));
-    if (bytes_tx < 0) printError("ack packet sendto failed", true);
+// Score of server address, NULL if the server wasn't seen yet
+static struct server_score *findScore(struct in_addr addr) {
+    for (int i = 0; i < score_count; i++) {
+        if (scores[i].addr.s_addr == addr.s_addr) return &scores[i];
+    }
+    return NULL;
+}
 
-    return bytes_tx;
+// Servers without score come first so they get measured, then the fastest ones
+static double serverOrder(const struct tftp_client_server *server) {
+    struct server_score *score = findScore(server->addr.sin_addr);
+    return score ? score->rtt_ms : -1;
 }
 
 /**
- * @brief Receive ACK packet, chceck opcode and compare expected block number with received block number
+ * @brief Order servers of race by response times of previous runs. If all of them are known, the fastest one
+ * gets head start and the others are asked only when it is slow or refuses the request
  *
- * @param expected_block expected block number of ack
- * 
- * @return bytes received
+ * @param c initialized client
  */
-int receiveAckPacket(uint16_t expected_block) {
-    char packet_buffer[DEFAULT_BLKSIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
+void orderServers(struct tftp_client *c) {
+    if (c->server_count < 2) return;
+
+    // Insertion sort keeps the order of hosts given on command line for equal scores
+    for (int i = 1; i < c->server_count; i++) {
+        struct tftp_client_server server = c->servers[i];
+        int j = i - 1;
+        while (j >= 0 && serverOrder(&c->servers[j]) > serverOrder(&server)) {
+            c->servers[j + 1] = c->servers[j];
+            j--;
+        }
+        c->servers[j + 1] = server;
+    }
+    c->server_addr = c->servers[0].addr;
 
-    // Receive ACK buffer
-    int bytes_rx = recvfrom(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
-    if (bytes_rx < 0) printError("recvfrom not succesful", true);
-    if (bytes_rx < 4) sendErrorPacket(4, "Illegal TFTP operation.");
+    double fastest = serverOrder(&c->servers[0]);
+    if (fastest >= 0) {
+        long long hedge_ms = (long long)(fastest * CLIENT_HEDGE_FACTOR);
+        tftpClientSetHedge(c, hedge_ms < CLIENT_MIN_HEDGE_MS ? CLIENT_MIN_HEDGE_MS : hedge_ms);
+    }
+}
 
-    uint16_t opcode;
-    uint16_t block;
+/**
+ * @brief Add response times of servers asked in the race to their scores and store them
+ *
+ * @param c client with finished transfer
+ * @param path score file, written to temporary file and renamed
+ */
+void saveScores(struct tftp_client *c, const char *path) {
+    for (int i = 0; i < c->server_count; i++) {
+        struct tftp_client_server *server = &c->servers[i];
+        if (!server->asked) continue;
+
+        double rtt_ms = server->answer_ms >= 0 ? server->answer_ms - server->asked_ms : c->session.opts.timeout * 1000.0;
+        struct server_score *score = findScore(server->addr.sin_addr);
+        if (score == NULL && score_count < CLIENT_MAX_SCORES) {
+            score = &scores[score_count++];
+            score->addr = server->addr.sin_addr;
+            score->rtt_ms = rtt_ms;
+            score->samples = 0;
+        }
+        if (score == NULL) continue;
+        score->rtt_ms += CLIENT_SCORE_WEIGHT * (rtt_ms - score->rtt_ms);
+        score->samples++;
+    }
 
-    // Get block and opcode
-    memcpy(&opcode, &packet_buffer[0], 2);
-    memcpy(&block, &packet_buffer[2], 2);
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid());
+    FILE *scores_file = fopen(tmp_path, "w");
+    if (scores_file == NULL) {
+        printError("couldn't write score file", false);
+        return;
+    }
+    for (int i = 0; i < score_count; i++) {
+        fprintf(scores_file, "%s %.3f %lu\n", inet_ntoa(scores[i].addr), scores[i].rtt_ms, scores[i].samples);
+    }
+    if (fclose(scores_file) != 0 || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        printError("couldn't write score file", false);
+    }
+}
 
-    opcode = ntohs(opcode);
-    block = ntohs(block);
+/**
+ * @brief Drive transfer of the client with packets received on its socket and real time until it ends
+ *
+ * @param c client with started transfer
+ */
+void runSession(struct tftp_client *c) {
+    struct tftp_session *session = &c->session;
+    const char *wait_name = session->role == TFTP_ROLE_SENDER ? "ack_wait" : "data_wait";
+
+    while (!tftpClientFinished(c)) {
+        long long wait_ns = trace.enabled ? traceClockNs() : 0;
+        if (handleTimeout(tftpClientDeadline(c) - tftpClockMs())) {
+            // Delayed ACK of windowed receiver and head start of the fastest server in race aren't timeouts
+            bool timed_out = !session->ack_pending && tftpSessionDeadline(session) <= tftpClockMs();
+            if (timed_out) printError("timed out", false);
+            if (trace.enabled) {
+                long long now_ns = traceClockNs();
+                traceComplete(&trace, wait_name, wait_ns, now_ns, session->block);
+                if (timed_out) traceInstant(&trace, "timeout", now_ns, session->block);
+            }
+            tftpClientOnTimer(c, tftpClockMs());
+            continue;
+        }
 
-    // Check opcode and block
-    if (opcode == ERROR_OPCODE) handleErrorPacket(packet_buffer);
-    else if (opcode != ACK_OPCODE) sendErrorPacket(4, "Illegal TFTP operation, unexpected opcode");
-    if (block != expected_block) sendErrorPacket(4, "Illegal TFTP operation, unexpected block");
+        rx_state.len = 0;
+        long long rx_us = lowlatClockUs();
+        if (tftpClientReceive(c, tftpClockMs()) <= 0) continue;
+        if (trace.enabled) traceComplete(&trace, wait_name, wait_ns, traceClockNs(), session->block);
 
-    // Print packet
-    printAckPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), expected_block, -1, -1);
+        // Packet that moved the transfer to the next block answered the last packet sent
+        bool advanced = rx_state.state == TFTP_SESSION_TRANSFER && (session->block != rx_state.block || session->state == TFTP_SESSION_DONE);
+        if (low_latency && rx_state.len > 0) latencyOnReceive(&latency, rx_state.head, rx_state.len, advanced ? rx_state.sent_us : -1, rx_us);
+    }
+
+    // Servers that didn't answer are scored by the timeout even if the transfer failed
+    if (c->server_count > 1 && c->download) {
+        if (session->state != TFTP_SESSION_FAILED) fprintf(stdout, "Race: %s answered first in %lld ms\n", inet_ntoa(c->servers[c->winner].addr.sin_addr), c->servers[c->winner].answer_ms - c->servers[c->winner].asked_ms);
+        if (score_path) saveScores(c, score_path);
+    }
+
+    if (session->state == TFTP_SESSION_FAILED) printError((char *)tftpClientError(c), true);
+    if (session->opts.windowsize > 1) tftpSessionPrintStats(session, stdout);
 
-    return bytes_rx;
+    if (low_latency) {
+        latencyPrint(&latency);
+        latencyDestroy(&latency);
+    }
 }
 
 /**
  * @brief Waits for data to be available to receive
  *
- * @param timeout time to wait (s)
+ * @param timeout time to wait (ms)
  * 
  * @return 1 if timed out, 0 if data are available to rece
  */
-int handleTimeout(int timeout) {
+int handleTimeout(long long timeout) {
     fd_set fds;
     struct timeval tv;
 
+    int sockfd = tftpClientFd(&client);
     FD_ZERO(&fds);
     FD_SET(sockfd, &fds);
 
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
+    if (timeout < 0) timeout = 0;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
 
-    int n = select(sockfd + 1, &fds, NULL, NULL, &tv);
+    // Low-latency mode spins on the socket before blocking
+    int n = low_latency ? lowlatWait(sockfd, timeout) : select(sockfd + 1, &fds, NULL, NULL, &tv);
 
     if (n < 0) {
         printError("select failed", true);
     } else if (n == 0) {
-        printError("timed out", false);
         return 1; 
     }
     return 0;
@@ -535,9 +584,14 @@ int handleTimeout(int timeout) {
 int main(int argc, char **argv) {
     // Neccessary variables
     char mode[] = "octet";
-    int blksize = DEFAULT_BLKSIZE;
-    int timeout = DEFAULT_TIMEOUT;
-    int maxRetransmitCount = 3;
+    struct tftp_options opts; // Requested options
+    bool resume_requested = false;
+    struct transfer transfer = {0};
+    static const struct tftp_client_hooks client_hooks = {
+        .on_oack = clientOnOack,
+        .on_packet = clientOnPacket,
+        .send = clientSend,
+    };
 
     // Variables for command line arguments
     char *host = NULL;
@@ -545,86 +599,49 @@ int main(int argc, char **argv) {
     char *filepath = NULL;
     char *dest_file = NULL;
 
-    handleArguments(argc, argv, &host, &server_port, &filepath, &dest_file);
-
-    createUDPSocket(&sockfd);
+    tftpOptionsInit(&opts);
 
-    configureServerAddress(host, server_port);
+    traceInit(&trace);
+    handleArguments(argc, argv, &host, &server_port, &filepath, &dest_file, &opts.compress, &resume_requested, &opts.windowsize, &opts.sack, &opts.fec);
+    traceStart(&trace, "tftp-client", filepath ? filepath : dest_file);
 
-    // Get information about source ip and source port
-    if (bind(sockfd, (struct sockaddr*)&src_addr, sizeof(src_addr)) < 0) {
-        printError("bind failed", true);
+    // Download resumes from the end of local file, upload from the end of file stored on server (reported in OACK)
+    if (resume_requested) {
+        if (filepath) findResumeOffset(dest_file, &opts.resume, &opts.resume_crc);
+        else opts.resume = 0;
     }
 
-    // Get information about the source IP and source port after the socket is bound
-    socklen_t src_len = sizeof(src_addr);
-    if (getsockname(sockfd, (struct sockaddr *)&src_addr, &src_len) < 0) {
-        printError("getsockname failed", true);
+    if (lowlat_cpus.count > 0 && lowlatPin(&lowlat_cpus, -1) < 0) printError("couldn't pin to CPUs", false);
+
+    // Resolve servers, create and bind socket
+    if (tftpClientInitRace(&client, host, server_port, all_addresses) < 0) printError((char *)tftpClientError(&client), true);
+    if (score_path) {
+        loadScores(score_path);
+        orderServers(&client);
     }
+    if (low_latency) lowlatTuneSocket(tftpClientFd(&client), opts.blksize);
 
-    // Number of currently processed block
-    uint16_t block;
+    transfer.dest_file = dest_file;
+    tftpClientSetHooks(&client, &client_hooks, &transfer);
+    latencyInit(&latency, lowlatClockUs());
 
     if (filepath) {
-        block = 0;
-        int bytes_rx = -1; // bytes received
-
-        sendRqPacket(RRQ_OPCODE, filepath, mode, &blksize, &timeout);
-
-        openFile(dest_file);
-
-        if (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT) {
-            for (int i = 0; i <= maxRetransmitCount; i++)
-            {
-                if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-                if (handleTimeout(timeout)) {
-                    sendRqPacket(RRQ_OPCODE, filepath, mode, &blksize, &timeout);
-                } else break;
-            }
-
-            receiveOackPacket(&blksize, &timeout);
-
-            server_port = ntohs(recv_addr.sin_port);
-            configureServerAddress(host, server_port);
-
-            sendAckPacket(block);
-        }
+        transfer.download = true;
 
-        do {
-            for (int i = 0; i <= maxRetransmitCount; i++) {
-                if (handleTimeout(timeout)) {
-                    if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-                    // If the block is zero last attempt to send was to send rq packet, so client has to regransmit rq packet
-                    if (block == 0) {
-                        if (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT) sendAckPacket(block);
-                        else sendRqPacket(RRQ_OPCODE, filepath, mode, &blksize, &timeout);
-                    }
-                    else sendAckPacket(block);
-                } else {
-                    break;
-                }
-            }
-
-            block++;
+        long long session_ns = traceClockNs();
+        if (tftpClientStartFetch(&client, filepath, mode, &opts, transferWrite, &transfer) < 0) printError((char *)tftpClientError(&client), true);
 
-            bytes_rx = receiveDataPacket(block, blksize);
-
-            // If the client received first data packet update destination port
-            if (block == 1) {
-                server_port = ntohs(recv_addr.sin_port);
-                configureServerAddress(host, server_port);   
-            }
+        runSession(&client);
+        traceComplete(&trace, "session", session_ns, traceClockNs(), client.session.block);
 
-            sendAckPacket(block);
-            // While not received less data then max in data packet
-        } while(bytes_rx >= blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE);
+        long long close_ns = traceClockNs();
+        if (transfer.dest) finishDecompression(transfer.dest, dest_file);
 
         fclose(file);
+        file = NULL;
+        traceComplete(&trace, "close", close_ns, traceClockNs(), -1);
 
     } else {
-        block = 0;
-        int bytes_tx = -1; // bytes sent
-
         // Load data from stdin to memory
         int index = 0;
         int ch;
@@ -639,49 +656,21 @@ int main(int argc, char **argv) {
             }
             stdin_data[index++] = (char)ch;
         }
-        stdin_data[index] = '\0';
-
-        sendRqPacket(WRQ_OPCODE, dest_file, mode, &blksize, &timeout);
-
-        for (int i = 0; i <= maxRetransmitCount; i++)
-        {
-            if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-            if (handleTimeout(timeout)) {
-                sendRqPacket(WRQ_OPCODE, dest_file, mode, &blksize, &timeout);
-            } else break;
-        }
+        transfer.stdin_data = stdin_data;
+        transfer.stdin_data_len = index;
 
-        if (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT) receiveOackPacket(&blksize, &timeout);
-        else receiveAckPacket(block);
+        long long session_ns = traceClockNs();
+        if (tftpClientStartUpload(&client, dest_file, mode, &opts, transferRead, &transfer) < 0) printError((char *)tftpClientError(&client), true);
 
-        block++;
-
-        // Update destination port with src port of ACK with block number 0
-        server_port = ntohs(recv_addr.sin_port);
-        configureServerAddress(host, server_port);
-
-        do {
-            bytes_tx = sendDataPacket(block, blksize, stdin_data, (block-1) * blksize); // last argument calculates what index should data start on
-
-            for (int i = 0; i <= maxRetransmitCount; i++)
-            {
-                if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-                if (handleTimeout(timeout)) {
-                    bytes_tx = sendDataPacket(block, blksize, stdin_data, (block-1) * blksize);
-                } else break;
-            }
-
-            receiveAckPacket(block);
-
-            block++;
-            // While not sent less data then max in data packet
-        } while(bytes_tx >= blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE);
+        runSession(&client);
+        traceComplete(&trace, "session", session_ns, traceClockNs(), client.session.block);
 
         // Free allocated memory for stdin data
-        if (stdin_data) free(stdin_data);
+        if (transfer.stdin_data) free(transfer.stdin_data);
     }
 
-    closeUDPSocket();
+    tftpClientClose(&client);
+    traceClose(&trace);
 
     return 0;
-}
\ No newline at end of file
+}
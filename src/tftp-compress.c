@@ -0,0 +1,306 @@
+/* tftp-compress.c ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-compress.h"
+
+// LZ4 block format constants
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_LOG 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t lzRead32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint32_t lzHash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Write the extension bytes of a literal or match length (length already reduced by 15)
+static unsigned char *lzWriteLength(unsigned char *op, int len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// Write a sequence of literals followed by a match, or only literals if match_len == 0
+static unsigned char *lzWriteSequence(unsigned char *op, const unsigned char *literals, int literal_len, int offset, int match_len) {
+    unsigned char *token = op++;
+
+    *token = (literal_len >= 15 ? 15 : literal_len) << 4;
+    if (literal_len >= 15) op = lzWriteLength(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len == 0) return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match_len -= LZ_MIN_MATCH;
+    *token |= match_len >= 15 ? 15 : match_len;
+    if (match_len >= 15) op = lzWriteLength(op, match_len - 15);
+
+    return op;
+}
+
+/**
+ * @brief Worst case size of compressed block
+ *
+ * @param src_len length of uncompressed data
+ *
+ * @return size of buffer, that is always big enough for compressed data
+ */
+int compressBound(int src_len) {
+    return src_len + src_len / 255 + 16;
+}
+
+/**
+ * @brief Compress block of data into LZ4 block format
+ *
+ * @param src data to compress
+ * @param src_len length of data
+ * @param dst destination buffer
+ * @param dst_cap size of destination buffer, has to be at least compressBound(src_len)
+ *
+ * @return length of compressed data, -1 if destination buffer is too small
+ */
+int compressBlock(const char *src, int src_len, char *dst, int dst_cap) {
+    if (dst_cap < compressBound(src_len)) return -1;
+
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *op = (unsigned char *)dst;
+    int table[1 << LZ_HASH_LOG];
+    for (int i = 0; i < (1 << LZ_HASH_LOG); i++) table[i] = -1;
+
+    int anchor = 0;
+    int pos = 0;
+
+    // Last match has to start at least LZ_MF_LIMIT bytes before end of the block
+    while (pos < src_len - LZ_MF_LIMIT) {
+        uint32_t sequence = lzRead32(&in[pos]);
+        uint32_t hash = lzHash(sequence);
+        int ref = table[hash];
+        table[hash] = pos;
+
+        if (ref < 0 || pos - ref > LZ_MAX_OFFSET || lzRead32(&in[ref]) != sequence) {
+            pos++;
+            continue;
+        }
+
+        // Extend match, last LZ_LAST_LITERALS bytes are always literals
+        int match_len = LZ_MIN_MATCH;
+        int max_len = src_len - LZ_LAST_LITERALS - pos;
+        while (match_len < max_len && in[ref + match_len] == in[pos + match_len]) match_len++;
+
+        op = lzWriteSequence(op, &in[anchor], pos - anchor, pos - ref, match_len);
+        pos += match_len;
+        anchor = pos;
+    }
+
+    op = lzWriteSequence(op, &in[anchor], src_len - anchor, 0, 0);
+
+    return op - (unsigned char *)dst;
+}
+
+// Read the extension bytes of a literal or match length, -1 on truncated input
+static int lzReadLength(const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned char byte;
+    do {
+        if (*ip >= iend) return -1;
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/**
+ * @brief Decompress LZ4 block, every read and write is bounds checked
+ *
+ * @param src compressed data
+ * @param src_len length of compressed data
+ * @param dst destination buffer
+ * @param dst_cap size of destination buffer
+ *
+ * @return length of decompressed data, -1 if input is malformed or doesn't fit
+ */
+int decompressBlock(const char *src, int src_len, char *dst, int dst_cap) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + src_len;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + dst_cap;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        // Copy literals
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && lzReadLength(&ip, iend, &literal_len) < 0) return -1;
+        if (literal_len > (size_t)(iend - ip) || literal_len > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+
+        // Last sequence contains only literals
+        if (ip == iend) break;
+
+        // Copy match, byte by byte because it can overlap with output
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst)) return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && lzReadLength(&ip, iend, &match_len) < 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) return -1;
+
+        const unsigned char *match = op - offset;
+        while (match_len--) *op++ = *match++;
+    }
+
+    return op - (unsigned char *)dst;
+}
+
+/**
+ * @brief Compress whole stream. Every chunk of COMPRESS_CHUNK_SIZE bytes is written
+ * as raw length, stored length and LZ4 block. Chunks that don't compress are stored raw.
+ *
+ * @param in stream to compress
+ * @param out stream for compressed data
+ *
+ * @return 0 on success, -1 on failure
+ */
+int compressStream(FILE *in, FILE *out) {
+    int packed_cap = compressBound(COMPRESS_CHUNK_SIZE);
+    char *raw = malloc(COMPRESS_CHUNK_SIZE);
+    char *packed = malloc(packed_cap);
+    int result = 0;
+
+    if (raw == NULL || packed == NULL) result = -1;
+
+    size_t raw_len;
+    while (result == 0 && (raw_len = fread(raw, 1, COMPRESS_CHUNK_SIZE, in)) > 0) {
+        int packed_len = compressBlock(raw, raw_len, packed, packed_cap);
+
+        uint32_t header[2];
+        char *payload = packed;
+        header[0] = htonl(raw_len);
+        header[1] = htonl(packed_len);
+        if (packed_len < 0 || packed_len >= (int)raw_len) {
+            payload = raw;
+            packed_len = raw_len;
+            header[1] = htonl(raw_len | COMPRESS_STORED_FLAG);
+        }
+
+        if (fwrite(header, 1, COMPRESS_HEADER_SIZE, out) != COMPRESS_HEADER_SIZE) result = -1;
+        else if (fwrite(payload, 1, packed_len, out) != (size_t)packed_len) result = -1;
+    }
+    if (ferror(in) || fflush(out) != 0) result = -1;
+
+    free(raw);
+    free(packed);
+    return result;
+}
+
+/**
+ * @brief Decompress stream created by compressStream
+ *
+ * @param in compressed stream
+ * @param out stream for decompressed data
+ *
+ * @return 0 on success, -1 if the stream is malformed or can't be written
+ */
+int decompressStream(FILE *in, FILE *out) {
+    int packed_cap = compressBound(COMPRESS_CHUNK_SIZE);
+    char *raw = malloc(COMPRESS_CHUNK_SIZE);
+    char *packed = malloc(packed_cap);
+    int result = 0;
+
+    if (raw == NULL || packed == NULL) result = -1;
+
+    uint32_t header[2];
+    size_t header_len;
+    while (result == 0 && (header_len = fread(header, 1, COMPRESS_HEADER_SIZE, in)) > 0) {
+        if (header_len != COMPRESS_HEADER_SIZE) {
+            result = -1;
+            break;
+        }
+
+        uint32_t raw_len = ntohl(header[0]);
+        uint32_t packed_len = ntohl(header[1]);
+        int stored = (packed_len & COMPRESS_STORED_FLAG) != 0;
+        packed_len &= ~COMPRESS_STORED_FLAG;
+
+        if (raw_len > COMPRESS_CHUNK_SIZE || packed_len > (uint32_t)packed_cap) result = -1;
+        else if (stored && packed_len != raw_len) result = -1;
+        else if (fread(packed, 1, packed_len, in) != packed_len) result = -1;
+        else if (stored) memcpy(raw, packed, raw_len);
+        else if (decompressBlock(packed, packed_len, raw, COMPRESS_CHUNK_SIZE) != (int)raw_len) result = -1;
+
+        if (result == 0 && fwrite(raw, 1, raw_len, out) != raw_len) result = -1;
+    }
+    if (ferror(in) || fflush(out) != 0) result = -1;
+
+    free(raw);
+    free(packed);
+    return result;
+}
+
+/**
+ * @brief Check that file is a stream created by compressStream, chunk headers must describe exactly the whole
+ * file. Chunks are decompressed only if decode is set, otherwise only their headers are read
+ *
+ * @param fd descriptor of compressed file
+ * @param size size of the file
+ * @param decode decompress every chunk
+ * @param raw_size size of decompressed data
+ *
+ * @return 0 if the stream is valid, -1 otherwise
+ */
+int compressCheckFile(int fd, off_t size, bool decode, off_t *raw_size) {
+    int packed_cap = compressBound(COMPRESS_CHUNK_SIZE);
+    char *raw = decode ? malloc(COMPRESS_CHUNK_SIZE) : NULL;
+    char *packed = decode ? malloc(packed_cap) : NULL;
+    int result = decode && (raw == NULL || packed == NULL) ? -1 : 0;
+
+    off_t offset = 0;
+    *raw_size = 0;
+    while (result == 0 && offset < size) {
+        uint32_t header[2];
+        if (pread(fd, header, COMPRESS_HEADER_SIZE, offset) != COMPRESS_HEADER_SIZE) {
+            result = -1;
+            break;
+        }
+
+        uint32_t raw_len = ntohl(header[0]);
+        uint32_t packed_len = ntohl(header[1]);
+        int stored = (packed_len & COMPRESS_STORED_FLAG) != 0;
+        packed_len &= ~COMPRESS_STORED_FLAG;
+        offset += COMPRESS_HEADER_SIZE;
+
+        if (raw_len == 0 || raw_len > COMPRESS_CHUNK_SIZE || packed_len > (uint32_t)packed_cap) result = -1;
+        else if ((stored && packed_len != raw_len) || packed_len > size - offset) result = -1;
+        else if (decode && !stored) {
+            if (pread(fd, packed, packed_len, offset) != (ssize_t)packed_len) result = -1;
+            else if (decompressBlock(packed, packed_len, raw, COMPRESS_CHUNK_SIZE) != (int)raw_len) result = -1;
+        }
+
+        offset += packed_len;
+        *raw_size += raw_len;
+    }
+
+    free(raw);
+    free(packed);
+    return result;
+}
@@ -0,0 +1,385 @@
+/* tftp-core.c **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-core.h"
+#include "../include/tftp-compress.h"
+#include "../include/tftp-crc32c.h"
+#include "../include/tftp-fec.h"
+
+/**
+ * @brief Set options to default values
+ *
+ * @param opts options to initialize
+ */
+void tftpOptionsInit(struct tftp_options *opts) {
+    opts->blksize = DEFAULT_BLKSIZE;
+    opts->timeout = DEFAULT_TIMEOUT;
+    opts->windowsize = DEFAULT_WINDOWSIZE;
+    opts->sack = false;
+    opts->fec = 0;
+    opts->cwnd = false;
+    opts->compress = false;
+    opts->resume = -1;
+    opts->resume_crc = 0;
+}
+
+/**
+ * @brief Check if any option differs from default, RQ with such options is answered with OACK
+ *
+ * @param opts options to check
+ *
+ * @return true if at least one option will be encoded
+ */
+bool tftpHasOptions(const struct tftp_options *opts) {
+    return opts->blksize != DEFAULT_BLKSIZE || opts->timeout != DEFAULT_TIMEOUT || opts->windowsize != DEFAULT_WINDOWSIZE ||
+        opts->sack || opts->fec > 0 || opts->cwnd || opts->compress || opts->resume >= 0;
+}
+
+// Append string with terminating zero, -1 if it doesn't fit
+static int appendString(char *buffer, size_t cap, size_t *pos, const char *str, size_t len) {
+    if (*pos + len + 1 > cap) return -1;
+    memcpy(&buffer[*pos], str, len);
+    *pos += len;
+    buffer[(*pos)++] = '\0';
+    return 0;
+}
+
+// Append number formatted in base 10 or 16 with terminating zero, -1 if it doesn't fit
+static int appendNumber(char *buffer, size_t cap, size_t *pos, unsigned long value, int base, int min_digits) {
+    char digits[32];
+    int len = 0;
+    do {
+        digits[len++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value > 0 || len < min_digits);
+
+    if (*pos + len + 1 > cap) return -1;
+    while (len > 0) buffer[(*pos)++] = digits[--len];
+    buffer[(*pos)++] = '\0';
+    return 0;
+}
+
+// Append option name and its numeric value
+static int appendOption(char *buffer, size_t cap, size_t *pos, const char *option, unsigned long value, int base, int min_digits) {
+    if (appendString(buffer, cap, pos, option, strlen(option)) < 0) return -1;
+    return appendNumber(buffer, cap, pos, value, base, min_digits);
+}
+
+/**
+ * @brief Encode options that differ from defaults as pairs of option and value
+ *
+ * @param buffer destination buffer
+ * @param cap size of buffer
+ * @param opts options to encode
+ *
+ * @return number of bytes written, -1 if buffer is too small
+ */
+int tftpEncodeOptions(char *buffer, size_t cap, const struct tftp_options *opts) {
+    size_t pos = 0;
+
+    if (opts->blksize != DEFAULT_BLKSIZE && appendOption(buffer, cap, &pos, BLKSIZE_OPT, opts->blksize, 10, 1) < 0) return -1;
+    if (opts->timeout != DEFAULT_TIMEOUT && appendOption(buffer, cap, &pos, TIMEOUT_OPT, opts->timeout, 10, 1) < 0) return -1;
+    if (opts->windowsize != DEFAULT_WINDOWSIZE && appendOption(buffer, cap, &pos, WINDOWSIZE_OPT, opts->windowsize, 10, 1) < 0) return -1;
+    if (opts->sack && appendOption(buffer, cap, &pos, SACK_OPT, 1, 10, 1) < 0) return -1;
+    if (opts->fec > 0 && appendOption(buffer, cap, &pos, FEC_OPT, opts->fec, 10, 1) < 0) return -1;
+    if (opts->cwnd && appendOption(buffer, cap, &pos, CWND_OPT, 1, 10, 1) < 0) return -1;
+    if (opts->compress) {
+        if (appendString(buffer, cap, &pos, COMPRESS_OPT, strlen(COMPRESS_OPT)) < 0) return -1;
+        if (appendString(buffer, cap, &pos, COMPRESS_CODEC, strlen(COMPRESS_CODEC)) < 0) return -1;
+    }
+    if (opts->resume >= 0) {
+        if (appendOption(buffer, cap, &pos, RESUME_OPT, opts->resume, 10, 1) < 0) return -1;
+        if (appendOption(buffer, cap, &pos, CRC32C_OPT, opts->resume_crc, 16, 8) < 0) return -1;
+    }
+
+    return pos;
+}
+
+/**
+ * @brief Encode RRQ or WRQ packet
+ *
+ * @param buffer destination buffer
+ * @param cap size of buffer
+ * @param opcode RRQ or WRQ opcode
+ * @param filename name of file
+ * @param mode transfer mode
+ * @param opts options appended after mode
+ *
+ * @return length of packet, -1 if buffer is too small
+ */
+int tftpEncodeRq(char *buffer, size_t cap, uint16_t opcode, const char *filename, const char *mode, const struct tftp_options *opts) {
+    size_t pos = OPCODE_SIZE;
+    if (cap < OPCODE_SIZE) return -1;
+    tftpPrepareHeader(buffer, opcode);
+
+    if (appendString(buffer, cap, &pos, filename, strlen(filename)) < 0) return -1;
+    if (appendString(buffer, cap, &pos, mode, strlen(mode)) < 0) return -1;
+
+    int opts_len = tftpEncodeOptions(&buffer[pos], cap - pos, opts);
+    if (opts_len < 0) return -1;
+
+    return pos + opts_len;
+}
+
+/**
+ * @brief Encode OACK packet, OACK of one session doesn't change so it is encoded once and retransmitted as is
+ *
+ * @param buffer destination buffer
+ * @param cap size of buffer
+ * @param opts acknowledged options
+ *
+ * @return length of packet, -1 if buffer is too small
+ */
+int tftpEncodeOack(char *buffer, size_t cap, const struct tftp_options *opts) {
+    if (cap < OPCODE_SIZE) return -1;
+    tftpPrepareHeader(buffer, OACK_OPCODE);
+
+    int opts_len = tftpEncodeOptions(&buffer[OPCODE_SIZE], cap - OPCODE_SIZE, opts);
+    if (opts_len < 0) return -1;
+
+    return OPCODE_SIZE + opts_len;
+}
+
+/**
+ * @brief Encode ERROR packet, message is truncated if it doesn't fit into buffer
+ *
+ * @param buffer destination buffer
+ * @param cap size of buffer, at least 5 bytes
+ * @param error_code error code
+ * @param error_msg error message
+ *
+ * @return length of packet
+ */
+int tftpEncodeError(char *buffer, size_t cap, uint16_t error_code, const char *error_msg) {
+    size_t msg_len = strlen(error_msg);
+    if (msg_len > cap - OPCODE_SIZE - EEROR_CODE_SIZE - 1) msg_len = cap - OPCODE_SIZE - EEROR_CODE_SIZE - 1;
+
+    tftpPrepareHeader(buffer, ERROR_OPCODE);
+    tftpSetBlock(buffer, error_code); // error code is on the same position as block number
+    memcpy(&buffer[OPCODE_SIZE + EEROR_CODE_SIZE], error_msg, msg_len);
+    buffer[OPCODE_SIZE + EEROR_CODE_SIZE + msg_len] = '\0';
+
+    return OPCODE_SIZE + EEROR_CODE_SIZE + msg_len + 1;
+}
+
+/**
+ * @brief Decode RRQ or WRQ packet, both strings have to be terminated inside the packet
+ *
+ * @param packet received packet
+ * @param len length of packet
+ * @param filename to set pointer to filename inside packet
+ * @param mode to set pointer to mode inside packet
+ * @param options_offset to set offset of first option
+ *
+ * @return 0 on success, -1 if packet is malformed
+ */
+int tftpDecodeRq(const char *packet, size_t len, const char **filename, const char **mode, size_t *options_offset) {
+    if (len < OPCODE_SIZE) return -1;
+
+    const char *filename_end = memchr(&packet[OPCODE_SIZE], '\0', len - OPCODE_SIZE);
+    if (filename_end == NULL) return -1;
+    size_t mode_offset = filename_end - packet + 1;
+
+    const char *mode_end = memchr(&packet[mode_offset], '\0', len - mode_offset);
+    if (mode_end == NULL) return -1;
+
+    *filename = &packet[OPCODE_SIZE];
+    *mode = &packet[mode_offset];
+    *options_offset = mode_end - packet + 1;
+    return 0;
+}
+
+/**
+ * @brief Decode ERROR packet
+ *
+ * @param packet received packet
+ * @param len length of packet
+ * @param error_code to set error code
+ * @param error_msg to set pointer to message inside packet
+ *
+ * @return 0 on success, -1 if packet is too short or message isn't terminated
+ */
+int tftpDecodeError(const char *packet, size_t len, uint16_t *error_code, const char **error_msg) {
+    size_t msg_offset = OPCODE_SIZE + EEROR_CODE_SIZE;
+    if (len <= msg_offset) return -1;
+    if (memchr(&packet[msg_offset], '\0', len - msg_offset) == NULL) return -1;
+
+    *error_code = tftpGetBlock(packet);
+    *error_msg = &packet[msg_offset];
+    return 0;
+}
+
+// Parse decimal number, -1 if the value isn't a number or is too big
+static long parseDecimal(const char *value, size_t len) {
+    long result = 0;
+    if (len == 0 || len > 15) return -1;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9') return -1;
+        result = result * 10 + (value[i] - '0');
+    }
+    return result;
+}
+
+// Parse decimal number of int option, -1 if it doesn't fit, so wrapped values don't pass range checks
+static int parseInt(const char *value, size_t len) {
+    long result = parseDecimal(value, len);
+    return result > INT_MAX ? -1 : (int)result;
+}
+
+// Parse hexadecimal 32 bit number, -1 if the value isn't a number or is too big
+static int parseHex32(const char *value, size_t len, uint32_t *result) {
+    *result = 0;
+    if (len == 0 || len > 8) return -1;
+    for (size_t i = 0; i < len; i++) {
+        char ch = value[i];
+        int digit;
+        if (ch >= '0' && ch <= '9') digit = ch - '0';
+        else if (ch >= 'a' && ch <= 'f') digit = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'F') digit = ch - 'A' + 10;
+        else return -1;
+        *result = (*result << 4) | digit;
+    }
+    return 0;
+}
+
+// Compare option name case insensitively, option names aren't terminated in the packet
+static bool optionIs(const char *option, size_t len, const char *name) {
+    return len == strlen(name) && !strncasecmp(option, name, len);
+}
+
+/**
+ * @brief Parse pairs of option and value in single pass, every string has to be terminated inside the packet.
+ * Numeric values that aren't numbers are set to -1, so range checks of the caller reject them
+ *
+ * @param packet received packet
+ * @param len length of packet
+ * @param offset offset of first option
+ * @param opts to set recognized options
+ * @param seen to set mask of recognized options (OPT_SEEN_*)
+ *
+ * @return 0 on success, -1 if packet is malformed
+ */
+int tftpParseOptions(const char *packet, size_t len, size_t offset, struct tftp_options *opts, unsigned *seen) {
+    size_t pos = offset;
+    *seen = 0;
+
+    while (pos < len) {
+        const char *option = &packet[pos];
+        const char *option_end = memchr(option, '\0', len - pos);
+        if (option_end == NULL) return -1;
+        pos = option_end - packet + 1;
+
+        if (pos >= len) return -1; // Option without value
+        const char *value = &packet[pos];
+        const char *value_end = memchr(value, '\0', len - pos);
+        if (value_end == NULL) return -1;
+        pos = value_end - packet + 1;
+
+        size_t option_len = option_end - option;
+        size_t value_len = value_end - value;
+
+        if (optionIs(option, option_len, BLKSIZE_OPT)) {
+            opts->blksize = parseInt(value, value_len);
+            *seen |= OPT_SEEN_BLKSIZE;
+        } else if (optionIs(option, option_len, TIMEOUT_OPT)) {
+            opts->timeout = parseInt(value, value_len);
+            *seen |= OPT_SEEN_TIMEOUT;
+        } else if (optionIs(option, option_len, WINDOWSIZE_OPT)) {
+            opts->windowsize = parseInt(value, value_len);
+            *seen |= OPT_SEEN_WINDOWSIZE;
+        } else if (optionIs(option, option_len, SACK_OPT)) {
+            opts->sack = optionIs(value, value_len, "1");
+            *seen |= OPT_SEEN_SACK;
+        } else if (optionIs(option, option_len, FEC_OPT)) {
+            opts->fec = parseInt(value, value_len);
+            *seen |= OPT_SEEN_FEC;
+        } else if (optionIs(option, option_len, CWND_OPT)) {
+            opts->cwnd = optionIs(value, value_len, "1");
+            *seen |= OPT_SEEN_CWND;
+        } else if (optionIs(option, option_len, COMPRESS_OPT)) {
+            opts->compress = optionIs(value, value_len, COMPRESS_CODEC);
+            *seen |= OPT_SEEN_COMPRESS;
+        } else if (optionIs(option, option_len, RESUME_OPT)) {
+            opts->resume = parseDecimal(value, value_len);
+            *seen |= OPT_SEEN_RESUME;
+        } else if (optionIs(option, option_len, CRC32C_OPT)) {
+            if (parseHex32(value, value_len, &opts->resume_crc) == 0) *seen |= OPT_SEEN_CRC32C;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Convert data to netascii, LF is sent as CR LF and CR as CR NUL. If the second byte
+ * of the pair doesn't fit into destination, it is kept in pending and written first on the next call
+ *
+ * @param src data from file
+ * @param src_len length of data
+ * @param src_used to set number of bytes of src that were converted
+ * @param dst destination buffer
+ * @param dst_cap size of destination buffer
+ * @param pending byte left from previous call, -1 if none
+ *
+ * @return number of bytes written to dst
+ */
+size_t tftpNetasciiEncode(const char *src, size_t src_len, size_t *src_used, char *dst, size_t dst_cap, int *pending) {
+    size_t in = 0;
+    size_t out = 0;
+
+    if (*pending >= 0 && out < dst_cap) {
+        dst[out++] = *pending;
+        *pending = -1;
+    }
+
+    while (in < src_len && out < dst_cap) {
+        char ch = src[in++];
+        if (ch == '\n' || ch == '\r') {
+            char next = ch == '\n' ? '\n' : '\0';
+            dst[out++] = '\r';
+            if (out < dst_cap) dst[out++] = next;
+            else *pending = (unsigned char)next;
+        } else {
+            dst[out++] = ch;
+        }
+    }
+
+    *src_used = in;
+    return out;
+}
+
+/**
+ * @brief Convert netascii data in place, CR LF is written as LF and CR NUL as CR. CR at the end
+ * of data is kept in cr_pending, bare CR is dropped
+ *
+ * @param data received data
+ * @param len length of data
+ * @param cr_pending previous data ended with CR
+ *
+ * @return length of converted data
+ */
+size_t tftpNetasciiDecode(char *data, size_t len, bool *cr_pending) {
+    size_t out = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        char ch = data[i];
+        if (*cr_pending) {
+            *cr_pending = false;
+            if (ch == '\n') {
+                data[out++] = '\n';
+                continue;
+            } else if (ch == '\0') {
+                data[out++] = '\r';
+                continue;
+            }
+        }
+        if (ch == '\r') *cr_pending = true;
+        else data[out++] = ch;
+    }
+
+    return out;
+}
@@ -0,0 +1,143 @@
+/* tftp-crc32c.c ********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78U // Castagnoli polynomial, reflected
+#define CRC32C_STREAM_CHUNK 65536
+
+static uint32_t crc32c_table[8][256];
+static bool crc32c_table_ready = false;
+
+// Build tables for slicing-by-8 software implementation
+static void crc32cInitTable() {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint32_t prev = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+    crc32c_table_ready = true;
+}
+
+static uint32_t crc32cSoftware(uint32_t crc, const unsigned char *p, size_t len) {
+    if (!crc32c_table_ready) crc32cInitTable();
+
+    while (len >= 8) {
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^
+              crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xff] ^ crc32c_table[2][(high >> 8) & 0xff] ^
+              crc32c_table[1][(high >> 16) & 0xff] ^ crc32c_table[0][high >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+// SSE4.2 crc32 instruction computes exactly CRC32C, 8 bytes per instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t crc64 = crc;
+
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, p, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+#endif
+
+/**
+ * @brief Update CRC32C checksum with data. Uses SSE4.2 instruction if CPU supports it
+ *
+ * @param crc checksum of preceding data, 0 for the first call
+ * @param data data to add to checksum
+ * @param len length of data
+ *
+ * @return checksum of preceding data and data
+ */
+uint32_t crc32cUpdate(uint32_t crc, const char *data, size_t len) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32cHardware(crc, (const unsigned char *)data, len);
+#endif
+    return ~crc32cSoftware(crc, (const unsigned char *)data, len);
+}
+
+/**
+ * @brief Compute CRC32C of len bytes read from current position of stream
+ *
+ * @param stream stream to read from
+ * @param len number of bytes to checksum
+ * @param crc to set computed checksum
+ *
+ * @return 0 on success, -1 if stream has less than len bytes
+ */
+int crc32cStream(FILE *stream, long len, uint32_t *crc) {
+    char *buffer = malloc(CRC32C_STREAM_CHUNK);
+    if (buffer == NULL) return -1;
+
+    *crc = 0;
+    while (len > 0) {
+        size_t chunk = len < CRC32C_STREAM_CHUNK ? len : CRC32C_STREAM_CHUNK;
+        if (fread(buffer, 1, chunk, stream) != chunk) break;
+        *crc = crc32cUpdate(*crc, buffer, chunk);
+        len -= chunk;
+    }
+
+    free(buffer);
+    return len == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Compute CRC32C of first len bytes of file, file offset is not changed
+ *
+ * @param fd descriptor of file
+ * @param len number of bytes to checksum
+ * @param crc to set computed checksum
+ *
+ * @return 0 on success, -1 if file has less than len bytes
+ */
+int crc32cFile(int fd, off_t len, uint32_t *crc) {
+    char *buffer = malloc(CRC32C_STREAM_CHUNK);
+    if (buffer == NULL) return -1;
+
+    off_t offset = 0;
+    *crc = 0;
+    while (offset < len) {
+        size_t chunk = len - offset < CRC32C_STREAM_CHUNK ? len - offset : CRC32C_STREAM_CHUNK;
+        ssize_t bytes_read = pread(fd, buffer, chunk, offset);
+        if (bytes_read <= 0) break;
+        *crc = crc32cUpdate(*crc, buffer, bytes_read);
+        offset += bytes_read;
+    }
+
+    free(buffer);
+    return offset == len ? 0 : -1;
+}
@@ -0,0 +1,561 @@
+/* tftp-dedup.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-dedup.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define DEDUP_STRIPE 64
+#define DEDUP_STRIPES_PER_BLOCK 16 // Accumulators are scrambled after every block
+#define DEDUP_PRIME32 0x9E3779B1ULL
+#define DEDUP_PRIME64_1 0x9E3779B185EBCA87ULL
+#define DEDUP_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+
+static const uint64_t dedup_key[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+static const uint64_t dedup_scramble_key[8] = {
+    0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+    0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+};
+
+static uint64_t dedup_gear[256];
+static bool dedup_gear_ready = false;
+
+// Gear table of chunker, generated by splitmix64 from fixed seed so boundaries never change between runs
+static void dedupInitGear() {
+    uint64_t state = 0x7466747064656470ULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        dedup_gear[i] = z ^ (z >> 31);
+    }
+    dedup_gear_ready = true;
+}
+
+// Multiply-accumulate of one stripe, every accumulator takes product of 32-bit halves of keyed lane
+// and the neighbouring lane unkeyed
+static void dedupAccumulate(uint64_t *acc, const unsigned char *stripe) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t data;
+        memcpy(&data, &stripe[8 * i], 8);
+        uint64_t key = data ^ dedup_key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (key & 0xffffffff) * (key >> 32);
+    }
+}
+
+static void dedupScramble(uint64_t *acc) {
+    for (int i = 0; i < 8; i++) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= dedup_scramble_key[i];
+        acc[i] *= DEDUP_PRIME32;
+    }
+}
+
+static void dedupStripesSoftware(uint64_t *acc, const unsigned char *data, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++) {
+        dedupAccumulate(acc, &data[s * DEDUP_STRIPE]);
+        if ((s + 1) % DEDUP_STRIPES_PER_BLOCK == 0) dedupScramble(acc);
+    }
+}
+
+#if defined(__x86_64__)
+// Same computation with 4 lanes per register, the result is identical to the software one
+__attribute__((target("avx2")))
+static void dedupStripesAvx2(uint64_t *acc, const unsigned char *data, size_t stripes) {
+    __m256i acc0 = _mm256_loadu_si256((const __m256i *)&acc[0]);
+    __m256i acc1 = _mm256_loadu_si256((const __m256i *)&acc[4]);
+    const __m256i key0 = _mm256_loadu_si256((const __m256i *)&dedup_key[0]);
+    const __m256i key1 = _mm256_loadu_si256((const __m256i *)&dedup_key[4]);
+    const __m256i scramble0 = _mm256_loadu_si256((const __m256i *)&dedup_scramble_key[0]);
+    const __m256i scramble1 = _mm256_loadu_si256((const __m256i *)&dedup_scramble_key[4]);
+    const __m256i prime = _mm256_set1_epi64x(DEDUP_PRIME32);
+
+    for (size_t s = 0; s < stripes; s++) {
+        const unsigned char *stripe = &data[s * DEDUP_STRIPE];
+        __m256i data0 = _mm256_loadu_si256((const __m256i *)stripe);
+        __m256i data1 = _mm256_loadu_si256((const __m256i *)(stripe + 32));
+        __m256i keyed0 = _mm256_xor_si256(data0, key0);
+        __m256i keyed1 = _mm256_xor_si256(data1, key1);
+        __m256i product0 = _mm256_mul_epu32(keyed0, _mm256_srli_epi64(keyed0, 32));
+        __m256i product1 = _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32));
+        // Neighbouring lanes are swapped within 128-bit halves
+        __m256i swapped0 = _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i swapped1 = _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2));
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(product0, swapped0));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(product1, swapped1));
+
+        if ((s + 1) % DEDUP_STRIPES_PER_BLOCK == 0) {
+            acc0 = _mm256_xor_si256(_mm256_xor_si256(acc0, _mm256_srli_epi64(acc0, 47)), scramble0);
+            acc1 = _mm256_xor_si256(_mm256_xor_si256(acc1, _mm256_srli_epi64(acc1, 47)), scramble1);
+            // 64x32-bit multiply from two 32x32-bit ones
+            acc0 = _mm256_add_epi64(_mm256_mul_epu32(acc0, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(acc0, 32), prime), 32));
+            acc1 = _mm256_add_epi64(_mm256_mul_epu32(acc1, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(acc1, 32), prime), 32));
+        }
+    }
+
+    _mm256_storeu_si256((__m256i *)&acc[0], acc0);
+    _mm256_storeu_si256((__m256i *)&acc[4], acc1);
+}
+#endif
+
+static uint64_t dedupMix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static uint64_t dedupAvalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+/**
+ * @brief 128-bit hash of chunk, multiply-accumulate over 64-byte stripes. Uses AVX2 if CPU supports it.
+ * Hash only names chunks in the store, equal hashes are confirmed by comparing data
+ *
+ * @param data chunk
+ * @param len length of chunk
+ * @param hash result, DEDUP_HASH_SIZE bytes
+ */
+void dedupHash(const char *data, size_t len, unsigned char *hash) {
+    uint64_t acc[8] = {
+        DEDUP_PRIME32, DEDUP_PRIME64_1, DEDUP_PRIME64_2, 0x165667B19E3779F9ULL,
+        0x85EBCA77C2B2AE63ULL, 0x27D4EB2F165667C5ULL, DEDUP_PRIME64_2 ^ len, DEDUP_PRIME64_1 ^ len,
+    };
+    size_t stripes = len / DEDUP_STRIPE;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) dedupStripesAvx2(acc, (const unsigned char *)data, stripes);
+    else dedupStripesSoftware(acc, (const unsigned char *)data, stripes);
+#else
+    dedupStripesSoftware(acc, (const unsigned char *)data, stripes);
+#endif
+
+    // The last partial stripe is padded with zeros, the length in accumulators tells the padding apart
+    unsigned char last[DEDUP_STRIPE] = {0};
+    memcpy(last, &data[stripes * DEDUP_STRIPE], len % DEDUP_STRIPE);
+    dedupAccumulate(acc, last);
+
+    uint64_t low = len * DEDUP_PRIME64_1;
+    uint64_t high = ~len * DEDUP_PRIME64_2;
+    for (int i = 0; i < 8; i += 2) {
+        low += dedupMix(acc[i] ^ dedup_key[i], acc[i + 1] ^ dedup_key[i + 1]);
+        high += dedupMix(acc[i] ^ dedup_scramble_key[i + 1], acc[i + 1] ^ dedup_scramble_key[i]);
+    }
+    low = dedupAvalanche(low);
+    high = dedupAvalanche(high);
+    memcpy(hash, &low, 8);
+    memcpy(&hash[8], &high, 8);
+}
+
+/**
+ * @brief Find chunk boundary (FastCDC). Search can continue when more data arrive, the state is kept in pos and
+ * fingerprint which have to be 0 for a new chunk
+ *
+ * @param data data of the chunk
+ * @param len length of data
+ * @param pos data before pos were already searched
+ * @param fingerprint gear fingerprint at pos
+ * @param final no more data will arrive
+ *
+ * @return length of chunk, 0 if more data are needed
+ */
+size_t dedupCut(const unsigned char *data, size_t len, size_t *pos, uint64_t *fingerprint, bool final) {
+    if (!dedup_gear_ready) dedupInitGear();
+    if (len <= DEDUP_MIN_CHUNK) return final ? len : 0;
+
+    // Boundary is never before minimal size, hashing starts there
+    size_t i = *pos < DEDUP_MIN_CHUNK ? DEDUP_MIN_CHUNK : *pos;
+    uint64_t fp = *pos < DEDUP_MIN_CHUNK ? 0 : *fingerprint;
+    size_t normal = len < DEDUP_AVG_CHUNK ? len : DEDUP_AVG_CHUNK;
+    size_t limit = len < DEDUP_MAX_CHUNK ? len : DEDUP_MAX_CHUNK;
+
+    for (; i < normal; i++) {
+        fp = (fp << 1) + dedup_gear[data[i]];
+        if (!(fp & DEDUP_MASK_S)) return i + 1;
+    }
+    for (; i < limit; i++) {
+        fp = (fp << 1) + dedup_gear[data[i]];
+        if (!(fp & DEDUP_MASK_L)) return i + 1;
+    }
+    if (limit == DEDUP_MAX_CHUNK) return DEDUP_MAX_CHUNK;
+
+    *pos = i;
+    *fingerprint = fp;
+    return final ? len : 0;
+}
+
+// Path of chunk relative to root, .chunks/<first byte>/<hash>[-variant]
+static void dedupChunkPath(char *path, size_t cap, const unsigned char *hash, int variant) {
+    int len = snprintf(path, cap, "%s/%02x/", DEDUP_CHUNK_DIR, hash[0]);
+    for (int i = 0; i < DEDUP_HASH_SIZE; i++) len += snprintf(&path[len], cap - len, "%02x", hash[i]);
+    if (variant > 0) snprintf(&path[len], cap - len, "-%d", variant);
+}
+
+// Names in the chunk directory aren't files of clients, whichever component leads there
+static bool dedupNameAllowed(const char *name) {
+    return !storageNameInDir(name, DEDUP_CHUNK_DIR);
+}
+
+// Chunk file has exactly the given data
+static bool dedupSameChunk(struct dedup_store *store, int fd, const unsigned char *data, size_t len) {
+    struct stat chunk_stat;
+    if (fstat(fd, &chunk_stat) < 0 || (size_t)chunk_stat.st_size != len) return false;
+    return pread(fd, store->compare, len, 0) == (ssize_t)len && memcmp(store->compare, data, len) == 0;
+}
+
+// Store chunk unless the store has it, new chunk is written to temporary file and linked, so concurrent
+// uploads never see partial chunk and never replace each other's chunk
+static int dedupStoreChunk(struct dedup_store *store, const unsigned char *data, size_t len, struct dedup_entry *entry) {
+    char dir[64], path[128], tmp_name[128];
+    memset(entry, 0, sizeof(*entry));
+    entry->len = len;
+    dedupHash((const char *)data, len, entry->hash);
+    store->chunks++;
+
+    snprintf(dir, sizeof(dir), "%s/%02x", DEDUP_CHUNK_DIR, entry->hash[0]);
+    if (mkdirat(store->root_fd, dir, 0755) < 0 && errno != EEXIST) return -1;
+    snprintf(tmp_name, sizeof(tmp_name), "%s/.tmp.%d", dir, getpid());
+
+    for (int variant = 0; variant < DEDUP_MAX_VARIANTS; variant++) {
+        dedupChunkPath(path, sizeof(path), entry->hash, variant);
+        entry->variant = variant;
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            int fd = openat(store->root_fd, path, O_RDONLY);
+            if (fd >= 0) {
+                bool same = dedupSameChunk(store, fd, data, len);
+                close(fd);
+                if (same) return 0;
+                break; // Different data with the same hash, try next variant
+            }
+            if (errno != ENOENT) return -1;
+
+            fd = openat(store->root_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return -1;
+            bool written = write(fd, data, len) == (ssize_t)len;
+            close(fd);
+            int rc = written ? linkat(store->root_fd, tmp_name, store->root_fd, path, 0) : -1;
+            int link_errno = errno;
+            unlinkat(store->root_fd, tmp_name, 0);
+            if (rc == 0) {
+                store->new_chunks++;
+                store->new_bytes += len;
+                return 0;
+            }
+            // Other upload stored the chunk meanwhile, compare with it
+            if (!written || link_errno != EEXIST) {
+                errno = link_errno;
+                return -1;
+            }
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+// Store chunk and append its reference to manifest
+static int dedupEmitChunk(struct dedup_store *store, struct dedup_writer *writer, size_t len) {
+    struct dedup_entry entry;
+    if (dedupStoreChunk(store, writer->buffer, len, &entry) < 0) return -1;
+    off_t offset = sizeof(struct dedup_manifest_header) + (off_t)writer->count * sizeof(struct dedup_entry);
+    if (pwrite(writer->manifest_fd, &entry, sizeof(entry), offset) != sizeof(entry)) return -1;
+
+    writer->count++;
+    writer->size += len;
+    writer->buffered -= len;
+    memmove(writer->buffer, &writer->buffer[len], writer->buffered);
+    writer->scan_pos = 0;
+    writer->fingerprint = 0;
+    return 0;
+}
+
+// Chunks of the entries have at most the maximal size and cover exactly the size of the file
+static bool dedupEntriesValid(const struct dedup_entry *entries, uint32_t count, uint64_t size) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].len > DEDUP_MAX_CHUNK) return false;
+        total += entries[i].len;
+    }
+    return total == size;
+}
+
+// Manifest is loaded into memory, other files are read as they are
+static int dedupOpenRead(struct dedup_store *store, const char *name, struct storage_file *file) {
+    int fd = openat(store->root_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat file_stat;
+    struct dedup_manifest_header header;
+    if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode)) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, DEDUP_MAGIC, 8) != 0) {
+        file->fd = fd;
+        file->owned = true;
+        file->size = file_stat.st_size;
+        return 0;
+    }
+
+    // Any file of the root can start with the magic, entries must fit the file and add up to the size
+    if (header.count > (file_stat.st_size - sizeof(header)) / sizeof(struct dedup_entry)) {
+        close(fd);
+        errno = EIO;
+        return -1;
+    }
+
+    struct dedup_reader *reader = malloc(sizeof(struct dedup_reader));
+    size_t entries_len = (size_t)header.count * sizeof(struct dedup_entry);
+    if (reader != NULL) reader->entries = malloc(entries_len ? entries_len : 1);
+    if (reader == NULL || reader->entries == NULL || pread(fd, reader->entries, entries_len, sizeof(header)) != (ssize_t)entries_len || !dedupEntriesValid(reader->entries, header.count, header.size)) {
+        if (reader) free(reader->entries);
+        free(reader);
+        close(fd);
+        errno = EIO;
+        return -1;
+    }
+    close(fd);
+
+    reader->count = header.count;
+    reader->chunk_fd = -1;
+    reader->chunk_entry = -1;
+    file->state = reader;
+    file->size = header.size;
+    return 0;
+}
+
+// Upload is written as temporary manifest and appears under its name with commit
+static int dedupOpenWrite(struct dedup_store *store, const char *name, struct storage_file *file) {
+    struct stat file_stat;
+    if (strlen(name) >= DEDUP_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (fstatat(store->root_fd, name, &file_stat, 0) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    struct dedup_writer *writer = malloc(sizeof(struct dedup_writer));
+    if (writer == NULL) return -1;
+    memset(writer, 0, offsetof(struct dedup_writer, buffer));
+    snprintf(writer->name, sizeof(writer->name), "%s", name);
+    // Single-socket mode runs many uploads in one process, every writer has its own manifest. Manifest left
+    // by a crashed process of the same pid is skipped
+    do {
+        snprintf(writer->tmp_name, sizeof(writer->tmp_name), "%s/.manifest.%d.%lu.tmp", DEDUP_CHUNK_DIR, getpid(), store->writers++);
+        writer->manifest_fd = openat(store->root_fd, writer->tmp_name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (writer->manifest_fd < 0 && errno == EEXIST);
+    if (writer->manifest_fd < 0) {
+        free(writer);
+        return -1;
+    }
+    file->state = writer;
+    return 0;
+}
+
+static int dedupOpen(void *backend, const char *name, int flags, struct storage_file *file) {
+    if (!dedupNameAllowed(name)) {
+        errno = EACCES;
+        return -1;
+    }
+    if (flags & STORAGE_WRITE) return dedupOpenWrite(backend, name, file);
+    return dedupOpenRead(backend, name, file);
+}
+
+static int dedupStat(void *backend, const char *name, struct storage_stat *stat) {
+    struct dedup_store *store = backend;
+    struct stat file_stat;
+    struct dedup_manifest_header header;
+    if (!dedupNameAllowed(name)) {
+        errno = EACCES;
+        return -1;
+    }
+
+    int fd = openat(store->root_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fstat(fd, &file_stat);
+    if (rc == 0 && !S_ISREG(file_stat.st_mode)) {
+        errno = ENOENT;
+        rc = -1;
+    }
+    if (rc == 0) {
+        bool manifest = pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, DEDUP_MAGIC, 8) == 0;
+        stat->size = manifest ? (off_t)header.size : file_stat.st_size;
+        stat->mtime = file_stat.st_mtime;
+    }
+    close(fd);
+    return rc;
+}
+
+static ssize_t dedupRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    struct dedup_store *store = file->backend;
+    struct dedup_reader *reader = file->state;
+    if (reader == NULL) return pread(file->fd, dst, len, offset);
+
+    if (offset >= file->size) return 0;
+    if (len > (size_t)(file->size - offset)) len = file->size - offset;
+
+    // Sequential reads continue from the chunk of the previous read
+    if (file->cursor < 0 || offset < file->cursor_offset) {
+        file->cursor = 0;
+        file->cursor_offset = 0;
+    }
+    while (file->cursor < reader->count && offset >= file->cursor_offset + reader->entries[file->cursor].len) {
+        file->cursor_offset += reader->entries[file->cursor].len;
+        file->cursor++;
+    }
+
+    size_t copied = 0;
+    while (copied < len) {
+        if (file->cursor >= reader->count) {
+            errno = EIO;
+            return -1;
+        }
+        struct dedup_entry *entry = &reader->entries[file->cursor];
+        if (reader->chunk_entry != file->cursor) {
+            char path[128];
+            if (reader->chunk_fd >= 0) close(reader->chunk_fd);
+            dedupChunkPath(path, sizeof(path), entry->hash, entry->variant);
+            reader->chunk_fd = openat(store->root_fd, path, O_RDONLY);
+            reader->chunk_entry = reader->chunk_fd < 0 ? -1 : file->cursor;
+            if (reader->chunk_fd < 0) return -1;
+        }
+
+        size_t in_chunk = offset + copied - file->cursor_offset;
+        size_t chunk = entry->len - in_chunk;
+        if (chunk > len - copied) chunk = len - copied;
+        if (pread(reader->chunk_fd, &dst[copied], chunk, in_chunk) != (ssize_t)chunk) {
+            errno = EIO;
+            return -1;
+        }
+        copied += chunk;
+
+        if (copied < len) {
+            file->cursor_offset += entry->len;
+            file->cursor++;
+        }
+    }
+
+    return copied;
+}
+
+static ssize_t dedupWrite(struct storage_file *file, const char *data, size_t len) {
+    struct dedup_store *store = file->backend;
+    struct dedup_writer *writer = file->state;
+
+    size_t written = 0;
+    while (written < len) {
+        size_t chunk = sizeof(writer->buffer) - writer->buffered;
+        if (chunk > len - written) chunk = len - written;
+        memcpy(&writer->buffer[writer->buffered], &data[written], chunk);
+        writer->buffered += chunk;
+        written += chunk;
+
+        size_t cut;
+        while ((cut = dedupCut(writer->buffer, writer->buffered, &writer->scan_pos, &writer->fingerprint, false)) > 0) {
+            if (dedupEmitChunk(store, writer, cut) < 0) return -1;
+        }
+    }
+
+    return written;
+}
+
+static int dedupCommit(struct storage_file *file) {
+    struct dedup_store *store = file->backend;
+    struct dedup_writer *writer = file->state;
+
+    size_t cut;
+    while (writer->buffered > 0 && (cut = dedupCut(writer->buffer, writer->buffered, &writer->scan_pos, &writer->fingerprint, true)) > 0) {
+        if (dedupEmitChunk(store, writer, cut) < 0) return -1;
+    }
+
+    struct dedup_manifest_header header = {0};
+    memcpy(header.magic, DEDUP_MAGIC, 8);
+    header.size = writer->size;
+    header.count = writer->count;
+    if (pwrite(writer->manifest_fd, &header, sizeof(header), 0) != sizeof(header)) return -1;
+
+    // Upload of the same name that finished first wins
+    if (linkat(store->root_fd, writer->tmp_name, store->root_fd, writer->name, 0) < 0) return -1;
+    unlinkat(store->root_fd, writer->tmp_name, 0);
+    writer->committed = true;
+    return 0;
+}
+
+// Chunks of uncommitted upload stay in the store, they are reused by the next upload of the same data
+static void dedupClose(struct storage_file *file) {
+    struct dedup_store *store = file->backend;
+
+    if (file->writable) {
+        struct dedup_writer *writer = file->state;
+        close(writer->manifest_fd);
+        if (!writer->committed) unlinkat(store->root_fd, writer->tmp_name, 0);
+        free(writer);
+    } else if (file->state != NULL) {
+        struct dedup_reader *reader = file->state;
+        if (reader->chunk_fd >= 0) close(reader->chunk_fd);
+        free(reader->entries);
+        free(reader);
+    } else {
+        close(file->fd);
+    }
+}
+
+static void dedupDestroy(void *backend) {
+    struct dedup_store *store = backend;
+    close(store->root_fd);
+    free(store);
+}
+
+const struct storage_ops dedup_storage_ops = {
+    .name = "dedup",
+    .resumable = false,
+    .open = dedupOpen,
+    .stat = dedupStat,
+    .read = dedupRead,
+    .write = dedupWrite,
+    .commit = dedupCommit,
+    .close = dedupClose,
+    .destroy = dedupDestroy,
+};
+
+/**
+ * @brief Create deduplicating backend in root directory. Uploads are split into content-defined chunks, every
+ * distinct chunk is stored once in .chunks and the uploaded name becomes manifest of chunk references.
+ * Reads reassemble manifests, other files of the directory are served as they are
+ *
+ * @param storage storage to initialize
+ * @param root_dirpath root directory
+ *
+ * @return 0 on success, -1 if the directory can't be opened
+ */
+int storageCreateDedup(struct storage *storage, const char *root_dirpath) {
+    struct dedup_store *store = malloc(sizeof(struct dedup_store));
+    if (store == NULL) return -1;
+    memset(store, 0, offsetof(struct dedup_store, compare));
+
+    store->root_fd = open(root_dirpath, O_RDONLY | O_DIRECTORY);
+    if (store->root_fd < 0 || (mkdirat(store->root_fd, DEDUP_CHUNK_DIR, 0755) < 0 && errno != EEXIST)) {
+        if (store->root_fd >= 0) close(store->root_fd);
+        free(store);
+        return -1;
+    }
+
+    storage->ops = &dedup_storage_ops;
+    storage->backend = store;
+    return 0;
+}
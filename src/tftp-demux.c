@@ -0,0 +1,127 @@
+/* tftp-demux.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-demux.h"
+
+// Home slot of key, multiplicative hash of address and port
+static uint32_t demuxHome(const struct demux_table *table, uint32_t addr, uint16_t port) {
+    uint64_t key = ((uint64_t)addr << 16) | port;
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & table->mask;
+}
+
+static bool demuxSlotMatches(const struct demux_slot *slot, uint32_t addr, uint16_t port) {
+    return slot->session != DEMUX_EMPTY && slot->addr == addr && slot->port == port;
+}
+
+/**
+ * @brief Initialize table of sessions
+ *
+ * @param table table
+ * @param max_sessions maximum number of sessions in the table
+ *
+ * @return 0 on success, -1 if memory couldn't be allocated
+ */
+int demuxInit(struct demux_table *table, uint32_t max_sessions) {
+    uint32_t capacity = 16;
+    while (capacity < 2 * max_sessions) capacity *= 2;
+
+    memset(table, 0, sizeof(*table));
+    table->slots = malloc(capacity * sizeof(struct demux_slot));
+    if (table->slots == NULL) return -1;
+    for (uint32_t i = 0; i < capacity; i++) table->slots[i].session = DEMUX_EMPTY;
+    table->mask = capacity - 1;
+    return 0;
+}
+
+/**
+ * @brief Find session of client
+ *
+ * @param table table
+ * @param addr address and port of client
+ *
+ * @return index of session, DEMUX_EMPTY if the client has none
+ */
+uint32_t demuxLookup(struct demux_table *table, const struct sockaddr_in *addr) {
+    uint32_t i = demuxHome(table, addr->sin_addr.s_addr, addr->sin_port);
+    table->lookups++;
+
+    while (true) {
+        struct demux_slot *slot = &table->slots[i];
+        table->probes++;
+        if (slot->session == DEMUX_EMPTY) return DEMUX_EMPTY;
+        if (demuxSlotMatches(slot, addr->sin_addr.s_addr, addr->sin_port)) return slot->session;
+        i = (i + 1) & table->mask;
+    }
+}
+
+/**
+ * @brief Add session of client
+ *
+ * @param table table
+ * @param addr address and port of client
+ * @param session index of session
+ *
+ * @return 0 on success, -1 if the client already has a session or the table is full
+ */
+int demuxInsert(struct demux_table *table, const struct sockaddr_in *addr, uint32_t session) {
+    // Table is kept at most half full, probe sequences stay short
+    if (2 * (table->count + 1) > table->mask + 1) return -1;
+
+    uint32_t i = demuxHome(table, addr->sin_addr.s_addr, addr->sin_port);
+    while (table->slots[i].session != DEMUX_EMPTY) {
+        if (demuxSlotMatches(&table->slots[i], addr->sin_addr.s_addr, addr->sin_port)) return -1;
+        i = (i + 1) & table->mask;
+    }
+
+    table->slots[i].addr = addr->sin_addr.s_addr;
+    table->slots[i].port = addr->sin_port;
+    table->slots[i].session = session;
+    table->count++;
+    return 0;
+}
+
+/**
+ * @brief Remove session of client
+ *
+ * @param table table
+ * @param addr address and port of client
+ */
+void demuxRemove(struct demux_table *table, const struct sockaddr_in *addr) {
+    uint32_t i = demuxHome(table, addr->sin_addr.s_addr, addr->sin_port);
+    while (!demuxSlotMatches(&table->slots[i], addr->sin_addr.s_addr, addr->sin_port)) {
+        if (table->slots[i].session == DEMUX_EMPTY) return;
+        i = (i + 1) & table->mask;
+    }
+
+    // Following slots of the cluster move back unless their home slot is after the hole
+    uint32_t hole = i;
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & table->mask;
+        struct demux_slot *slot = &table->slots[j];
+        if (slot->session == DEMUX_EMPTY) break;
+
+        uint32_t home = demuxHome(table, slot->addr, slot->port);
+        if (((j - home) & table->mask) >= ((j - hole) & table->mask)) {
+            table->slots[hole] = *slot;
+            hole = j;
+        }
+    }
+
+    table->slots[hole].session = DEMUX_EMPTY;
+    table->count--;
+}
+
+/**
+ * @brief Release memory of table
+ *
+ * @param table table
+ */
+void demuxDestroy(struct demux_table *table) {
+    free(table->slots);
+    table->slots = NULL;
+}
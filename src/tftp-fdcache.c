@@ -0,0 +1,137 @@
+/* tftp-fdcache.c *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-fdcache.h"
+
+// Close descriptor of the entry and mark it empty
+static void fdCacheEvict(struct fd_cache_entry *entry) {
+    if (entry->fd >= 0) close(entry->fd);
+    entry->fd = -1;
+    entry->name[0] = '\0';
+}
+
+// Cached descriptor still refers to the file found under its name
+static bool fdCacheValid(const struct fd_cache_entry *entry, const struct stat *st) {
+    return entry->dev == st->st_dev && entry->ino == st->st_ino && entry->size == st->st_size &&
+        entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Open root directory and initialize empty cache
+ *
+ * @param cache cache
+ * @param root_dirpath root directory of the server
+ *
+ * @return 0 on success, -1 if the directory can't be opened
+ */
+int fdCacheInit(struct fd_cache *cache, const char *root_dirpath) {
+    memset(cache, 0, sizeof(*cache));
+    for (int i = 0; i < FD_CACHE_SIZE; i++) cache->entries[i].fd = -1;
+
+    cache->root_fd = open(root_dirpath, O_RDONLY | O_DIRECTORY);
+    return cache->root_fd < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Name of file relative to root directory. Leading slashes are skipped, so absolute names
+ * stay inside the root like they did when the name was appended to root path
+ *
+ * @param filename filename from RQ packet
+ *
+ * @return relative name
+ */
+const char *fdCacheRelative(const char *filename) {
+    while (*filename == '/') filename++;
+    return *filename ? filename : ".";
+}
+
+/**
+ * @brief Get read-only descriptor of file in root directory. The descriptor is owned by the cache,
+ * users read it with pread so the offset is never shared
+ *
+ * @param cache cache
+ * @param filename filename from RQ packet
+ * @param now current time (s)
+ *
+ * @return descriptor, -1 if the file can't be opened (errno is set)
+ */
+int fdCacheOpen(struct fd_cache *cache, const char *filename, time_t now) {
+    const char *name = fdCacheRelative(filename);
+    if (strlen(name) >= FD_CACHE_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    struct fd_cache_entry *entry = NULL;
+    struct fd_cache_entry *victim = &cache->entries[0];
+    for (int i = 0; i < FD_CACHE_SIZE; i++) {
+        struct fd_cache_entry *candidate = &cache->entries[i];
+        if (candidate->fd >= 0 && strcmp(candidate->name, name) == 0) {
+            entry = candidate;
+            break;
+        }
+        // Empty entry is used first, otherwise the least recently used one
+        if (victim->fd >= 0 && (candidate->fd < 0 || candidate->last_used < victim->last_used)) victim = candidate;
+    }
+
+    struct stat st;
+    if (entry != NULL) {
+        entry->last_used = ++cache->uses;
+        if (now - entry->checked < FD_CACHE_REVALIDATE_SEC) {
+            cache->hits++;
+            return entry->fd;
+        }
+
+        // File could have been replaced, deleted or modified
+        if (fstatat(cache->root_fd, name, &st, 0) < 0) {
+            fdCacheEvict(entry);
+            return -1;
+        }
+        if (fdCacheValid(entry, &st)) {
+            entry->checked = now;
+            cache->hits++;
+            return entry->fd;
+        }
+
+        cache->reopens++;
+        fdCacheEvict(entry);
+        victim = entry;
+    } else {
+        cache->misses++;
+    }
+
+    int fd = openat(cache->root_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+
+    fdCacheEvict(victim);
+    snprintf(victim->name, sizeof(victim->name), "%s", name);
+    victim->fd = fd;
+    victim->dev = st.st_dev;
+    victim->ino = st.st_ino;
+    victim->mtime = st.st_mtim;
+    victim->size = st.st_size;
+    victim->checked = now;
+    victim->last_used = ++cache->uses;
+
+    return fd;
+}
+
+/**
+ * @brief Close all cached descriptors and root directory
+ *
+ * @param cache cache
+ */
+void fdCacheDestroy(struct fd_cache *cache) {
+    for (int i = 0; i < FD_CACHE_SIZE; i++) fdCacheEvict(&cache->entries[i]);
+    if (cache->root_fd >= 0) close(cache->root_fd);
+    cache->root_fd = -1;
+}
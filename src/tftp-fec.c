@@ -0,0 +1,68 @@
+/* tftp-fec.c ***********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-fec.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Portable XOR, 8 bytes per step
+static void fecXorSoftware(unsigned char *dst, const unsigned char *src, size_t len) {
+    while (len >= 8) {
+        uint64_t a, b;
+        memcpy(&a, dst, 8);
+        memcpy(&b, src, 8);
+        a ^= b;
+        memcpy(dst, &a, 8);
+        dst += 8;
+        src += 8;
+        len -= 8;
+    }
+    while (len--) *dst++ ^= *src++;
+}
+
+#if defined(__x86_64__)
+// AVX2 XORs 32 bytes per instruction, SSE2 (always present on x86-64) the rest of 16 bytes
+__attribute__((target("avx2")))
+static void fecXorAvx2(unsigned char *dst, const unsigned char *src, size_t len) {
+    while (len >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)dst);
+        __m256i b = _mm256_loadu_si256((const __m256i *)src);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_xor_si256(a, b));
+        dst += 32;
+        src += 32;
+        len -= 32;
+    }
+    if (len >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)dst);
+        __m128i b = _mm_loadu_si128((const __m128i *)src);
+        _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(a, b));
+        dst += 16;
+        src += 16;
+        len -= 16;
+    }
+    fecXorSoftware(dst, src, len);
+}
+#endif
+
+/**
+ * @brief XOR data into parity. Uses AVX2 if CPU supports it
+ *
+ * @param dst parity, at least len bytes
+ * @param src payload of block
+ * @param len length of payload
+ */
+void fecXor(char *dst, const char *src, size_t len) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        fecXorAvx2((unsigned char *)dst, (const unsigned char *)src, len);
+        return;
+    }
+#endif
+    fecXorSoftware((unsigned char *)dst, (const unsigned char *)src, len);
+}
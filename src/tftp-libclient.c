@@ -0,0 +1,570 @@
+/* tftp-libclient.c *****************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-libclient.h"
+#include "../include/tftp-fec.h"
+
+// Call on_done once and return buffers of the finished session to the pool
+static void clientCheckDone(struct tftp_client *c) {
+    if (c->done || !tftpSessionFinished(&c->session)) return;
+
+    c->done = true;
+    tftpSessionRelease(&c->session);
+    if (c->hooks != NULL && c->hooks->on_done) c->hooks->on_done(c);
+}
+
+// Server of race with the address, -1 if there is none
+static int clientFindServer(const struct tftp_client *c, const struct sockaddr_in *addr) {
+    for (int i = 0; i < c->server_count; i++) {
+        if (c->servers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr) return i;
+    }
+    return -1;
+}
+
+// Send RQ waiting in the session to servers that weren't asked yet
+static void clientAskRest(struct tftp_client *c, long long now) {
+    c->hedge_at = TIMER_NEVER;
+    for (int i = 0; i < c->server_count; i++) {
+        struct tftp_client_server *server = &c->servers[i];
+        if (server->asked) continue;
+        server->asked = true;
+        server->asked_ms = now;
+        sendto(c->sockfd, c->session.tx_packet, c->session.tx_len, 0, (struct sockaddr *)&server->addr, sizeof(server->addr));
+    }
+}
+
+// ERROR of one server in race, e.g. mirror without the file, ends the transfer only if no other server can answer
+static bool clientRaceError(struct tftp_client *c, int server, long long now) {
+    c->servers[server].failed = true;
+
+    bool pending = false;
+    for (int i = 0; i < c->server_count; i++) {
+        if (c->servers[i].asked && !c->servers[i].failed) pending = true;
+    }
+    if (!pending && c->hedge_at != TIMER_NEVER) {
+        clientAskRest(c, now);
+        pending = true;
+    }
+    return pending;
+}
+
+// Connect socket to transfer port of the server once no other server of race can answer. The kernel then drops
+// packets of other hosts and ports and receiving doesn't copy the source address
+static void clientConnect(struct tftp_client *c) {
+    for (int i = 0; i < c->server_count; i++) {
+        const struct tftp_client_server *server = &c->servers[i];
+        if (i != c->winner && server->asked && !server->failed && server->answer_ms < 0) return;
+    }
+    if (connect(c->sockfd, (struct sockaddr *)&c->server_addr, sizeof(c->server_addr)) < 0) return;
+    c->connected = true;
+    c->recv_addr = c->server_addr;
+}
+
+static int clientSend(struct tftp_session *session, const char *packet, size_t len) {
+    struct tftp_client *c = tftpClientOf(session);
+    if (c->hooks != NULL && c->hooks->send) return c->hooks->send(c, packet, len);
+    return tftpClientSendPacket(c, packet, len);
+}
+
+static int clientRead(struct tftp_session *session, char *dst, size_t cap) {
+    struct tftp_client *c = tftpClientOf(session);
+    return c->source(c->user, dst, cap);
+}
+
+static int clientWrite(struct tftp_session *session, char *data, size_t len) {
+    struct tftp_client *c = tftpClientOf(session);
+    if (c->sink != NULL) return c->sink(c->user, data, len);
+
+    if (len > c->buffer_cap - c->buffer_len) return -1;
+    memcpy(&c->buffer[c->buffer_len], data, len);
+    c->buffer_len += len;
+    return 0;
+}
+
+// Check acknowledged options against the requested ones, then let the application prepare the transfer
+static int clientOnOack(struct tftp_session *session, bool received, unsigned seen) {
+    struct tftp_client *c = tftpClientOf(session);
+    struct tftp_options *opts = &session->opts;
+
+    if (received) {
+        if ((seen & OPT_SEEN_BLKSIZE) && (opts->blksize < MIN_BLKSIZE || opts->blksize > MAX_BLKSIZE)) {
+            tftpSessionAbort(session, 8, "invalid value for blksize option");
+            return -1;
+        }
+        if ((seen & OPT_SEEN_TIMEOUT) && (opts->timeout < MIN_TIMEOUT || opts->timeout > MAX_TIMEOUT)) {
+            tftpSessionAbort(session, 8, "invalid value for timeout option");
+            return -1;
+        }
+        // Server can only lower the requested window
+        if ((seen & OPT_SEEN_WINDOWSIZE) && (opts->windowsize < MIN_WINDOWSIZE || opts->windowsize > c->requested.windowsize)) {
+            tftpSessionAbort(session, 8, "invalid value for windowsize option");
+            return -1;
+        }
+        if ((seen & OPT_SEEN_SACK) && opts->sack && !c->requested.sack) {
+            tftpSessionAbort(session, 8, "invalid value for sack option");
+            return -1;
+        }
+        if ((seen & OPT_SEEN_CWND) && opts->cwnd && !c->requested.cwnd) {
+            tftpSessionAbort(session, 8, "invalid value for cwnd option");
+            return -1;
+        }
+        // Server can only shrink the requested parity group
+        if ((seen & OPT_SEEN_FEC) && opts->fec > 0 && (opts->fec < MIN_FEC_GROUP || opts->fec > c->requested.fec)) {
+            tftpSessionAbort(session, 8, "invalid value for fec option");
+            return -1;
+        }
+        if ((seen & OPT_SEEN_COMPRESS) && !opts->compress) {
+            tftpSessionAbort(session, 8, "invalid value for compress option");
+            return -1;
+        }
+        if ((seen & OPT_SEEN_RESUME) && opts->resume < 0) {
+            tftpSessionAbort(session, 8, "invalid value for resume option");
+            return -1;
+        }
+    }
+
+    if (c->download && opts->resume >= 0 && opts->resume != c->requested.resume) {
+        tftpSessionAbort(session, 8, "invalid value for resume option");
+        return -1;
+    }
+
+    if (c->hooks != NULL && c->hooks->on_oack) return c->hooks->on_oack(c, received);
+    return 0;
+}
+
+static void clientOnPacket(struct tftp_session *session, const char *packet, size_t len) {
+    struct tftp_client *c = tftpClientOf(session);
+    if (c->hooks != NULL && c->hooks->on_packet) c->hooks->on_packet(c, packet, len);
+}
+
+static const struct tftp_session_io client_io = {
+    .send = clientSend,
+    .read = clientRead,
+    .write = clientWrite,
+    .on_oack = clientOnOack,
+    .on_packet = clientOnPacket,
+};
+
+// Send RQ and start session of the transfer
+static int clientStart(struct tftp_client *c, uint16_t opcode, const char *filename, const char *mode, const struct tftp_options *opts) {
+    char rq_packet[MAX_RQ_PACKET_SIZE];
+
+    c->requested = *opts;
+    c->download = opcode == RRQ_OPCODE;
+    c->done = false;
+
+    // Socket of the previous transfer is connected to its server, RQ goes to the listening port
+    if (c->connected) {
+        struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+        connect(c->sockfd, &unspec, sizeof(unspec));
+        c->connected = false;
+    }
+    c->server_addr = c->servers[0].addr;
+
+    // Only downloads race, upload would leave a partial file on every server that answered
+    long long now = tftpClockMs();
+    c->winner = c->download && c->server_count > 1 ? -1 : 0;
+    c->hedge_at = c->winner < 0 && c->hedge_ms > 0 ? now + c->hedge_ms : TIMER_NEVER;
+    for (int i = 0; i < c->server_count; i++) {
+        c->servers[i].asked = i == 0 || (c->winner < 0 && c->hedge_at == TIMER_NEVER);
+        c->servers[i].asked_ms = now;
+        c->servers[i].failed = false;
+        c->servers[i].answer_ms = -1;
+    }
+
+    // Ranges of ACK and parity are useful only with more blocks in flight, parity group fits into the window.
+    // Receiver of the session acknowledges incomplete windows, so the sender can run congestion window below
+    // the windowsize once the server acknowledges that
+    if (c->requested.windowsize == 1) c->requested.sack = false;
+    c->requested.cwnd = c->requested.windowsize > 1;
+    if (c->requested.windowsize == 1) c->requested.fec = 0;
+    if (c->requested.fec > c->requested.windowsize) c->requested.fec = c->requested.windowsize;
+
+    int rq_packet_len = tftpEncodeRq(rq_packet, sizeof(rq_packet), opcode, filename, mode ? mode : "octet", &c->requested);
+    if (rq_packet_len < 0) {
+        snprintf(c->error_msg, sizeof(c->error_msg), "filename too long");
+        return -1;
+    }
+
+    tftpSessionInit(&c->session, c->download ? TFTP_ROLE_RECEIVER : TFTP_ROLE_SENDER, &client_io, c, NULL, 0);
+    tftpSessionSetPool(&c->session, &c->pool);
+    c->session.opts = c->requested;
+    tftpSessionStart(&c->session, rq_packet, rq_packet_len, tftpHasOptions(&c->requested), now);
+
+    clientCheckDone(c);
+    return c->session.state == TFTP_SESSION_FAILED ? -1 : 0;
+}
+
+/**
+ * @brief Resolve server and create socket bound to any local port
+ *
+ * @param c client to initialize
+ * @param host hostname or address of server, comma separated list of servers races them
+ * @param port port of server
+ *
+ * @return 0 on success, -1 with message in tftpClientError
+ */
+int tftpClientInit(struct tftp_client *c, const char *host, int port) {
+    return tftpClientInitRace(c, host, port, false);
+}
+
+/**
+ * @brief Resolve servers and create socket bound to any local port. Downloads send RQ to all servers and
+ * continue with the first one that answers with OACK or DATA
+ *
+ * @param c client to initialize
+ * @param hosts comma separated hostnames or addresses of servers
+ * @param port port of servers
+ * @param all_addresses every address of a hostname is a server, otherwise only the first one
+ *
+ * @return 0 on success, -1 with message in tftpClientError
+ */
+int tftpClientInitRace(struct tftp_client *c, const char *hosts, int port, bool all_addresses) {
+    memset(c, 0, sizeof(*c));
+    c->sockfd = -1;
+    c->hedge_at = TIMER_NEVER;
+    poolInit(&c->pool, 0);
+
+    char host[NI_MAXHOST];
+    while (*hosts != '\0') {
+        size_t len = strcspn(hosts, ",");
+        if (len == 0 || len >= sizeof(host)) {
+            snprintf(c->error_msg, sizeof(c->error_msg), "no such host");
+            return -1;
+        }
+        memcpy(host, hosts, len);
+        host[len] = '\0';
+        hosts += hosts[len] == ',' ? len + 1 : len;
+
+        // getaddrinfo is reentrant unlike gethostbyname
+        struct addrinfo hints = {0};
+        struct addrinfo *result = NULL;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host, NULL, &hints, &result) != 0 || result == NULL) {
+            snprintf(c->error_msg, sizeof(c->error_msg), "no such host");
+            return -1;
+        }
+        for (struct addrinfo *info = result; info != NULL && c->server_count < TFTP_CLIENT_MAX_SERVERS; info = all_addresses ? info->ai_next : NULL) {
+            struct sockaddr_in *addr = (struct sockaddr_in *)info->ai_addr;
+            if (clientFindServer(c, addr) >= 0) continue;
+            memcpy(&c->servers[c->server_count].addr, addr, sizeof(*addr));
+            c->servers[c->server_count].addr.sin_port = htons(port);
+            c->server_count++;
+        }
+        freeaddrinfo(result);
+    }
+    if (c->server_count == 0) {
+        snprintf(c->error_msg, sizeof(c->error_msg), "no such host");
+        return -1;
+    }
+    c->server_addr = c->servers[0].addr;
+
+    c->sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (c->sockfd < 0) {
+        snprintf(c->error_msg, sizeof(c->error_msg), "couldn't create socket");
+        return -1;
+    }
+
+    c->local_addr.sin_family = AF_INET;
+    socklen_t local_len = sizeof(c->local_addr);
+    if (bind(c->sockfd, (struct sockaddr *)&c->local_addr, sizeof(c->local_addr)) < 0 ||
+        getsockname(c->sockfd, (struct sockaddr *)&c->local_addr, &local_len) < 0) {
+        snprintf(c->error_msg, sizeof(c->error_msg), "bind failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Give the first server a head start, the others get RQ only if it doesn't answer in time or answers
+ * with ERROR. The application orders c->servers, e.g. by response times of previous runs
+ *
+ * @param c initialized client
+ * @param hedge_ms head start of the first server, 0 sends RQ to all servers at once
+ */
+void tftpClientSetHedge(struct tftp_client *c, long long hedge_ms) {
+    c->hedge_ms = hedge_ms;
+}
+
+/**
+ * @brief Set callbacks of the application, has to be called before the transfer starts
+ *
+ * @param c client
+ * @param hooks callbacks, NULL for none
+ * @param user pointer passed to sink and source, available to hooks as c->user
+ */
+void tftpClientSetHooks(struct tftp_client *c, const struct tftp_client_hooks *hooks, void *user) {
+    c->hooks = hooks;
+    c->user = user;
+}
+
+/**
+ * @brief Start download, data are passed to sink in order
+ *
+ * @param c initialized client
+ * @param filename file on server
+ * @param mode transfer mode, NULL for octet
+ * @param opts requested options
+ * @param sink callback receiving data
+ * @param user pointer passed to sink
+ *
+ * @return 0 if RQ was sent, -1 with message in tftpClientError
+ */
+int tftpClientStartFetch(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, tftp_client_sink sink, void *user) {
+    c->sink = sink;
+    c->user = user;
+    return clientStart(c, RRQ_OPCODE, filename, mode, opts);
+}
+
+/**
+ * @brief Start download into buffer of the caller, file bigger than the buffer ends the transfer with error
+ *
+ * @param c initialized client
+ * @param filename file on server
+ * @param mode transfer mode, NULL for octet
+ * @param opts requested options
+ * @param buffer destination, its length is c->buffer_len
+ * @param cap size of buffer
+ *
+ * @return 0 if RQ was sent, -1 with message in tftpClientError
+ */
+int tftpClientStartFetchBuffer(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, char *buffer, size_t cap) {
+    c->sink = NULL;
+    c->buffer = buffer;
+    c->buffer_cap = cap;
+    c->buffer_len = 0;
+    return clientStart(c, RRQ_OPCODE, filename, mode, opts);
+}
+
+/**
+ * @brief Start upload, data are taken from source
+ *
+ * @param c initialized client
+ * @param filename destination file on server
+ * @param mode transfer mode, NULL for octet
+ * @param opts requested options
+ * @param source callback filling data
+ * @param user pointer passed to source
+ *
+ * @return 0 if RQ was sent, -1 with message in tftpClientError
+ */
+int tftpClientStartUpload(struct tftp_client *c, const char *filename, const char *mode, const struct tftp_options *opts, tftp_client_source source, void *user) {
+    c->source = source;
+    c->user = user;
+    return clientStart(c, WRQ_OPCODE, filename, mode, opts);
+}
+
+/**
+ * @brief Send packet to the server, used by the send hook that wraps transmission
+ *
+ * @param c client
+ * @param packet packet to send
+ * @param len length of packet
+ *
+ * @return bytes sent, -1 on error
+ */
+int tftpClientSendPacket(struct tftp_client *c, const char *packet, size_t len) {
+    if (c->connected) return send(c->sockfd, packet, len, 0);
+    if (c->winner >= 0) return sendto(c->sockfd, packet, len, 0, (struct sockaddr *)&c->server_addr, sizeof(c->server_addr));
+
+    // RQ of race goes to every asked server that didn't refuse it
+    int bytes_tx = -1;
+    for (int i = 0; i < c->server_count; i++) {
+        struct tftp_client_server *server = &c->servers[i];
+        if (!server->asked || server->failed) continue;
+        if (sendto(c->sockfd, packet, len, 0, (struct sockaddr *)&server->addr, sizeof(server->addr)) >= 0) bytes_tx = len;
+    }
+    return bytes_tx;
+}
+
+/**
+ * @brief Receive and process one packet if there is any, the socket isn't blocked
+ *
+ * @param c client with started transfer
+ * @param now current time (ms)
+ *
+ * @return 1 if a packet was received, 0 if there was none, -1 on error
+ */
+int tftpClientReceive(struct tftp_client *c, long long now) {
+    if (tftpClientFinished(c)) return 0;
+
+    size_t rx_cap;
+    char *rx_packet = tftpSessionRxBuffer(&c->session, &rx_cap);
+    if (rx_packet == NULL) {
+        clientCheckDone(c);
+        return -1;
+    }
+
+    ssize_t bytes_rx;
+    if (c->connected) {
+        bytes_rx = recv(c->sockfd, rx_packet, rx_cap, MSG_DONTWAIT);
+    } else {
+        socklen_t recv_len = sizeof(c->recv_addr);
+        bytes_rx = recvfrom(c->sockfd, rx_packet, rx_cap, MSG_DONTWAIT, (struct sockaddr *)&c->recv_addr, &recv_len);
+    }
+    if (bytes_rx < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        tftpSessionAbort(&c->session, 0, "recvfrom not successful");
+        clientCheckDone(c);
+        return -1;
+    }
+
+    // Answers of servers in race are timed, also the late ones of servers that lost
+    int server = c->server_count > 1 && !c->connected ? clientFindServer(c, &c->recv_addr) : c->winner;
+    if (server >= 0 && c->servers[server].answer_ms < 0) c->servers[server].answer_ms = now;
+
+    // The first answer comes from transfer port of server, the rest has to come from the same port
+    if (c->session.state == TFTP_SESSION_WAIT_FIRST && c->winner < 0) {
+        // Hosts outside of the race and servers that weren't asked are ignored
+        if (server < 0 || !c->servers[server].asked) return 1;
+        if (bytes_rx >= OPCODE_SIZE && tftpGetOpcode(rx_packet) == ERROR_OPCODE && clientRaceError(c, server, now)) {
+            if (c->hooks != NULL && c->hooks->on_packet) c->hooks->on_packet(c, rx_packet, bytes_rx);
+            return 1;
+        }
+        c->winner = server;
+        c->hedge_at = TIMER_NEVER;
+        c->server_addr = c->recv_addr;
+        clientConnect(c);
+    } else if (c->session.state == TFTP_SESSION_WAIT_FIRST && !c->connected && c->recv_addr.sin_addr.s_addr == c->server_addr.sin_addr.s_addr) {
+        c->server_addr.sin_port = c->recv_addr.sin_port;
+        clientConnect(c);
+    } else if (c->recv_addr.sin_addr.s_addr != c->server_addr.sin_addr.s_addr || c->recv_addr.sin_port != c->server_addr.sin_port) {
+        // Packet from another port or host doesn't belong to the transfer (RFC 1350 section 4), servers that lost
+        // the race get this ERROR too
+        char packet[MAX_ERROR_PACKET_SIZE];
+        int packet_len = tftpEncodeError(packet, sizeof(packet), 5, "Unknown transfer ID");
+        sendto(c->sockfd, packet, packet_len, 0, (struct sockaddr *)&c->recv_addr, sizeof(c->recv_addr));
+        if (server >= 0) clientConnect(c);
+        return 1;
+    }
+
+    tftpSessionOnPacket(&c->session, rx_packet, bytes_rx, now);
+    clientCheckDone(c);
+    return 1;
+}
+
+/**
+ * @brief Process all packets waiting on the socket, called by event loop of the caller when tftpClientFd is readable
+ *
+ * @param c client with started transfer
+ * @param now current time (ms)
+ */
+void tftpClientOnReadable(struct tftp_client *c, long long now) {
+    while (!tftpClientFinished(c) && tftpClientReceive(c, now) > 0);
+}
+
+/**
+ * @brief Retransmit or send delayed ACK, called by event loop of the caller at tftpClientDeadline
+ *
+ * @param c client with started transfer
+ * @param now current time (ms)
+ */
+void tftpClientOnTimer(struct tftp_client *c, long long now) {
+    if (tftpClientFinished(c)) return;
+    if (now >= c->hedge_at) clientAskRest(c, now);
+    tftpSessionOnTimer(&c->session, now);
+    clientCheckDone(c);
+}
+
+/**
+ * @brief Drive started transfer until it ends, waiting on the socket of the client only
+ *
+ * @param c client with started transfer
+ *
+ * @return 0 if the transfer was successful, -1 otherwise
+ */
+int tftpClientRun(struct tftp_client *c) {
+    while (!tftpClientFinished(c)) {
+        long long timeout = tftpClientDeadline(c) - tftpClockMs();
+        if (timeout < 0) timeout = 0;
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(c->sockfd, &fds);
+        struct timeval tv = { .tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000 };
+
+        int n = select(c->sockfd + 1, &fds, NULL, NULL, &tv);
+        if (n < 0 && errno != EINTR) {
+            tftpClientAbort(c, 0, "select failed");
+        } else if (n == 0) {
+            tftpClientOnTimer(c, tftpClockMs());
+        } else if (n > 0) {
+            tftpClientOnReadable(c, tftpClockMs());
+        }
+    }
+
+    return c->session.state == TFTP_SESSION_DONE ? 0 : -1;
+}
+
+/**
+ * @brief End transfer with error, ERROR packet is sent to the server
+ *
+ * @param c client
+ * @param error_code TFTP error code
+ * @param error_msg error message
+ */
+void tftpClientAbort(struct tftp_client *c, uint16_t error_code, const char *error_msg) {
+    tftpSessionAbort(&c->session, error_code, error_msg);
+    clientCheckDone(c);
+}
+
+/**
+ * @brief Error of the client
+ *
+ * @param c client
+ *
+ * @return error message, empty string if there was no error
+ */
+const char *tftpClientError(const struct tftp_client *c) {
+    if (c->session.state == TFTP_SESSION_FAILED) return c->session.error_msg;
+    return c->error_msg;
+}
+
+/**
+ * @brief Release buffers and close socket, the transfer is ended if it still runs
+ *
+ * @param c client
+ */
+void tftpClientClose(struct tftp_client *c) {
+    tftpSessionRelease(&c->session);
+    poolDestroy(&c->pool);
+    if (c->sockfd >= 0) close(c->sockfd);
+    c->sockfd = -1;
+}
+
+/**
+ * @brief Download file into buffer, the whole transfer in one call
+ *
+ * @param host hostname or address of server
+ * @param port port of server
+ * @param filename file on server
+ * @param opts requested options, NULL for defaults
+ * @param buffer destination
+ * @param cap size of buffer
+ * @param error buffer for error message, can be NULL
+ * @param error_cap size of error buffer
+ *
+ * @return length of the file, -1 on error
+ */
+long tftpClientFetch(const char *host, int port, const char *filename, const struct tftp_options *opts, char *buffer, size_t cap, char *error, size_t error_cap) {
+    struct tftp_client client;
+    struct tftp_options defaults;
+    tftpOptionsInit(&defaults);
+
+    long len = -1;
+    if (tftpClientInit(&client, host, port) == 0 &&
+        tftpClientStartFetchBuffer(&client, filename, NULL, opts ? opts : &defaults, buffer, cap) == 0 &&
+        tftpClientRun(&client) == 0) {
+        len = client.buffer_len;
+    }
+
+    if (len < 0 && error != NULL) snprintf(error, error_cap, "%s", tftpClientError(&client));
+    tftpClientClose(&client);
+    return len;
+}
@@ -0,0 +1,619 @@
+/* tftp-loadgen.c *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-loadgen.h"
+
+static const struct tftp_session_io loadgen_io = {
+    .send = loadgenSend,
+    .read = loadgenRead,
+    .write = loadgenWrite,
+    .on_packet = loadgenOnPacket,
+};
+
+// Function for printing error messages and terminating process if exit_failure
+void printError(char *error, bool exit_failure) {
+    fprintf(stdout, "Local error: %s\n", error);
+    fflush(stdout);
+    if (exit_failure) exit(EXIT_FAILURE);
+}
+
+// Function for printing usage and terminating process
+void printUsage(char **argv) {
+    fprintf(stdout, "Usage: %s -h <hostname> [-p port] [-n clients] [-c concurrency] [-R rate] [-r ramp_s] [-S script] [-b blksize[,blksize...]] [-t timeout[,timeout...]] [-s seed]\n", argv[0]);
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+// Parse comma separated list of numbers in range, every value is a choice
+static int parseChoices(char *list, int *values, int min, int max) {
+    int count = 0;
+    for (char *value = strtok(list, ","); value != NULL; value = strtok(NULL, ",")) {
+        if (count == LOADGEN_MAX_CHOICES) printError("too many values", true);
+        values[count] = atoi(value);
+        if (values[count] < min || values[count] > max) return -1;
+        count++;
+    }
+    return count;
+}
+
+// Parse script, comma separated file names, names starting with ? are expected to be missing
+static void parseScript(char *script, struct loadgen_config *config) {
+    config->step_count = 0;
+    for (char *name = strtok(script, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (config->step_count == LOADGEN_MAX_STEPS) printError("too many steps in script", true);
+
+        struct loadgen_step *step = &config->steps[config->step_count++];
+        step->probe = name[0] == '?';
+        if (step->probe) name++;
+        if (name[0] == '\0' || strlen(name) >= LOADGEN_NAME_LEN) printError("invalid file name in script", true);
+        strcpy(step->name, name);
+    }
+}
+
+// Function for handling arguments
+void handleArguments(int argc, char **argv, struct loadgen_config *config) {
+    static char default_script[] = LOADGEN_DEFAULT_SCRIPT;
+    char *script = default_script;
+    bool host_set = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "h:p:n:c:R:r:S:b:t:s:")) != -1) {
+        switch (option) {
+        case 'h':
+            config->host = optarg;
+            host_set = true;
+            break;
+        case 'p':
+            config->port = atoi(optarg);
+            break;
+        case 'n':
+            config->clients = atoi(optarg);
+            break;
+        case 'c':
+            config->concurrency = atoi(optarg);
+            break;
+        case 'R':
+            config->rate = atof(optarg);
+            break;
+        case 'r':
+            config->ramp = atof(optarg);
+            break;
+        case 'S':
+            script = optarg;
+            break;
+        case 'b':
+            config->blksize_count = parseChoices(optarg, config->blksizes, MIN_BLKSIZE, MAX_BLKSIZE);
+            if (config->blksize_count <= 0) printError("invalid blksize", true);
+            break;
+        case 't':
+            config->timeout_count = parseChoices(optarg, config->timeouts, MIN_TIMEOUT, MAX_TIMEOUT);
+            if (config->timeout_count <= 0) printError("invalid timeout", true);
+            break;
+        case 's':
+            config->seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            printUsage(argv);
+            break;
+        }
+    }
+
+    if (!host_set || config->clients <= 0 || config->port <= 0) printUsage(argv);
+    if (config->concurrency <= 0 || config->concurrency > config->clients) config->concurrency = config->clients;
+    if (config->rate < 0 || config->ramp < 0) printUsage(argv);
+
+    parseScript(script, config);
+    if (config->step_count == 0) printUsage(argv);
+}
+
+// xorshift64* generator, choices of options depend only on the seed
+static uint64_t loadgenRandom(struct loadgen *lg) {
+    lg->rng ^= lg->rng >> 12;
+    lg->rng ^= lg->rng << 25;
+    lg->rng ^= lg->rng >> 27;
+    return lg->rng * 2685821657736338717ULL;
+}
+
+// Second of the run, the timeline grows as needed
+static struct loadgen_second *loadgenSecond(struct loadgen *lg, long long now) {
+    size_t index = now > lg->start_ms ? (now - lg->start_ms) / 1000 : 0;
+
+    if (index >= lg->second_count) {
+        size_t count = index + 1 > lg->second_count * 2 ? index + 1 : lg->second_count * 2;
+        struct loadgen_second *seconds = realloc(lg->seconds, count * sizeof(struct loadgen_second));
+        if (seconds == NULL) printError("memory allocation error", true);
+        memset(&seconds[lg->second_count], 0, (count - lg->second_count) * sizeof(struct loadgen_second));
+        lg->seconds = seconds;
+        lg->second_count = count;
+    }
+    if (index + 1 > lg->second_used) lg->second_used = index + 1;
+    return &lg->seconds[index];
+}
+
+// Append value to growing array
+static void *loadgenAppend(void *array, size_t *count, size_t *cap, size_t size) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 1024;
+        array = realloc(array, *cap * size);
+        if (array == NULL) printError("memory allocation error", true);
+    }
+    (*count)++;
+    return array;
+}
+
+// Expand placeholders of script file name for client
+static void expandName(const char *pattern, int id, char *name, size_t cap) {
+    size_t len = 0;
+    name[0] = '\0';
+
+    for (const char *c = pattern; *c != '\0' && len < cap - 1; c++) {
+        char part[32];
+        if (c[0] == '%' && c[1] == 'i') {
+            snprintf(part, sizeof(part), "%d", id);
+        } else if (c[0] == '%' && c[1] == 'x') {
+            // IP address 10.x.x.x in hex, the way PXE clients ask for it
+            snprintf(part, sizeof(part), "0A%06X", id & 0xffffff);
+        } else if (c[0] == '%' && c[1] == 'm') {
+            snprintf(part, sizeof(part), "52-54-00-%02x-%02x-%02x", (id >> 16) & 0xff, (id >> 8) & 0xff, id & 0xff);
+        } else if (c[0] == '%' && c[1] == '%') {
+            snprintf(part, sizeof(part), "%%");
+        } else {
+            name[len++] = *c;
+            name[len] = '\0';
+            continue;
+        }
+        c++;
+        len += snprintf(&name[len], cap - len, "%s", part);
+        if (len >= cap) len = cap - 1;
+    }
+}
+
+/**
+ * @brief Send packet of client session to the server
+ *
+ * @param session session of client
+ * @param packet packet
+ * @param len length of packet
+ *
+ * @return bytes sent, -1 on error
+ */
+int loadgenSend(struct tftp_session *session, const char *packet, size_t len) {
+    struct loadgen_client *client = session->ctx;
+    return sendto(client->sockfd, packet, len, 0, (struct sockaddr *) &client->peer, sizeof(client->peer));
+}
+
+// Simulated clients only download
+int loadgenRead(struct tftp_session *session, char *dst, size_t cap) {
+    (void)session;
+    (void)dst;
+    (void)cap;
+    return -1;
+}
+
+// Downloaded data are only counted
+int loadgenWrite(struct tftp_session *session, char *data, size_t len) {
+    struct loadgen_client *client = session->ctx;
+    (void)data;
+    client->bytes += len;
+    return 0;
+}
+
+// The first answer to RQ ends admission of the request
+void loadgenOnPacket(struct tftp_session *session, const char *packet, size_t len) {
+    struct loadgen_client *client = session->ctx;
+    struct loadgen *lg = client->lg;
+    (void)packet;
+    (void)len;
+
+    if (client->admitted) return;
+    client->admitted = true;
+
+    lg->admissions = loadgenAppend(lg->admissions, &lg->admission_count, &lg->admission_cap, sizeof(struct loadgen_sample));
+    struct loadgen_sample *sample = &lg->admissions[lg->admission_count - 1];
+    sample->at_ms = tftpClockMs() - lg->start_ms;
+    sample->value_us = lowlatClockUs() - client->rq_us;
+}
+
+// Retransmission timer of client session expired
+static void loadgenTimerExpired(struct tftp_timer *timer, long long now) {
+    struct loadgen_client *client = timer->ctx;
+
+    tftpSessionOnTimer(&client->session, now);
+    if (tftpSessionFinished(&client->session)) loadgenEndStep(client, now);
+    else timerWheelArm(&client->lg->wheel, &client->timer, tftpSessionDeadline(&client->session));
+}
+
+/**
+ * @brief Send RQ of the current step of client from a new port
+ *
+ * @param client simulated client
+ * @param now current time (ms)
+ */
+void loadgenStartStep(struct loadgen_client *client, long long now) {
+    struct loadgen *lg = client->lg;
+    const struct loadgen_config *config = lg->config;
+    const struct loadgen_step *step = &config->steps[client->step];
+
+    client->sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (client->sockfd < 0) printError("socket creation failed", true);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+    if (epoll_ctl(lg->epfd, EPOLL_CTL_ADD, client->sockfd, &event) < 0) printError("epoll_ctl failed", true);
+
+    // Every request picks its own options
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    if (config->blksize_count > 0) opts.blksize = config->blksizes[loadgenRandom(lg) % config->blksize_count];
+    if (config->timeout_count > 0) opts.timeout = config->timeouts[loadgenRandom(lg) % config->timeout_count];
+
+    char name[LOADGEN_NAME_LEN];
+    expandName(step->name, client->id, name, sizeof(name));
+
+    char rq_packet[MAX_RQ_PACKET_SIZE];
+    int rq_packet_len = tftpEncodeRq(rq_packet, sizeof(rq_packet), RRQ_OPCODE, name, "octet", &opts);
+    if (rq_packet_len < 0) printError("file name too long", true);
+
+    client->peer = lg->server_addr;
+    client->admitted = false;
+    client->bytes = 0;
+    client->rq_us = lowlatClockUs();
+    lg->requests++;
+
+    tftpSessionInit(&client->session, TFTP_ROLE_RECEIVER, &loadgen_io, client, NULL, 0);
+    tftpSessionSetPool(&client->session, &lg->pool);
+    client->session.opts = opts;
+    tftpSessionStart(&client->session, rq_packet, rq_packet_len, tftpHasOptions(&opts), now);
+
+    if (tftpSessionFinished(&client->session)) loadgenEndStep(client, now);
+    else timerWheelArm(&lg->wheel, &client->timer, tftpSessionDeadline(&client->session));
+}
+
+/**
+ * @brief Account result of the current step, continue with the next step or end the client.
+ * Client that failed a step gives up the same way a booting machine does
+ *
+ * @param client simulated client
+ * @param now current time (ms)
+ */
+void loadgenEndStep(struct loadgen_client *client, long long now) {
+    struct loadgen *lg = client->lg;
+    const struct loadgen_config *config = lg->config;
+    struct tftp_session *session = &client->session;
+    bool probe = config->steps[client->step].probe;
+    bool ok = false;
+
+    if (session->state == TFTP_SESSION_DONE) {
+        // Probed file that exists is fine too
+        ok = true;
+        if (probe) {
+            lg->probes++;
+        } else {
+            lg->downloads++;
+        }
+    } else if (session->remote_error) {
+        if (probe && session->error_code == 1) {
+            ok = true;
+            lg->probes++;
+        } else {
+            lg->error_codes[session->error_code <= LOADGEN_MAX_ERROR_CODE ? session->error_code : LOADGEN_MAX_ERROR_CODE + 1]++;
+        }
+    } else if (session->stats.timeouts > (unsigned long)session->max_retransmits) {
+        lg->timeouts++;
+    } else {
+        lg->local_errors++;
+    }
+
+    lg->bytes += client->bytes;
+    client->total_bytes += client->bytes;
+    loadgenSecond(lg, now)->bytes += client->bytes;
+
+    timerWheelCancel(&lg->wheel, &client->timer);
+    tftpSessionRelease(session);
+    epoll_ctl(lg->epfd, EPOLL_CTL_DEL, client->sockfd, NULL);
+    close(client->sockfd);
+    client->sockfd = -1;
+
+    if (ok && ++client->step < config->step_count) {
+        loadgenStartStep(client, now);
+        return;
+    }
+
+    struct loadgen_second *second = loadgenSecond(lg, now);
+    second->finished++;
+    if (!ok) {
+        second->failed++;
+    } else {
+        // Throughput of the whole boot sequence of the client
+        lg->clients_ok++;
+        long long duration_us = lowlatClockUs() - client->start_us;
+        lg->throughputs = loadgenAppend(lg->throughputs, &lg->throughput_count, &lg->throughput_cap, sizeof(double));
+        lg->throughputs[lg->throughput_count - 1] = duration_us > 0 ? client->total_bytes / 1024.0 / (duration_us / 1e6) : 0;
+    }
+    lg->active--;
+    lg->finished++;
+}
+
+/**
+ * @brief Receive all pending packets of client socket and pass them to its session
+ *
+ * @param client simulated client
+ */
+void loadgenOnReadable(struct loadgen_client *client) {
+    struct loadgen *lg = client->lg;
+    struct tftp_session *session = &client->session;
+
+    while (client->sockfd >= 0) {
+        size_t rx_cap;
+        char *rx_packet = tftpSessionRxBuffer(session, &rx_cap);
+        if (rx_packet == NULL) {
+            loadgenEndStep(client, tftpClockMs());
+            return;
+        }
+
+        struct sockaddr_in recv_addr;
+        socklen_t recv_len = sizeof(recv_addr);
+        int bytes_rx = recvfrom(client->sockfd, rx_packet, rx_cap, 0, (struct sockaddr *) &recv_addr, &recv_len);
+        if (bytes_rx < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) printError("recvfrom not succesful", false);
+            return;
+        }
+
+        // The first answer comes from transfer port of server, other ports and hosts are ignored
+        if (recv_addr.sin_addr.s_addr != client->peer.sin_addr.s_addr) continue;
+        if (session->state == TFTP_SESSION_WAIT_FIRST) client->peer.sin_port = recv_addr.sin_port;
+        else if (recv_addr.sin_port != client->peer.sin_port) continue;
+
+        long long now = tftpClockMs();
+        tftpSessionOnPacket(session, rx_packet, bytes_rx, now);
+
+        if (tftpSessionFinished(session)) {
+            loadgenEndStep(client, now);
+            return;
+        }
+        timerWheelArm(&lg->wheel, &client->timer, tftpSessionDeadline(session));
+    }
+}
+
+// Number of clients that should have been started after elapsed seconds of ramp
+static double loadgenAllowed(const struct loadgen_config *config, double elapsed) {
+    if (config->rate == 0) return config->clients;
+    if (elapsed < config->ramp) return config->rate * elapsed * elapsed / (2 * config->ramp);
+    return config->rate * config->ramp / 2 + config->rate * (elapsed - config->ramp);
+}
+
+/**
+ * @brief Start clients allowed by ramp-up profile and concurrency limit
+ *
+ * @param lg load generator
+ * @param now current time (ms)
+ */
+void loadgenStartClients(struct loadgen *lg, long long now) {
+    const struct loadgen_config *config = lg->config;
+    double allowed = loadgenAllowed(config, (now - lg->start_ms) / 1000.0);
+
+    while (lg->started < config->clients && lg->active < config->concurrency && lg->started < allowed) {
+        struct loadgen_client *client = &lg->clients[lg->started++];
+        lg->active++;
+
+        loadgenSecond(lg, now)->started++;
+        client->start_us = lowlatClockUs();
+        client->total_bytes = 0;
+
+        loadgenStartStep(client, now);
+    }
+}
+
+/**
+ * @brief Time the next client is allowed to start by ramp-up profile
+ *
+ * @param lg load generator
+ *
+ * @return time (ms), TIMER_NEVER if all clients were started or the concurrency limit is reached
+ */
+long long loadgenNextStart(struct loadgen *lg) {
+    const struct loadgen_config *config = lg->config;
+    if (lg->started >= config->clients || lg->active >= config->concurrency) return TIMER_NEVER;
+    if (config->rate == 0) return lg->start_ms;
+
+    // Inverse of loadgenAllowed for the next client
+    double next = lg->started + 1;
+    double ramp_clients = config->rate * config->ramp / 2;
+    double elapsed;
+    if (config->ramp > 0 && next <= ramp_clients) elapsed = sqrt(2 * config->ramp * next / config->rate);
+    else elapsed = (next - ramp_clients) / config->rate + config->ramp;
+
+    return lg->start_ms + (long long)ceil(elapsed * 1000);
+}
+
+static int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentile of sorted values
+static long long percentileLongLong(const long long *values, size_t count, int percent) {
+    if (count == 0) return 0;
+    size_t index = (count * percent + 99) / 100;
+    return values[index > 0 ? index - 1 : 0];
+}
+
+static double percentileDouble(const double *values, size_t count, int percent) {
+    if (count == 0) return 0;
+    size_t index = (count * percent + 99) / 100;
+    return values[index > 0 ? index - 1 : 0];
+}
+
+/**
+ * @brief Print totals, error rates, admission latency, throughput distribution, timeline per second and
+ * the first second where admission latency exploded or clients started failing
+ *
+ * @param lg load generator
+ * @param wall_ms duration of the run
+ */
+void loadgenReport(struct loadgen *lg, double wall_ms) {
+    const struct loadgen_config *config = lg->config;
+    unsigned long failed = config->clients - lg->clients_ok;
+
+    fprintf(stdout, "clients=%d ok=%lu failed=%lu (%.2f%%) requests=%lu probes=%lu downloads=%lu bytes=%llu wall_ms=%.1f\n",
+        config->clients, lg->clients_ok, failed, 100.0 * failed / config->clients, lg->requests, lg->probes, lg->downloads, lg->bytes, wall_ms);
+
+    fprintf(stdout, "errors: timeout=%lu local=%lu", lg->timeouts, lg->local_errors);
+    for (int code = 0; code <= LOADGEN_MAX_ERROR_CODE; code++) {
+        if (lg->error_codes[code] > 0) fprintf(stdout, " code%d=%lu", code, lg->error_codes[code]);
+    }
+    if (lg->error_codes[LOADGEN_MAX_ERROR_CODE + 1] > 0) fprintf(stdout, " other=%lu", lg->error_codes[LOADGEN_MAX_ERROR_CODE + 1]);
+    fprintf(stdout, "\n");
+
+    // Admission latency of all requests
+    long long *latencies = malloc((lg->admission_count + 1) * sizeof(long long));
+    if (latencies == NULL) printError("memory allocation error", true);
+    for (size_t i = 0; i < lg->admission_count; i++) latencies[i] = lg->admissions[i].value_us;
+    qsort(latencies, lg->admission_count, sizeof(long long), compareLongLong);
+    fprintf(stdout, "admission_us: n=%zu p50=%lld p90=%lld p99=%lld max=%lld\n", lg->admission_count,
+        percentileLongLong(latencies, lg->admission_count, 50), percentileLongLong(latencies, lg->admission_count, 90),
+        percentileLongLong(latencies, lg->admission_count, 99), lg->admission_count ? latencies[lg->admission_count - 1] : 0);
+
+    qsort(lg->throughputs, lg->throughput_count, sizeof(double), compareDouble);
+    fprintf(stdout, "client_KiB/s: n=%zu p1=%.1f p10=%.1f p50=%.1f p90=%.1f p99=%.1f\n", lg->throughput_count,
+        percentileDouble(lg->throughputs, lg->throughput_count, 1), percentileDouble(lg->throughputs, lg->throughput_count, 10),
+        percentileDouble(lg->throughputs, lg->throughput_count, 50), percentileDouble(lg->throughputs, lg->throughput_count, 90),
+        percentileDouble(lg->throughputs, lg->throughput_count, 99));
+
+    // Timeline, admissions are sorted by time they were recorded
+    fprintf(stdout, "%6s %8s %8s %8s %8s %12s %10s\n", "sec", "active", "started", "done", "failed", "adm_p99_us", "MiB/s");
+    size_t sample = 0;
+    long long baseline = -1;
+    long long saturation = -1;
+    unsigned long saturation_active = 0;
+    unsigned long peak_active = 0;
+    for (size_t i = 0; i < lg->second_used; i++) {
+        struct loadgen_second *second = &lg->seconds[i];
+
+        size_t count = 0;
+        while (sample < lg->admission_count && lg->admissions[sample].at_ms < (long long)(i + 1) * 1000) {
+            latencies[count++] = lg->admissions[sample++].value_us;
+        }
+        qsort(latencies, count, sizeof(long long), compareLongLong);
+        long long p99 = percentileLongLong(latencies, count, 99);
+
+        // Median of the first second with requests is latency of unloaded server
+        if (baseline < 0 && count > 0) {
+            baseline = percentileLongLong(latencies, count, 50);
+            if (baseline < LOADGEN_MIN_BASELINE_US) baseline = LOADGEN_MIN_BASELINE_US;
+        }
+
+        if (second->peak_active > peak_active) peak_active = second->peak_active;
+        if (saturation < 0 && (second->failed > 0 || (baseline > 0 && p99 > baseline * LOADGEN_SATURATION_FACTOR))) {
+            saturation = i;
+            saturation_active = second->peak_active;
+        }
+
+        fprintf(stdout, "%6zu %8lu %8lu %8lu %8lu %12lld %10.2f\n", i, second->peak_active,
+            second->started, second->finished, second->failed, p99, second->bytes / 1048576.0);
+    }
+
+    if (saturation >= 0) {
+        fprintf(stdout, "saturation: second %lld with %lu active clients (admission p99 over %dx p50 of the first second %lldus or failures)\n",
+            saturation, saturation_active, LOADGEN_SATURATION_FACTOR, baseline);
+    } else {
+        fprintf(stdout, "saturation: not reached up to %lu active clients\n", peak_active);
+    }
+
+    free(latencies);
+}
+
+int main(int argc, char **argv) {
+    struct loadgen_config config = {
+        .host = NULL,
+        .port = TFTP_SERVER_PORT,
+        .clients = 100,
+        .concurrency = 0,
+        .rate = 0,
+        .ramp = 0,
+        .blksize_count = 0,
+        .timeout_count = 0,
+        .seed = 1,
+    };
+    handleArguments(argc, argv, &config);
+
+    // Every client needs its own socket
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur != RLIM_INFINITY && (rlim_t)config.concurrency + 16 > limit.rlim_cur) {
+            printError("concurrency is over limit of open files", true);
+        }
+    }
+
+    struct loadgen lg;
+    memset(&lg, 0, sizeof(lg));
+    lg.config = &config;
+    lg.rng = config.seed ? config.seed : 1;
+
+    struct hostent *host_info = gethostbyname(config.host);
+    if (host_info == NULL) printError("no such host", true);
+    lg.server_addr.sin_family = AF_INET;
+    lg.server_addr.sin_port = htons(config.port);
+    memcpy(&lg.server_addr.sin_addr.s_addr, host_info->h_addr_list[0], host_info->h_length);
+
+    lg.epfd = epoll_create1(0);
+    if (lg.epfd < 0) printError("epoll_create1 failed", true);
+
+    lg.clients = calloc(config.clients, sizeof(struct loadgen_client));
+    if (lg.clients == NULL) printError("memory allocation error", true);
+    for (int i = 0; i < config.clients; i++) {
+        lg.clients[i].lg = &lg;
+        lg.clients[i].id = i;
+        lg.clients[i].sockfd = -1;
+        timerInit(&lg.clients[i].timer, loadgenTimerExpired, &lg.clients[i]);
+    }
+
+    poolInit(&lg.pool, 0);
+    lg.start_ms = tftpClockMs();
+    timerWheelInit(&lg.wheel, lg.start_ms);
+    long long start_us = lowlatClockUs();
+
+    struct epoll_event events[LOADGEN_MAX_EVENTS];
+    while (lg.finished < config.clients) {
+        long long now = tftpClockMs();
+        loadgenStartClients(&lg, now);
+
+        struct loadgen_second *second = loadgenSecond(&lg, now);
+        if ((unsigned long)lg.active > second->peak_active) second->peak_active = lg.active;
+
+        // Sleep until the nearest retransmission or start of the next client
+        long long next = timerWheelNext(&lg.wheel);
+        long long next_start = loadgenNextStart(&lg);
+        if (next_start < next) next = next_start;
+        int timeout = -1;
+        if (next != TIMER_NEVER) timeout = next > now ? (int)(next - now) : 0;
+
+        int count = epoll_wait(lg.epfd, events, LOADGEN_MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR) printError("epoll_wait failed", true);
+
+        for (int i = 0; i < count; i++) loadgenOnReadable(events[i].data.ptr);
+        timerWheelAdvance(&lg.wheel, tftpClockMs());
+    }
+
+    loadgenReport(&lg, (lowlatClockUs() - start_us) / 1000.0);
+
+    poolDestroy(&lg.pool);
+    close(lg.epfd);
+    free(lg.clients);
+    free(lg.admissions);
+    free(lg.throughputs);
+    free(lg.seconds);
+    return 0;
+}
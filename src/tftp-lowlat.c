@@ -0,0 +1,222 @@
+/* tftp-lowlat.c ********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <errno.h>
+
+#include "../include/tftp-lowlat.h"
+#include "../include/tftp-core.h"
+
+/**
+ * @brief Parse list of CPUs, e.g. "0,2-3"
+ *
+ * @param list comma separated CPU numbers or ranges
+ * @param cpus to set parsed CPUs
+ *
+ * @return number of CPUs, -1 if the list is invalid
+ */
+int lowlatParseCpus(const char *list, struct lowlat_cpus *cpus) {
+    cpus->count = 0;
+
+    while (*list) {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if (end == list || first < 0) return -1;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first) return -1;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpus->count == LOWLAT_MAX_CPUS || cpu >= CPU_SETSIZE) return -1;
+            cpus->cpus[cpus->count++] = cpu;
+        }
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        list = end;
+    }
+
+    return cpus->count > 0 ? cpus->count : -1;
+}
+
+/**
+ * @brief Pin calling process to CPUs. Workers are spread over the CPUs round robin
+ *
+ * @param cpus configured CPUs
+ * @param worker index of worker, -1 pins to all configured CPUs
+ *
+ * @return 0 on success, -1 on failure
+ */
+int lowlatPin(const struct lowlat_cpus *cpus, int worker) {
+    if (cpus->count == 0) return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (worker < 0) {
+        for (int i = 0; i < cpus->count; i++) CPU_SET(cpus->cpus[i], &set);
+    } else {
+        CPU_SET(cpus->cpus[worker % cpus->count], &set);
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * @brief Set busy polling and priority of socket and size its buffers for blksize.
+ * Options that need privileges are silently skipped
+ *
+ * @param sockfd socket
+ * @param blksize negotiated blksize
+ */
+void lowlatTuneSocket(int sockfd, int blksize) {
+    int busy_poll = LOWLAT_BUSY_POLL_USEC;
+    setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+
+    int priority = LOWLAT_SOCK_PRIORITY;
+    setsockopt(sockfd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+
+    int tos = IPTOS_LOWDELAY;
+    setsockopt(sockfd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+    // Buffers are only raised, kernel default can already be big enough
+    int wanted = LOWLAT_SOCKBUF_PACKETS * (blksize + DATA_HEADER_SIZE + LOWLAT_PACKET_OVERHEAD);
+    int options[] = {SO_SNDBUF, SO_RCVBUF};
+    for (int i = 0; i < 2; i++) {
+        int current;
+        socklen_t len = sizeof(current);
+        if (getsockopt(sockfd, SOL_SOCKET, options[i], &current, &len) == 0 && current < wanted) {
+            setsockopt(sockfd, SOL_SOCKET, options[i], &wanted, sizeof(wanted));
+        }
+    }
+}
+
+/**
+ * @brief Wait for data on socket by spinning on non-blocking receive, after LOWLAT_SPIN_USEC
+ * fall back to select() for the rest of timeout. There is no spinning on machines with one CPU
+ *
+ * @param sockfd socket
+ * @param timeout time to wait (ms)
+ *
+ * @return 1 if data are available, 0 if timed out, -1 on error
+ */
+int lowlatWait(int sockfd, long long timeout_ms) {
+    // With one CPU spinning only delays the peer process, SO_BUSY_POLL is used alone then
+    static long spin_usec = -1;
+    if (spin_usec < 0) spin_usec = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOWLAT_SPIN_USEC : 0;
+
+    long long now = lowlatClockUs();
+    long long deadline = now + (timeout_ms > 0 ? timeout_ms * 1000 : 0);
+    long long spin_end = now + spin_usec;
+    if (spin_end > deadline) spin_end = deadline;
+
+    char byte;
+    do {
+        ssize_t n = recv(sockfd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+        if (n >= 0) return 1;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+        now = lowlatClockUs();
+    } while (now < spin_end);
+
+    if (now >= deadline) return 0;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sockfd, &fds);
+    struct timeval tv;
+    tv.tv_sec = (deadline - now) / 1000000;
+    tv.tv_usec = (deadline - now) % 1000000;
+
+    int n = select(sockfd + 1, &fds, NULL, NULL, &tv);
+    return n < 0 ? -1 : n > 0;
+}
+
+/**
+ * @brief Start measuring latency of transfer
+ *
+ * @param stats statistics
+ * @param start_us start of the transfer (us)
+ */
+void latencyInit(struct latency_stats *stats, long long start_us) {
+    memset(stats, 0, sizeof(*stats));
+    stats->start_us = start_us;
+    stats->ttfb_us = -1;
+    stats->last_tx_us = -1;
+}
+
+/**
+ * @brief Record sent packet
+ *
+ * @param stats statistics
+ * @param packet sent packet
+ * @param len length of packet
+ * @param retransmit packet was sent before, its answer can't be used as RTT sample
+ * @param now_us current time (us)
+ */
+void latencyOnSend(struct latency_stats *stats, const char *packet, size_t len, bool retransmit, long long now_us) {
+    if (len >= OPCODE_SIZE && tftpGetOpcode(packet) == DATA_OPCODE && stats->ttfb_us < 0) stats->ttfb_us = now_us - stats->start_us;
+    stats->last_tx_us = retransmit ? -1 : now_us;
+}
+
+/**
+ * @brief Record received packet, it is RTT sample if it answered the last sent packet
+ *
+ * @param stats statistics
+ * @param packet received packet
+ * @param len length of packet
+ * @param sent_us first transmission of the packet it answers, -1 if it isn't an answer or the packet was retransmitted
+ * @param now_us current time (us)
+ */
+void latencyOnReceive(struct latency_stats *stats, const char *packet, size_t len, long long sent_us, long long now_us) {
+    if (len >= OPCODE_SIZE && tftpGetOpcode(packet) == DATA_OPCODE && stats->ttfb_us < 0) stats->ttfb_us = now_us - stats->start_us;
+    if (sent_us < 0) return;
+
+    if (stats->count == stats->cap) {
+        size_t cap = stats->cap ? stats->cap * 2 : 1024;
+        long long *samples = realloc(stats->samples, cap * sizeof(long long));
+        if (samples == NULL) return;
+        stats->samples = samples;
+        stats->cap = cap;
+    }
+    stats->samples[stats->count++] = now_us - sent_us;
+}
+
+static int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Print p50/p99 block RTT and time to first byte to stdout
+ *
+ * @param stats statistics
+ */
+void latencyPrint(struct latency_stats *stats) {
+    fprintf(stdout, "Latency: blocks=%zu", stats->count);
+    if (stats->count > 0) {
+        qsort(stats->samples, stats->count, sizeof(long long), compareLongLong);
+        fprintf(stdout, " rtt_p50=%lldus rtt_p99=%lldus", stats->samples[(stats->count - 1) / 2], stats->samples[(stats->count * 99 - 1) / 100]);
+    }
+    if (stats->ttfb_us >= 0) fprintf(stdout, " ttfb=%lldus", stats->ttfb_us);
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief Free samples
+ *
+ * @param stats statistics
+ */
+void latencyDestroy(struct latency_stats *stats) {
+    free(stats->samples);
+    stats->samples = NULL;
+    stats->count = stats->cap = 0;
+}
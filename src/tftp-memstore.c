@@ -0,0 +1,354 @@
+/* tftp-memstore.c ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-memstore.h"
+
+// Lock shared state, child that died holding the lock left it consistent enough to continue
+static void memstoreLock(struct memstore *store) {
+    if (pthread_mutex_lock(&store->lock) == EOWNERDEAD) pthread_mutex_consistent(&store->lock);
+}
+
+// Next extent of every extent, stored right after the header
+static uint32_t *memstoreLinks(struct memstore *store) {
+    return (uint32_t *)(store + 1);
+}
+
+static char *memstoreExtent(struct memstore *store, uint32_t extent) {
+    return (char *)store + store->data_offset + (size_t)extent * MEMSTORE_EXTENT_SIZE;
+}
+
+// FNV-1a
+static uint32_t memstoreHash(const char *name) {
+    uint32_t hash = 2166136261U;
+    for (; *name != '\0'; name++) hash = (hash ^ (unsigned char)*name) * 16777619U;
+    return hash;
+}
+
+// Slot of the name, or the first reusable slot of its probe sequence if it isn't there (-1 if the table is full).
+// Called with the lock held
+static long memstoreLookup(struct memstore *store, const char *name, bool *found) {
+    uint32_t slot = memstoreHash(name) & (MEMSTORE_MAX_FILES - 1);
+    long reusable = -1;
+
+    *found = false;
+    for (int probe = 0; probe < MEMSTORE_MAX_FILES; probe++, slot = (slot + 1) & (MEMSTORE_MAX_FILES - 1)) {
+        struct memstore_entry *entry = &store->entries[slot];
+        if (entry->state == MEMSTORE_FREE) return reusable >= 0 ? reusable : (long)slot;
+        if (entry->state == MEMSTORE_DELETED) {
+            if (reusable < 0) reusable = slot;
+            continue;
+        }
+        if (strcmp(entry->name, name) == 0) {
+            *found = true;
+            return slot;
+        }
+    }
+    return reusable;
+}
+
+static uint32_t memstoreAllocate(struct memstore *store) {
+    uint32_t *links = memstoreLinks(store);
+
+    memstoreLock(store);
+    uint32_t extent = store->free_extent;
+    if (extent != MEMSTORE_NO_EXTENT) {
+        store->free_extent = links[extent];
+        store->free_count--;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    if (extent != MEMSTORE_NO_EXTENT) links[extent] = MEMSTORE_NO_EXTENT;
+    return extent;
+}
+
+// Only uploads can be written, the name must not exist. The backend isn't resumable, STORAGE_APPEND is ignored
+static int memstoreOpen(void *backend, const char *name, int flags, struct storage_file *file) {
+    struct memstore *store = backend;
+    if (strlen(name) >= MEMSTORE_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memstoreLock(store);
+    bool found;
+    long slot = memstoreLookup(store, name, &found);
+    int error = 0;
+
+    if (!(flags & STORAGE_WRITE)) {
+        if (!found || store->entries[slot].state != MEMSTORE_READY) error = ENOENT;
+        else file->size = store->entries[slot].size;
+    } else if (found) {
+        error = EEXIST;
+    } else if (slot < 0) {
+        error = ENOSPC;
+    } else {
+        struct memstore_entry *entry = &store->entries[slot];
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+        entry->state = MEMSTORE_WRITING;
+        entry->size = 0;
+        entry->first = MEMSTORE_NO_EXTENT;
+        entry->last = MEMSTORE_NO_EXTENT;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    file->entry = slot;
+    return 0;
+}
+
+static int memstoreStat(void *backend, const char *name, struct storage_stat *stat) {
+    struct memstore *store = backend;
+
+    memstoreLock(store);
+    bool found;
+    long slot = memstoreLookup(store, name, &found);
+    found = found && store->entries[slot].state == MEMSTORE_READY;
+    if (found) {
+        stat->size = store->entries[slot].size;
+        stat->mtime = store->entries[slot].mtime;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    if (!found) errno = ENOENT;
+    return found ? 0 : -1;
+}
+
+// Ready files never change, so they are read without the lock
+static ssize_t memstoreRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    struct memstore *store = file->backend;
+    struct memstore_entry *entry = &store->entries[file->entry];
+    uint32_t *links = memstoreLinks(store);
+
+    if (offset >= entry->size) return 0;
+    if (len > (size_t)(entry->size - offset)) len = entry->size - offset;
+
+    // Sequential reads continue from the extent of the previous read
+    if (file->cursor < 0 || offset < file->cursor_offset) {
+        file->cursor = entry->first;
+        file->cursor_offset = 0;
+    }
+    while (offset >= file->cursor_offset + MEMSTORE_EXTENT_SIZE) {
+        file->cursor = links[file->cursor];
+        file->cursor_offset += MEMSTORE_EXTENT_SIZE;
+    }
+
+    size_t copied = 0;
+    while (copied < len) {
+        size_t in_extent = offset + copied - file->cursor_offset;
+        size_t chunk = MEMSTORE_EXTENT_SIZE - in_extent;
+        if (chunk > len - copied) chunk = len - copied;
+        memcpy(&dst[copied], memstoreExtent(store, file->cursor) + in_extent, chunk);
+        copied += chunk;
+
+        if (copied < len) {
+            file->cursor = links[file->cursor];
+            file->cursor_offset += MEMSTORE_EXTENT_SIZE;
+        }
+    }
+
+    return copied;
+}
+
+// Writer owns the entry until commit, only allocation of extents takes the lock
+static ssize_t memstoreWrite(struct storage_file *file, const char *data, size_t len) {
+    struct memstore *store = file->backend;
+    struct memstore_entry *entry = &store->entries[file->entry];
+    uint32_t *links = memstoreLinks(store);
+
+    size_t written = 0;
+    while (written < len) {
+        size_t used = entry->size % MEMSTORE_EXTENT_SIZE;
+        if (used == 0) {
+            uint32_t extent = memstoreAllocate(store);
+            if (extent == MEMSTORE_NO_EXTENT) {
+                errno = ENOSPC;
+                return -1;
+            }
+            if (entry->first == MEMSTORE_NO_EXTENT) entry->first = extent;
+            else links[entry->last] = extent;
+            entry->last = extent;
+        }
+
+        size_t chunk = MEMSTORE_EXTENT_SIZE - used;
+        if (chunk > len - written) chunk = len - written;
+        memcpy(memstoreExtent(store, entry->last) + used, &data[written], chunk);
+        entry->size += chunk;
+        written += chunk;
+    }
+
+    return written;
+}
+
+static int memstoreCommit(struct storage_file *file) {
+    struct memstore *store = file->backend;
+
+    memstoreLock(store);
+    store->entries[file->entry].state = MEMSTORE_READY;
+    store->entries[file->entry].mtime = time(NULL);
+    store->files++;
+    pthread_mutex_unlock(&store->lock);
+    return 0;
+}
+
+// Uncommitted upload is discarded, its extents return to the free list
+static void memstoreClose(struct storage_file *file) {
+    struct memstore *store = file->backend;
+    struct memstore_entry *entry = &store->entries[file->entry];
+    if (!file->writable || entry->state != MEMSTORE_WRITING) return;
+
+    uint32_t *links = memstoreLinks(store);
+    memstoreLock(store);
+    if (entry->first != MEMSTORE_NO_EXTENT) {
+        uint32_t count = 1;
+        for (uint32_t extent = entry->first; extent != entry->last; extent = links[extent]) count++;
+        links[entry->last] = store->free_extent;
+        store->free_extent = entry->first;
+        store->free_count += count;
+    }
+    entry->state = MEMSTORE_DELETED;
+    pthread_mutex_unlock(&store->lock);
+}
+
+static void memstoreDestroy(void *backend) {
+    struct memstore *store = backend;
+    pthread_mutex_destroy(&store->lock);
+    munmap(store, store->mapping_size);
+}
+
+const struct storage_ops memory_storage_ops = {
+    .name = "memory",
+    .resumable = false,
+    .open = memstoreOpen,
+    .stat = memstoreStat,
+    .read = memstoreRead,
+    .write = memstoreWrite,
+    .commit = memstoreCommit,
+    .close = memstoreClose,
+    .destroy = memstoreDestroy,
+};
+
+// Copy file of the directory into the store under its relative path
+static int memstoreLoadFile(struct storage *storage, int dir_fd, const char *name, const char *path) {
+    int fd = openat(dir_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct storage_file file;
+    if (storageOpen(storage, path, STORAGE_WRITE, &file) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char buffer[STORAGE_CRC_CHUNK];
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (storageWrite(&file, buffer, bytes_read) < 0) break;
+    }
+
+    int rc = bytes_read == 0 ? storageCommit(&file) : -1;
+    storageClose(&file);
+    close(fd);
+    return rc;
+}
+
+// Walk regular files below the directory (descriptor is consumed). Without storage only memory they need is
+// summed into total, otherwise they are loaded. Files with too long paths can't be looked up and are skipped
+static int memstoreWalk(struct storage *storage, int dir_fd, char *path, size_t path_len, size_t *total) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        close(dir_fd);
+        return -1;
+    }
+
+    int rc = 0;
+    struct dirent *dirent;
+    while (rc == 0 && (dirent = readdir(dir)) != NULL) {
+        const char *name = dirent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        int len = snprintf(&path[path_len], MEMSTORE_NAME_LEN - path_len, "%s%s", path_len > 0 ? "/" : "", name);
+        if (len < 0 || (size_t)len >= MEMSTORE_NAME_LEN - path_len) continue;
+
+        struct stat file_stat;
+        if (fstatat(dirfd(dir), name, &file_stat, 0) < 0) continue;
+
+        if (S_ISDIR(file_stat.st_mode)) {
+            int child_fd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY);
+            if (child_fd >= 0) rc = memstoreWalk(storage, child_fd, path, path_len + len, total);
+        } else if (S_ISREG(file_stat.st_mode)) {
+            if (storage == NULL) *total += (file_stat.st_size + MEMSTORE_EXTENT_SIZE - 1) / MEMSTORE_EXTENT_SIZE * MEMSTORE_EXTENT_SIZE;
+            else rc = memstoreLoadFile(storage, dirfd(dir), name, path);
+        }
+    }
+
+    path[path_len] = '\0';
+    closedir(dir);
+    return rc;
+}
+
+/**
+ * @brief Create memory backend in memory shared by the listener and all children, files of the root
+ * directory are loaded into it. Uploads are visible after they complete, failed uploads are discarded
+ *
+ * @param storage storage to initialize
+ * @param root_dirpath directory to load
+ * @param capacity memory for file data, 0 for size of the directory with space for uploads
+ *
+ * @return 0 on success, -1 if the directory can't be loaded
+ */
+int storageCreateMemory(struct storage *storage, const char *root_dirpath, size_t capacity) {
+    char path[MEMSTORE_NAME_LEN] = "";
+    size_t loaded = 0;
+
+    int root_fd = open(root_dirpath, O_RDONLY | O_DIRECTORY);
+    if (root_fd < 0 || memstoreWalk(NULL, root_fd, path, 0, &loaded) < 0) return -1;
+    if (capacity == 0) capacity = loaded + MEMSTORE_DEFAULT_SPARE;
+
+    // Pages of the mapping are allocated when they are written
+    size_t extent_count = (capacity + MEMSTORE_EXTENT_SIZE - 1) / MEMSTORE_EXTENT_SIZE;
+    if (extent_count >= MEMSTORE_NO_EXTENT) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t data_offset = sizeof(struct memstore) + extent_count * sizeof(uint32_t);
+    data_offset = (data_offset + MEMSTORE_EXTENT_SIZE - 1) / MEMSTORE_EXTENT_SIZE * MEMSTORE_EXTENT_SIZE;
+    size_t mapping_size = data_offset + extent_count * MEMSTORE_EXTENT_SIZE;
+
+    struct memstore *store = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (store == MAP_FAILED) return -1;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    int mutex_rc = pthread_mutex_init(&store->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    if (mutex_rc != 0) {
+        munmap(store, mapping_size);
+        return -1;
+    }
+
+    store->mapping_size = mapping_size;
+    store->data_offset = data_offset;
+    store->extent_count = extent_count;
+    store->free_count = extent_count;
+    store->free_extent = extent_count > 0 ? 0 : MEMSTORE_NO_EXTENT;
+    uint32_t *links = memstoreLinks(store);
+    for (uint32_t i = 0; i < extent_count; i++) links[i] = i + 1 < extent_count ? i + 1 : MEMSTORE_NO_EXTENT;
+
+    storage->ops = &memory_storage_ops;
+    storage->backend = store;
+
+    root_fd = open(root_dirpath, O_RDONLY | O_DIRECTORY);
+    if (root_fd < 0 || memstoreWalk(storage, root_fd, path, 0, NULL) < 0) {
+        storageDestroy(storage);
+        return -1;
+    }
+    return 0;
+}
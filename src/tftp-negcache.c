@@ -0,0 +1,198 @@
+/* tftp-negcache.c ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-negcache.h"
+
+// Name relative to root, leading slashes are skipped the same way fd cache does
+static const char *negCacheRelative(const char *filename) {
+    while (*filename == '/') filename++;
+    return filename;
+}
+
+// FNV-1a hash of name
+static uint32_t negCacheHash(const char *name) {
+    uint32_t hash = 2166136261U;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Remove all entries that depend on the watch
+static void negCacheInvalidateWatch(struct neg_cache *cache, int watch) {
+    for (int set = 0; set < NEG_CACHE_SETS; set++) {
+        for (int way = 0; way < NEG_CACHE_WAYS; way++) {
+            struct neg_cache_entry *entry = &cache->entries[set][way];
+            if (entry->expires != 0 && (watch < 0 || entry->watch == watch)) {
+                entry->expires = 0;
+                cache->invalidations++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Find watch of directory, the directory is watched when it is needed for the first time
+ *
+ * @param cache cache
+ * @param dir directory relative to root
+ *
+ * @return index of watch, -1 if the directory can't be watched
+ */
+static int negCacheWatch(struct neg_cache *cache, const char *dir) {
+    for (int i = 0; i < cache->watch_count; i++) {
+        if (strcmp(cache->watches[i].dir, dir) == 0) return cache->watches[i].wd < 0 ? -1 : i;
+    }
+    if (cache->watch_count == NEG_CACHE_MAX_WATCHES) return -1;
+
+    char path[2 * NEG_CACHE_NAME_LEN];
+    snprintf(path, sizeof(path), "%s/%s", cache->root_dirpath, dir);
+    int wd = inotify_add_watch(cache->inotify_fd, path, NEG_CACHE_WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0) return -1;
+
+    // The same directory can be reached by different names, kernel returns the same wd
+    for (int i = 0; i < cache->watch_count; i++) {
+        if (cache->watches[i].wd == wd) return i;
+    }
+
+    struct neg_cache_watch *watch = &cache->watches[cache->watch_count];
+    watch->wd = wd;
+    snprintf(watch->dir, sizeof(watch->dir), "%s", dir);
+    return cache->watch_count++;
+}
+
+/**
+ * @brief Initialize empty cache and watch root directory
+ *
+ * @param cache cache
+ * @param root_dirpath root directory of the server
+ *
+ * @return 0 on success, -1 if inotify isn't available (the cache stays disabled)
+ */
+int negCacheInit(struct neg_cache *cache, const char *root_dirpath) {
+    memset(cache, 0, sizeof(*cache));
+    cache->root_dirpath = root_dirpath;
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK);
+    if (cache->inotify_fd < 0) return -1;
+
+    if (negCacheWatch(cache, "") != 0) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read pending inotify events and drop entries of directories that changed
+ *
+ * @param cache cache
+ */
+void negCacheProcessEvents(struct neg_cache *cache) {
+    if (cache->inotify_fd < 0) return;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(cache->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            // Lost events, nothing in the cache can be trusted
+            if (event->mask & IN_Q_OVERFLOW) {
+                negCacheInvalidateWatch(cache, -1);
+                continue;
+            }
+
+            for (int i = 0; i < cache->watch_count; i++) {
+                if (cache->watches[i].wd != event->wd) continue;
+                negCacheInvalidateWatch(cache, i);
+                if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) cache->watches[i].wd = -1;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check if file is known to be missing
+ *
+ * @param cache cache
+ * @param filename filename from RQ packet
+ * @param now current time (s)
+ *
+ * @return true if the file doesn't exist
+ */
+bool negCacheLookup(struct neg_cache *cache, const char *filename, time_t now) {
+    if (cache->inotify_fd < 0) return false;
+
+    const char *name = negCacheRelative(filename);
+    struct neg_cache_entry *set = cache->entries[negCacheHash(name) % NEG_CACHE_SETS];
+    for (int way = 0; way < NEG_CACHE_WAYS; way++) {
+        if (set[way].expires > now && strcmp(set[way].name, name) == 0) {
+            cache->hits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Remember missing file. The entry depends on the closest existing directory of the file,
+ * so creating the file or any of its missing directories invalidates it
+ *
+ * @param cache cache
+ * @param filename filename from RQ packet
+ * @param now current time (s)
+ */
+void negCacheInsert(struct neg_cache *cache, const char *filename, time_t now) {
+    if (cache->inotify_fd < 0) return;
+
+    const char *name = negCacheRelative(filename);
+    if (strlen(name) >= NEG_CACHE_NAME_LEN) return;
+
+    // Walk up from the parent directory until a directory can be watched
+    char dir[NEG_CACHE_NAME_LEN];
+    snprintf(dir, sizeof(dir), "%s", name);
+    int watch = -1;
+    while (watch < 0) {
+        char *slash = strrchr(dir, '/');
+        if (slash != NULL) *slash = '\0';
+        else dir[0] = '\0';
+
+        watch = negCacheWatch(cache, dir);
+        if (dir[0] == '\0') break;
+    }
+    if (watch < 0) return;
+
+    // Replace the same name, an empty or expired entry, or the one expiring first
+    struct neg_cache_entry *set = cache->entries[negCacheHash(name) % NEG_CACHE_SETS];
+    struct neg_cache_entry *victim = &set[0];
+    for (int way = 0; way < NEG_CACHE_WAYS; way++) {
+        if (set[way].expires != 0 && strcmp(set[way].name, name) == 0) {
+            victim = &set[way];
+            break;
+        }
+        if (set[way].expires <= now) victim = &set[way];
+        else if (victim->expires > now && set[way].expires < victim->expires) victim = &set[way];
+    }
+
+    snprintf(victim->name, sizeof(victim->name), "%s", name);
+    victim->expires = now + NEG_CACHE_TTL_SEC;
+    victim->watch = watch;
+    cache->inserts++;
+}
+
+/**
+ * @brief Close inotify descriptor, all watches are removed with it
+ *
+ * @param cache cache
+ */
+void negCacheDestroy(struct neg_cache *cache) {
+    if (cache->inotify_fd >= 0) close(cache->inotify_fd);
+    cache->inotify_fd = -1;
+}
@@ -0,0 +1,264 @@
+/* tftp-pack.c **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-pack.h"
+
+// Archive is written under temporary name and renamed when it is complete
+char tmp_path[PATH_MAX] = "";
+
+// Function for printing error messages and terminating process if exit_failure
+void printError(char *error, bool exit_failure) {
+    fprintf(stdout, "Local error: %s\n", error);
+    fflush(stdout);
+    if (exit_failure) {
+        if (tmp_path[0] != '\0') unlink(tmp_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function for printing usage and terminating process
+void printUsage(char **argv) {
+    fprintf(stdout, "Usage: %s -o archive root\n", argv[0]);
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+// Function for handling arguments
+void handleArguments(int argc, char **argv, char **archive_path, char **root_dirpath) {
+    int option;
+    while ((option = getopt(argc, argv, "o:")) != -1) {
+        switch (option) {
+        case 'o':
+            *archive_path = optarg;
+            break;
+        default:
+            printUsage(argv);
+            break;
+        }
+    }
+
+    if (*archive_path == NULL || optind != argc - 1) printUsage(argv);
+    *root_dirpath = argv[optind];
+}
+
+static int compareFiles(const void *a, const void *b) {
+    return strcmp(((const struct pack_file *)a)->name, ((const struct pack_file *)b)->name);
+}
+
+// Files of a page or more start at a page boundary, smaller files are packed but don't cross one, so every file
+// is sent from the fewest pages and small configs don't waste a page each
+static uint64_t placeFile(uint64_t end, off_t size) {
+    if (size == 0) return end;
+    if (size < PACK_ALIGN && end / PACK_ALIGN == (end + size - 1) / PACK_ALIGN) return end;
+    return (end + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+/**
+ * @brief Add regular files below the directory to the list, the descriptor is consumed. Symbolic links to files
+ * are followed, links to directories aren't, so the walk can't loop. Files with too long paths are skipped
+ *
+ * @param list list of files
+ * @param dir_fd descriptor of directory
+ * @param path path of the directory relative to the root, buffer of PACK_NAME_LEN
+ * @param path_len length of path
+ *
+ * @return 0 on success, -1 on error
+ */
+int collectFiles(struct pack_list *list, int dir_fd, char *path, size_t path_len) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        close(dir_fd);
+        return -1;
+    }
+
+    int rc = 0;
+    struct dirent *dirent;
+    while (rc == 0 && (dirent = readdir(dir)) != NULL) {
+        const char *name = dirent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        int len = snprintf(&path[path_len], PACK_NAME_LEN - path_len, "%s%s", path_len > 0 ? "/" : "", name);
+        if (len < 0 || (size_t)len >= PACK_NAME_LEN - path_len) continue;
+
+        struct stat file_stat;
+        if (fstatat(dirfd(dir), name, &file_stat, AT_SYMLINK_NOFOLLOW) < 0) continue;
+        if (S_ISLNK(file_stat.st_mode) && (fstatat(dirfd(dir), name, &file_stat, 0) < 0 || !S_ISREG(file_stat.st_mode))) continue;
+
+        if (S_ISDIR(file_stat.st_mode)) {
+            int child_fd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY);
+            if (child_fd >= 0) rc = collectFiles(list, child_fd, path, path_len + len);
+        } else if (S_ISREG(file_stat.st_mode)) {
+            if (list->count == list->cap) {
+                size_t cap = list->cap ? list->cap * 2 : 256;
+                struct pack_file *files = realloc(list->files, cap * sizeof(struct pack_file));
+                if (files == NULL) {
+                    rc = -1;
+                    break;
+                }
+                list->files = files;
+                list->cap = cap;
+            }
+
+            struct pack_file *file = &list->files[list->count];
+            file->name = strdup(path);
+            if (file->name == NULL) {
+                rc = -1;
+                break;
+            }
+            file->size = file_stat.st_size;
+            file->mtime = file_stat.st_mtime;
+            list->count++;
+        }
+    }
+
+    path[path_len] = '\0';
+    closedir(dir);
+    return rc;
+}
+
+// Copy data of file into the archive at its offset, the file must not change while it is packed
+static int copyFile(const struct pack_file *file, int root_fd, int archive_fd) {
+    int fd = openat(root_fd, file->name, O_RDONLY);
+    if (fd < 0) return -1;
+
+    char buffer[PACK_COPY_SIZE];
+    off_t copied = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (copied + bytes_read > file->size || pwrite(archive_fd, buffer, bytes_read, file->offset + copied) != bytes_read) break;
+        copied += bytes_read;
+    }
+    close(fd);
+
+    return bytes_read == 0 && copied == file->size ? 0 : -1;
+}
+
+/**
+ * @brief Write archive of files sorted by name: header, index entries, hash table, names and file data
+ *
+ * @param list sorted files, their offsets are set
+ * @param root_fd root directory of the files
+ * @param archive_fd empty archive file
+ *
+ * @return 0 on success, -1 on error
+ */
+int writeArchive(struct pack_list *list, int root_fd, int archive_fd) {
+    if (list->count >= UINT32_MAX / 2) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    struct pack_header header = {0};
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.count = list->count;
+    header.slot_count = 16;
+    while (header.slot_count < 2 * header.count) header.slot_count *= 2;
+
+    uint64_t slots_offset = sizeof(header) + (uint64_t)header.count * sizeof(struct pack_entry);
+    header.names_offset = slots_offset + (uint64_t)header.slot_count * sizeof(uint32_t);
+    header.names_size = 1; // Empty archive still has one name
+    for (size_t i = 0; i < list->count; i++) header.names_size += strlen(list->files[i].name) + 1;
+    if (header.names_size >= UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint64_t end = header.names_offset + header.names_size;
+    for (size_t i = 0; i < list->count; i++) {
+        list->files[i].offset = placeFile(end, list->files[i].size);
+        end = list->files[i].offset + list->files[i].size;
+    }
+    header.size = end;
+
+    // Index with names is built in memory and written at once
+    char *index = calloc(1, header.names_offset + header.names_size);
+    if (index == NULL) return -1;
+    struct pack_entry *entries = (struct pack_entry *)(index + sizeof(header));
+    uint32_t *slots = (uint32_t *)(index + slots_offset);
+    char *names = index + header.names_offset;
+    memcpy(index, &header, sizeof(header));
+    memset(slots, 0xff, header.slot_count * sizeof(uint32_t));
+
+    uint32_t name_offset = 1;
+    for (uint32_t i = 0; i < header.count; i++) {
+        const struct pack_file *file = &list->files[i];
+        struct pack_entry *entry = &entries[i];
+        entry->offset = file->offset;
+        entry->size = file->size;
+        entry->mtime = file->mtime;
+        entry->name = name_offset;
+        entry->hash = packHash(file->name);
+        strcpy(&names[name_offset], file->name);
+        name_offset += strlen(file->name) + 1;
+
+        uint32_t slot = entry->hash & (header.slot_count - 1);
+        while (slots[slot] != PACK_NO_ENTRY) slot = (slot + 1) & (header.slot_count - 1);
+        slots[slot] = i;
+    }
+
+    ssize_t index_size = header.names_offset + header.names_size;
+    bool written = pwrite(archive_fd, index, index_size, 0) == index_size;
+    free(index);
+    if (!written) return -1;
+
+    for (size_t i = 0; i < list->count; i++) {
+        if (copyFile(&list->files[i], root_fd, archive_fd) < 0) {
+            list->failed = list->files[i].name;
+            return -1;
+        }
+    }
+
+    // Padding before an empty last file isn't written by any pwrite
+    return ftruncate(archive_fd, header.size);
+}
+
+int main(int argc, char **argv) {
+    char *archive_path = NULL;
+    char *root_dirpath = NULL;
+    char path[PACK_NAME_LEN] = "";
+    struct pack_list list = {0};
+
+    handleArguments(argc, argv, &archive_path, &root_dirpath);
+
+    int root_fd = open(root_dirpath, O_RDONLY | O_DIRECTORY);
+    if (root_fd < 0) printError("couldn't open root directory", true);
+    if (collectFiles(&list, openat(root_fd, ".", O_RDONLY | O_DIRECTORY), path, 0) < 0) printError("couldn't read root directory", true);
+    qsort(list.files, list.count, sizeof(struct pack_file), compareFiles);
+
+    // Server maps the archive at the path only after it is complete, deploy is the final rename
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", archive_path, getpid());
+    int archive_fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (archive_fd < 0) {
+        tmp_path[0] = '\0';
+        printError("couldn't create archive", true);
+    }
+    if (writeArchive(&list, root_fd, archive_fd) < 0) {
+        char error[PACK_NAME_LEN + 64];
+        if (list.failed) snprintf(error, sizeof(error), "couldn't copy %s, file changed while packing?", list.failed);
+        else snprintf(error, sizeof(error), "couldn't write archive");
+        printError(error, true);
+    }
+    struct stat archive_stat;
+    if (fsync(archive_fd) < 0 || fstat(archive_fd, &archive_stat) < 0 || close(archive_fd) < 0) printError("couldn't write archive", true);
+
+    // Archive is checked by the backend of the server before it replaces the old one
+    struct storage storage;
+    struct storage_stat file_stat;
+    if (storageCreatePack(&storage, tmp_path) < 0) printError("archive is invalid", true);
+    for (size_t i = 0; i < list.count; i++) {
+        if (storageStat(&storage, list.files[i].name, &file_stat) < 0 || file_stat.size != list.files[i].size) printError("archive is invalid", true);
+    }
+    storageDestroy(&storage);
+
+    if (rename(tmp_path, archive_path) < 0) printError("couldn't rename archive", true);
+    fprintf(stdout, "Packed %zu files into %s (%lld bytes)\n", list.count, archive_path, (long long)archive_stat.st_size);
+
+    for (size_t i = 0; i < list.count; i++) free(list.files[i].name);
+    free(list.files);
+    close(root_fd);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/* tftp-packstore.c *****************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-packstore.h"
+
+/**
+ * @brief Hash of file name in the archive (FNV-1a)
+ *
+ * @param name file name
+ *
+ * @return hash
+ */
+uint32_t packHash(const char *name) {
+    uint32_t hash = 2166136261U;
+    for (; *name != '\0'; name++) hash = (hash ^ (unsigned char)*name) * 16777619U;
+    return hash;
+}
+
+// Check that every offset of the archive stays inside the mapping, lookups and reads then need no checks
+static bool packValid(const struct pack_header *header, uint64_t size) {
+    if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 || header->size != size) return false;
+    if (header->slot_count <= header->count || (header->slot_count & (header->slot_count - 1)) != 0) return false;
+
+    uint64_t slots_offset = sizeof(struct pack_header) + (uint64_t)header->count * sizeof(struct pack_entry);
+    uint64_t names_end = header->names_offset + header->names_size;
+    if (header->names_offset < slots_offset + (uint64_t)header->slot_count * sizeof(uint32_t)) return false;
+    if (header->names_size == 0 || names_end < header->names_offset || names_end > size) return false;
+
+    const char *map = (const char *)header;
+    const struct pack_entry *entries = (const struct pack_entry *)(header + 1);
+    const uint32_t *slots = (const uint32_t *)(map + slots_offset);
+    if (map[names_end - 1] != '\0') return false;
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        const struct pack_entry *entry = &entries[i];
+        if (entry->name >= header->names_size) return false;
+        if (entry->offset < names_end || entry->offset > size || entry->size > size - entry->offset) return false;
+    }
+    for (uint32_t i = 0; i < header->slot_count; i++) {
+        if (slots[i] != PACK_NO_ENTRY && slots[i] >= header->count) return false;
+    }
+    return true;
+}
+
+// Map and check archive, NULL with errno set if it can't be used
+static struct pack_archive *packMap(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (file_stat.st_size < (off_t)sizeof(struct pack_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Mapping keeps the file, the descriptor isn't needed
+    void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const struct pack_header *header = map;
+    struct pack_archive *archive = calloc(1, sizeof(struct pack_archive));
+    if (archive == NULL || !packValid(header, file_stat.st_size)) {
+        free(archive);
+        munmap(map, file_stat.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    archive->map = map;
+    archive->size = file_stat.st_size;
+    archive->entries = (const struct pack_entry *)(header + 1);
+    archive->slots = (const uint32_t *)(archive->entries + header->count);
+    archive->names = archive->map + header->names_offset;
+    archive->count = header->count;
+    archive->mask = header->slot_count - 1;
+    archive->dev = file_stat.st_dev;
+    archive->ino = file_stat.st_ino;
+
+    // Index is read by every lookup, file data are paged in when they are sent
+    madvise(map, header->names_offset + header->names_size, MADV_WILLNEED);
+    return archive;
+}
+
+static void packRelease(struct pack_archive *archive) {
+    if (!archive->retired || archive->refs > 0) return;
+    munmap((void *)archive->map, archive->size);
+    free(archive);
+}
+
+// Archive serving new requests. Deploy renames a new archive over the path, it is mapped by the first request
+// after the check interval. Archive that can't be used is ignored and the old one is served
+static struct pack_archive *packCurrent(struct packstore *store) {
+    time_t now = time(NULL);
+    if (now - store->checked < PACK_CHECK_INTERVAL) return store->current;
+    store->checked = now;
+
+    struct stat path_stat;
+    if (stat(store->path, &path_stat) < 0) return store->current;
+    if (path_stat.st_dev == store->current->dev && path_stat.st_ino == store->current->ino) return store->current;
+
+    struct pack_archive *archive = packMap(store->path);
+    if (archive == NULL) return store->current;
+
+    store->current->retired = true;
+    packRelease(store->current);
+    store->current = archive;
+    return archive;
+}
+
+// Entry of the name, one hash and usually one comparison
+static const struct pack_entry *packFind(const struct pack_archive *archive, const char *name) {
+    uint32_t hash = packHash(name);
+    uint32_t slot = hash & archive->mask;
+
+    for (uint32_t probe = 0; probe <= archive->mask; probe++, slot = (slot + 1) & archive->mask) {
+        uint32_t index = archive->slots[slot];
+        if (index == PACK_NO_ENTRY) break;
+        const struct pack_entry *entry = &archive->entries[index];
+        if (entry->hash == hash && strcmp(&archive->names[entry->name], name) == 0) return entry;
+    }
+
+    errno = ENOENT;
+    return NULL;
+}
+
+static int packOpen(void *backend, const char *name, int flags, struct storage_file *file) {
+    if (flags & STORAGE_WRITE) {
+        errno = EROFS;
+        return -1;
+    }
+
+    struct pack_archive *archive = packCurrent(backend);
+    const struct pack_entry *entry = packFind(archive, name);
+    if (entry == NULL) return -1;
+
+    // File keeps its archive mapped, also when a new archive is deployed during the transfer
+    archive->refs++;
+    file->state = archive;
+    file->entry = entry - archive->entries;
+    file->data = archive->map + entry->offset;
+    file->size = entry->size;
+    return 0;
+}
+
+static int packStat(void *backend, const char *name, struct storage_stat *stat) {
+    const struct pack_entry *entry = packFind(packCurrent(backend), name);
+    if (entry == NULL) return -1;
+
+    stat->size = entry->size;
+    stat->mtime = entry->mtime;
+    return 0;
+}
+
+// Blocks are copied straight from the mapping
+static ssize_t packRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    if (offset >= file->size) return 0;
+    if (len > (size_t)(file->size - offset)) len = file->size - offset;
+    memcpy(dst, &file->data[offset], len);
+    return len;
+}
+
+static ssize_t packWrite(struct storage_file *file, const char *data, size_t len) {
+    (void)file;
+    (void)data;
+    (void)len;
+    errno = EROFS;
+    return -1;
+}
+
+static int packCommit(struct storage_file *file) {
+    (void)file;
+    return 0;
+}
+
+static void packClose(struct storage_file *file) {
+    struct pack_archive *archive = file->state;
+    archive->refs--;
+    packRelease(archive);
+}
+
+static void packDestroy(void *backend) {
+    struct packstore *store = backend;
+    store->current->retired = true;
+    packRelease(store->current);
+    free(store);
+}
+
+const struct storage_ops pack_storage_ops = {
+    .name = "pack",
+    .resumable = false,
+    .open = packOpen,
+    .stat = packStat,
+    .read = packRead,
+    .write = packWrite,
+    .commit = packCommit,
+    .close = packClose,
+    .destroy = packDestroy,
+};
+
+/**
+ * @brief Create read-only backend serving files of archive made by tftp-pack. The archive is mapped and checked
+ * once, names are looked up in its hash table and blocks are copied from the mapping, so a warm start doesn't
+ * read or index anything. Archive renamed over the path replaces the served one
+ *
+ * @param storage storage to initialize
+ * @param archive_path path of archive
+ *
+ * @return 0 on success, -1 if the archive can't be used
+ */
+int storageCreatePack(struct storage *storage, const char *archive_path) {
+    struct packstore *store = calloc(1, sizeof(struct packstore));
+    if (store == NULL) return -1;
+
+    if (strlen(archive_path) >= sizeof(store->path)) {
+        free(store);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(store->path, sizeof(store->path), "%s", archive_path);
+
+    store->current = packMap(archive_path);
+    if (store->current == NULL) {
+        free(store);
+        return -1;
+    }
+    store->checked = time(NULL);
+
+    storage->ops = &pack_storage_ops;
+    storage->backend = store;
+    return 0;
+}
@@ -0,0 +1,163 @@
+/* tftp-pool.c **********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-pool.h"
+
+// Smallest class whose buffer fits size bytes, -1 if it is too big
+static int poolClass(size_t size) {
+    for (int cls = 0; cls < POOL_CLASSES; cls++) {
+        if (size <= ((size_t)POOL_MIN_CLASS << cls) + POOL_SLACK) return cls;
+    }
+    return -1;
+}
+
+// Allocate new slab for class and put its buffers on free list
+static int poolGrow(struct buffer_pool *pool, struct pool_class *class, int cls) {
+    size_t count = POOL_SLAB_SIZE / class->stride;
+    if (count == 0) count = 1;
+    size_t bytes = POOL_ALIGN + count * class->stride;
+
+    if (pool->max_bytes != 0 && pool->reserved + bytes > pool->max_bytes) return -1;
+
+    void *memory;
+    if (posix_memalign(&memory, POOL_ALIGN, bytes) != 0) return -1;
+
+    // Slab header takes the first aligned block, buffers follow
+    struct pool_slab *slab = memory;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    char *base = (char *)memory + POOL_ALIGN;
+    for (size_t i = 0; i < count; i++) {
+        struct pool_buffer *buffer = (struct pool_buffer *)(base + i * class->stride);
+        buffer->cls = cls;
+        buffer->next = class->free;
+        class->free = buffer;
+    }
+
+    class->slabs++;
+    class->buffers += count;
+    pool->reserved += bytes;
+    return 0;
+}
+
+/**
+ * @brief Initialize empty pool, slabs are allocated on demand
+ *
+ * @param pool buffer pool
+ * @param max_bytes limit of memory of the pool, 0 without limit
+ */
+void poolInit(struct buffer_pool *pool, size_t max_bytes) {
+    memset(pool, 0, sizeof(*pool));
+    pool->max_bytes = max_bytes;
+
+    for (int cls = 0; cls < POOL_CLASSES; cls++) {
+        struct pool_class *class = &pool->classes[cls];
+        class->size = ((size_t)POOL_MIN_CLASS << cls) + POOL_SLACK;
+        class->stride = sizeof(struct pool_buffer) + (class->size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    }
+}
+
+/**
+ * @brief Usable size of buffer that poolAlloc returns for requested size
+ *
+ * @param size requested size
+ *
+ * @return size of class, 0 if the size is too big
+ */
+size_t poolCapacity(size_t size) {
+    int cls = poolClass(size);
+    return cls < 0 ? 0 : ((size_t)POOL_MIN_CLASS << cls) + POOL_SLACK;
+}
+
+/**
+ * @brief Take buffer of at least size bytes from the pool. Buffer isn't zeroed
+ *
+ * @param pool buffer pool
+ * @param size requested size
+ * @param cap set to usable size of the buffer (size of its class), can be NULL
+ *
+ * @return buffer or NULL if the size is too big or the limit of the pool was reached
+ */
+void *poolAlloc(struct buffer_pool *pool, size_t size, size_t *cap) {
+    int cls = poolClass(size);
+    if (cls < 0) {
+        pool->failures++;
+        return NULL;
+    }
+
+    struct pool_class *class = &pool->classes[cls];
+    if (class->free != NULL) {
+        pool->reuses++;
+    } else if (poolGrow(pool, class, cls) < 0) {
+        pool->failures++;
+        return NULL;
+    }
+
+    struct pool_buffer *buffer = class->free;
+    class->free = buffer->next;
+
+    class->in_use++;
+    if (class->in_use > class->peak) class->peak = class->in_use;
+    pool->in_use += class->size;
+    if (pool->in_use > pool->peak) pool->peak = pool->in_use;
+    pool->allocs++;
+
+    if (cap != NULL) *cap = class->size;
+    return buffer + 1;
+}
+
+/**
+ * @brief Return buffer to its class, NULL is ignored
+ *
+ * @param pool buffer pool the buffer was allocated from
+ * @param data buffer
+ */
+void poolFree(struct buffer_pool *pool, void *data) {
+    if (data == NULL) return;
+
+    struct pool_buffer *buffer = (struct pool_buffer *)data - 1;
+    struct pool_class *class = &pool->classes[buffer->cls];
+    buffer->next = class->free;
+    class->free = buffer;
+
+    class->in_use--;
+    pool->in_use -= class->size;
+}
+
+/**
+ * @brief Print memory of the pool and usage of every class that was used
+ *
+ * @param pool buffer pool
+ * @param stream output stream
+ */
+void poolPrintStats(const struct buffer_pool *pool, FILE *stream) {
+    fprintf(stream, "Buffers: reserved=%zuB in_use=%zuB peak=%zuB allocs=%lu reused=%lu failed=%lu\n",
+        pool->reserved, pool->in_use, pool->peak, pool->allocs, pool->reuses, pool->failures);
+
+    for (int cls = 0; cls < POOL_CLASSES; cls++) {
+        const struct pool_class *class = &pool->classes[cls];
+        if (class->slabs == 0) continue;
+        fprintf(stream, "  class %6zuB: slabs=%lu buffers=%lu in_use=%lu peak=%lu\n",
+            class->size, class->slabs, class->buffers, class->in_use, class->peak);
+    }
+}
+
+/**
+ * @brief Release all slabs, buffers of the pool can't be used anymore
+ *
+ * @param pool buffer pool
+ */
+void poolDestroy(struct buffer_pool *pool) {
+    struct pool_slab *slab = pool->slabs;
+    while (slab != NULL) {
+        struct pool_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    poolInit(pool, pool->max_bytes);
+}
@@ -0,0 +1,383 @@
+/* tftp-sched.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-sched.h"
+
+static long long schedClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Lock shared state, child that died holding the lock left it consistent enough to continue
+static void schedLock(struct sched *sched) {
+    if (pthread_mutex_lock(&sched->lock) == EOWNERDEAD) pthread_mutex_consistent(&sched->lock);
+}
+
+static void bucketInit(struct sched_bucket *bucket, double rate, long long now) {
+    bucket->rate = rate;
+    bucket->burst = rate * SCHED_BURST_MS / 1000;
+    if (bucket->burst < SCHED_MAX_PACKET) bucket->burst = SCHED_MAX_PACKET;
+    bucket->tokens = bucket->burst;
+    bucket->last_ns = now;
+}
+
+static void bucketRefill(struct sched_bucket *bucket, long long now) {
+    if (bucket->rate <= 0) return;
+    bucket->tokens += bucket->rate * (now - bucket->last_ns) / 1e9;
+    if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+    bucket->last_ns = now;
+}
+
+// Time when the bucket has enough tokens, 0 if it has them now
+static long long bucketReady(const struct sched_bucket *bucket, size_t bytes, long long now) {
+    if (bucket->rate <= 0 || bucket->tokens >= bytes) return 0;
+    return now + (long long)((bytes - bucket->tokens) / bucket->rate * 1e9) + 1;
+}
+
+static void listPush(struct sched *sched, int id, int list_id) {
+    struct sched_list *list = &sched->lists[list_id];
+    struct sched_flow *flow = &sched->flows[id];
+
+    flow->list = list_id;
+    flow->prev = list->tail;
+    flow->next = -1;
+    if (list->tail >= 0) sched->flows[list->tail].next = id;
+    else list->head = id;
+    list->tail = id;
+    list->count++;
+}
+
+static void listRemove(struct sched *sched, int id) {
+    struct sched_flow *flow = &sched->flows[id];
+    if (flow->list == SCHED_LIST_NONE) return;
+    struct sched_list *list = &sched->lists[flow->list];
+
+    if (flow->prev >= 0) sched->flows[flow->prev].next = flow->next;
+    else list->head = flow->next;
+    if (flow->next >= 0) sched->flows[flow->next].prev = flow->prev;
+    else list->tail = flow->prev;
+    list->count--;
+    flow->list = SCHED_LIST_NONE;
+}
+
+/**
+ * @brief Try to grant waiting packet of the flow, tokens are taken from the global and client bucket
+ *
+ * @param sched scheduler
+ * @param id flow at the head of its list
+ * @param now current time (ns)
+ * @param wake earliest time when a blocked flow can be granted, lowered if this flow is blocked
+ *
+ * @return 1 if granted, 0 if the client bucket is empty, -1 if the global bucket is empty
+ */
+static int schedGrant(struct sched *sched, int id, long long now, long long *wake) {
+    struct sched_flow *flow = &sched->flows[id];
+    struct sched_bucket *bucket = flow->bucket >= 0 ? &sched->buckets[flow->bucket] : NULL;
+
+    long long ready = bucketReady(&sched->global, flow->pending, now);
+    if (ready > 0) {
+        if (*wake < 0 || ready < *wake) *wake = ready;
+        return -1;
+    }
+    if (bucket) {
+        bucketRefill(bucket, now);
+        ready = bucketReady(bucket, flow->pending, now);
+        if (ready > 0) {
+            if (*wake < 0 || ready < *wake) *wake = ready;
+            return 0;
+        }
+        if (bucket->rate > 0) bucket->tokens -= flow->pending;
+    }
+    if (sched->global.rate > 0) sched->global.tokens -= flow->pending;
+
+    listRemove(sched, id);
+    flow->granted = true;
+    flow->sent += flow->pending;
+    flow->deficit = 0; // The queue of the flow is empty again
+    sched->grants++;
+    return 1;
+}
+
+/**
+ * @brief Grant waiting packets in deficit round robin order while there are tokens. New flows are served
+ * first in arrival order, old flows get quantum in every round and send when their deficit covers the packet
+ *
+ * @param sched locked scheduler
+ * @param now current time (ns)
+ * @param granted set if any packet was granted
+ *
+ * @return time when the next packet can be granted, -1 if no flow is blocked by tokens
+ */
+static long long schedDispatch(struct sched *sched, long long now, bool *granted) {
+    long long wake = -1;
+    bucketRefill(&sched->global, now);
+
+    // New flows, a flow blocked by its client bucket doesn't stop the others
+    int id = sched->lists[SCHED_LIST_NEW].head;
+    while (id >= 0) {
+        int next = sched->flows[id].next;
+        int result = schedGrant(sched, id, now, &wake);
+        if (result < 0) return wake;
+        if (result > 0) *granted = true;
+        id = next;
+    }
+
+    // Old flows, stop after every flow in the list was blocked in a row
+    struct sched_list *list = &sched->lists[SCHED_LIST_OLD];
+    int blocked = 0;
+    while (list->count > 0 && blocked < list->count) {
+        id = list->head;
+        struct sched_flow *flow = &sched->flows[id];
+
+        // Flow gets quantum on every visit until its deficit covers the packet
+        if (flow->deficit < (long long)flow->pending) {
+            flow->deficit += SCHED_QUANTUM;
+            blocked = 0;
+        }
+        if (flow->deficit >= (long long)flow->pending) {
+            int result = schedGrant(sched, id, now, &wake);
+            if (result < 0) return wake;
+            if (result > 0) {
+                *granted = true;
+                blocked = 0;
+                continue;
+            }
+            blocked++;
+        }
+
+        // Move the flow to the end of the round
+        listRemove(sched, id);
+        listPush(sched, id, SCHED_LIST_OLD);
+    }
+
+    return wake;
+}
+
+// Free slot of the flow and its reference to the client bucket
+static void flowRelease(struct sched *sched, int id) {
+    struct sched_flow *flow = &sched->flows[id];
+    if (flow->pid == 0) return;
+
+    listRemove(sched, id);
+    if (flow->bucket >= 0) sched->buckets[flow->bucket].flows--;
+    flow->pid = 0;
+}
+
+/**
+ * @brief Parse rate in bits per second with optional suffix k, M or G
+ *
+ * @param arg rate like 100M
+ * @param rate to set rate in bytes per second
+ *
+ * @return 0 on success, -1 if the rate is malformed
+ */
+int schedParseRate(const char *arg, double *rate) {
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value <= 0) return -1;
+
+    if (*end == 'k' || *end == 'K') value *= 1e3;
+    else if (*end == 'm' || *end == 'M') value *= 1e6;
+    else if (*end == 'g' || *end == 'G') value *= 1e9;
+    else if (*end != '\0') return -1;
+    if (*end != '\0' && end[1] != '\0') return -1;
+
+    *rate = value / 8;
+    return 0;
+}
+
+/**
+ * @brief Parse cap of client subnet in form rate[/prefix], every client has its own cap without prefix
+ *
+ * @param arg cap like 10M/24
+ * @param rate to set rate in bytes per second
+ * @param prefix to set length of subnet prefix
+ *
+ * @return 0 on success, -1 if the cap is malformed
+ */
+int schedParseClientRate(const char *arg, double *rate, int *prefix) {
+    char buffer[64];
+    if (strlen(arg) >= sizeof(buffer)) return -1;
+    strcpy(buffer, arg);
+
+    *prefix = 32;
+    char *slash = strchr(buffer, '/');
+    if (slash) {
+        *slash = '\0';
+        char *end;
+        long value = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || value < 0 || value > 32) return -1;
+        *prefix = value;
+    }
+
+    return schedParseRate(buffer, rate);
+}
+
+/**
+ * @brief Create scheduler in anonymous shared memory, so it is shared by children forked later
+ *
+ * @param global_rate cap of all transfers in bytes per second, 0 without cap
+ * @param client_rate cap of every client subnet in bytes per second, 0 without cap
+ * @param prefix length of subnet prefix sharing one client cap
+ *
+ * @return scheduler, NULL on failure
+ */
+struct sched *schedCreate(double global_rate, double client_rate, int prefix) {
+    struct sched *sched = mmap(NULL, sizeof(struct sched), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sched == MAP_FAILED) return NULL;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    int mutex_rc = pthread_mutex_init(&sched->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_rc = pthread_cond_init(&sched->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (mutex_rc != 0 || cond_rc != 0) {
+        munmap(sched, sizeof(struct sched));
+        return NULL;
+    }
+
+    long long now = schedClockNs();
+    bucketInit(&sched->global, global_rate, now);
+    sched->client_rate = client_rate;
+    sched->prefix = prefix;
+    for (int i = 0; i < SCHED_MAX_FLOWS; i++) sched->flows[i].list = SCHED_LIST_NONE;
+    for (int i = 0; i < 2; i++) {
+        sched->lists[i].head = -1;
+        sched->lists[i].tail = -1;
+    }
+
+    return sched;
+}
+
+/**
+ * @brief Register transfer of the process, flows of clients from the same subnet share one bucket
+ *
+ * @param sched scheduler
+ * @param addr address of client
+ * @param pid process of the transfer
+ *
+ * @return flow, -1 if there are too many transfers
+ */
+int schedOpen(struct sched *sched, struct in_addr addr, pid_t pid) {
+    uint32_t mask = sched->prefix == 0 ? 0 : 0xffffffffu << (32 - sched->prefix);
+    uint32_t key = ntohl(addr.s_addr) & mask;
+    long long now = schedClockNs();
+
+    schedLock(sched);
+
+    // Slot of a child killed without closing its flow is reused
+    int id = -1;
+    for (int i = 0; i < SCHED_MAX_FLOWS && id < 0; i++) {
+        struct sched_flow *flow = &sched->flows[i];
+        if (flow->pid != 0 && kill(flow->pid, 0) < 0 && errno == ESRCH) flowRelease(sched, i);
+        if (flow->pid == 0) id = i;
+    }
+
+    int bucket = -1;
+    if (id >= 0 && sched->client_rate > 0) {
+        int free_bucket = -1;
+        for (int i = 0; i < SCHED_MAX_BUCKETS && bucket < 0; i++) {
+            if (sched->buckets[i].flows > 0 && sched->buckets[i].key == key) bucket = i;
+            else if (sched->buckets[i].flows == 0 && free_bucket < 0) free_bucket = i;
+        }
+        if (bucket < 0 && free_bucket >= 0) {
+            bucket = free_bucket;
+            sched->buckets[bucket].key = key;
+            bucketInit(&sched->buckets[bucket], sched->client_rate, now);
+        }
+        if (bucket < 0) id = -1;
+    }
+
+    if (id >= 0) {
+        struct sched_flow *flow = &sched->flows[id];
+        memset(flow, 0, sizeof(*flow));
+        flow->pid = pid;
+        flow->bucket = bucket;
+        flow->list = SCHED_LIST_NONE;
+        if (bucket >= 0) sched->buckets[bucket].flows++;
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+    return id;
+}
+
+/**
+ * @brief Wait until the packet of the flow is granted by the scheduler
+ *
+ * @param sched scheduler
+ * @param id flow
+ * @param bytes size of packet on the wire
+ */
+void schedAcquire(struct sched *sched, int id, size_t bytes) {
+    struct sched_flow *flow = &sched->flows[id];
+    bool granted = false;
+
+    schedLock(sched);
+
+    flow->pending = bytes;
+    flow->granted = false;
+    listPush(sched, id, flow->sent < SCHED_NEW_FLOW_BYTES ? SCHED_LIST_NEW : SCHED_LIST_OLD);
+
+    long long wake = schedDispatch(sched, schedClockNs(), &granted);
+    if (!flow->granted) sched->waits++;
+
+    while (!flow->granted) {
+        if (granted) pthread_cond_broadcast(&sched->cond);
+        granted = false;
+
+        // Waiter woken by the bucket deadline dispatches for everybody
+        long long now = schedClockNs();
+        if (wake < 0 || wake > now + SCHED_MAX_WAIT_NS) wake = now + SCHED_MAX_WAIT_NS;
+        struct timespec deadline = {wake / 1000000000, wake % 1000000000};
+        if (pthread_cond_timedwait(&sched->cond, &sched->lock, &deadline) == EOWNERDEAD) pthread_mutex_consistent(&sched->lock);
+        if (flow->granted) break;
+
+        wake = schedDispatch(sched, schedClockNs(), &granted);
+    }
+    if (granted) pthread_cond_broadcast(&sched->cond);
+
+    flow->pending = 0;
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/**
+ * @brief Unregister flow of finished transfer
+ *
+ * @param sched scheduler
+ * @param id flow
+ */
+void schedClose(struct sched *sched, int id) {
+    schedLock(sched);
+
+    flowRelease(sched, id);
+
+    // Packets behind the removed flow may be granted now
+    bool granted = false;
+    schedDispatch(sched, schedClockNs(), &granted);
+    if (granted) pthread_cond_broadcast(&sched->cond);
+
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/**
+ * @brief Unmap scheduler
+ *
+ * @param sched scheduler
+ */
+void schedDestroy(struct sched *sched) {
+    if (sched) munmap(sched, sizeof(struct sched));
+}
@@ -6,13 +6,62 @@
  */
 
 #include "../include/tftp-server.h"
+#include "../include/tftp-compress.h"
+#include "../include/tftp-fec.h"
 
 int server_socket = -1;
 int sockfd = -1;
 struct sockaddr_in server_addr, recv_addr, src_addr;
+struct sockaddr_in client_addr; // Address and port (TID) of client of the transfer
 socklen_t recv_len = sizeof(recv_addr);
 
-FILE *file = NULL;
+// Storage backend (-b) of files, the file of the transfer is opened through it
+char *storage_backend = "posix";
+struct storage storage;
+struct storage_file transfer_file;
+struct storage_file decompress_file; // Destination of compressed upload, transfer_file holds the compressed stream meanwhile
+struct vfiles vfiles; // Virtual files rendered from templates (-V rules, -H host table)
+char *vfile_rules_path = NULL; // Rules mapping requested names to templates (-V)
+char *vfile_hosts_path = NULL; // Table of per-host variables used by the templates (-H)
+
+// Low-latency mode (-L), CPUs to pin to (-P) and measured latency
+bool low_latency = false;
+struct lowlat_cpus lowlat_cpus;
+struct latency_stats latency;
+
+// Trace of sampled sessions (-T) and percentage of sessions to trace (-S)
+struct trace trace;
+int trace_sample = 100;
+
+// Transmit scheduler shared by all children, created only with global (-B) or client (-C) cap
+struct sched *sched = NULL;
+int sched_flow = -1;
+double sched_global_rate = 0;
+double sched_client_rate = 0;
+int sched_prefix = 32;
+
+struct neg_cache neg_cache; // Files known to be missing, answered by the listener without fork
+off_t file_offset = 0; // Offset of the next read of file being sent
+
+// TX and RX buffers of the session are sized from blksize and reused for every packet
+struct buffer_pool buffer_pool;
+char rq_packet[MAX_RQ_PACKET_SIZE + 1]; // One more byte to terminate strings of malformed packets
+char oack_packet[MAX_RQ_PACKET_SIZE];
+int oack_packet_len = 0;
+
+// State of netascii conversion between DATA packets
+char netascii_buffer[MAX_BLKSIZE];
+struct netascii_state netascii = {.buffer = netascii_buffer, .cap = sizeof(netascii_buffer), .pending = -1};
+
+// Demultiplexing mode (-M sockets), all sessions run in the listener on a fixed set of sockets
+int demux_socket_count = 0;
+int demux_sockets[DEMUX_MAX_SOCKETS];
+struct demux_table demux_table;
+struct demux_transfer *demux_transfers;
+uint32_t *demux_free; // Stack of unused transfers
+uint32_t demux_free_count = 0;
+struct timer_wheel demux_wheel;
+char demux_packet[POOL_MAX_SIZE]; // Packets of all sessions are received here and processed in place
 
 // Function for printing error messages and terminating process if exit_failure
 void printError(char *error, bool exit_failure) {
@@ -23,34 +72,19 @@ void printError(char *error, bool exit_failure) {
 
 // Function for printing usage and terminating process
 void printUsage(char **argv) {
-    fprintf(stdout, "Usage: %s [-p port] root_dirpath\n", argv[0]);
+    fprintf(stdout, "Usage: %s [-p port] [-L] [-P cpus] [-T trace_file] [-S percent] [-B rate] [-C rate[/prefix]] [-b posix|memory[:size]|tar|dedup|pack] [-V rules] [-H hosts] [-M sockets] root\n", argv[0]);
     fflush(stdout);
     exit(EXIT_FAILURE);
 }
 
 // Function for printing RQ packets
 void printRqPacket(char *rq_opcode, char *src_ip, int src_port, char *filepath, char *mode, int blksize, int timeout) {
-    // Format OPTS output to be appended after RQ packet
-    char opts[1024];
-    bzero(opts, sizeof(opts));
-    char blksize_val[1024];
-    bzero(blksize_val, sizeof(blksize_val));
-    sprintf(blksize_val, "%d", blksize);
-    char timeout_val[1024];
-    bzero(timeout_val, sizeof(timeout_val));
-    sprintf(timeout_val, "%d", timeout);
+    fprintf(stderr, "%s %s:%d \"%s\" %s ", rq_opcode, src_ip, src_port, filepath, mode);
 
-    if (atoi(blksize_val) != DEFAULT_BLKSIZE) {
-        strcat(opts, "blksize=");
-        strcat(opts, blksize_val);
-        strcat(opts, " ");
-    }
-    if (atoi(timeout_val) != DEFAULT_TIMEOUT) {
-        strcat(opts, "timeout=");
-        strcat(opts, timeout_val);
-    }
+    // Append OPTS output after RQ packet
+    if (blksize != DEFAULT_BLKSIZE) fprintf(stderr, "blksize=%d ", blksize);
+    if (timeout != DEFAULT_TIMEOUT) fprintf(stderr, "timeout=%d", timeout);
 
-    fprintf(stderr, "%s %s:%d \"%s\" %s %s", rq_opcode, src_ip, src_port, filepath, mode, opts);
     fprintf(stderr, "\n");
     fflush(stderr);
 }
@@ -113,11 +147,43 @@ void printPacket(char *packet, int size) {
 // Function for handling arguments
 void handleArguments(int argc, char **argv, int *server_port, char **root_dirpath) {
     char option;
-    while ((option = getopt(argc, argv, "p:")) != -1) {
+    while ((option = getopt(argc, argv, "p:LP:T:S:B:C:b:V:H:M:")) != -1) {
         switch (option) {
         case 'p':
             *server_port = atoi(optarg);
             break;
+        case 'L':
+            low_latency = true;
+            break;
+        case 'P':
+            if (lowlatParseCpus(optarg, &lowlat_cpus) < 0) printUsage(argv);
+            break;
+        case 'T':
+            if (traceOpen(&trace, optarg) < 0) printError("couldn't open trace file", true);
+            break;
+        case 'S':
+            trace_sample = atoi(optarg);
+            if (trace_sample < 0 || trace_sample > 100) printUsage(argv);
+            break;
+        case 'B':
+            if (schedParseRate(optarg, &sched_global_rate) < 0) printUsage(argv);
+            break;
+        case 'C':
+            if (schedParseClientRate(optarg, &sched_client_rate, &sched_prefix) < 0) printUsage(argv);
+            break;
+        case 'b':
+            storage_backend = optarg;
+            break;
+        case 'V':
+            vfile_rules_path = optarg;
+            break;
+        case 'H':
+            vfile_hosts_path = optarg;
+            break;
+        case 'M':
+            demux_socket_count = atoi(optarg);
+            if (demux_socket_count < 1 || demux_socket_count > DEMUX_MAX_SOCKETS) printUsage(argv);
+            break;
         default:
             printUsage(argv);
             break;
@@ -155,30 +221,247 @@ void configureServerAddress(int server_port) {
 }
 
 /**
- * @brief Open file for read or write based on send_file value. Concat filename after root_dirpath
+ * @brief TFTP error code matching errno of failed storage operation
+ *
+ * @param error_msg set to message of the code, unchanged for errors without better TFTP code
+ *
+ * @return error code
+ */
+uint16_t storageErrorCode(char **error_msg) {
+    if (errno == ENOENT || errno == ENOTDIR) {
+        *error_msg = "File not found";
+        return 1;
+    }
+    if (errno == EEXIST) {
+        *error_msg = "File already exists";
+        return 6;
+    }
+    if (errno == EACCES || errno == EPERM || errno == EROFS) {
+        *error_msg = "Access violation";
+        return 2;
+    }
+    if (errno == ENOSPC) {
+        *error_msg = "Disk full or allocation exceeded";
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send error packet matching errno of failed storage operation and exit
+ *
+ * @param error_msg message of errors without better TFTP code
+ */
+void sendStorageError(char *error_msg) {
+    uint16_t error_code = storageErrorCode(&error_msg);
+    sendErrorPacket(error_code, error_msg, true);
+}
+
+/**
+ * @brief Open file for read or write based on send_file value. File is looked up in the storage backend
  *
- * @param root_dirpath root dirpath of files to be read or to be written
  * @param filename name of file
  * @param send_file server is sending file
+ * @param opts negotiated options, resume offset is set to accepted offset (-1 if declined) and when receiving
+ * file resume checksum is set to CRC32C of stored data
  */
-void openFile(char *root_dirpath, char *filename, bool send_file) {
-    // Combine root dirpath and filename to get full path
-    char filepath[1024] = "";
-    strcat(filepath, root_dirpath);
-    if (filepath[strlen(filepath)] != '/') strcat(filepath, "/");
-    strcat(filepath, filename);
-
+void openFile(char *filename, bool send_file, struct tftp_options *opts) {
     // Open file for read or write
     if (send_file) {
-        file = fopen(filepath, "rb");
-        if (file == NULL) sendErrorPacket(1, "File not found", true);
+        file_offset = 0;
+        if (opts->compress) {
+            openCompressedFile(filename);
+            return;
+        }
+        // File to send was opened by the listener
+        if (!storageIsOpen(&transfer_file)) sendErrorPacket(1, "File not found", true);
+
+        // Continue from resume offset only if client has the same data before it
+        if (opts->resume >= 0) {
+            uint32_t crc;
+            if (storageCrc32c(&transfer_file, opts->resume, &crc) < 0 || crc != opts->resume_crc) opts->resume = -1;
+            else file_offset = opts->resume;
+        }
     } else {
-        file = fopen(filepath, "rb"); // Check if file already exists
-        if (file != NULL) sendErrorPacket(6, "File already exists", true);
+        // Partially uploaded file is continued, otherwise the file must not exist. Destination of compressed upload
+        // is removed if the stream turns out to be malformed
+        int flags = STORAGE_WRITE | (opts->resume >= 0 ? STORAGE_APPEND : 0) | (opts->compress ? STORAGE_DISCARD : 0);
+        if (storageOpen(&storage, filename, flags, &transfer_file) < 0) sendStorageError("Couldn't create file");
+
+        // Client checks CRC32C of stored data before sending the rest
+        if (opts->resume >= 0) {
+            opts->resume = transfer_file.size;
+            if (storageCrc32c(&transfer_file, opts->resume, &opts->resume_crc) < 0) sendErrorPacket(0, "Couldn't read file", true);
+        }
+
+        // Compressed upload is received into temporary file and decompressed before the last block is acknowledged
+        if (opts->compress) {
+            decompress_file = transfer_file;
+            if (storageFileFromStream(&transfer_file, tmpfile()) < 0) sendErrorPacket(0, "Couldn't create file", true);
+        }
+    }
+}
+
+// Later modification time, nanoseconds included
+static bool mtimeAfter(const struct stat *a, const struct stat *b) {
+    return a->st_mtim.tv_sec > b->st_mtim.tv_sec || (a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec > b->st_mtim.tv_nsec);
+}
+
+/**
+ * @brief Serve compressed file of root directory as transfer file if it holds the current data of the file.
+ * Sidecar of administrator must be a valid stream not older than the file, every chunk is decompressed.
+ * Generated sidecar has the modification time of the file it was made from, only its chunk headers are checked
+ *
+ * @param root_fd root directory
+ * @param sidecar_name name of compressed file relative to root
+ * @param file_stat stat of the requested file
+ * @param generated sidecar was made by the server
+ *
+ * @return 0 if the sidecar is served, -1 otherwise
+ */
+int openSidecar(int root_fd, const char *sidecar_name, const struct stat *file_stat, bool generated) {
+    int fd = openat(root_fd, sidecar_name, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat sidecar_stat;
+    off_t raw_size;
+    bool fresh = fstat(fd, &sidecar_stat) == 0 && S_ISREG(sidecar_stat.st_mode);
+    if (fresh && generated) fresh = !mtimeAfter(&sidecar_stat, file_stat) && !mtimeAfter(file_stat, &sidecar_stat);
+    else if (fresh) fresh = !mtimeAfter(file_stat, &sidecar_stat);
+
+    if (fresh && compressCheckFile(fd, sidecar_stat.st_size, !generated, &raw_size) == 0 && raw_size == file_stat->st_size) {
+        if (storageFileFromFd(&transfer_file, fd) == 0) return 0;
+    }
+    close(fd);
+    return -1;
+}
+
+/**
+ * @brief Open compressed version of file for read. With posix storage sidecar file of administrator
+ * (filename + ".lz4") is served if it is valid and up to date, otherwise the server compresses the file once
+ * into the private directory of the root, so the next request for the same file doesn't have to compress it again.
+ * Other backends compress into anonymous temporary file
+ *
+ * @param filename name of the requested file
+ */
+void openCompressedFile(char *filename) {
+    const char *name = fdCacheRelative(filename);
+    int root_fd = storagePosixRoot(&storage);
+
+    struct storage_file original_file;
+    if (storageOpen(&storage, filename, STORAGE_READ, &original_file) < 0) sendStorageError("Couldn't read file");
+
+    char sidecar_name[MAX_FILENAME_LEN + 16] = "";
+    char cache_name[PATH_MAX] = "";
+    struct stat file_stat;
+    if (root_fd >= 0 && fstat(original_file.fd, &file_stat) == 0) {
+        snprintf(sidecar_name, sizeof(sidecar_name), "%s%s", name, COMPRESS_SIDECAR_EXT);
+        if (openSidecar(root_fd, sidecar_name, &file_stat, false) == 0) {
+            storageClose(&original_file);
+            return;
+        }
+        if (storagePrivateName(&storage, COMPRESS_CACHE_AREA, filename, cache_name, sizeof(cache_name)) < 0) cache_name[0] = '\0';
+        if (cache_name[0] != '\0' && openSidecar(root_fd, cache_name, &file_stat, true) == 0) {
+            storageClose(&original_file);
+            return;
+        }
+    }
 
-        file = fopen(filepath, "wb");
-        if (file == NULL) sendErrorPacket(0, "Couldn't create file", true);
+    FILE *original = storageStream(&original_file, "r");
+    if (original == NULL) sendErrorPacket(0, "Couldn't compress file", true);
+    FILE *compressed = NULL;
+
+    // Compress into temporary file next to the cached sidecar and rename it, so other processes never see partial
+    // sidecar. The sidecar gets modification time of the file it was made from
+    char tmp_name[PATH_MAX + 32] = "";
+    snprintf(tmp_name, sizeof(tmp_name), "%s.%d.tmp", cache_name, getpid());
+    int tmp_fd = cache_name[0] == '\0' ? -1 : openat(root_fd, tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    compressed = tmp_fd < 0 ? NULL : fdopen(tmp_fd, "w+b");
+    if (compressed != NULL) {
+        struct timespec times[2] = {file_stat.st_atim, file_stat.st_mtim};
+        if (compressStream(original, compressed) < 0 || futimens(tmp_fd, times) < 0 || renameat(root_fd, tmp_name, root_fd, cache_name) < 0) {
+            fclose(compressed);
+            unlinkat(root_fd, tmp_name, 0);
+            compressed = NULL;
+            rewind(original);
+        }
+    }
+
+    // If root directory isn't writable compress into anonymous temporary file
+    if (compressed == NULL) {
+        compressed = tmpfile();
+        if (compressed == NULL || compressStream(original, compressed) < 0) sendErrorPacket(0, "Couldn't compress file", true);
     }
+
+    fclose(original);
+    storageClose(&original_file);
+    if (storageFileFromStream(&transfer_file, compressed) < 0) sendErrorPacket(0, "Couldn't compress file", true);
+}
+
+/**
+ * @brief Decompress received upload from temporary file into the destination file, the destination is discarded
+ * if the stream is malformed
+ *
+ * @return 0 on success, -1 if the upload can't be decompressed
+ */
+int finishDecompression() {
+    if (!storageIsOpen(&decompress_file)) return 0;
+
+    FILE *compressed = storageStream(&transfer_file, "r");
+    FILE *dest = storageStream(&decompress_file, "w");
+    int result = 0;
+    if (compressed == NULL || dest == NULL || decompressStream(compressed, dest) < 0 || fflush(dest) != 0) result = -1;
+
+    if (compressed) fclose(compressed);
+    if (dest) fclose(dest);
+    storageClose(&transfer_file);
+    if (result < 0) {
+        storageClose(&decompress_file);
+        return -1;
+    }
+    transfer_file = decompress_file;
+    decompress_file.ops = NULL;
+    return 0;
+}
+
+/**
+ * @brief Send ERROR matching errno of failed commit instead of the last ACK
+ *
+ * @param session session receiving the file
+ */
+void abortCommit(struct tftp_session *session) {
+    char *error_msg = "Couldn't store file";
+    uint16_t error_code = storageErrorCode(&error_msg);
+    tftpSessionAbort(session, error_code, error_msg);
+}
+
+/**
+ * @brief Finish upload before its last block is acknowledged, compressed upload is decompressed and the file
+ * is committed, so the client learns whether it was stored
+ *
+ * @param session session receiving the file
+ *
+ * @return 0 on success, -1 after ERROR was sent
+ */
+int sessionFinish(struct tftp_session *session) {
+    if (finishDecompression() < 0) {
+        tftpSessionAbort(session, 0, "Couldn't decompress file");
+        return -1;
+    }
+    if (storageCommit(&transfer_file) < 0) {
+        abortCommit(session);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close file of the transfer when the child exits. Upload was committed before its last ACK, uncommitted
+ * upload is kept or discarded by the backend
+ */
+void closeTransferFile() {
+    storageClose(&decompress_file);
+    storageClose(&transfer_file);
 }
 
 /**
@@ -188,27 +471,21 @@ void openFile(char *root_dirpath, char *filename, bool send_file) {
  * @param error_msg error message
  */
 void sendErrorPacket(uint16_t error_code, char *error_msg, bool exit_failure) {
-    uint16_t opcode = ERROR_OPCODE;
+    char packet_buffer[MAX_ERROR_PACKET_SIZE];
+    int packet_buffer_len = tftpEncodeError(packet_buffer, sizeof(packet_buffer), error_code, error_msg);
 
-    opcode = htons(opcode);
-    error_code = htons(error_code);
-
-    // Set error packet
-    int packet_buffer_len = OPCODE_SIZE + EEROR_CODE_SIZE + strlen(error_msg) + 1;
-    char packet_buffer[packet_buffer_len];
-    bzero(packet_buffer, sizeof(packet_buffer));
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &error_code, 2);
-    memcpy(&packet_buffer[4], error_msg, strlen(error_msg));
-
-    // Send error packet
-    int bytes_tx = sendto(sockfd, packet_buffer, packet_buffer_len, 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
-    if (bytes_tx < 0) printError("sendto not successful", true);
+    // Send error packet, listener answers from its own socket
+    int error_sockfd = sockfd >= 0 ? sockfd : server_socket;
+    int bytes_tx = sendto(error_sockfd, packet_buffer, packet_buffer_len, 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
+    if (bytes_tx < 0) printError("sendto not successful", exit_failure);
 
     // Used while receiving RQ packet so the main process doesnt get terminated
-    if (!exit_failure) printError(error_msg, false);
+    if (!exit_failure) {
+        printError(error_msg, false);
+        return;
+    }
     // Print local error
-    if (ntohs(error_code) != 5) printError(error_msg, true);
+    if (error_code != 5) printError(error_msg, true);
     else printError(error_msg, false);
 }
 
@@ -216,81 +493,35 @@ void sendErrorPacket(uint16_t error_code, char *error_msg, bool exit_failure) {
  * @brief Handler for error packet. If error code isn't 5 terminate process
  *
  * @param packet error packet
+ * @param len length of error packet
  */
-void handleErrorPacket(char *packet) {
-    uint16_t error_code;
+void handleErrorPacket(char *packet, int len) {
+    uint16_t error_code = 0;
+    const char *error_msg = "";
 
     // Get code and message
-    memcpy(&error_code, &packet[2], 2);
-    error_code = ntohs(error_code);
-    char *error_msg = &packet[4];
+    tftpDecodeError(packet, len, &error_code, &error_msg);
 
     // Print ERROR packet
-    printErrorPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), error_code, error_msg);
+    printErrorPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), error_code, (char *)error_msg);
 
     // Print local error
-    if (error_code == 5) printError(error_msg, false);
-    else printError(error_msg, true);
+    if (error_code == 5) printError((char *)error_msg, false);
+    else printError((char *)error_msg, true);
 }
 
 /**
- * @brief Send OACK packet with blksize and timeout, if they are not default values
+ * @brief Encode OACK packet with options that are not default values, the session sends it
  *
- * @param blksize set blksize if not default in options
- * @param timeout set timeout if not default in options
+ * @param opts acknowledged options
  * 
- * @return bytes sent
+ * @return length of OACK packet
  */
-int sendOackPacket(int blksize, int timeout) {
-    uint16_t opcode = OACK_OPCODE;
-
-    // Set necessary variables for blksize option
-    char blksize_opt[] = "blksize";
-    char blksize_val[1024];
-    bzero(blksize_val, sizeof(blksize_val));
-    sprintf(blksize_val, "%d", blksize);
-
-    // Set necewssary variables for timeout option
-    char timeout_opt[] = "timeout";
-    char timeout_val[1024];
-    bzero(timeout_val, sizeof(timeout_val));
-    sprintf(timeout_val, "%d", timeout);
-
-    opcode = htons(opcode);
-
-    // Calculate length of packet based on options
-    int packet_buffer_len = OPCODE_SIZE;
-    if (blksize != DEFAULT_BLKSIZE) packet_buffer_len += strlen(blksize_opt) + 1 + strlen(blksize_val) + 1;
-    if (blksize != DEFAULT_TIMEOUT) packet_buffer_len += strlen(timeout_opt) + 1 + strlen(timeout_val) + 1;
-
-    // Declare packet and set opcode 
-    char packet_buffer[packet_buffer_len];
-    bzero(packet_buffer, sizeof(packet_buffer));
-    int curr_byte = 0; // For easier indexing of packet
-    memcpy(&packet_buffer[curr_byte], &opcode, OPCODE_SIZE);
-    curr_byte += OPCODE_SIZE;
-
-    // Add blksize option to OACK packet if not default
-    if (blksize != DEFAULT_BLKSIZE) {
-        memcpy(&packet_buffer[curr_byte], blksize_opt, strlen(blksize_opt));
-        curr_byte += strlen(blksize_opt) + 1;
-        memcpy(&packet_buffer[curr_byte], blksize_val, strlen(blksize_val));
-        curr_byte += strlen(blksize_val) + 1;
-    }
-
-    // Add timeout option to OACK packet if not default
-    if (timeout != DEFAULT_TIMEOUT) {
-        memcpy(&packet_buffer[curr_byte], timeout_opt, strlen(timeout_opt));
-        curr_byte += strlen(timeout_opt) + 1;
-        memcpy(&packet_buffer[curr_byte], timeout_val, strlen(timeout_val));
-        curr_byte += strlen(timeout_val) + 1;
-    }
-
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
-    if (bytes_tx < 0) printError("sendto not succesful", true);
+int encodeOackPacket(struct tftp_options *opts) {
+    oack_packet_len = tftpEncodeOack(oack_packet, sizeof(oack_packet), opts);
+    if (oack_packet_len < 0) printError("OACK packet too long", true);
 
-    return bytes_tx;
+    return oack_packet_len;
 }
 
 /**
@@ -298,35 +529,20 @@ int sendOackPacket(int blksize, int timeout) {
  *
  * @param rq_packet rq packet
  * @param bytes_rx length of rq packet
- * @param blksize to set blksize if in potions
- * @param timeout to set timeout if in potions
+ * @param options_offset offset of first option in rq packet
+ * @param opts to set options found in rq packet
+ * 
+ * @return 0 on success, -1 if options are malformed
  */
-void handleOptions(char *rq_packet, size_t bytes_rx, int *blksize, int *timeout) {
-    char blcksize_opt[] = "blksize";
-    char timeout_opt[] = "timeout";
-
-    // Calculate how many bytes are filename and mode for indexing options
-    int filename_len = strlen(&rq_packet[2]);
-    int mode_len = strlen(&rq_packet[2 + filename_len + 1]);
+int handleOptions(char *rq_packet, size_t bytes_rx, size_t options_offset, struct tftp_options *opts) {
+    unsigned seen;
 
-    int bytes_processed = 2 + filename_len + 1 + mode_len + 1; // For easier indexing of packet
+    if (tftpParseOptions(rq_packet, bytes_rx, options_offset, opts, &seen) < 0) return -1;
 
-    char *option;
-    char *value;
+    // Resume offset can't be verified without checksum
+    if ((seen & OPT_SEEN_RESUME) && !(seen & OPT_SEEN_CRC32C)) opts->resume = -1;
 
-    // Loop through pairs of option and value and save them if recognized
-    while (bytes_processed < bytes_rx) {
-        option = &rq_packet[bytes_processed];
-        bytes_processed += strlen(option) + 1;
-        value = &rq_packet[bytes_processed];
-        bytes_processed += strlen(value) + 1;
-
-        if (!strcmp(option, blcksize_opt)) {
-            *blksize = atoi(value);
-        } else if (!strcmp(option, timeout_opt)) {
-            *timeout = atoi(value);
-        }
-    }
+    return 0;
 }
 
 /**
@@ -335,31 +551,39 @@ void handleOptions(char *rq_packet, size_t bytes_rx, int *blksize, int *timeout)
  * @param mode to set mode received in rq packet
  * @param filename to set mode filename in rq packet
  * @param send_file to set send_file if server is sending file else false
- * @param blksize get blksize if any in options
- * @param timeout get timeout if any in options
+ * @param opts get options if any in rq packet
  * 
  * @return bytes received
  */
-int receiveRqPacket(char *mode, char *filename, bool *send_file, int *blksize, int *timeout) {
-    char packet_buffer[DEFAULT_BLKSIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
-
+int receiveRqPacket(char *mode, char *filename, bool *send_file, struct tftp_options *opts) {
     // Receive packet
-    int bytes_rx = recvfrom(server_socket, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
+    int bytes_rx = recvfrom(server_socket, rq_packet, MAX_RQ_PACKET_SIZE, 0, (struct sockaddr *) &recv_addr, &recv_len);
     if (bytes_rx < 0) {
         printError("recvfrom not succesful", false);
         return -1; // Return -1 so the main server process doesn't fork
     }
+
+    return parseRqPacket(bytes_rx, mode, filename, send_file, opts);
+}
+
+/**
+ * @brief Check RQ packet received into rq_packet from recv_addr, set parameters and get options if any
+ *
+ * @param bytes_rx length of packet
+ * @param mode to set mode received in rq packet
+ * @param filename to set mode filename in rq packet
+ * @param send_file to set send_file if server is sending file else false
+ * @param opts get options if any in rq packet
+ *
+ * @return bytes_rx, -1 if the packet isn't valid request (error was sent)
+ */
+int parseRqPacket(int bytes_rx, char *mode, char *filename, bool *send_file, struct tftp_options *opts) {
     if (bytes_rx < 2) {
         sendErrorPacket(4, "Illegal TFTP operation.", false);
         return -1; // Return -1 so the main server process doesn't fork
     }
 
-    uint16_t opcode;
-
-    memcpy(&opcode, &packet_buffer[0], 2);
-
-    opcode = ntohs(opcode);
+    uint16_t opcode = tftpGetOpcode(rq_packet);
 
     // Decide whether it is download or upload
     if (opcode == RRQ_OPCODE) *send_file = true;
@@ -370,262 +594,712 @@ int receiveRqPacket(char *mode, char *filename, bool *send_file, int *blksize, i
     }
 
     // Get filename and mode
-    strcpy(filename, &packet_buffer[2]);
-    strcpy(mode, &packet_buffer[2 + strlen(filename) + 1]);
+    const char *rq_filename;
+    const char *rq_mode;
+    size_t options_offset;
+    if (tftpDecodeRq(rq_packet, bytes_rx, &rq_filename, &rq_mode, &options_offset) < 0 ||
+        strlen(rq_filename) >= MAX_FILENAME_LEN || strlen(rq_mode) >= MAX_MODE_LEN) {
+        sendErrorPacket(4, "Illegal TFTP operation.", false);
+        return -1; // Return -1 so the main server process doesn't fork
+    }
+    strcpy(filename, rq_filename);
+    strcpy(mode, rq_mode);
 
     // If there are more bytes after mode handle options
-    if (OPCODE_SIZE + strlen(filename) + 1 + strlen(mode) + 1 < bytes_rx) {
-        handleOptions(packet_buffer, bytes_rx, blksize, timeout);
+    if (options_offset < (size_t)bytes_rx && handleOptions(rq_packet, bytes_rx, options_offset, opts) < 0) {
+        sendErrorPacket(8, "Malformed options", false);
+        return -1; // Return -1 so the main server process doesn't fork
     }
 
     // Print RQ packet
     if (opcode == RRQ_OPCODE) {
-        printRqPacket("RRQ", inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), filename, mode, *blksize, *timeout);
+        printRqPacket("RRQ", inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), filename, mode, opts->blksize, opts->timeout);
     } else if (opcode == WRQ_OPCODE) {
-        printRqPacket("WRQ", inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), filename, mode, *blksize, *timeout);
+        printRqPacket("WRQ", inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), filename, mode, opts->blksize, opts->timeout);
     }
 
     // Cancel inavalid option values
-    if (*blksize < MIN_BLKSIZE || *blksize > MAX_BLKSIZE) {
-        *blksize = DEFAULT_BLKSIZE;
+    if (opts->blksize < MIN_BLKSIZE || opts->blksize > MAX_BLKSIZE) {
+        opts->blksize = DEFAULT_BLKSIZE;
+    }
+    if (opts->timeout < MIN_TIMEOUT || opts->timeout > MAX_TIMEOUT) {
+        opts->timeout = DEFAULT_TIMEOUT;
+    }
+    // Bigger window is answered with the biggest supported one (RFC 7440)
+    if (opts->windowsize < MIN_WINDOWSIZE) {
+        opts->windowsize = DEFAULT_WINDOWSIZE;
+    } else if (opts->windowsize > MAX_WINDOWSIZE) {
+        opts->windowsize = MAX_WINDOWSIZE;
+    }
+    // Ranges of ACK, congestion window and parity are useful only with more blocks in flight, parity group
+    // fits into the window
+    if (opts->windowsize == 1) {
+        opts->sack = false;
+        opts->cwnd = false;
+    }
+    if (opts->fec < MIN_FEC_GROUP || opts->windowsize == 1) {
+        opts->fec = 0;
+    } else if (opts->fec > MAX_FEC_GROUP || opts->fec > opts->windowsize) {
+        opts->fec = opts->windowsize < MAX_FEC_GROUP ? opts->windowsize : MAX_FEC_GROUP;
+    }
+    // Compressed stream is binary, netascii conversion would corrupt it
+    if (strcmp(mode, "octet") != 0) {
+        opts->compress = false;
     }
-    if (*timeout < MIN_TIMEOUT || *timeout > MAX_TIMEOUT) {
-        *timeout = DEFAULT_TIMEOUT;
+    // Offsets of netascii or compressed stream don't match offsets in the file, partial uploads are kept only
+    // by backends that can continue them
+    if (opts->resume < 0 || opts->compress || strcmp(mode, "octet") != 0 || (!*send_file && !storageResumable(&storage))) {
+        opts->resume = -1;
     }
 
     return bytes_rx;
 }
 
 /**
- * @brief Send DATA packet, set opcode, read blksize bytes of data and set it in packet
+ * @brief Find file of request in the listener. Virtual file is rendered, missing file is answered from
+ * the negative cache and file to send is opened, so the transfer inherits the cached descriptor
  *
- * @param block expected block number of data
- * @param blksize size of payload data
- * @param is_retransmit seek cursor backward in file so new data aren't read
- * 
- * @return bytes sent
+ * @param filename requested file
+ * @param send_file server is sending file
+ * @param opts options of request, compression is dropped for virtual files
+ * @param has_options set if the answer is OACK
+ * @param now current time
+ *
+ * @return 0 on success, -1 if the request was answered with error
  */
-int sendDataPacket(uint16_t block, int blksize, bool is_retransmit, char *mode) {
-    static int bytes_read;
-    uint16_t opcode = DATA_OPCODE;
-    
-    // Create DATA packet
-    char packet_buffer[blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
+int prepareRequest(char *filename, bool send_file, struct tftp_options *opts, bool *has_options, time_t now) {
+    *has_options = tftpHasOptions(opts);
+
+    // Missing files are answered directly, PXE clients probe many config names that don't exist
+    negCacheProcessEvents(&neg_cache);
+
+    // Virtual files are rendered in the listener and kept in its cache, children send the rendered data
+    transfer_file.ops = NULL;
+    int virtual_file = send_file ? vfileOpen(&vfiles, &storage, filename, recv_addr.sin_addr, now, &transfer_file) : 0;
+    if (virtual_file < 0) {
+        sendErrorPacket(errno == ENOENT ? 1 : 0, errno == ENOENT ? "File not found" : "Couldn't render file", false);
+        return -1;
+    }
+    // Rendered files are small, they are sent uncompressed
+    if (virtual_file && opts->compress) {
+        opts->compress = false;
+        *has_options = tftpHasOptions(opts);
+    }
 
-    block = htons(block);
-    opcode = htons(opcode);
+    if (send_file && !virtual_file && negCacheLookup(&neg_cache, filename, now)) {
+        sendErrorPacket(1, "File not found", false);
+        return -1;
+    }
 
-    // Set opcode and block number
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &block, 2);
+    // File to send is opened in the listener, so the child inherits the cached descriptor
+    if (send_file && !virtual_file && !opts->compress && storageOpen(&storage, filename, STORAGE_READ, &transfer_file) < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) negCacheInsert(&neg_cache, filename, now);
+        sendErrorPacket(1, "File not found", false);
+        return -1;
+    }
 
-    // If the data packet is being retransmited seek cursor backward, so the right data are sent
-    if (is_retransmit) fseek(file, -bytes_read, SEEK_END);
+    return 0;
+}
 
-    // Replace \n with \r\n if the mode is netascii
-    if (strcmp(mode, "netascii") == 0) {
-        char ch[2];
-        bzero(ch, sizeof(ch));
-        for (int i = 0; i < blksize; i++) {
-            if (fread(ch, sizeof(char), 1, file) == 0) {
-                break;
-            }
-            bytes_read = i + 1;
-            if (!strcmp(ch, "\n")) {
-                strcat(&packet_buffer[4], "\r\n");
-                i++;
-            } else {
-                strcat(&packet_buffer[4], ch);
-            }
+/**
+ * @brief Read up to cap bytes of file converted to netascii
+ *
+ * @param file file being sent
+ * @param offset offset of the next read of file
+ * @param state conversion state of the transfer
+ * @param dst destination for converted data
+ * @param cap maximum number of bytes to write
+ * 
+ * @return bytes written
+ */
+int readNetascii(struct storage_file *file, off_t *offset, struct netascii_state *state, char *dst, int cap) {
+    int written = 0;
+
+    while (written < cap) {
+        // Refill buffer with data from file
+        if (state->pos == state->len && state->pending < 0) {
+            ssize_t bytes_read = storageRead(file, state->buffer, state->cap, *offset);
+            if (bytes_read <= 0) break;
+            state->len = bytes_read;
+            state->pos = 0;
+            *offset += bytes_read;
         }
-    } else {
-        bytes_read = fread(&packet_buffer[4], sizeof(char), blksize, file);
-    }
 
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, bytes_read + OPCODE_SIZE + BLOCK_NUMBER_SIZE, 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
-    if (bytes_tx < 0) printError("sendto not successful", true);
+        size_t used;
+        written += tftpNetasciiEncode(&state->buffer[state->pos], state->len - state->pos, &used, &dst[written], cap - written, &state->pending);
+        state->pos += used;
+    }
 
-    return bytes_tx;
+    return written;
 }
 
 /**
- * @brief Receive DATA packet, check opcode, receive blksize bytes of payload data and write it to file
+ * @brief Send packet of the session to the client
  *
- * @param expected_block expected block number of data
- * @param blksize size of payload data
+ * @param session session sending the packet
+ * @param packet packet to send
+ * @param len length of packet
  * 
- * @return bytes received
+ * @return bytes sent
  */
-int receiveDataPacket(uint16_t expected_block, int blksize, char *mode) {
-    // Create packet
-    char packet_buffer[blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
-
-    // Receive packet
-    int bytes_rx = recvfrom(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
-    if (bytes_rx < 0) printError("recvfrom not succesful", true);
-    if (bytes_rx < 4) sendErrorPacket(4, "Illegal TFTP operation.", true);
+int sessionSend(struct tftp_session *session, const char *packet, size_t len) {
+    // DATA and PARITY packets wait for their turn and tokens of the scheduler
+    if (sched_flow >= 0 && (tftpGetOpcode(packet) == DATA_OPCODE || tftpGetOpcode(packet) == FEC_OPCODE)) {
+        long long wait_ns = trace.enabled ? traceClockNs() : 0;
+        schedAcquire(sched, sched_flow, len + SCHED_OVERHEAD);
+        if (trace.enabled) traceComplete(&trace, "sched_wait", wait_ns, traceClockNs(), tftpGetBlock(packet));
+    }
 
-    uint16_t opcode;
-    uint16_t block;
+    if (low_latency) latencyOnSend(&latency, packet, len, session->retries > 0, lowlatClockUs());
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
 
-    // Get opcode and block number
-    memcpy(&opcode, &packet_buffer[0], 2);
-    memcpy(&block, &packet_buffer[2], 2);
+    int bytes_tx = sendto(sockfd, packet, len, 0, (struct sockaddr *) &client_addr, sizeof(client_addr));
+    if (bytes_tx < 0) printError("sendto not successful", true);
 
-    opcode = ntohs(opcode);
-    block = ntohs(block);
+    if (trace.enabled) {
+        uint16_t opcode = tftpGetOpcode(packet);
+        long block = (opcode == DATA_OPCODE || opcode == ACK_OPCODE) && len >= DATA_HEADER_SIZE ? tftpGetBlock(packet) : -1;
+        traceComplete(&trace, session->retries > 0 ? "retransmit" : "send", start_ns, traceClockNs(), block);
+    }
 
-    // Check opcode and block
-    if (opcode == ERROR_OPCODE) handleErrorPacket(packet_buffer);
-    else if (opcode != DATA_OPCODE) sendErrorPacket(4, "Illegal TFTP operation.", true);
+    return bytes_tx;
+}
 
-    if (block != expected_block) sendErrorPacket(4, "Illegal TFTP operation.", true);
+/**
+ * @brief Read payload of the next DATA packet, converted to netascii if the mode is netascii
+ *
+ * @param session session sending the file, its context is transfer mode
+ * @param dst destination for data
+ * @param cap maximum number of bytes (blksize)
+ * 
+ * @return bytes read, -1 on error
+ */
+int sessionRead(struct tftp_session *session, char *dst, size_t cap) {
+    char *mode = session->ctx;
 
-    char data[blksize + 1];
-    bzero(data, sizeof(data));
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
+    ssize_t bytes_read;
 
-    // Read data from packet. If netassci ignore \r
+    // Replace \n with \r\n if the mode is netascii
     if (strcmp(mode, "netascii") == 0) {
-        char ch;
-        int bytes_written = 0;
-        for (int i = 0; i < bytes_rx - OPCODE_SIZE - BLOCK_NUMBER_SIZE; i++) {
-            ch = packet_buffer[4 + i];
-            if (ch == '\r') {
-                continue;
-            }
-            else {
-                data[bytes_written] = ch;
-                bytes_written++;
-            }
-        }
+        bytes_read = readNetascii(&transfer_file, &file_offset, &netascii, dst, cap);
     } else {
-        memcpy(data, &packet_buffer[4], bytes_rx - OPCODE_SIZE - BLOCK_NUMBER_SIZE);
+        bytes_read = storageRead(&transfer_file, dst, cap, file_offset);
+        if (bytes_read < 0) return -1;
+        file_offset += bytes_read;
     }
-    // Write data to file
-    if (fprintf(file, "%s", data) < 0) sendErrorPacket(3, "Disk full or allocation exceeded", true);
 
-    // Print DATA packet
-    printDataPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), block);
+    // Block of the DATA packet being filled
+    if (trace.enabled) traceComplete(&trace, "read", start_ns, traceClockNs(), session->block);
 
-    return bytes_rx;
+    return bytes_read;
 }
 
 /**
- * @brief Send ACK packet, set opcode and set block number with block param
+ * @brief Write payload of received DATA packet to file
  *
- * @param block block number to send the ack for
+ * @param session session receiving the file, its context is transfer mode
+ * @param data payload of DATA packet
+ * @param len length of payload
  * 
- * @return bytes sent
+ * @return 0 on success, -1 if data couldn't be written
  */
-int sendAckPacket(uint16_t block) {
-    uint16_t opcode = ACK_OPCODE;
+int sessionWrite(struct tftp_session *session, char *data, size_t len) {
+    char *mode = session->ctx;
 
-    // Create ACK packet
-    char packet_buffer[ACK_PACKET_SIZE];
-    bzero(packet_buffer, 4);
+    // Data are written directly from packet. If netascii convert them in place
+    if (strcmp(mode, "netascii") == 0) len = tftpNetasciiDecode(data, len, &netascii.cr_pending);
 
-    block = htons(block);
-    opcode = htons(opcode);
+    long long start_ns = trace.enabled ? traceClockNs() : 0;
+    if (storageWrite(&transfer_file, data, len) != (ssize_t)len) return -1;
+    if (trace.enabled) traceComplete(&trace, "write", start_ns, traceClockNs(), (uint16_t)(session->block + 1));
 
-    // Set ACK packet
-    memcpy(&packet_buffer[0], &opcode, 2);
-    memcpy(&packet_buffer[2], &block, 2);
+    return 0;
+}
 
-    // Send packet
-    int bytes_tx = sendto(sockfd, packet_buffer, ACK_PACKET_SIZE, 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
-    if (bytes_tx < 0) printError("sendto not succesful", true);
+/**
+ * @brief Print packet received by the session
+ *
+ * @param session session that received the packet
+ * @param packet received packet
+ * @param len length of packet
+ */
+void sessionPrintPacket(struct tftp_session *session, const char *packet, size_t len) {
+    (void)session;
+    if (len < OPCODE_SIZE) return;
+
+    uint16_t opcode = tftpGetOpcode(packet);
+    if (opcode == ERROR_OPCODE) {
+        uint16_t error_code = 0;
+        const char *error_msg = "";
+        tftpDecodeError(packet, len, &error_code, &error_msg);
+        printErrorPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), error_code, (char *)error_msg);
+        return;
+    }
+    if (len < DATA_HEADER_SIZE) return;
 
-    return bytes_tx;
+    if (opcode == DATA_OPCODE) {
+        printDataPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), ntohs(src_addr.sin_port), tftpGetBlock(packet));
+    } else if (opcode == ACK_OPCODE) {
+        printAckPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), tftpGetBlock(packet), NULL, NULL);
+    }
 }
 
 /**
- * @brief Receive ACK packet, chceck opcode and compare expected block number with received block number
+ * @brief Compare address and port of two endpoints
  *
- * @param expected_block expected block number of ack
- * 
- * @return bytes received
+ * @param a first address
+ * @param b second address
+ *
+ * @return true if the addresses identify the same transfer endpoint
  */
-int receiveAckPacket(uint16_t expected_block) {
-    char packet_buffer[DEFAULT_BLKSIZE];
-    bzero(packet_buffer, sizeof(packet_buffer));
+bool sameTid(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
 
-    // Receive ACK buffer
-    int bytes_rx = recvfrom(sockfd, packet_buffer, sizeof(packet_buffer), 0, (struct sockaddr *) &recv_addr, &recv_len);
-    if (bytes_rx < 0) printError("recvfrom not succesful", true);
-    if (bytes_rx < 4) sendErrorPacket(4, "Illegal TFTP operation.", true);
+/**
+ * @brief Drive session with packets received on sockfd and real time until the transfer ends
+ *
+ * @param session started session
+ */
+void runSession(struct tftp_session *session) {
+    const char *wait_name = session->role == TFTP_ROLE_SENDER ? "ack_wait" : "data_wait";
+
+    while (!tftpSessionFinished(session)) {
+        long long wait_ns = trace.enabled ? traceClockNs() : 0;
+        if (handleTimeout(tftpSessionDeadline(session) - tftpClockMs())) {
+            // Delayed ACK of windowed receiver isn't a timeout
+            if (!session->ack_pending) printError("timed out", false);
+            if (trace.enabled) {
+                long long now_ns = traceClockNs();
+                traceComplete(&trace, wait_name, wait_ns, now_ns, session->block);
+                if (!session->ack_pending) traceInstant(&trace, "timeout", now_ns, session->block);
+            }
+            tftpSessionOnTimer(session, tftpClockMs());
+            continue;
+        }
 
-    uint16_t opcode;
-    uint16_t block;
+        size_t rx_cap;
+        char *rx_packet = tftpSessionRxBuffer(session, &rx_cap);
+        if (rx_packet == NULL) break;
 
-    // Get block and opcode
-    memcpy(&opcode, &packet_buffer[0], 2);
-    memcpy(&block, &packet_buffer[2], 2);
+        int bytes_rx = recvfrom(sockfd, rx_packet, rx_cap, 0, (struct sockaddr *) &recv_addr, &recv_len);
+        if (bytes_rx < 0) printError("recvfrom not succesful", true);
+        long long rx_us = lowlatClockUs();
+        if (trace.enabled) traceComplete(&trace, wait_name, wait_ns, traceClockNs(), session->block);
 
-    opcode = ntohs(opcode);
-    block = ntohs(block);
+        // Packet from another port or host doesn't belong to the transfer (RFC 1350 section 4)
+        if (!sameTid(&recv_addr, &client_addr)) {
+            sendErrorPacket(5, "Unknown transfer ID", false);
+            recv_addr = client_addr;
+            continue;
+        }
+
+        uint16_t block = session->block;
+        enum tftp_session_state state = session->state;
+        long long sent_us = latency.last_tx_us;
 
-    // Check opcode and block
-    if (opcode == ERROR_OPCODE) handleErrorPacket(packet_buffer);
-    else if (opcode != ACK_OPCODE) sendErrorPacket(4, "Illegal TFTP operation, unexpected opcode", true);
-    if (block != expected_block) sendErrorPacket(4, "Illegal TFTP operation, unexpected opcode", true);
+        tftpSessionOnPacket(session, rx_packet, bytes_rx, tftpClockMs());
 
-    // Print packet
-    printAckPacket(inet_ntoa(recv_addr.sin_addr), ntohs(recv_addr.sin_port), block, NULL, NULL);
+        // Packet that moved the transfer to the next block answered the last packet sent
+        bool advanced = state == TFTP_SESSION_TRANSFER && (session->block != block || session->state == TFTP_SESSION_DONE);
+        if (low_latency) latencyOnReceive(&latency, rx_packet, bytes_rx, advanced ? sent_us : -1, rx_us);
+    }
 
+    tftpSessionRelease(session);
+    if (session->state == TFTP_SESSION_FAILED) printError(session->error_msg, true);
+    if (session->opts.windowsize > 1) tftpSessionPrintStats(session, stdout);
 
-    return bytes_rx;
+    if (low_latency) {
+        latencyPrint(&latency);
+        latencyDestroy(&latency);
+    }
+}
+
+/**
+ * @brief Write events of the traced session when the child exits, also on exit through printError
+ */
+void flushTrace() {
+    traceClose(&trace);
+}
+
+/**
+ * @brief Unregister transfer from the scheduler when the child exits, also on exit through printError
+ */
+void closeSchedFlow() {
+    if (sched_flow >= 0) schedClose(sched, sched_flow);
+    sched_flow = -1;
 }
 
 /**
  * @brief Waits for data to be available to receive
  *
- * @param timeout time to wait (s)
+ * @param timeout time to wait (ms)
  * 
  * @return 1 if timed out, 0 if data are available to rece
  */
-int handleTimeout(int timeout) {
+int handleTimeout(long long timeout) {
     fd_set fds;
     struct timeval tv;
 
     FD_ZERO(&fds);
     FD_SET(sockfd, &fds);
 
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
+    if (timeout < 0) timeout = 0;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
 
-    int n = select(sockfd + 1, &fds, NULL, NULL, &tv);
+    // Low-latency mode spins on the socket before blocking
+    int n = low_latency ? lowlatWait(sockfd, timeout) : select(sockfd + 1, &fds, NULL, NULL, &tv);
 
     if (n < 0) {
         printError("select failed", true);
     } else if (n == 0) {
-        printError("timed out", false);
         return 1; 
     }
     return 0;
 }
 
+/**
+ * @brief Send packet of demultiplexed session from the socket its request arrived on
+ *
+ * @param session session sending the packet, its context is the transfer
+ * @param packet packet to send
+ * @param len length of packet
+ *
+ * @return bytes sent, -1 on error
+ */
+int demuxSend(struct tftp_session *session, const char *packet, size_t len) {
+    struct demux_transfer *transfer = session->ctx;
+    return sendto(transfer->sockfd, packet, len, 0, (struct sockaddr *) &transfer->peer, sizeof(transfer->peer));
+}
+
+/**
+ * @brief Read payload of the next DATA packet of demultiplexed session
+ *
+ * @param session session sending the file, its context is the transfer
+ * @param dst destination for data
+ * @param cap maximum number of bytes (blksize)
+ *
+ * @return bytes read, -1 on error
+ */
+int demuxRead(struct tftp_session *session, char *dst, size_t cap) {
+    struct demux_transfer *transfer = session->ctx;
+    if (transfer->netascii_mode) return readNetascii(&transfer->file, &transfer->offset, &transfer->netascii, dst, cap);
+
+    ssize_t bytes_read = storageRead(&transfer->file, dst, cap, transfer->offset);
+    if (bytes_read < 0) return -1;
+    transfer->offset += bytes_read;
+    return bytes_read;
+}
+
+/**
+ * @brief Write payload of DATA packet received by demultiplexed session
+ *
+ * @param session session receiving the file, its context is the transfer
+ * @param data payload of DATA packet
+ * @param len length of payload
+ *
+ * @return 0 on success, -1 if data couldn't be written
+ */
+int demuxWrite(struct tftp_session *session, char *data, size_t len) {
+    struct demux_transfer *transfer = session->ctx;
+    if (transfer->netascii_mode) len = tftpNetasciiDecode(data, len, &transfer->netascii.cr_pending);
+    return storageWrite(&transfer->file, data, len) == (ssize_t)len ? 0 : -1;
+}
+
+/**
+ * @brief Commit uploaded file before the last block is acknowledged
+ *
+ * @param session session receiving the file, its context is the transfer
+ *
+ * @return 0 on success, -1 after ERROR was sent
+ */
+int demuxFinish(struct tftp_session *session) {
+    struct demux_transfer *transfer = session->ctx;
+    if (storageCommit(&transfer->file) < 0) {
+        abortCommit(session);
+        return -1;
+    }
+    return 0;
+}
+
+static const struct tftp_session_io demux_io = {
+    .send = demuxSend,
+    .read = demuxRead,
+    .write = demuxWrite,
+    .finish = demuxFinish,
+    .on_packet = sessionPrintPacket,
+};
+
+// Retransmission timer of demultiplexed session expired
+static void demuxTimerExpired(struct tftp_timer *timer, long long now) {
+    struct demux_transfer *transfer = timer->ctx;
+    bool delayed_ack = transfer->session.ack_pending;
+
+    if (tftpSessionOnTimer(&transfer->session, now) && !delayed_ack) printError("timed out", false);
+    if (tftpSessionFinished(&transfer->session)) demuxEnd(transfer);
+    else timerWheelArm(&demux_wheel, &transfer->timer, tftpSessionDeadline(&transfer->session));
+}
+
+/**
+ * @brief Start transfer of request received into demux_packet from recv_addr. Files are opened the same way
+ * forked transfers open them, but errors are answered without exiting
+ *
+ * @param socket socket the request arrived on
+ * @param bytes_rx length of request
+ * @param now current time (ms)
+ */
+void demuxStart(int socket, int bytes_rx, long long now) {
+    char mode[MAX_MODE_LEN] = "";
+    char filename[MAX_FILENAME_LEN] = "";
+    struct tftp_options opts;
+    bool send_file;
+    bool has_options;
+
+    tftpOptionsInit(&opts);
+    if (bytes_rx > MAX_RQ_PACKET_SIZE) bytes_rx = MAX_RQ_PACKET_SIZE;
+    memcpy(rq_packet, demux_packet, bytes_rx);
+    if (parseRqPacket(bytes_rx, mode, filename, &send_file, &opts) < 0) return;
+
+    // Compression needs temporary file of every transfer, it is declined
+    opts.compress = false;
+    if (demux_free_count == 0) {
+        sendErrorPacket(0, "Too many transfers", false);
+        return;
+    }
+    if (prepareRequest(filename, send_file, &opts, &has_options, time(NULL)) < 0) return;
+
+    struct demux_transfer *transfer = &demux_transfers[demux_free[demux_free_count - 1]];
+    transfer->file = transfer_file;
+    transfer_file.ops = NULL;
+    transfer->offset = 0;
+
+    char *error_msg = NULL;
+    uint16_t error_code = 0;
+    if (send_file) {
+        // File stays open in the listener while its caches serve other requests
+        if (storageDetach(&transfer->file) < 0) error_msg = "Couldn't open file";
+
+        // Continue from resume offset only if client has the same data before it
+        uint32_t crc;
+        if (error_msg == NULL && opts.resume >= 0) {
+            if (storageCrc32c(&transfer->file, opts.resume, &crc) < 0 || crc != opts.resume_crc) opts.resume = -1;
+            else transfer->offset = opts.resume;
+        }
+    } else {
+        // Partially uploaded file is continued, otherwise the file must not exist
+        int flags = STORAGE_WRITE | (opts.resume >= 0 ? STORAGE_APPEND : 0);
+        if (storageOpen(&storage, filename, flags, &transfer->file) < 0) {
+            error_msg = "Couldn't create file";
+            error_code = storageErrorCode(&error_msg);
+        } else if (opts.resume >= 0) {
+            opts.resume = transfer->file.size;
+            if (storageCrc32c(&transfer->file, opts.resume, &opts.resume_crc) < 0) error_msg = "Couldn't read file";
+        }
+    }
+
+    transfer->netascii_mode = strcmp(mode, "netascii") == 0;
+    transfer->netascii = (struct netascii_state){.pending = -1};
+    if (error_msg == NULL && transfer->netascii_mode && send_file) {
+        transfer->netascii.buffer = poolAlloc(&buffer_pool, DEMUX_NETASCII_BUFFER, &transfer->netascii.cap);
+        if (transfer->netascii.buffer == NULL) error_msg = "Couldn't allocate buffers";
+    }
+
+    if (error_msg != NULL) {
+        storageClose(&transfer->file);
+        sendErrorPacket(error_code, error_msg, false);
+        return;
+    }
+
+    transfer->sockfd = socket;
+    transfer->peer = recv_addr;
+    demux_free_count--;
+    demuxInsert(&demux_table, &transfer->peer, transfer->index);
+
+    // If handling options the session starts with OACK, otherwise with DATA 1 or ACK 0
+    if (has_options) encodeOackPacket(&opts);
+
+    tftpSessionInit(&transfer->session, send_file ? TFTP_ROLE_SENDER : TFTP_ROLE_RECEIVER, &demux_io, transfer, NULL, 0);
+    tftpSessionSetPool(&transfer->session, &buffer_pool);
+    transfer->session.opts = opts;
+    tftpSessionStart(&transfer->session, has_options ? oack_packet : NULL, oack_packet_len, false, now);
+
+    if (tftpSessionFinished(&transfer->session)) demuxEnd(transfer);
+    else timerWheelArm(&demux_wheel, &transfer->timer, tftpSessionDeadline(&transfer->session));
+}
+
+/**
+ * @brief End demultiplexed transfer, uploaded file was committed before its last ACK
+ *
+ * @param transfer transfer
+ */
+void demuxEnd(struct demux_transfer *transfer) {
+    struct tftp_session *session = &transfer->session;
+
+    timerWheelCancel(&demux_wheel, &transfer->timer);
+    tftpSessionRelease(session);
+    if (session->state == TFTP_SESSION_FAILED && session->error_msg[0] != '\0') printError(session->error_msg, false);
+    if (session->opts.windowsize > 1) tftpSessionPrintStats(session, stdout);
+
+    storageClose(&transfer->file);
+    poolFree(&buffer_pool, transfer->netascii.buffer);
+    transfer->netascii.buffer = NULL;
+    demuxRemove(&demux_table, &transfer->peer);
+    demux_free[demux_free_count++] = transfer->index;
+}
+
+/**
+ * @brief Receive pending packets of socket and pass them to sessions of their clients
+ *
+ * @param socket readable socket
+ */
+void demuxOnReadable(int socket) {
+    for (int i = 0; i < DEMUX_RECV_BATCH; i++) {
+        recv_len = sizeof(recv_addr);
+        int bytes_rx = recvfrom(socket, demux_packet, sizeof(demux_packet) - 1, MSG_DONTWAIT, (struct sockaddr *) &recv_addr, &recv_len);
+        if (bytes_rx < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) printError("recvfrom not succesful", false);
+            return;
+        }
+
+        // Errors are answered from the socket the packet arrived on
+        server_socket = socket;
+        long long now = tftpClockMs();
+        uint16_t opcode = bytes_rx >= OPCODE_SIZE ? tftpGetOpcode(demux_packet) : 0;
+        bool request = opcode == RRQ_OPCODE || opcode == WRQ_OPCODE;
+
+        uint32_t index = demuxLookup(&demux_table, &recv_addr);
+        if (index != DEMUX_EMPTY) {
+            struct demux_transfer *transfer = &demux_transfers[index];
+
+            // Request repeated before the client answered anything is a retransmission, the session resends
+            // its first packet by timer. Later request from the same port replaces transfer the client gave up on
+            if (request && transfer->session.stats.packets_received == 0) continue;
+            if (request) {
+                printError("transfer replaced by new request", false);
+                demuxEnd(transfer);
+            } else {
+                tftpSessionOnPacket(&transfer->session, demux_packet, bytes_rx, now);
+                if (tftpSessionFinished(&transfer->session)) demuxEnd(transfer);
+                else timerWheelArm(&demux_wheel, &transfer->timer, tftpSessionDeadline(&transfer->session));
+                continue;
+            }
+        }
+
+        // Packet of transfer that already ended is answered like packet to closed transfer port, ERROR never is
+        if (request) demuxStart(socket, bytes_rx, now);
+        else if (opcode != ERROR_OPCODE) sendErrorPacket(5, "Unknown transfer ID", false);
+    }
+}
+
+/**
+ * @brief Serve all transfers in the listener on a fixed set of sockets bound to the server port (-M). Sessions
+ * are found by address and port of client in open-addressing table, retransmissions are driven by timer wheel
+ */
+void runDemux() {
+    struct epoll_event events[DEMUX_MAX_EVENTS];
+    int epfd = epoll_create1(0);
+    if (epfd < 0) printError("epoll_create1 failed", true);
+
+    // Sockets share the port, kernel spreads clients over them by hash of addresses and ports
+    int reuse = 1;
+    for (int i = 0; i < demux_socket_count; i++) {
+        createUDPSocket(&demux_sockets[i]);
+        if (demux_socket_count > 1 && setsockopt(demux_sockets[i], SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            printError("SO_REUSEPORT not available", true);
+        }
+        if (low_latency) lowlatTuneSocket(demux_sockets[i], DEFAULT_BLKSIZE);
+        if (bind(demux_sockets[i], (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) printError("Bind error", true);
+
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = demux_sockets[i]};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, demux_sockets[i], &event) < 0) printError("epoll_ctl failed", true);
+    }
+
+    // Transfers with lower index are taken first, so the used ones stay close together
+    demux_transfers = calloc(DEMUX_MAX_SESSIONS, sizeof(struct demux_transfer));
+    demux_free = malloc(DEMUX_MAX_SESSIONS * sizeof(uint32_t));
+    if (demux_transfers == NULL || demux_free == NULL || demuxInit(&demux_table, DEMUX_MAX_SESSIONS) < 0) {
+        printError("memory allocation error", true);
+    }
+    for (uint32_t i = 0; i < DEMUX_MAX_SESSIONS; i++) {
+        demux_transfers[i].index = i;
+        timerInit(&demux_transfers[i].timer, demuxTimerExpired, &demux_transfers[i]);
+        demux_free[demux_free_count++] = DEMUX_MAX_SESSIONS - 1 - i;
+    }
+
+    poolInit(&buffer_pool, 0);
+    timerWheelInit(&demux_wheel, tftpClockMs());
+    src_addr = server_addr;
+
+    while (true) {
+        // Sleep until the nearest retransmission
+        long long now = tftpClockMs();
+        long long next = timerWheelNext(&demux_wheel);
+        int timeout = -1;
+        if (next != TIMER_NEVER) timeout = next > now ? (int)(next - now) : 0;
+
+        int count = epoll_wait(epfd, events, DEMUX_MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR) printError("epoll_wait failed", true);
+
+        for (int i = 0; i < count; i++) demuxOnReadable(events[i].data.fd);
+        timerWheelAdvance(&demux_wheel, tftpClockMs());
+    }
+}
+
 int main(int argc, char **argv) {
     // Neccessary variables
-    char mode[128] = "";
-    int blksize;
-    int timeout;
-    int maxRetransmitCount = 3;
+    char mode[MAX_MODE_LEN] = "";
+    struct tftp_options opts;
+    bool has_options;
+    struct tftp_session session;
+    static const struct tftp_session_io session_io = {
+        .send = sessionSend,
+        .read = sessionRead,
+        .write = sessionWrite,
+        .finish = sessionFinish,
+        .on_packet = sessionPrintPacket,
+    };
 
     // Variables for command line arguments
     int server_port = TFTP_SERVER_PORT;
     char *root_dirpath = NULL;
 
     bool send_file; // Indicates if server is sending file
-    char filename[1024] = ""; // Allocation for storing name of local file
+    char filename[MAX_FILENAME_LEN] = ""; // Allocation for storing name of local file
 
+    traceInit(&trace);
     handleArguments(argc, argv, &server_port, &root_dirpath);
 
-    createUDPSocket(&server_socket);
+    // Trace and scheduler are per child process, sessions of demultiplexing mode share the listener
+    if (demux_socket_count > 0 && (trace.fd >= 0 || sched_global_rate > 0 || sched_client_rate > 0)) {
+        printError("-T, -B and -C can't be used with -M", true);
+    }
+
+    // Root is opened once, files are opened relative to it. Lookups of other backends than posix are in memory,
+    // they don't need negative cache
+    if (storageCreate(&storage, storage_backend, root_dirpath) < 0) printError("couldn't open storage", true);
+    neg_cache.inotify_fd = -1;
+    if (storagePosixRoot(&storage) >= 0 && negCacheInit(&neg_cache, root_dirpath) < 0) printError("inotify not available, negative cache disabled", false);
+
+    vfileInit(&vfiles);
+    if (vfile_rules_path && vfileLoadRules(&vfiles, vfile_rules_path) < 0) printError("couldn't load virtual file rules", true);
+    if (vfile_hosts_path && vfileLoadHosts(&vfiles, vfile_hosts_path) < 0) printError("couldn't load host table", true);
+
+    if (sched_global_rate > 0 || sched_client_rate > 0) {
+        sched = schedCreate(sched_global_rate, sched_client_rate, sched_prefix);
+        if (sched == NULL) printError("couldn't create scheduler", true);
+    }
+
+    // Listener runs on all configured CPUs, children are spread over them
+    int worker_count = 0;
+    if (lowlat_cpus.count > 0 && lowlatPin(&lowlat_cpus, -1) < 0) printError("couldn't pin to CPUs", false);
 
     configureServerAddress(server_port);
+    if (demux_socket_count > 0) runDemux();
+
+    createUDPSocket(&server_socket);
+    if (low_latency) lowlatTuneSocket(server_socket, DEFAULT_BLKSIZE);
 
     // Bind server_socket to listen on specific port
     if (bind(server_socket, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
@@ -633,22 +1307,56 @@ int main(int argc, char **argv) {
     }
 
     while(true) {
-        blksize = DEFAULT_BLKSIZE;
-        timeout = DEFAULT_TIMEOUT;
+        tftpOptionsInit(&opts);
 
-        if (receiveRqPacket(mode, filename, &send_file, &blksize, &timeout) == -1) continue;
+        if (receiveRqPacket(mode, filename, &send_file, &opts) == -1) continue;
+        long long rq_us = lowlatClockUs();
+        long long rq_ns = traceClockNs();
+
+        time_t now = time(NULL);
+        if (prepareRequest(filename, send_file, &opts, &has_options, now) < 0) continue;
 
         // Create a child proccess to handle the request, the main porccess will listen for more requests 
+        int worker = worker_count++;
+        bool traced = trace.fd >= 0 && (trace_sample >= 100 || rand() % 100 < trace_sample);
         pid_t pid = fork();
         if (pid != 0) {
+            // The child has its own copy of the opened file
+            storageClose(&transfer_file);
             closeUDPSocket(&sockfd);
             continue;
         } else {
 
             closeUDPSocket(&server_socket);
+            client_addr = recv_addr;
+
+            // Only sampled children trace, the rest close the trace file
+            if (traced) {
+                traceStart(&trace, "tftp-server", filename);
+                atexit(flushTrace);
+                traceInstant(&trace, "request", rq_ns, -1);
+                traceComplete(&trace, "fork", rq_ns, traceClockNs(), -1);
+            } else {
+                traceClose(&trace);
+            }
 
             createUDPSocket(&sockfd);
 
+            if (lowlat_cpus.count > 0) lowlatPin(&lowlat_cpus, worker);
+            if (low_latency) lowlatTuneSocket(sockfd, opts.blksize);
+            latencyInit(&latency, rq_us);
+
+            // Downloads are scheduled, kernel pacing (fq qdisc) additionally smooths the rate of a single client
+            if (sched && send_file) {
+                sched_flow = schedOpen(sched, client_addr.sin_addr, getpid());
+                if (sched_flow < 0) sendErrorPacket(0, "Too many transfers", true);
+                atexit(closeSchedFlow);
+                if (sched_client_rate > 0 && sched_prefix == 32) {
+                    unsigned int pacing_rate = sched_client_rate > UINT32_MAX ? UINT32_MAX : (unsigned int)sched_client_rate;
+                    setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing_rate, sizeof(pacing_rate));
+                }
+            }
+
             // Get information about source ip and source port
             if (bind(sockfd, (struct sockaddr*)&src_addr, sizeof(src_addr)) < 0) {
                 printError("bind failed", true);
@@ -660,85 +1368,28 @@ int main(int argc, char **argv) {
                 printError("getsockname failed", true);
             }
             
-            // If handling options send OACK to the client
-            if (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT) sendOackPacket(blksize, timeout);
-
-            // Number of currently processed block
-            uint16_t block;
-
-            if (send_file) {
-                // Open file for read
-                openFile(root_dirpath, filename, send_file);
-
-                int bytes_tx; // bytes sent
-                block = 0;
-
-                // If handling options handle retransmisson of OACK
-                if (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT) {
-                    for (int i = 0; i <= maxRetransmitCount; i++)
-                    {
-                        if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-                        if (handleTimeout(timeout)) {
-                            sendOackPacket(blksize, timeout);
-                        } else break;
-                    }
-
-                    // After sending OACK server needs to receive ACK with block number 0
-
-                    receiveAckPacket(block);
-                }
-
-                block++;
-
-                do {
-                    bytes_tx = sendDataPacket(block, blksize, false, mode);
-
-                    // Handle retransmisson of DATA packet
-                    for (int i = 0; i <= maxRetransmitCount; i++)
-                    {
-                        if (i == maxRetransmitCount) printError("max retansmission count reached", true);
-                        if (handleTimeout(timeout)) {
-                            bytes_tx = sendDataPacket(block, blksize, true, mode);
-                        } else break;
-                    }
-                    // Receive appropriate ACK
-                    receiveAckPacket(block);
-
-                    block++;
-                    // While not sent less data then max in data packet
-                } while (bytes_tx >= blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE);
-                
-            } else {
-                // Open file for write
-                openFile(root_dirpath, filename, send_file);
-
-                block = 0;
-                int bytes_rx; // bytes received
-
-                // If not handling options send ACK to the client
-                if ((blksize == DEFAULT_BLKSIZE && timeout == DEFAULT_TIMEOUT)) sendAckPacket(block);
-
-                do {
-                    for (int i = 0; i <= maxRetransmitCount; i++)
-                    {
-                        if (i == maxRetransmitCount) printError("Max retansmission count reached", true);
-                        if (handleTimeout(timeout)) {
-                            // If this if is true, it means last sent packet was OACK, thus retransmit OACK
-                            if (block = 1 && (blksize != DEFAULT_BLKSIZE || timeout != DEFAULT_TIMEOUT)) {
-                                sendOackPacket(blksize, timeout);
-                            }
-                            else sendAckPacket(block);
-                        } else break;
-                    }
-
-                    block++;
-
-                    bytes_rx = receiveDataPacket(block, blksize, mode);
-
-                    sendAckPacket(block);
-                // While not received less data then max in data packet
-                } while (bytes_rx >= blksize + OPCODE_SIZE + BLOCK_NUMBER_SIZE);
-            }
+            // Open file for read or write, OACK depends on resume offset found in the file
+            long long open_ns = traceClockNs();
+            atexit(closeTransferFile);
+            openFile(filename, send_file, &opts);
+            traceComplete(&trace, "open", open_ns, traceClockNs(), -1);
+
+            // If handling options the session starts with OACK, otherwise with DATA 1 or ACK 0
+            if (has_options) encodeOackPacket(&opts);
+
+            poolInit(&buffer_pool, 0);
+            tftpSessionInit(&session, send_file ? TFTP_ROLE_SENDER : TFTP_ROLE_RECEIVER, &session_io, mode, NULL, 0);
+            tftpSessionSetPool(&session, &buffer_pool);
+            session.opts = opts;
+            long long session_ns = traceClockNs();
+            tftpSessionStart(&session, has_options ? oack_packet : NULL, oack_packet_len, false, tftpClockMs());
+
+            runSession(&session);
+            traceComplete(&trace, "session", session_ns, traceClockNs(), session.block);
+
+            long long close_ns = traceClockNs();
+            closeTransferFile();
+            traceComplete(&trace, "close", close_ns, traceClockNs(), -1);
             break;
         }
     }
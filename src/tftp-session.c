@@ -0,0 +1,909 @@
+/* tftp-session.c *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-session.h"
+#include "../include/tftp-fec.h"
+
+// Set error of the session and end it without sending anything
+static void sessionFail(struct tftp_session *s, uint16_t error_code, const char *error_msg, bool remote) {
+    s->error_code = error_code;
+    s->remote_error = remote;
+    snprintf(s->error_msg, sizeof(s->error_msg), "%s", error_msg);
+    s->state = TFTP_SESSION_FAILED;
+    if (s->wheel != NULL) timerWheelCancel(s->wheel, &s->timer);
+}
+
+// End session successfully
+static void sessionDone(struct tftp_session *s, long long now) {
+    s->state = TFTP_SESSION_DONE;
+    s->stats.end_ms = now;
+    if (s->wheel != NULL) timerWheelCancel(s->wheel, &s->timer);
+}
+
+// Replace pooled buffer by buffer of the class that fits need bytes, content isn't kept
+static int sessionFitBuffer(struct tftp_session *s, char **buffer, size_t *cap, size_t need) {
+    if (*buffer != NULL && *cap == poolCapacity(need)) return 0;
+
+    poolFree(s->pool, *buffer);
+    *buffer = poolAlloc(s->pool, need, cap);
+    if (*buffer == NULL) {
+        *cap = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Size TX buffer for DATA of negotiated blksize (or for initial packet), slots of the rest of the window,
+// parity buffer and RX buffer for DATA, PARITY, OACK or ERROR with terminating byte
+static int sessionFitBuffers(struct tftp_session *s, size_t tx_need, bool rx) {
+    if (s->pool == NULL) return 0;
+
+    size_t data_len = (size_t)s->opts.blksize + DATA_HEADER_SIZE;
+    if (tx_need < data_len) tx_need = data_len;
+    if (sessionFitBuffer(s, &s->tx_packet, &s->tx_cap, tx_need) < 0) return -1;
+    s->slots[0].packet = s->tx_packet;
+    s->slots[0].cap = s->tx_cap;
+
+    for (int i = 1; i < MAX_WINDOWSIZE; i++) {
+        struct tftp_window_slot *slot = &s->slots[i];
+        if (i < s->window) {
+            if (sessionFitBuffer(s, &slot->packet, &slot->cap, data_len) < 0) return -1;
+        } else if (slot->packet != NULL) {
+            poolFree(s->pool, slot->packet);
+            slot->packet = NULL;
+            slot->cap = 0;
+        }
+    }
+
+    if (s->opts.fec > 0) {
+        if (sessionFitBuffer(s, &s->fec_packet, &s->fec_cap, (size_t)s->opts.blksize + FEC_HEADER_SIZE) < 0) return -1;
+    } else if (s->fec_packet != NULL) {
+        poolFree(s->pool, s->fec_packet);
+        s->fec_packet = NULL;
+        s->fec_cap = 0;
+    }
+
+    if (!rx) return 0;
+    if (s->opts.fec > 0) data_len += FEC_HEADER_SIZE - DATA_HEADER_SIZE;
+    size_t rx_need = data_len > MAX_ERROR_PACKET_SIZE ? data_len : MAX_ERROR_PACKET_SIZE;
+    return sessionFitBuffer(s, &s->rx_packet, &s->rx_cap, rx_need + 1);
+}
+
+// Retransmission timer of session in timer wheel expired
+static void sessionTimerExpired(struct tftp_timer *timer, long long now) {
+    tftpSessionOnTimer(timer->ctx, now);
+}
+
+// Arm retransmission timer (or delayed ACK of receiver)
+static void sessionArm(struct tftp_session *s, long long deadline) {
+    s->deadline = deadline;
+    if (s->wheel != NULL) timerWheelArm(s->wheel, &s->timer, s->deadline);
+}
+
+// Send packet, timer is armed with the negotiated timeout
+static void sessionTransmitPacket(struct tftp_session *s, const char *packet, size_t len, long long now) {
+    sessionArm(s, now + (long long)s->opts.timeout * 1000);
+    s->stats.packets_sent++;
+    if (s->io->send(s, packet, len) < 0) {
+        sessionFail(s, 0, "sendto not successful", false);
+    }
+}
+
+// Send last packet again or for the first time
+static void sessionTransmit(struct tftp_session *s, long long now) {
+    sessionTransmitPacket(s, s->tx_packet, s->tx_len, now);
+}
+
+// Slot of DATA packet of block acked + 1 + index
+static struct tftp_window_slot *sessionSlot(struct tftp_session *s, int index) {
+    return &s->slots[(s->window_head + index) % s->window];
+}
+
+// Add block to parity of the current group, the first block of the group starts new parity
+static void sessionFecAdd(struct tftp_session *s, uint16_t block, const char *data, size_t len) {
+    if (s->fec_count == s->opts.fec) s->fec_count = 0;
+    if (s->fec_count == 0) {
+        memset(&s->fec_packet[FEC_HEADER_SIZE], 0, s->opts.blksize);
+        s->fec_first = block;
+        s->fec_len_xor = 0;
+    }
+
+    fecXor(&s->fec_packet[FEC_HEADER_SIZE], data, len);
+    s->fec_len_xor ^= len;
+    s->fec_count++;
+}
+
+// Send parity of the group after its last DATA, it isn't retransmitted
+static void sessionSendParity(struct tftp_session *s, long long now) {
+    fecSetHeader(s->fec_packet, s->fec_first, s->fec_count, s->fec_len_xor);
+    s->stats.parity++;
+    sessionTransmitPacket(s, s->fec_packet, FEC_HEADER_SIZE + s->opts.blksize, now);
+}
+
+// Send the next block of the round, block sent before (after loss) is sent again from its slot
+static void sessionSendData(struct tftp_session *s, long long now) {
+    struct tftp_window_slot *slot = sessionSlot(s, (uint16_t)(s->block - s->acked));
+    bool new_block = s->block == s->read_block;
+
+    s->block++;
+    if (!new_block) {
+        s->stats.retransmits++;
+        sessionTransmitPacket(s, slot->packet, slot->len, now);
+        return;
+    }
+
+    if ((size_t)s->opts.blksize + DATA_HEADER_SIZE > slot->cap) {
+        tftpSessionAbort(s, 8, "blksize too big");
+        return;
+    }
+
+    tftpPrepareHeader(slot->packet, DATA_OPCODE);
+    tftpSetBlock(slot->packet, s->block);
+
+    int bytes_read = s->io->read(s, &slot->packet[DATA_HEADER_SIZE], s->opts.blksize);
+    if (bytes_read < 0) {
+        if (!tftpSessionFinished(s)) tftpSessionAbort(s, 0, "Couldn't read file");
+        return;
+    }
+
+    slot->len = DATA_HEADER_SIZE + bytes_read;
+    s->read_block = s->block;
+    s->last_block = bytes_read < s->opts.blksize;
+    s->stats.bytes += bytes_read;
+    s->retries = 0;
+    if (s->fec_packet != NULL) sessionFecAdd(s, s->block, &slot->packet[DATA_HEADER_SIZE], bytes_read);
+    sessionTransmitPacket(s, slot->packet, slot->len, now);
+
+    if (s->fec_packet != NULL && !tftpSessionFinished(s) && (s->fec_count == s->opts.fec || s->last_block)) {
+        sessionSendParity(s, now);
+    }
+}
+
+// Block of the round was lost, the window is halved or after timeout starts again from one block. Without
+// cwnd option the peer waits for complete windows, so the window stays at windowsize
+static void sessionWindowCut(struct tftp_session *s, bool timeout) {
+    s->stats.losses++;
+    s->round_acked = 0;
+    if (!s->opts.cwnd) return;
+
+    s->ssthresh = s->cwnd / 2 > 1 ? s->cwnd / 2 : 1;
+    s->cwnd = timeout ? 1 : s->ssthresh;
+}
+
+// Send blocks until the congestion window is full or the file is sent, blocks reported by ranges of ACK
+// aren't sent again
+static void sessionFillWindow(struct tftp_session *s, long long now) {
+    while (!tftpSessionFinished(s) && (uint16_t)(s->block - s->acked) < s->cwnd) {
+        if (s->block == s->read_block && s->last_block) break;
+
+        uint16_t next = s->block - s->acked;
+        if (next < 64 && (s->sacked >> next & 1)) {
+            s->block++;
+            s->stats.sacked++;
+            continue;
+        }
+        sessionSendData(s, now);
+    }
+}
+
+// Blocks of the window were acknowledged, bitmaps follow the first unacknowledged block
+static void sessionShiftSack(struct tftp_session *s, uint16_t advance) {
+    s->sacked = advance < 64 ? s->sacked >> advance : 0;
+    s->resent = advance < 64 ? s->resent >> advance : 0;
+}
+
+static inline uint16_t sessionGet16(const char *src) {
+    return ((uint8_t)src[0] << 8) | (uint8_t)src[1];
+}
+
+static inline void sessionPut16(char *dst, uint16_t value) {
+    dst[0] = value >> 8;
+    dst[1] = value & 0xff;
+}
+
+// Mark blocks of ranges appended to ACK, ranges outside of blocks read so far are stale and ignored
+static void sessionMarkRanges(struct tftp_session *s, const char *packet, size_t len) {
+    uint16_t read = s->read_block - s->acked;
+
+    for (size_t pos = ACK_PACKET_SIZE; pos + SACK_RANGE_SIZE <= len; pos += SACK_RANGE_SIZE) {
+        uint16_t first = sessionGet16(&packet[pos]) - s->acked - 1;
+        uint16_t last = sessionGet16(&packet[pos + 2]) - s->acked - 1;
+        if (first > last || last >= read || last >= 64) continue;
+
+        for (uint16_t i = first; i <= last; i++) s->sacked |= 1ULL << i;
+    }
+}
+
+// Send gaps before the last reported block again, only blocks that weren't sent again since the loss.
+// The first gap of the loss cuts the window
+static void sessionResendGaps(struct tftp_session *s, long long now) {
+    int highest = 63 - __builtin_clzll(s->sacked);
+    uint64_t gaps = ~s->sacked & ~s->resent & ((1ULL << highest) - 1);
+    if (gaps == 0) return;
+
+    if (s->resent == 0) sessionWindowCut(s, false);
+    s->resent |= gaps;
+
+    for (int i = 0; i < highest && !tftpSessionFinished(s); i++) {
+        if (!(gaps >> i & 1)) continue;
+        struct tftp_window_slot *slot = sessionSlot(s, i);
+        s->stats.retransmits++;
+        sessionTransmitPacket(s, slot->packet, slot->len, now);
+    }
+}
+
+// Blocks were acknowledged, once cwnd of them complete the round slow start doubles the window, then it grows
+// by one block. ACK of incomplete window (delayed by the receiver) counts towards the round
+static void sessionWindowGrow(struct tftp_session *s, uint16_t advance) {
+    s->round_acked += advance;
+    if (s->round_acked < s->cwnd) return;
+
+    s->round_acked = 0;
+    s->stats.rounds++;
+    s->stats.cwnd_sum += s->cwnd;
+    if (!s->opts.cwnd) return;
+
+    if (s->cwnd < s->ssthresh) s->cwnd *= 2;
+    else s->cwnd++;
+    if (s->cwnd > s->window) s->cwnd = s->window;
+    if (s->cwnd > s->stats.cwnd_max) s->stats.cwnd_max = s->cwnd;
+}
+
+// Set window for negotiated windowsize, sender without pool has only tx_packet and sends one block per round.
+// Receiver keeps blocks after a gap in slots only with sack, fec or cwnd option
+static void sessionSetupWindow(struct tftp_session *s) {
+    bool keep = s->opts.sack || s->opts.fec > 0 || s->opts.cwnd;
+    s->window = s->opts.windowsize;
+    if (s->window < MIN_WINDOWSIZE || (s->role == TFTP_ROLE_RECEIVER && !keep)) s->window = MIN_WINDOWSIZE;
+    if (s->window > MAX_WINDOWSIZE || (s->pool == NULL && s->window > 1)) s->window = s->pool == NULL ? 1 : MAX_WINDOWSIZE;
+
+    // Peer without cwnd option acknowledges only complete windows, smaller round would wait for timeout
+    s->cwnd = s->opts.cwnd && s->window > SESSION_INITIAL_CWND ? SESSION_INITIAL_CWND : s->window;
+    s->ssthresh = s->window;
+    s->round_acked = 0;
+    s->stats.cwnd_max = s->cwnd;
+}
+
+// Append ranges of blocks stored after the gap to ACK, as many as fit into TX buffer
+static size_t sessionEncodeRanges(struct tftp_session *s, char *dst, size_t cap) {
+    size_t len = 0;
+
+    for (int i = 0; i < 64 && len + SACK_RANGE_SIZE <= cap; i++) {
+        if (!(s->sacked >> i & 1)) continue;
+
+        int first = i;
+        while (i + 1 < 64 && (s->sacked >> (i + 1) & 1)) i++;
+        sessionPut16(&dst[len], s->block + 1 + first);
+        sessionPut16(&dst[len + 2], s->block + 1 + i);
+        len += SACK_RANGE_SIZE;
+    }
+    return len;
+}
+
+// Acknowledge block (ACK 0 acknowledges OACK)
+static void sessionSendAck(struct tftp_session *s, uint16_t block, long long now) {
+    s->block = block;
+    s->acked = block;
+    s->ack_pending = false;
+    tftpPrepareHeader(s->tx_packet, ACK_OPCODE);
+    tftpSetBlock(s->tx_packet, block);
+    s->tx_len = ACK_PACKET_SIZE;
+    if (s->opts.sack) s->tx_len += sessionEncodeRanges(s, &s->tx_packet[ACK_PACKET_SIZE], s->tx_cap - ACK_PACKET_SIZE);
+    s->retries = 0;
+    s->ack_sent_ms = now;
+    s->last_ack_ms = now;
+    sessionTransmit(s, now);
+}
+
+// Finish negotiation, options that weren't acknowledged fall back to defaults
+static int sessionNegotiated(struct tftp_session *s, const char *packet, size_t len) {
+    unsigned seen = 0;
+    bool received = packet != NULL;
+
+    // Requested options are replaced by acknowledged ones, options of server stay as negotiated
+    if (s->wait_oack) tftpOptionsInit(&s->opts);
+    if (received && tftpParseOptions(packet, len, OPCODE_SIZE, &s->opts, &seen) < 0) {
+        tftpSessionAbort(s, 8, "Malformed options");
+        return -1;
+    }
+
+    if (s->io->on_oack && s->io->on_oack(s, received, seen) < 0) {
+        if (!tftpSessionFinished(s)) tftpSessionAbort(s, 8, "Option negotiation failed");
+        return -1;
+    }
+    sessionSetupWindow(s);
+
+    // Buffers allocated for requested blksize shrink to the acknowledged one, RX buffer holds
+    // the packet being processed and is replaced after it
+    if (sessionFitBuffers(s, 0, false) < 0) {
+        sessionFail(s, 3, "Couldn't allocate buffers", false);
+        return -1;
+    }
+    s->refit_rx = s->pool != NULL;
+    return 0;
+}
+
+// Send the last ACK again without touching the retransmission timer
+static void sessionResendAck(struct tftp_session *s) {
+    s->stats.packets_sent++;
+    s->stats.duplicates++;
+    if (s->io->send(s, s->tx_packet, s->tx_len) < 0) {
+        sessionFail(s, 0, "sendto not successful", false);
+    }
+}
+
+// Acknowledge the last block received in order after DATA stop arriving. The rest of the round can trail by
+// the jitter of the path, so the wait is half of the measured round trip or twice the gap between DATA of one
+// round (paced sender), and below half of the timeout so the sender doesn't retransmit before the ACK
+static void sessionDelayAck(struct tftp_session *s, long long now) {
+    long long delay = s->rtt_ms / 2 > s->data_gap_ms * 2 ? s->rtt_ms / 2 : s->data_gap_ms * 2;
+    long long max_delay = (long long)s->opts.timeout * 1000 / 2;
+    if (delay > max_delay) delay = max_delay;
+    if (delay < SESSION_MIN_ACK_DELAY_MS) delay = SESSION_MIN_ACK_DELAY_MS;
+    s->ack_pending = true;
+    sessionArm(s, now + delay);
+}
+
+// Pass payload of DATA to write callback, before that it is added to parity of the current group
+static int sessionWriteData(struct tftp_session *s, char *data, size_t len) {
+    if (s->fec_packet != NULL) sessionFecAdd(s, s->block + 1, data, len);
+    if (s->io->write(s, data, len) < 0) {
+        if (!tftpSessionFinished(s)) tftpSessionAbort(s, 3, "Disk full or allocation exceeded");
+        return -1;
+    }
+    s->stats.bytes += len;
+    return 0;
+}
+
+// Slot of receiver for block s->block + 1 + index, slot 0 holds ACK
+static struct tftp_window_slot *sessionRxSlot(struct tftp_session *s, int index) {
+    return &s->slots[1 + (s->window_head + index) % (s->window - 1)];
+}
+
+// Block was received in order, bitmap and slots of stored blocks follow it
+static void sessionRxAdvance(struct tftp_session *s) {
+    s->block++;
+    if (s->window < 2) return;
+    s->sacked >>= 1;
+    s->window_head = (s->window_head + 1) % (s->window - 1);
+}
+
+// Store block received after a gap until the gap is filled, false if it is out of the window or stored already
+static bool sessionStoreData(struct tftp_session *s, uint16_t offset, const char *packet, size_t len) {
+    if (offset >= s->window || offset >= 64 || (s->sacked >> offset & 1)) return false;
+
+    struct tftp_window_slot *slot = sessionRxSlot(s, offset);
+    if (len > (size_t)s->opts.blksize + DATA_HEADER_SIZE || len > slot->cap) return false;
+    memcpy(slot->packet, packet, len);
+    slot->len = len;
+    s->sacked |= 1ULL << offset;
+    return true;
+}
+
+// Handle DATA packet on receiving side
+static void sessionOnData(struct tftp_session *s, char *packet, size_t len, long long now) {
+    uint16_t block = tftpGetBlock(packet);
+    uint16_t offset = block - (uint16_t)(s->block + 1);
+    int windowsize = s->opts.windowsize > 1 ? s->opts.windowsize : 1;
+
+    if (offset != 0) {
+        // Duplicate of the last DATA means our ACK was lost, acknowledge it again (RFC 1123 4.2.3.1).
+        // Older blocks were delayed in the network and are ignored
+        if (windowsize == 1) {
+            if (block == s->block) sessionResendAck(s);
+            else s->stats.duplicates++;
+            return;
+        }
+
+        // Sender went back after our ACK was lost, burst of old blocks is answered by one ACK. With cwnd option
+        // the sender sends old block again only after timeout, which is at least half of the timeout after our
+        // ACK (longest delay of ACK), sooner it is a duplicate from the network and ACK would report a false gap
+        if ((uint16_t)(s->block - block) < 0x8000) {
+            s->stats.duplicates++;
+            if (!s->opts.cwnd || now - s->last_ack_ms >= (long long)s->opts.timeout * 1000 / 2) sessionDelayAck(s, now);
+            return;
+        }
+
+        // Gap in the window, the sender continues after the last block received in order (RFC 7440).
+        // With sack or fec the following blocks are kept, sack reports them in ranges of ACK sent when
+        // DATA stop arriving and fec waits for PARITY of the group before acknowledging the gap. With cwnd
+        // option they are kept too and every one of them is acknowledged at once, sender takes ACK inside
+        // the window as delayed ACK and learns about the gap from duplicates of it
+        if (s->window < 2 || !sessionStoreData(s, offset, packet, len)) s->stats.duplicates++;
+        if ((s->acked != s->block || (s->opts.cwnd && !s->opts.sack)) && s->fec_packet == NULL) sessionSendAck(s, s->block, now);
+        else if (s->window >= 2 || s->opts.cwnd) sessionDelayAck(s, now);
+        return;
+    }
+    if (len > (size_t)s->opts.blksize + DATA_HEADER_SIZE) {
+        tftpSessionAbort(s, 4, "Illegal TFTP operation.");
+        return;
+    }
+
+    size_t data_len = len - DATA_HEADER_SIZE;
+    if (sessionWriteData(s, &packet[DATA_HEADER_SIZE], data_len) < 0) return;
+
+    // Gap between DATA of the same round and the round trip from our ACK to the next DATA are smoothed
+    // for the delayed ACK
+    if (s->ack_pending) s->data_gap_ms = (3 * s->data_gap_ms + (now - s->last_data_ms)) / 4;
+    if (s->ack_sent_ms >= 0) {
+        long long rtt = now - s->ack_sent_ms;
+        s->rtt_ms = s->rtt_ms == 0 ? rtt : (7 * s->rtt_ms + rtt) / 8;
+        s->ack_sent_ms = -1;
+    }
+    s->last_data_ms = now;
+    sessionRxAdvance(s);
+
+    // Packet shorter than blksize ends the transfer, blocks stored after the filled gap follow
+    bool last = data_len < (size_t)s->opts.blksize;
+    while (!last && (s->sacked & 1)) {
+        struct tftp_window_slot *slot = sessionRxSlot(s, 0);
+        data_len = slot->len - DATA_HEADER_SIZE;
+        if (sessionWriteData(s, &slot->packet[DATA_HEADER_SIZE], data_len) < 0) return;
+        sessionRxAdvance(s);
+        last = data_len < (size_t)s->opts.blksize;
+    }
+
+    if (!last && (uint16_t)(s->block - s->acked) < windowsize) {
+        sessionDelayAck(s, now);
+        return;
+    }
+
+    if (last && s->io->finish && s->io->finish(s) < 0) {
+        if (!tftpSessionFinished(s)) tftpSessionAbort(s, 0, "Couldn't store file");
+        return;
+    }
+
+    sessionSendAck(s, s->block, now);
+    if (s->state == TFTP_SESSION_FAILED) return;
+
+    if (last) {
+        sessionDone(s, now);
+    }
+}
+
+// Rebuild the only lost block of the group from PARITY, other blocks of the group were written (they are
+// in parity of the current group) or stored after a gap. PARITY that isn't needed is ignored
+static void sessionOnParity(struct tftp_session *s, char *packet, size_t len, long long now) {
+    uint16_t first = fecGetFirst(packet);
+    int count = fecGetCount(packet);
+    int start = (int16_t)(uint16_t)(first - (uint16_t)(s->block + 1)); // Offset of the group from the next block
+    uint16_t len_xor = fecGetLenXor(packet);
+    char *parity = &packet[FEC_HEADER_SIZE];
+
+    s->stats.parity++;
+    if (s->fec_packet == NULL || s->window < 2 || len != (size_t)s->opts.blksize + FEC_HEADER_SIZE) return;
+    if (count < 1 || count > s->opts.fec || start + count <= 0) return;
+
+    if (start < 0) {
+        if (s->fec_first != first || s->fec_count != -start) return;
+        fecXor(parity, &s->fec_packet[FEC_HEADER_SIZE], s->opts.blksize);
+        len_xor ^= s->fec_len_xor;
+    }
+
+    int missing = -1;
+    for (int i = start < 0 ? 0 : start; i < start + count; i++) {
+        if (i >= s->window || i >= 64) return;
+        if (s->sacked >> i & 1) {
+            struct tftp_window_slot *slot = sessionRxSlot(s, i);
+            fecXor(parity, &slot->packet[DATA_HEADER_SIZE], slot->len - DATA_HEADER_SIZE);
+            len_xor ^= slot->len - DATA_HEADER_SIZE;
+        } else if (missing >= 0) {
+            return; // One parity rebuilds only one block
+        } else {
+            missing = i;
+        }
+    }
+    if (missing < 0 || len_xor > s->opts.blksize) return;
+
+    // Parity becomes payload of DATA packet of the lost block
+    char *data = &packet[FEC_HEADER_SIZE - DATA_HEADER_SIZE];
+    tftpPrepareHeader(data, DATA_OPCODE);
+    tftpSetBlock(data, s->block + 1 + missing);
+    s->stats.recovered++;
+    if (missing == 0) sessionOnData(s, data, len_xor + DATA_HEADER_SIZE, now);
+    else sessionStoreData(s, missing, data, len_xor + DATA_HEADER_SIZE);
+}
+
+// Handle ACK packet on sending side
+static void sessionOnAck(struct tftp_session *s, const char *packet, size_t len, long long now) {
+    uint16_t block = tftpGetBlock(packet);
+    uint16_t advance = block - s->acked;
+    uint16_t sent = s->block - s->acked;
+    bool ranges = s->opts.sack && len > ACK_PACKET_SIZE;
+
+    // ACK 0 acknowledges OACK, nothing was sent yet
+    if (advance == 0 && sent == 0 && s->read_block == s->acked && !s->last_block) {
+        sessionFillWindow(s, now);
+        return;
+    }
+
+    // With cwnd option the peer sends the same ACK again for every block after a gap
+    bool dup = s->opts.cwnd && advance == 0 && sent > 0 && !ranges;
+
+    // Other duplicate or stale ACK is ignored, sending DATA again for it would double every following
+    // packet (Sorcerer's Apprentice), lost DATA is retransmitted only by the timer. After timeout the peer
+    // can acknowledge blocks that were sent before. ACK with ranges reports new blocks even without advance
+    if ((advance == 0 && !ranges && !dup) || advance > (uint16_t)(s->read_block - s->acked)) {
+        s->stats.duplicates++;
+        return;
+    }
+
+    if (dup) s->dup_acks++;
+    if (advance > 0) {
+        s->acked = block;
+        s->window_head = (s->window_head + advance) % s->window;
+        s->retries = 0;
+        s->dup_acks = 0;
+        sessionShiftSack(s, advance);
+        if (advance >= sent) s->block = block;
+    }
+
+    if (block == s->read_block && s->last_block) {
+        sessionDone(s, now);
+        return;
+    }
+
+    // Ranges tell which blocks after the gap arrived, only the gaps are sent again
+    if (ranges) sessionMarkRanges(s, packet, len);
+    if (s->sacked != 0) {
+        sessionResendGaps(s, now);
+        sessionFillWindow(s, now);
+        return;
+    }
+
+    // Peer without cwnd option acknowledges inside the round only when the next block was lost, the rest of
+    // the round is sent again. With the option ACK inside the round is delayed and the window slides, the gap
+    // is reported by the same ACK again. Duplicated or reordered packets cause single duplicates, so only
+    // SESSION_DUP_ACKS of them send the first block after the gap again (the peer keeps the following ones),
+    // once until it is acknowledged. After the last block nothing makes the peer report the gap, so ACK
+    // inside the round is taken as the report
+    bool tail = s->block == s->read_block && s->last_block;
+    bool gap = advance == 0 ? s->dup_acks >= SESSION_DUP_ACKS : tail;
+    if (advance < sent && !s->opts.cwnd) {
+        s->block = block;
+        s->resent = 0;
+        sessionWindowCut(s, false);
+    } else if (advance < sent && !ranges && !(s->resent & 1) && gap) {
+        struct tftp_window_slot *slot = sessionSlot(s, 0);
+        s->resent |= 1;
+        sessionWindowCut(s, false);
+        s->stats.retransmits++;
+        sessionTransmitPacket(s, slot->packet, slot->len, now);
+    } else if (advance == 0) {
+        // Every duplicate lets one new block beyond cwnd out (limited transmit, RFC 3042), so a small window
+        // still gets enough duplicates to report the gap
+        s->stats.duplicates++;
+        if (dup && !tail && s->block == s->read_block && (uint16_t)(s->block - s->acked) < s->window) sessionSendData(s, now);
+        return;
+    } else {
+        sessionWindowGrow(s, advance);
+    }
+    sessionFillWindow(s, now);
+}
+
+/**
+ * @brief Initialize session, nothing is sent until tftpSessionStart
+ *
+ * @param s session
+ * @param role sender or receiver of DATA
+ * @param io callbacks of the session
+ * @param ctx owner of the session, available to callbacks as s->ctx
+ * @param tx_buffer buffer for sent packets, has to fit DATA packet with negotiated blksize
+ * @param tx_cap size of tx_buffer
+ */
+void tftpSessionInit(struct tftp_session *s, enum tftp_session_role role, const struct tftp_session_io *io, void *ctx, char *tx_buffer, size_t tx_cap) {
+    memset(s, 0, sizeof(*s));
+    s->role = role;
+    s->state = TFTP_SESSION_IDLE;
+    s->io = io;
+    s->ctx = ctx;
+    s->max_retransmits = DEFAULT_MAX_RETRANSMITS;
+    s->tx_packet = tx_buffer;
+    s->tx_cap = tx_cap;
+    s->slots[0].packet = tx_buffer;
+    s->slots[0].cap = tx_cap;
+    s->window = 1;
+    s->cwnd = 1;
+    s->ssthresh = 1;
+    s->ack_sent_ms = -1;
+    tftpOptionsInit(&s->opts);
+    timerInit(&s->timer, sessionTimerExpired, s);
+}
+
+/**
+ * @brief Drive retransmissions of session by timer wheel instead of polling tftpSessionOnTimer,
+ * has to be called before tftpSessionStart
+ *
+ * @param s session
+ * @param wheel timer wheel shared by sessions of the event loop
+ */
+void tftpSessionSetWheel(struct tftp_session *s, struct timer_wheel *wheel) {
+    s->wheel = wheel;
+}
+
+/**
+ * @brief Take TX and RX buffers of the session from pool, has to be called before tftpSessionStart
+ * with tx_buffer of tftpSessionInit set to NULL. Buffers are sized from requested blksize at start
+ * and shrink to the negotiated one
+ *
+ * @param s session
+ * @param pool buffer pool shared by sessions
+ */
+void tftpSessionSetPool(struct tftp_session *s, struct buffer_pool *pool) {
+    s->pool = pool;
+}
+
+/**
+ * @brief Buffer for the next packet of the session, pending shrink of the buffer after negotiation
+ * is done here, when no received packet is in it
+ *
+ * @param s session
+ * @param cap set to size of the buffer, one byte is left for terminating malformed packets
+ *
+ * @return buffer, NULL if the session has no pool or the buffer couldn't be allocated
+ */
+char *tftpSessionRxBuffer(struct tftp_session *s, size_t *cap) {
+    if (s->refit_rx) {
+        s->refit_rx = false;
+        if (sessionFitBuffers(s, 0, true) < 0) {
+            tftpSessionAbort(s, 3, "Couldn't allocate buffers");
+            return NULL;
+        }
+    }
+
+    *cap = s->rx_cap > 0 ? s->rx_cap - 1 : 0;
+    return s->rx_packet;
+}
+
+/**
+ * @brief Return buffers of the session to its pool, the session can't send anything after that
+ *
+ * @param s session
+ */
+void tftpSessionRelease(struct tftp_session *s) {
+    if (s->pool == NULL) return;
+
+    poolFree(s->pool, s->tx_packet);
+    poolFree(s->pool, s->rx_packet);
+    poolFree(s->pool, s->fec_packet);
+    s->fec_packet = NULL;
+    s->fec_cap = 0;
+    for (int i = 1; i < MAX_WINDOWSIZE; i++) {
+        poolFree(s->pool, s->slots[i].packet);
+        s->slots[i].packet = NULL;
+        s->slots[i].cap = 0;
+    }
+    s->slots[0].packet = NULL;
+    s->slots[0].cap = 0;
+    s->window = 1;
+    s->tx_packet = NULL;
+    s->rx_packet = NULL;
+    s->tx_cap = 0;
+    s->rx_cap = 0;
+    if (s->wheel != NULL) timerWheelCancel(s->wheel, &s->timer);
+    if (!tftpSessionFinished(s)) s->state = TFTP_SESSION_FAILED;
+}
+
+/**
+ * @brief Start session. If initial packet is given (RQ of client, OACK of server) it is sent and
+ * the session waits for the first answer, otherwise sender sends DATA 1 and receiver sends ACK 0
+ *
+ * @param s session
+ * @param initial initial packet or NULL
+ * @param len length of initial packet
+ * @param wait_oack options were requested, the first answer is expected to be OACK
+ * @param now current time (ms)
+ *
+ * @return state of the session
+ */
+int tftpSessionStart(struct tftp_session *s, const char *initial, size_t len, bool wait_oack, long long now) {
+    s->stats.start_ms = now;
+    s->wait_oack = wait_oack;
+    s->block = 0;
+    s->acked = 0;
+    s->read_block = 0;
+    s->window_head = 0;
+    s->sacked = 0;
+    s->resent = 0;
+    s->fec_count = 0;
+
+    if (sessionFitBuffers(s, initial != NULL ? len : 0, true) < 0) {
+        sessionFail(s, 3, "Couldn't allocate buffers", false);
+        return s->state;
+    }
+
+    if (initial != NULL) {
+        if (len > s->tx_cap) {
+            sessionFail(s, 0, "initial packet too long", false);
+            return s->state;
+        }
+        memcpy(s->tx_packet, initial, len);
+        s->tx_len = len;
+        s->state = TFTP_SESSION_WAIT_FIRST;
+        sessionTransmit(s, now);
+    } else {
+        sessionSetupWindow(s);
+        if (sessionFitBuffers(s, 0, false) < 0) {
+            sessionFail(s, 3, "Couldn't allocate buffers", false);
+            return s->state;
+        }
+        s->state = TFTP_SESSION_TRANSFER;
+        if (s->role == TFTP_ROLE_SENDER) sessionFillWindow(s, now);
+        else sessionSendAck(s, 0, now);
+    }
+
+    return s->state;
+}
+
+/**
+ * @brief Process packet received from the peer
+ *
+ * @param s session
+ * @param packet received packet, payload of DATA is passed to write callback in place
+ * @param len length of packet
+ * @param now current time (ms)
+ *
+ * @return state of the session
+ */
+int tftpSessionOnPacket(struct tftp_session *s, char *packet, size_t len, long long now) {
+    // Final ACK can be lost too, receiver that is done still acknowledges DATA of the last window again
+    if (s->state == TFTP_SESSION_DONE && s->role == TFTP_ROLE_RECEIVER && len >= DATA_HEADER_SIZE &&
+        tftpGetOpcode(packet) == DATA_OPCODE && (uint16_t)(s->block - tftpGetBlock(packet)) < (s->opts.windowsize > 1 ? s->opts.windowsize : 1)) {
+        s->stats.packets_received++;
+        sessionResendAck(s);
+        return s->state;
+    }
+    if (tftpSessionFinished(s) || s->state == TFTP_SESSION_IDLE) return s->state;
+
+    s->stats.packets_received++;
+    if (s->io->on_packet) s->io->on_packet(s, packet, len);
+
+    if (len < OPCODE_SIZE) {
+        tftpSessionAbort(s, 4, "Illegal TFTP operation.");
+        return s->state;
+    }
+
+    uint16_t opcode = tftpGetOpcode(packet);
+
+    if (opcode == ERROR_OPCODE) {
+        uint16_t error_code = 0;
+        const char *error_msg = "";
+        tftpDecodeError(packet, len, &error_code, &error_msg);
+        sessionFail(s, error_code, error_msg, true);
+        return s->state;
+    }
+
+    // The first answer decides options of the transfer
+    if (s->state == TFTP_SESSION_WAIT_FIRST) {
+        if (opcode == OACK_OPCODE && s->wait_oack) {
+            if (sessionNegotiated(s, packet, len) < 0) return s->state;
+
+            s->state = TFTP_SESSION_TRANSFER;
+            if (s->role == TFTP_ROLE_SENDER) sessionFillWindow(s, now);
+            else sessionSendAck(s, 0, now);
+            return s->state;
+        }
+
+        bool expected = s->role == TFTP_ROLE_SENDER ? opcode == ACK_OPCODE : opcode == DATA_OPCODE || (opcode == FEC_OPCODE && s->opts.fec > 0);
+        if (!expected || len < DATA_HEADER_SIZE) {
+            tftpSessionAbort(s, 4, "Illegal TFTP operation.");
+            return s->state;
+        }
+
+        // Peer ignored the options or no options were requested
+        if (sessionNegotiated(s, NULL, 0) < 0) return s->state;
+        s->state = TFTP_SESSION_TRANSFER;
+    }
+
+    // OACK retransmitted by the server because ACK 0 was lost, receiver acknowledges it again
+    if (opcode == OACK_OPCODE && s->wait_oack) {
+        if (s->role == TFTP_ROLE_RECEIVER && s->block == 0) sessionResendAck(s);
+        else s->stats.duplicates++;
+        return s->state;
+    }
+
+    if (len < DATA_HEADER_SIZE) {
+        tftpSessionAbort(s, 4, "Illegal TFTP operation.");
+    } else if (s->role == TFTP_ROLE_RECEIVER && opcode == DATA_OPCODE) {
+        sessionOnData(s, packet, len, now);
+    } else if (s->role == TFTP_ROLE_RECEIVER && opcode == FEC_OPCODE && s->opts.fec > 0) {
+        if (len >= FEC_HEADER_SIZE) sessionOnParity(s, packet, len, now);
+    } else if (s->role == TFTP_ROLE_SENDER && opcode == ACK_OPCODE) {
+        sessionOnAck(s, packet, len, now);
+    } else {
+        tftpSessionAbort(s, 4, "Illegal TFTP operation, unexpected opcode");
+    }
+
+    return s->state;
+}
+
+/**
+ * @brief Retransmit the last packet if the timer expired, fail the session after max_retransmits
+ *
+ * @param s session
+ * @param now current time (ms)
+ *
+ * @return 1 if the timer fired, 0 otherwise
+ */
+int tftpSessionOnTimer(struct tftp_session *s, long long now) {
+    if (tftpSessionFinished(s) || s->state == TFTP_SESSION_IDLE || now < s->deadline) return 0;
+
+    // Delayed ACK of receiver isn't a timeout
+    if (s->ack_pending) {
+        sessionSendAck(s, s->block, now);
+        return 1;
+    }
+
+    s->stats.timeouts++;
+    if (s->retries >= s->max_retransmits) {
+        sessionFail(s, 0, "max retansmission count reached", false);
+        return 1;
+    }
+
+    s->retries++;
+
+    // Sender goes back to the first unacknowledged block with window of one block, blocks reported
+    // by ranges of ACK are skipped
+    if (s->role == TFTP_ROLE_SENDER && s->state == TFTP_SESSION_TRANSFER) {
+        s->block = s->acked;
+        s->resent = 0;
+        s->dup_acks = 0;
+        sessionWindowCut(s, true);
+        sessionFillWindow(s, now);
+        return 1;
+    }
+
+    // DATA after ACK sent again can answer either of them, it doesn't measure the round trip
+    s->ack_sent_ms = -1;
+    s->stats.retransmits++;
+    sessionTransmit(s, now);
+
+    return 1;
+}
+
+/**
+ * @brief End session with error, ERROR packet is sent to the peer
+ *
+ * @param s session
+ * @param error_code TFTP error code
+ * @param error_msg error message
+ */
+void tftpSessionAbort(struct tftp_session *s, uint16_t error_code, const char *error_msg) {
+    char packet[MAX_ERROR_PACKET_SIZE];
+    int packet_len = tftpEncodeError(packet, sizeof(packet), error_code, error_msg);
+
+    if (!tftpSessionFinished(s)) {
+        s->stats.packets_sent++;
+        s->io->send(s, packet, packet_len);
+    }
+    sessionFail(s, error_code, error_msg, false);
+}
+
+/**
+ * @brief Print window, loss and goodput of finished session
+ *
+ * @param s session
+ * @param stream output stream
+ */
+void tftpSessionPrintStats(const struct tftp_session *s, FILE *stream) {
+    double seconds = (s->stats.end_ms - s->stats.start_ms) / 1000.0;
+    double goodput = seconds > 0 ? s->stats.bytes / 1024.0 / seconds : 0;
+    double cwnd_avg = s->stats.rounds > 0 ? (double)s->stats.cwnd_sum / s->stats.rounds : s->cwnd;
+
+    if (s->role == TFTP_ROLE_SENDER) {
+        fprintf(stream, "Window: windowsize=%d%s cwnd_avg=%.1f cwnd_max=%d rounds=%lu losses=%lu retransmits=%lu",
+            s->opts.windowsize, s->opts.sack ? " sack" : "", cwnd_avg, s->stats.cwnd_max, s->stats.rounds, s->stats.losses, s->stats.retransmits);
+        if (s->opts.sack) fprintf(stream, " sacked=%lu", s->stats.sacked);
+        if (s->opts.fec > 0) fprintf(stream, " fec=%d parity=%lu", s->opts.fec, s->stats.parity);
+    } else {
+        fprintf(stream, "Window: windowsize=%d acks=%lu duplicates=%lu timeouts=%lu",
+            s->opts.windowsize, s->stats.packets_sent, s->stats.duplicates, s->stats.timeouts);
+        if (s->opts.fec > 0) fprintf(stream, " fec=%d parity=%lu recovered=%lu", s->opts.fec, s->stats.parity, s->stats.recovered);
+    }
+    fprintf(stream, " goodput=%.1fKiB/s\n", goodput);
+    fflush(stream);
+}
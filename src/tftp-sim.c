@@ -0,0 +1,532 @@
+/* tftp-sim.c ***********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-sim.h"
+#include "../include/tftp-fec.h"
+
+static const struct tftp_session_io sim_io = {
+    .send = simSend,
+    .read = simRead,
+    .write = simWrite,
+};
+
+// Function for printing error messages and terminating process if exit_failure
+void printError(char *error, bool exit_failure) {
+    fprintf(stdout, "Local error: %s\n", error);
+    fflush(stdout);
+    if (exit_failure) exit(EXIT_FAILURE);
+}
+
+// Function for printing usage and terminating process
+void printUsage(char **argv) {
+    fprintf(stdout, "Usage: %s [-n sessions] [-s seed] [-l loss%%[,loss%%...]] [-D duplicate%%] [-d delay_ms] [-j jitter_ms] [-b blksize] [-t timeout] [-w windowsize] [-S] [-F fec_group] [-r rate_KiB/s] [-q queue] [-f file_size] [-u] [-A max_retransmits]\n", argv[0]);
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+// Function for handling arguments
+void handleArguments(int argc, char **argv, struct sim_config *config) {
+    int option;
+    while ((option = getopt(argc, argv, "n:s:l:D:d:j:b:t:w:SF:r:q:f:uA:")) != -1) {
+        switch (option) {
+        case 'n':
+            config->sessions = atoi(optarg);
+            break;
+        case 's':
+            config->seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            // Comma separated list of loss percentages, every value is one scenario
+            config->scenarios = 0;
+            for (char *value = strtok(optarg, ","); value != NULL; value = strtok(NULL, ",")) {
+                if (config->scenarios == SIM_MAX_SCENARIOS) printError("too many loss scenarios", true);
+                config->loss[config->scenarios++] = atof(value) / 100;
+            }
+            break;
+        case 'D':
+            config->duplicate = atof(optarg) / 100;
+            break;
+        case 'd':
+            config->delay = atoi(optarg);
+            break;
+        case 'j':
+            config->jitter = atoi(optarg);
+            break;
+        case 'b':
+            config->blksize = atoi(optarg);
+            break;
+        case 't':
+            config->timeout = atoi(optarg);
+            break;
+        case 'w':
+            config->windowsize = atoi(optarg);
+            break;
+        case 'S':
+            config->sack = true;
+            break;
+        case 'F':
+            config->fec = atoi(optarg);
+            break;
+        case 'r':
+            config->rate = atof(optarg) * 1024 / 1000;
+            break;
+        case 'q':
+            config->queue = atoi(optarg);
+            break;
+        case 'f':
+            config->file_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            config->upload = true;
+            break;
+        case 'A':
+            config->max_retransmits = atof(optarg);
+            break;
+        default:
+            printUsage(argv);
+            break;
+        }
+    }
+
+    if (config->sessions <= 0 || config->scenarios == 0) printUsage(argv);
+    if (config->delay < 0 || config->jitter < 0) printUsage(argv);
+    if (config->blksize < MIN_BLKSIZE || config->blksize > MAX_BLKSIZE) printError("invalid blksize", true);
+    if (config->timeout < MIN_TIMEOUT || config->timeout > MAX_TIMEOUT) printError("invalid timeout", true);
+    if (config->windowsize < MIN_WINDOWSIZE || config->windowsize > MAX_WINDOWSIZE) printError("invalid windowsize", true);
+    if (config->fec != 0 && (config->fec < MIN_FEC_GROUP || config->fec > MAX_FEC_GROUP || config->fec > config->windowsize)) printError("invalid fec group", true);
+    if (config->rate < 0 || config->queue < 1) printUsage(argv);
+}
+
+// xorshift64* generator, the whole simulation depends only on the seed
+uint64_t simRandom(struct sim *sim) {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng * 2685821657736338717ULL;
+}
+
+// Random number in range <0, 1)
+double simRandomUnit(struct sim *sim) {
+    return (simRandom(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Derive independent seed of every session from seed of the run (splitmix64)
+static uint64_t simSessionSeed(uint64_t seed, int index) {
+    uint64_t z = seed + (uint64_t)(index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+/**
+ * @brief Put packet into the virtual network, it is delivered after delay and random jitter. With bottleneck
+ * it waits for the link first and is dropped if the queue of the link is full
+ *
+ * @param sim simulation
+ * @param to SIM_CLIENT or SIM_SERVER
+ * @param packet packet
+ * @param len length of packet
+ */
+void simDeliver(struct sim *sim, int to, const char *packet, size_t len) {
+    const struct sim_config *config = sim->config;
+    long long link_delay = 0;
+
+    if (config->rate > 0) {
+        double start = sim->link_free[to] > sim->now ? sim->link_free[to] : sim->now;
+        if ((start - sim->now) * config->rate >= (double)config->queue * len) {
+            sim->dropped++;
+            return;
+        }
+        sim->link_free[to] = start + len / config->rate;
+        link_delay = (long long)(sim->link_free[to] - sim->now + 0.999);
+    }
+
+    for (int i = 0; i < SIM_MAX_IN_FLIGHT; i++) {
+        struct sim_packet *slot = &sim->packets[i];
+        if (slot->used) continue;
+
+        slot->used = true;
+        slot->to = to;
+        slot->deliver_at = sim->now + link_delay + config->delay;
+        if (config->jitter > 0) slot->deliver_at += simRandom(sim) % (config->jitter + 1);
+        slot->seq = sim->seq++;
+        slot->len = len;
+        memcpy(slot->data, packet, len);
+        return;
+    }
+
+    // Queue of the network is full
+    sim->dropped++;
+}
+
+/**
+ * @brief Send callback of simulated sessions, packet can be lost or duplicated
+ *
+ * @param session sending session, its context is struct sim_endpoint
+ * @param packet packet
+ * @param len length of packet
+ *
+ * @return bytes sent
+ */
+int simSend(struct tftp_session *session, const char *packet, size_t len) {
+    struct sim_endpoint *endpoint = session->ctx;
+    struct sim *sim = endpoint->sim;
+    int to = endpoint->id == SIM_CLIENT ? SIM_SERVER : SIM_CLIENT;
+
+    if (simRandomUnit(sim) < sim->loss) {
+        sim->dropped++;
+        return len;
+    }
+
+    simDeliver(sim, to, packet, len);
+    if (simRandomUnit(sim) < sim->config->duplicate) {
+        sim->duplicated++;
+        simDeliver(sim, to, packet, len);
+    }
+
+    return len;
+}
+
+/**
+ * @brief Read callback of simulated sender, reads from memory
+ *
+ * @param session sending session, its context is struct sim_endpoint
+ * @param dst destination for data
+ * @param cap maximum number of bytes
+ *
+ * @return bytes read
+ */
+int simRead(struct tftp_session *session, char *dst, size_t cap) {
+    struct sim_endpoint *endpoint = session->ctx;
+
+    size_t bytes_read = endpoint->src_len - endpoint->src_pos;
+    if (bytes_read > cap) bytes_read = cap;
+    memcpy(dst, &endpoint->src[endpoint->src_pos], bytes_read);
+    endpoint->src_pos += bytes_read;
+
+    return bytes_read;
+}
+
+/**
+ * @brief Write callback of simulated receiver, writes to memory
+ *
+ * @param session receiving session, its context is struct sim_endpoint
+ * @param data payload
+ * @param len length of payload
+ *
+ * @return 0 on success, -1 if more data than the size of file was received
+ */
+int simWrite(struct tftp_session *session, char *data, size_t len) {
+    struct sim_endpoint *endpoint = session->ctx;
+
+    if (endpoint->dst_len + len > endpoint->sim->config->file_size) return -1;
+    memcpy(&endpoint->dst[endpoint->dst_len], data, len);
+    endpoint->dst_len += len;
+
+    return 0;
+}
+
+/**
+ * @brief Handle RQ packet on simulated server the same way as the server does and start its session.
+ * Real server forks another child for retransmitted RQ, the simulation keeps the first one
+ *
+ * @param sim simulation
+ * @param packet RQ packet
+ * @param len length of packet
+ */
+void simServerRq(struct sim *sim, char *packet, size_t len) {
+    struct sim_endpoint *server = &sim->endpoints[SIM_SERVER];
+    if (server->started) return;
+
+    const char *filename;
+    const char *mode;
+    size_t options_offset;
+    unsigned seen;
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    if (tftpDecodeRq(packet, len, &filename, &mode, &options_offset) < 0) return;
+    if (tftpParseOptions(packet, len, options_offset, &opts, &seen) < 0) return;
+
+    // Cancel inavalid option values, simulated files are only in memory
+    if (opts.blksize < MIN_BLKSIZE || opts.blksize > MAX_BLKSIZE) opts.blksize = DEFAULT_BLKSIZE;
+    if (opts.timeout < MIN_TIMEOUT || opts.timeout > MAX_TIMEOUT) opts.timeout = DEFAULT_TIMEOUT;
+    if (opts.windowsize < MIN_WINDOWSIZE) opts.windowsize = DEFAULT_WINDOWSIZE;
+    if (opts.windowsize > MAX_WINDOWSIZE) opts.windowsize = MAX_WINDOWSIZE;
+    if (opts.windowsize == 1) opts.sack = false;
+    if (opts.windowsize == 1) opts.cwnd = false;
+    if (opts.fec < MIN_FEC_GROUP || opts.windowsize == 1) opts.fec = 0;
+    if (opts.fec > MAX_FEC_GROUP || opts.fec > opts.windowsize) opts.fec = opts.windowsize < MAX_FEC_GROUP ? opts.windowsize : MAX_FEC_GROUP;
+    opts.compress = false;
+    opts.resume = -1;
+
+    bool send_file = tftpGetOpcode(packet) == RRQ_OPCODE;
+    tftpSessionInit(&server->session, send_file ? TFTP_ROLE_SENDER : TFTP_ROLE_RECEIVER, &sim_io, server, NULL, 0);
+    tftpSessionSetPool(&server->session, &sim->pool);
+    tftpSessionSetWheel(&server->session, &sim->wheel);
+    server->session.opts = opts;
+    server->started = true;
+
+    // If handling options the session starts with OACK
+    if (tftpHasOptions(&opts)) {
+        char oack_packet[MAX_RQ_PACKET_SIZE];
+        int oack_packet_len = tftpEncodeOack(oack_packet, sizeof(oack_packet), &opts);
+        tftpSessionStart(&server->session, oack_packet, oack_packet_len, false, sim->now);
+    } else {
+        tftpSessionStart(&server->session, NULL, 0, false, sim->now);
+    }
+}
+
+/**
+ * @brief Run one client/server session on the virtual network until both sides finish.
+ * Events (packet delivery, timers) are processed in order of virtual time
+ *
+ * @param sim simulation with config and loss of the scenario
+ * @param seed seed of the session
+ * @param file_data buffer for the transferred file (file_size bytes)
+ * @param received buffer for the received file (file_size bytes)
+ * @param result to set outcome of the session
+ */
+void runSimSession(struct sim *sim, uint64_t seed, char *file_data, char *received, struct sim_result *result) {
+    const struct sim_config *config = sim->config;
+    struct sim_endpoint *client = &sim->endpoints[SIM_CLIENT];
+    struct sim_endpoint *server = &sim->endpoints[SIM_SERVER];
+
+    sim->rng = seed;
+    sim->now = 0;
+    sim->seq = 0;
+    sim->dropped = 0;
+    sim->duplicated = 0;
+    sim->link_free[SIM_CLIENT] = 0;
+    sim->link_free[SIM_SERVER] = 0;
+    timerWheelInit(&sim->wheel, sim->now);
+    for (int i = 0; i < SIM_MAX_IN_FLIGHT; i++) sim->packets[i].used = false;
+
+    // Content of the file is random too
+    for (size_t i = 0; i < config->file_size; i += sizeof(uint64_t)) {
+        uint64_t value = simRandom(sim);
+        size_t n = config->file_size - i < sizeof(uint64_t) ? config->file_size - i : sizeof(uint64_t);
+        memcpy(&file_data[i], &value, n);
+    }
+
+    for (int id = SIM_CLIENT; id <= SIM_SERVER; id++) {
+        struct sim_endpoint *endpoint = &sim->endpoints[id];
+        endpoint->sim = sim;
+        endpoint->id = id;
+        endpoint->started = false;
+        endpoint->src_pos = 0;
+        endpoint->dst_len = 0;
+
+        // Sender reads the file, receiver writes into received buffer
+        bool sender = (id == SIM_CLIENT) == config->upload;
+        endpoint->src = sender ? file_data : NULL;
+        endpoint->src_len = sender ? config->file_size : 0;
+        endpoint->dst = sender ? NULL : received;
+    }
+
+    // Client starts with RQ, options are requested if they are not default
+    struct tftp_options opts;
+    tftpOptionsInit(&opts);
+    opts.blksize = config->blksize;
+    opts.timeout = config->timeout;
+    opts.windowsize = config->windowsize;
+    opts.sack = config->sack && config->windowsize > 1;
+    opts.cwnd = config->windowsize > 1;
+    opts.fec = config->windowsize > 1 ? config->fec : 0;
+
+    char rq_packet[MAX_RQ_PACKET_SIZE];
+    int rq_packet_len = tftpEncodeRq(rq_packet, sizeof(rq_packet), config->upload ? WRQ_OPCODE : RRQ_OPCODE, "sim.bin", "octet", &opts);
+    tftpSessionInit(&client->session, config->upload ? TFTP_ROLE_SENDER : TFTP_ROLE_RECEIVER, &sim_io, client, NULL, 0);
+    tftpSessionSetPool(&client->session, &sim->pool);
+    tftpSessionSetWheel(&client->session, &sim->wheel);
+    client->session.opts = opts;
+    client->started = true;
+    tftpSessionStart(&client->session, rq_packet, rq_packet_len, tftpHasOptions(&opts), sim->now);
+
+    long long client_end = -1;
+    while (!tftpSessionFinished(&client->session) || (server->started && !tftpSessionFinished(&server->session))) {
+        // Find the next event, packets are delivered before timers expiring at the same time
+        struct sim_packet *next_packet = NULL;
+        for (int i = 0; i < SIM_MAX_IN_FLIGHT; i++) {
+            struct sim_packet *slot = &sim->packets[i];
+            if (!slot->used) continue;
+            if (next_packet == NULL || slot->deliver_at < next_packet->deliver_at ||
+                (slot->deliver_at == next_packet->deliver_at && slot->seq < next_packet->seq)) {
+                next_packet = slot;
+            }
+        }
+
+        long long next_timer = timerWheelNext(&sim->wheel);
+
+        if (next_packet != NULL && next_packet->deliver_at <= next_timer) {
+            sim->now = next_packet->deliver_at;
+
+            // RQ goes to the listening server, other packets to sessions
+            uint16_t opcode = next_packet->len >= OPCODE_SIZE ? tftpGetOpcode(next_packet->data) : 0;
+            if (next_packet->to == SIM_SERVER && (opcode == RRQ_OPCODE || opcode == WRQ_OPCODE)) {
+                simServerRq(sim, next_packet->data, next_packet->len);
+            } else {
+                // Packet is received into RX buffer of the session, longer packet is truncated as by recvfrom
+                struct sim_endpoint *endpoint = &sim->endpoints[next_packet->to];
+                size_t rx_cap;
+                char *rx_packet = endpoint->started ? tftpSessionRxBuffer(&endpoint->session, &rx_cap) : NULL;
+                if (rx_packet != NULL) {
+                    size_t rx_len = next_packet->len < rx_cap ? next_packet->len : rx_cap;
+                    memcpy(rx_packet, next_packet->data, rx_len);
+                    tftpSessionOnPacket(&endpoint->session, rx_packet, rx_len, sim->now);
+                }
+            }
+            next_packet->used = false;
+        } else if (next_timer != TIMER_NEVER) {
+            // Retransmission timers of sessions fire from the wheel
+            sim->now = next_timer;
+            timerWheelAdvance(&sim->wheel, sim->now);
+        } else {
+            break;
+        }
+
+        if (client_end < 0 && tftpSessionFinished(&client->session)) client_end = sim->now;
+    }
+
+    // Congestion window of the sender
+    struct tftp_session *sender = config->upload ? &client->session : &server->session;
+    result->rounds = config->upload || server->started ? sender->stats.rounds : 0;
+    result->cwnd_sum = config->upload || server->started ? sender->stats.cwnd_sum : 0;
+
+    // Buffers go back to the pool for the next session
+    result->buffer_bytes = tftpSessionBufferBytes(&client->session) + (server->started ? tftpSessionBufferBytes(&server->session) : 0);
+    tftpSessionRelease(&client->session);
+    if (server->started) tftpSessionRelease(&server->session);
+
+    // Transfer is successful only if the receiver has exactly the same data
+    struct sim_endpoint *receiver = config->upload ? server : client;
+    result->ok = client->session.state == TFTP_SESSION_DONE && receiver->started &&
+        receiver->dst_len == config->file_size && memcmp(received, file_data, config->file_size) == 0;
+    result->duration = client_end;
+    result->retransmits = client->session.stats.retransmits + (server->started ? server->session.stats.retransmits : 0);
+    result->packets = client->session.stats.packets_sent + (server->started ? server->session.stats.packets_sent : 0);
+    result->dropped = sim->dropped;
+}
+
+static int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Run all sessions with one loss probability and print one line of statistics
+ *
+ * @param config configuration of the run
+ * @param loss loss probability
+ *
+ * @return false if a session failed or sessions retransmitted more than allowed by -A
+ */
+bool runScenario(const struct sim_config *config, double loss) {
+    struct sim *sim = calloc(1, sizeof(struct sim));
+    char *file_data = malloc(config->file_size + 1);
+    char *received = malloc(config->file_size + 1);
+    long long *durations = malloc(config->sessions * sizeof(long long));
+    if (sim == NULL || file_data == NULL || received == NULL || durations == NULL) printError("memory allocation error", true);
+
+    sim->config = config;
+    sim->loss = loss;
+    poolInit(&sim->pool, 0);
+
+    int ok = 0;
+    unsigned long retransmits = 0;
+    unsigned long packets = 0;
+    unsigned long dropped = 0;
+    long long total_duration = 0;
+    size_t buffer_bytes = 0;
+    unsigned long rounds = 0;
+    unsigned long long cwnd_sum = 0;
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    for (int i = 0; i < config->sessions; i++) {
+        struct sim_result result;
+        runSimSession(sim, simSessionSeed(config->seed, i), file_data, received, &result);
+
+        retransmits += result.retransmits;
+        packets += result.packets;
+        dropped += result.dropped;
+        rounds += result.rounds;
+        cwnd_sum += result.cwnd_sum;
+        if (result.buffer_bytes > buffer_bytes) buffer_bytes = result.buffer_bytes;
+        if (result.ok) {
+            durations[ok++] = result.duration;
+            total_duration += result.duration;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_ms = (wall_end.tv_sec - wall_start.tv_sec) * 1000.0 + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+
+    fprintf(stdout, "%6.2f %8d %8d %10.2f %10.2f %10.2f",
+        loss * 100, ok, config->sessions - ok,
+        (double)retransmits / config->sessions, (double)packets / config->sessions, (double)dropped / config->sessions);
+
+    // Completion time and throughput of successful sessions (virtual time)
+    if (ok > 0) {
+        qsort(durations, ok, sizeof(long long), compareLongLong);
+        double throughput = total_duration > 0 ? (double)config->file_size * ok / 1024 / (total_duration / 1000.0) : 0;
+        fprintf(stdout, " %9lld %9lld %10.1f %11.1f", durations[(ok - 1) / 2], durations[(ok * 99 - 1) / 100], (double)total_duration / ok, throughput);
+    } else {
+        fprintf(stdout, " %9s %9s %10s %11s", "-", "-", "-", "-");
+    }
+    // Average congestion window of senders, buffers of one client/server pair and memory of the pool shared by all sessions
+    fprintf(stdout, " %6.1f %8zu %8zu %9.1f\n", rounds > 0 ? (double)cwnd_sum / rounds : 1.0, buffer_bytes, sim->pool.reserved, wall_ms);
+    fflush(stdout);
+
+    bool passed = config->max_retransmits < 0 || (ok == config->sessions && (double)retransmits / config->sessions <= config->max_retransmits);
+
+    free(durations);
+    free(received);
+    free(file_data);
+    poolDestroy(&sim->pool);
+    free(sim);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    struct sim_config config = {
+        .sessions = 1000,
+        .seed = 1,
+        .loss = {0, 0.01, 0.05, 0.1},
+        .scenarios = 4,
+        .duplicate = 0,
+        .delay = 10,
+        .jitter = 0,
+        .blksize = DEFAULT_BLKSIZE,
+        .timeout = DEFAULT_TIMEOUT,
+        .windowsize = DEFAULT_WINDOWSIZE,
+        .sack = false,
+        .fec = 0,
+        .rate = 0,
+        .queue = 64,
+        .file_size = 65536,
+        .upload = false,
+        .max_retransmits = -1,
+    };
+
+    handleArguments(argc, argv, &config);
+
+    fprintf(stdout, "seed=%llu sessions=%d %s file=%zu blksize=%d timeout=%d windowsize=%d%s fec=%d delay=%d jitter=%d duplicate=%.2f%% rate=%.0fKiB/s queue=%d\n",
+        (unsigned long long)config.seed, config.sessions, config.upload ? "upload" : "download", config.file_size,
+        config.blksize, config.timeout, config.windowsize, config.sack ? " sack" : "", config.fec, config.delay, config.jitter, config.duplicate * 100, config.rate * 1000 / 1024, config.queue);
+    fprintf(stdout, "%6s %8s %8s %10s %10s %10s %9s %9s %10s %11s %6s %8s %8s %9s\n",
+        "loss%", "ok", "failed", "retx/sess", "pkts/sess", "lost/sess", "p50_ms", "p99_ms", "mean_ms", "KiB/s", "cwnd", "buf_B", "pool_B", "wall_ms");
+
+    bool passed = true;
+    for (int i = 0; i < config.scenarios; i++) {
+        if (!runScenario(&config, config.loss[i])) passed = false;
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,643 @@
+/* tftp-storage.c *******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include "../include/tftp-storage.h"
+#include "../include/tftp-memstore.h"
+#include "../include/tftp-tarstore.h"
+#include "../include/tftp-dedup.h"
+#include "../include/tftp-packstore.h"
+
+// Position of stream reading or writing storage file
+struct storage_cookie {
+    struct storage_file *file;
+    off_t offset;
+};
+
+static void storageFileInit(struct storage_file *file) {
+    memset(file, 0, sizeof(*file));
+    file->fd = -1;
+    file->entry = -1;
+    file->cursor = -1;
+}
+
+/**
+ * @brief Whether some component of the name is the directory, checked in every component so "dir/../.tftp" is
+ * caught as well
+ *
+ * @param name filename from RQ packet
+ * @param dir name of the directory
+ *
+ * @return true if the name leads into the directory
+ */
+bool storageNameInDir(const char *name, const char *dir) {
+    size_t dir_len = strlen(dir);
+    for (const char *component = name; component != NULL; component = strchr(component, '/')) {
+        while (*component == '/') component++;
+        if (strncmp(component, dir, dir_len) == 0 && (component[dir_len] == '/' || component[dir_len] == '\0')) return true;
+    }
+    return false;
+}
+
+// Name of file of the area in the private directory, '/' and '%' of the name are escaped, so every name has its
+// own file directly in the area. Directories are created on demand
+static int posixPrivateName(int root_fd, const char *area, const char *name, char *dst, size_t cap) {
+    int len = snprintf(dst, cap, "%s/%s/", STORAGE_PRIVATE_DIR, area);
+    if (len < 0 || (size_t)len >= cap) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    size_t pos = len;
+    for (const char *c = name; *c != '\0'; c++) {
+        if (pos + 4 > cap) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        if (*c == '/' || *c == '%') pos += snprintf(&dst[pos], cap - pos, "%%%02X", (unsigned char)*c);
+        else dst[pos++] = *c;
+    }
+    dst[pos] = '\0';
+
+    dst[len - 1] = '\0';
+    mkdirat(root_fd, STORAGE_PRIVATE_DIR, 0700);
+    mkdirat(root_fd, dst, 0700);
+    dst[len - 1] = '/';
+    return 0;
+}
+
+// Upload is written to its partial file, so the name appears only complete. Existing name is never written,
+// only a partial file left by an interrupted upload of the name is continued with STORAGE_APPEND
+static int posixOpenWrite(struct posix_store *store, const char *name, int flags, struct storage_file *file) {
+    int root_fd = store->cache.root_fd;
+    struct stat file_stat;
+
+    if (strlen(name) >= sizeof(((struct posix_upload *)NULL)->name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (fstatat(root_fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    struct posix_upload *upload = calloc(1, sizeof(struct posix_upload));
+    if (upload == NULL) return -1;
+    snprintf(upload->name, sizeof(upload->name), "%s", name);
+    upload->discard = flags & STORAGE_DISCARD;
+    if (posixPrivateName(root_fd, STORAGE_PARTIAL_AREA, name, upload->part_name, sizeof(upload->part_name)) < 0) {
+        free(upload);
+        return -1;
+    }
+
+    // Interrupted upload is continued only by resume, new upload starts with empty partial file. Partial file
+    // left by an interrupted upload is truncated once the lock shows that its upload is gone
+    bool append = flags & STORAGE_APPEND;
+    bool stale = false;
+    if (append) {
+        file->fd = openat(root_fd, upload->part_name, O_RDWR | O_CREAT | O_APPEND, 0666);
+    } else {
+        file->fd = openat(root_fd, upload->part_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (file->fd < 0 && errno == EEXIST) {
+            file->fd = openat(root_fd, upload->part_name, O_RDWR | O_NOFOLLOW);
+            stale = true;
+        }
+    }
+    if (file->fd < 0) {
+        free(upload);
+        return -1;
+    }
+    file->owned = true;
+    file->state = upload;
+
+    // Concurrent uploads of the same name would interleave their data
+    if (flock(file->fd, LOCK_EX | LOCK_NB) < 0 || fstat(file->fd, &file_stat) < 0) {
+        if (errno == EWOULDBLOCK) errno = EEXIST;
+        close(file->fd);
+        free(upload);
+        return -1;
+    }
+
+    // Stale partial file could have been committed by its upload before the lock was taken, then it is
+    // no longer the partial file of the name and mustn't be truncated
+    if (stale) {
+        struct stat part_stat;
+        bool same = fstatat(root_fd, upload->part_name, &part_stat, AT_SYMLINK_NOFOLLOW) == 0 && part_stat.st_ino == file_stat.st_ino &&
+            part_stat.st_dev == file_stat.st_dev;
+        if (!same) errno = EEXIST;
+        if (!same || ftruncate(file->fd, 0) < 0) {
+            close(file->fd);
+            free(upload);
+            return -1;
+        }
+        file_stat.st_size = 0;
+    }
+    file->size = file_stat.st_size;
+
+    file->stream = fdopen(file->fd, "ab");
+    if (file->stream == NULL) {
+        close(file->fd);
+        free(upload);
+        return -1;
+    }
+    return 0;
+}
+
+static int posixOpen(void *backend, const char *name, int flags, struct storage_file *file) {
+    struct posix_store *store = backend;
+    struct stat file_stat;
+
+    if (storageNameInDir(name, STORAGE_PRIVATE_DIR)) {
+        errno = EACCES;
+        return -1;
+    }
+
+    // Files to send come from the descriptor cache, the cache owns them
+    if (!(flags & STORAGE_WRITE)) {
+        file->fd = fdCacheOpen(&store->cache, name, time(NULL));
+        if (file->fd < 0) return -1;
+        if (fstat(file->fd, &file_stat) < 0) return -1;
+        file->size = file_stat.st_size;
+        return 0;
+    }
+
+    return posixOpenWrite(store, name, flags, file);
+}
+
+static int posixStat(void *backend, const char *name, struct storage_stat *stat) {
+    struct posix_store *store = backend;
+    struct stat file_stat;
+
+    if (storageNameInDir(name, STORAGE_PRIVATE_DIR)) {
+        errno = EACCES;
+        return -1;
+    }
+    if (fstatat(store->cache.root_fd, name, &file_stat, 0) < 0) return -1;
+    if (!S_ISREG(file_stat.st_mode)) {
+        errno = ENOENT;
+        return -1;
+    }
+    stat->size = file_stat.st_size;
+    stat->mtime = file_stat.st_mtime;
+    return 0;
+}
+
+static ssize_t posixRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    // Buffered writes have to reach the file before it is read back
+    if (file->stream != NULL && fflush(file->stream) != 0) return -1;
+    return pread(file->fd, dst, len, offset);
+}
+
+static ssize_t posixWrite(struct storage_file *file, const char *data, size_t len) {
+    if (fwrite(data, sizeof(char), len, file->stream) != len) return -1;
+    return len;
+}
+
+// Complete upload gets its name, upload of the same name that finished first wins
+static int posixCommit(struct storage_file *file) {
+    struct posix_store *store = file->backend;
+    struct posix_upload *upload = file->state;
+    if (file->stream != NULL && fflush(file->stream) != 0) return -1;
+    if (upload == NULL || upload->committed) return 0; // Stream outside of the backend
+
+    if (linkat(store->cache.root_fd, upload->part_name, store->cache.root_fd, upload->name, 0) < 0) return -1;
+    unlinkat(store->cache.root_fd, upload->part_name, 0);
+    upload->committed = true;
+    return 0;
+}
+
+// Partial upload stays in the private directory, so it can be resumed
+static void posixClose(struct storage_file *file) {
+    struct posix_store *store = file->backend;
+    struct posix_upload *upload = file->state;
+
+    if (file->stream != NULL) fclose(file->stream);
+    else if (file->owned) close(file->fd);
+
+    if (upload == NULL) return;
+    if (!upload->committed && upload->discard) unlinkat(store->cache.root_fd, upload->part_name, 0);
+    free(upload);
+}
+
+static void posixDestroy(void *backend) {
+    struct posix_store *store = backend;
+    fdCacheDestroy(&store->cache);
+    free(store);
+}
+
+const struct storage_ops posix_storage_ops = {
+    .name = "posix",
+    .resumable = true,
+    .open = posixOpen,
+    .stat = posixStat,
+    .read = posixRead,
+    .write = posixWrite,
+    .commit = posixCommit,
+    .close = posixClose,
+    .destroy = posixDestroy,
+};
+
+/**
+ * @brief Create posix backend serving files of the root directory
+ *
+ * @param storage storage to initialize
+ * @param root_dirpath root directory
+ *
+ * @return 0 on success, -1 if the directory can't be opened
+ */
+int storageCreatePosix(struct storage *storage, const char *root_dirpath) {
+    struct posix_store *store = malloc(sizeof(struct posix_store));
+    if (store == NULL) return -1;
+    if (fdCacheInit(&store->cache, root_dirpath) < 0) {
+        free(store);
+        return -1;
+    }
+
+    storage->ops = &posix_storage_ops;
+    storage->backend = store;
+    return 0;
+}
+
+/**
+ * @brief Create storage backend by its name: "posix" (root is a directory), "memory[:size]" (files of root
+ * directory are loaded into memory, size limits memory for files and uploads), "tar" (root is an archive),
+ * "dedup" (root is a directory, uploads are stored as deduplicated chunks) or "pack" (root is an archive made
+ * by tftp-pack)
+ *
+ * @param storage storage to initialize
+ * @param backend name of backend with optional argument
+ * @param root root directory or archive
+ *
+ * @return 0 on success, -1 on error
+ */
+int storageCreate(struct storage *storage, const char *backend, const char *root) {
+    if (strcmp(backend, "posix") == 0) return storageCreatePosix(storage, root);
+    if (strcmp(backend, "tar") == 0) return storageCreateTar(storage, root);
+    if (strcmp(backend, "dedup") == 0) return storageCreateDedup(storage, root);
+    if (strcmp(backend, "pack") == 0) return storageCreatePack(storage, root);
+
+    if (strncmp(backend, "memory", 6) == 0 && (backend[6] == '\0' || backend[6] == ':')) {
+        size_t capacity = 0;
+        if (backend[6] == ':' && storageParseSize(&backend[7], &capacity) < 0) return -1;
+        return storageCreateMemory(storage, root, capacity);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * @brief Parse size in bytes with optional suffix k, M or G (powers of 1024)
+ *
+ * @param arg size string
+ * @param size parsed size
+ *
+ * @return 0 on success, -1 if the size is invalid
+ */
+int storageParseSize(const char *arg, size_t *size) {
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value <= 0) return -1;
+
+    if (*end == 'k' || *end == 'K') value *= 1024, end++;
+    else if (*end == 'M') value *= 1024 * 1024, end++;
+    else if (*end == 'G') value *= 1024.0 * 1024 * 1024, end++;
+    if (*end != '\0') return -1;
+
+    *size = (size_t)value;
+    return 0;
+}
+
+/**
+ * @brief Open file of the storage
+ *
+ * @param storage storage
+ * @param filename filename from RQ packet, looked up relative to root
+ * @param flags STORAGE_READ or STORAGE_WRITE with optional STORAGE_APPEND
+ * @param file opened file
+ *
+ * @return 0 on success, -1 with errno set (ENOENT, EEXIST, EROFS, ENOSPC, ...)
+ */
+int storageOpen(struct storage *storage, const char *filename, int flags, struct storage_file *file) {
+    storageFileInit(file);
+    file->writable = flags & STORAGE_WRITE;
+    if (storage->ops->open(storage->backend, fdCacheRelative(filename), flags, file) < 0) return -1;
+
+    file->ops = storage->ops;
+    file->backend = storage->backend;
+    return 0;
+}
+
+/**
+ * @brief Get size and modification time of file
+ *
+ * @param storage storage
+ * @param filename filename from RQ packet
+ * @param stat size and time of file
+ *
+ * @return 0 on success, -1 with errno set
+ */
+int storageStat(struct storage *storage, const char *filename, struct storage_stat *stat) {
+    return storage->ops->stat(storage->backend, fdCacheRelative(filename), stat);
+}
+
+/**
+ * @brief Read data of file at offset
+ *
+ * @param file open file
+ * @param dst destination
+ * @param len maximum number of bytes
+ * @param offset offset in file
+ *
+ * @return bytes read (0 at the end of file), -1 on error
+ */
+ssize_t storageRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    return file->ops->read(file, dst, len, offset);
+}
+
+/**
+ * @brief Append data to file opened for write
+ *
+ * @param file open file
+ * @param data data to write
+ * @param len length of data
+ *
+ * @return bytes written, -1 on error
+ */
+ssize_t storageWrite(struct storage_file *file, const char *data, size_t len) {
+    if (!file->writable) {
+        errno = EBADF;
+        return -1;
+    }
+
+    ssize_t written = file->ops->write(file, data, len);
+    if (written > 0) file->size += written;
+    return written;
+}
+
+/**
+ * @brief Finish upload, the backend makes the file complete and visible
+ *
+ * @param file file opened for write
+ *
+ * @return 0 on success, -1 on error
+ */
+int storageCommit(struct storage_file *file) {
+    if (!file->writable) return 0;
+    return file->ops->commit(file);
+}
+
+/**
+ * @brief Close file, closing closed file does nothing
+ *
+ * @param file file
+ */
+void storageClose(struct storage_file *file) {
+    if (file->ops == NULL) return;
+    file->ops->close(file);
+    storageFileInit(file);
+}
+
+/**
+ * @brief Release backend of the storage
+ *
+ * @param storage storage
+ */
+void storageDestroy(struct storage *storage) {
+    if (storage->ops == NULL) return;
+    storage->ops->destroy(storage->backend);
+    storage->ops = NULL;
+    storage->backend = NULL;
+}
+
+/**
+ * @brief Make read-only storage file of descriptor outside of any backend, e.g. precompressed sidecar
+ *
+ * @param file file to initialize
+ * @param fd descriptor, closed with the file
+ *
+ * @return 0 on success, -1 if the descriptor can't be used
+ */
+int storageFileFromFd(struct storage_file *file, int fd) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) return -1;
+
+    storageFileInit(file);
+    file->ops = &posix_storage_ops;
+    file->fd = fd;
+    file->owned = true;
+    file->size = file_stat.st_size;
+    return 0;
+}
+
+/**
+ * @brief Make writable storage file of stdio stream outside of any backend, e.g. temporary file
+ *
+ * @param file file to initialize
+ * @param stream stream, closed with the file
+ *
+ * @return 0 on success, -1 if the stream can't be used
+ */
+int storageFileFromStream(struct storage_file *file, FILE *stream) {
+    if (stream == NULL || fflush(stream) != 0) return -1;
+    if (storageFileFromFd(file, fileno(stream)) < 0) return -1;
+
+    file->stream = stream;
+    file->writable = true;
+    return 0;
+}
+
+static ssize_t bufferRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    if (offset >= file->size) return 0;
+    if (len > (size_t)(file->size - offset)) len = file->size - offset;
+    memcpy(dst, &file->data[offset], len);
+    return len;
+}
+
+static ssize_t bufferWrite(struct storage_file *file, const char *data, size_t len) {
+    (void)file;
+    (void)data;
+    (void)len;
+    errno = EROFS;
+    return -1;
+}
+
+static int bufferCommit(struct storage_file *file) {
+    (void)file;
+    return 0;
+}
+
+// Data are owned by the caller unless the file was detached
+static void bufferClose(struct storage_file *file) {
+    if (file->owned) free((char *)file->data);
+}
+
+// Files in memory of the caller, they aren't a backend so they can't be opened by name
+static const struct storage_ops buffer_file_ops = {
+    .name = "buffer",
+    .read = bufferRead,
+    .write = bufferWrite,
+    .commit = bufferCommit,
+    .close = bufferClose,
+};
+
+/**
+ * @brief Make read-only storage file of data in memory, e.g. rendered virtual file
+ *
+ * @param file file to initialize
+ * @param data contents of file, they have to stay valid until the file is closed
+ * @param len length of data
+ */
+void storageFileFromBuffer(struct storage_file *file, const char *data, size_t len) {
+    storageFileInit(file);
+    file->ops = &buffer_file_ops;
+    file->data = data;
+    file->size = len;
+}
+
+/**
+ * @brief Make file to send independent of caches of the opener, its descriptor or data are copied. Needed when
+ * the file stays open in the same process while the caches serve other requests and evict their entries
+ *
+ * @param file open file
+ *
+ * @return 0 on success, -1 if the copy couldn't be made
+ */
+int storageDetach(struct storage_file *file) {
+    if (file->owned || file->writable) return 0;
+
+    if (file->ops == &posix_storage_ops) {
+        int fd = dup(file->fd);
+        if (fd < 0) return -1;
+        file->fd = fd;
+        file->owned = true;
+    } else if (file->ops == &buffer_file_ops) {
+        char *data = malloc(file->size > 0 ? file->size : 1);
+        if (data == NULL) return -1;
+        memcpy(data, file->data, file->size);
+        file->data = data;
+        file->owned = true;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compute CRC32C of the first len bytes of file
+ *
+ * @param file open file
+ * @param len number of bytes
+ * @param crc result
+ *
+ * @return 0 on success, -1 if file has less than len bytes
+ */
+int storageCrc32c(struct storage_file *file, off_t len, uint32_t *crc) {
+    char *buffer = malloc(STORAGE_CRC_CHUNK);
+    if (buffer == NULL) return -1;
+
+    off_t offset = 0;
+    *crc = 0;
+    while (offset < len) {
+        size_t chunk = len - offset < STORAGE_CRC_CHUNK ? len - offset : STORAGE_CRC_CHUNK;
+        ssize_t bytes_read = storageRead(file, buffer, chunk, offset);
+        if (bytes_read <= 0) break;
+        *crc = crc32cUpdate(*crc, buffer, bytes_read);
+        offset += bytes_read;
+    }
+
+    free(buffer);
+    return offset == len ? 0 : -1;
+}
+
+static ssize_t storageCookieRead(void *cookie, char *buf, size_t size) {
+    struct storage_cookie *position = cookie;
+    ssize_t bytes_read = storageRead(position->file, buf, size, position->offset);
+    if (bytes_read > 0) position->offset += bytes_read;
+    return bytes_read;
+}
+
+static ssize_t storageCookieWrite(void *cookie, const char *buf, size_t size) {
+    struct storage_cookie *position = cookie;
+    ssize_t written = storageWrite(position->file, buf, size);
+    return written < 0 ? 0 : written;
+}
+
+static int storageCookieSeek(void *cookie, off64_t *offset, int whence) {
+    struct storage_cookie *position = cookie;
+    off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? position->offset : position->file->size;
+    if (base + *offset < 0) return -1;
+
+    position->offset = base + *offset;
+    *offset = position->offset;
+    return 0;
+}
+
+static int storageCookieClose(void *cookie) {
+    free(cookie);
+    return 0;
+}
+
+/**
+ * @brief Open stdio stream reading file from its start or appending to it, used by stream compression.
+ * Seeking moves reads only, writes always append
+ * Closing the stream leaves the file open
+ *
+ * @param file open file
+ * @param mode "r" or "w"
+ *
+ * @return stream, NULL on error
+ */
+FILE *storageStream(struct storage_file *file, const char *mode) {
+    struct storage_cookie *cookie = malloc(sizeof(struct storage_cookie));
+    if (cookie == NULL) return NULL;
+    cookie->file = file;
+    cookie->offset = 0;
+
+    cookie_io_functions_t functions = {
+        .read = storageCookieRead,
+        .write = storageCookieWrite,
+        .seek = storageCookieSeek,
+        .close = storageCookieClose,
+    };
+    FILE *stream = fopencookie(cookie, mode, functions);
+    if (stream == NULL) free(cookie);
+    return stream;
+}
+
+/**
+ * @brief Root directory of posix backend, other backends have no directory to store sidecar files
+ *
+ * @param storage storage
+ *
+ * @return descriptor of root directory, -1 if the backend isn't posix
+ */
+int storagePosixRoot(const struct storage *storage) {
+    if (storage->ops != &posix_storage_ops) return -1;
+    return ((struct posix_store *)storage->backend)->cache.root_fd;
+}
+
+/**
+ * @brief Name of file of the requested file in area of the private directory of posix root, the directory
+ * isn't served to clients. Directories of the area are created on demand
+ *
+ * @param storage storage
+ * @param area area of the private directory
+ * @param filename filename from RQ packet
+ * @param dst buffer for the name relative to the root
+ * @param cap size of dst
+ *
+ * @return 0 on success, -1 if the backend isn't posix or the name is too long
+ */
+int storagePrivateName(const struct storage *storage, const char *area, const char *filename, char *dst, size_t cap) {
+    int root_fd = storagePosixRoot(storage);
+    if (root_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return posixPrivateName(root_fd, area, fdCacheRelative(filename), dst, cap);
+}
@@ -0,0 +1,266 @@
+/* tftp-tarstore.c ******************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-tarstore.h"
+
+// Numeric field of header, octal text or base-256 with the highest bit of the first byte set
+static off_t tarNumber(const char *field, size_t len) {
+    off_t value = 0;
+
+    if ((unsigned char)field[0] & 0x80) {
+        value = (unsigned char)field[0] & 0x7f;
+        for (size_t i = 1; i < len; i++) value = (value << 8) | (unsigned char)field[i];
+        return value;
+    }
+
+    for (size_t i = 0; i < len && field[i] != '\0' && field[i] != ' '; i++) {
+        if (field[i] < '0' || field[i] > '7') return -1;
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+// Checksum is the sum of header bytes with the checksum field counted as spaces
+static bool tarChecksumValid(const char *header) {
+    unsigned long sum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)header[i];
+    return tarNumber(&header[148], 8) == (off_t)sum;
+}
+
+// Value of path record of pax extended header ("<len> path=<name>\n" records)
+static bool tarPaxPath(const char *data, size_t len, char *name, size_t name_cap) {
+    size_t pos = 0;
+    bool found = false;
+
+    while (pos < len) {
+        size_t record_len = 0;
+        size_t i = pos;
+        while (i < len && data[i] >= '0' && data[i] <= '9') record_len = record_len * 10 + (data[i++] - '0');
+        if (i >= len || data[i] != ' ' || record_len == 0 || pos + record_len > len) break;
+
+        const char *key = &data[i + 1];
+        const char *end = &data[pos + record_len - 1]; // Newline ending the record
+        if (end - key > 5 && strncmp(key, "path=", 5) == 0 && (size_t)(end - key - 5) < name_cap) {
+            memcpy(name, key + 5, end - key - 5);
+            name[end - key - 5] = '\0';
+            found = true;
+        }
+        pos += record_len;
+    }
+
+    return found;
+}
+
+static int tarCompareEntries(const void *a, const void *b) {
+    const struct tarstore_entry *first = a;
+    const struct tarstore_entry *second = b;
+    int rc = strcmp(first->name, second->name);
+    if (rc != 0) return rc;
+    return first->offset < second->offset ? -1 : first->offset > second->offset;
+}
+
+static int tarCompareName(const void *key, const void *entry) {
+    return strcmp(key, ((const struct tarstore_entry *)entry)->name);
+}
+
+static int tarAddEntry(struct tarstore *store, const char *name, off_t offset, off_t size, time_t mtime) {
+    while (strncmp(name, "./", 2) == 0) name += 2;
+    while (*name == '/') name++;
+    if (*name == '\0') return 0;
+
+    if (store->count == store->cap) {
+        size_t cap = store->cap ? store->cap * 2 : 256;
+        struct tarstore_entry *entries = realloc(store->entries, cap * sizeof(struct tarstore_entry));
+        if (entries == NULL) return -1;
+        store->entries = entries;
+        store->cap = cap;
+    }
+
+    struct tarstore_entry *entry = &store->entries[store->count];
+    entry->name = strdup(name);
+    if (entry->name == NULL) return -1;
+    entry->offset = offset;
+    entry->size = size;
+    entry->mtime = mtime;
+    store->count++;
+    return 0;
+}
+
+// Read headers of the whole archive and build index of regular files
+static int tarBuildIndex(struct tarstore *store) {
+    char header[TAR_BLOCK_SIZE];
+    char name[TAR_NAME_LEN];
+    char long_name[TAR_NAME_LEN] = ""; // Name from GNU or pax header for the next file
+    char extended[2 * TAR_NAME_LEN];
+    off_t offset = 0;
+
+    while (pread(store->fd, header, sizeof(header), offset) == sizeof(header)) {
+        // Archive ends with zero blocks
+        if (header[0] == '\0') break;
+        if (!tarChecksumValid(header)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        off_t size = tarNumber(&header[124], 12);
+        time_t mtime = tarNumber(&header[136], 12);
+        char type = header[156];
+        off_t data = offset + TAR_BLOCK_SIZE;
+        if (size < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (type == 'L' || type == 'x') {
+            // Names that don't fit are dropped, the file is then indexed under its truncated ustar name
+            long_name[0] = '\0';
+            if (size < (off_t)sizeof(extended) && pread(store->fd, extended, size, data) == size) {
+                if (type == 'L' && size < TAR_NAME_LEN) {
+                    memcpy(long_name, extended, size);
+                    long_name[size] = '\0';
+                } else if (type == 'x') {
+                    tarPaxPath(extended, size, long_name, sizeof(long_name));
+                }
+            }
+        } else {
+            if (type == '0' || type == '\0' || type == '7') {
+                if (long_name[0] != '\0') {
+                    snprintf(name, sizeof(name), "%s", long_name);
+                } else if (strncmp(&header[257], "ustar", 5) == 0 && header[345] != '\0') {
+                    snprintf(name, sizeof(name), "%.155s/%.100s", &header[345], header);
+                } else {
+                    snprintf(name, sizeof(name), "%.100s", header);
+                }
+                if (tarAddEntry(store, name, data, size, mtime) < 0) return -1;
+            }
+            long_name[0] = '\0';
+        }
+
+        offset = data + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    }
+
+    // File added again later in the archive replaces the earlier one
+    qsort(store->entries, store->count, sizeof(struct tarstore_entry), tarCompareEntries);
+    size_t kept = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        if (i + 1 < store->count && strcmp(store->entries[i].name, store->entries[i + 1].name) == 0) {
+            free(store->entries[i].name);
+            continue;
+        }
+        store->entries[kept++] = store->entries[i];
+    }
+    store->count = kept;
+    return 0;
+}
+
+static struct tarstore_entry *tarFind(struct tarstore *store, const char *name) {
+    return bsearch(name, store->entries, store->count, sizeof(struct tarstore_entry), tarCompareName);
+}
+
+static int tarOpen(void *backend, const char *name, int flags, struct storage_file *file) {
+    struct tarstore *store = backend;
+    if (flags & STORAGE_WRITE) {
+        errno = EROFS;
+        return -1;
+    }
+
+    struct tarstore_entry *entry = tarFind(store, name);
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    file->fd = store->fd;
+    file->entry = entry - store->entries;
+    file->base = entry->offset;
+    file->size = entry->size;
+    return 0;
+}
+
+static int tarStat(void *backend, const char *name, struct storage_stat *stat) {
+    struct tarstore_entry *entry = tarFind(backend, name);
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    stat->size = entry->size;
+    stat->mtime = entry->mtime;
+    return 0;
+}
+
+static ssize_t tarRead(struct storage_file *file, char *dst, size_t len, off_t offset) {
+    if (offset >= file->size) return 0;
+    if (len > (size_t)(file->size - offset)) len = file->size - offset;
+    return pread(file->fd, dst, len, file->base + offset);
+}
+
+static ssize_t tarWrite(struct storage_file *file, const char *data, size_t len) {
+    (void)file;
+    (void)data;
+    (void)len;
+    errno = EROFS;
+    return -1;
+}
+
+static int tarCommit(struct storage_file *file) {
+    (void)file;
+    return 0;
+}
+
+// Descriptor of the archive is shared by all files
+static void tarClose(struct storage_file *file) {
+    (void)file;
+}
+
+static void tarDestroy(void *backend) {
+    struct tarstore *store = backend;
+    for (size_t i = 0; i < store->count; i++) free(store->entries[i].name);
+    free(store->entries);
+    close(store->fd);
+    free(store);
+}
+
+const struct storage_ops tar_storage_ops = {
+    .name = "tar",
+    .resumable = false,
+    .open = tarOpen,
+    .stat = tarStat,
+    .read = tarRead,
+    .write = tarWrite,
+    .commit = tarCommit,
+    .close = tarClose,
+    .destroy = tarDestroy,
+};
+
+/**
+ * @brief Create read-only backend serving regular files of tar archive (ustar, GNU long names and pax paths).
+ * Index of the archive is sorted once, lookups are binary searches and blocks are read straight from the archive
+ *
+ * @param storage storage to initialize
+ * @param archive_path path of archive
+ *
+ * @return 0 on success, -1 if the archive can't be read
+ */
+int storageCreateTar(struct storage *storage, const char *archive_path) {
+    struct tarstore *store = calloc(1, sizeof(struct tarstore));
+    if (store == NULL) return -1;
+
+    store->fd = open(archive_path, O_RDONLY | O_CLOEXEC);
+    if (store->fd < 0) {
+        free(store);
+        return -1;
+    }
+    if (tarBuildIndex(store) < 0) {
+        tarDestroy(store);
+        return -1;
+    }
+
+    storage->ops = &tar_storage_ops;
+    storage->backend = store;
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* tftp-timer.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-timer.h"
+
+// Link timer into slot that covers its expiration relative to the current tick
+static void wheelInsert(struct timer_wheel *wheel, struct tftp_timer *timer) {
+    long long expires = timer->expires;
+    long long delta = expires - wheel->now;
+
+    if (delta < 0) {
+        // Already expired, fires on the next tick
+        expires = wheel->now;
+        delta = 0;
+    } else if (delta >= TIMER_WHEEL_RANGE) {
+        // Out of range, waits in the last level and is placed again when it is cascaded
+        expires = wheel->now + TIMER_WHEEL_RANGE - 1;
+        delta = TIMER_WHEEL_RANGE - 1;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1LL << ((level + 1) * TIMER_WHEEL_SLOT_BITS)) level++;
+    int slot = (expires >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_MASK;
+
+    struct tftp_timer **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head != NULL) (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+    timer->level = level;
+    timer->slot = slot;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+// Unlink timer from its slot
+static void wheelRemove(struct timer_wheel *wheel, struct tftp_timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) timer->next->pprev = timer->pprev;
+    if (wheel->slots[timer->level][timer->slot] == NULL) wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Take all timers out of slot, the list stays linked through next
+static struct tftp_timer *wheelDetach(struct timer_wheel *wheel, int level, int slot) {
+    struct tftp_timer *list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    return list;
+}
+
+// Move timers of the slot that starts at the current tick to lower levels
+static void wheelCascade(struct timer_wheel *wheel, int level) {
+    int slot = (wheel->now >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_MASK;
+    struct tftp_timer *timer = wheelDetach(wheel, level, slot);
+
+    while (timer != NULL) {
+        struct tftp_timer *next = timer->next;
+        wheelInsert(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Initialize empty timer wheel
+ *
+ * @param wheel timer wheel
+ * @param now current time (ms)
+ */
+void timerWheelInit(struct timer_wheel *wheel, long long now) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] = 0;
+    }
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+/**
+ * @brief Arm timer or move already armed timer to new expiration time
+ *
+ * @param wheel timer wheel
+ * @param timer timer initialized by timerInit
+ * @param expires expiration time (ms), time in the past fires on the next timerWheelAdvance
+ */
+void timerWheelArm(struct timer_wheel *wheel, struct tftp_timer *timer, long long expires) {
+    if (timerArmed(timer)) wheelRemove(wheel, timer);
+    else wheel->count++;
+
+    timer->expires = expires;
+    wheelInsert(wheel, timer);
+}
+
+/**
+ * @brief Disarm timer, nothing happens if it isn't armed
+ *
+ * @param wheel timer wheel
+ * @param timer timer
+ */
+void timerWheelCancel(struct timer_wheel *wheel, struct tftp_timer *timer) {
+    if (!timerArmed(timer)) return;
+
+    wheelRemove(wheel, timer);
+    timer->expires = TIMER_NEVER;
+    wheel->count--;
+}
+
+/**
+ * @brief Time the event loop has to wake up at. Timers of the first level are exact, timers of higher
+ * levels report the time they are cascaded at, which is never later than their expiration
+ *
+ * @param wheel timer wheel
+ *
+ * @return time (ms) or TIMER_NEVER if no timer is armed
+ */
+long long timerWheelNext(const struct timer_wheel *wheel) {
+    if (wheel->count == 0) return TIMER_NEVER;
+
+    long long next = TIMER_NEVER;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0) continue;
+
+        int shift = level * TIMER_WHEEL_SLOT_BITS;
+        int current = (wheel->now >> shift) & TIMER_WHEEL_MASK;
+        long long round = 1LL << (shift + TIMER_WHEEL_SLOT_BITS);
+        long long base = wheel->now & ~(round - 1);
+
+        // Current slot is still pending only if the current tick is where it is cascaded
+        bool pending = (wheel->now & ((1LL << shift) - 1)) == 0;
+        uint64_t ahead = occupied & (pending ? ~0ULL << current : current == TIMER_WHEEL_MASK ? 0 : ~0ULL << (current + 1));
+
+        long long at;
+        if (ahead != 0) at = base + ((long long)__builtin_ctzll(ahead) << shift);
+        else at = base + round + ((long long)__builtin_ctzll(occupied) << shift);
+
+        if (at < next) next = at;
+    }
+
+    return next;
+}
+
+/**
+ * @brief Fire all timers that expired until now, callbacks can arm and cancel any timers
+ *
+ * @param wheel timer wheel
+ * @param now current time (ms)
+ *
+ * @return number of fired timers
+ */
+size_t timerWheelAdvance(struct timer_wheel *wheel, long long now) {
+    size_t fired = 0;
+
+    while (wheel->now <= now) {
+        long long tick = wheel->now;
+        int slot = tick & TIMER_WHEEL_MASK;
+
+        // Start of a round of a level cascades the next slot of the level above
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((tick & ((1LL << (level * TIMER_WHEEL_SLOT_BITS)) - 1)) != 0) break;
+            wheelCascade(wheel, level);
+        }
+
+        // Expired timers stay linked in local list, so callbacks can cancel them. Timers armed
+        // by callbacks for this tick or earlier fire on the next tick
+        struct tftp_timer *expired = wheelDetach(wheel, 0, slot);
+        if (expired != NULL) expired->pprev = &expired;
+        wheel->now = tick + 1;
+
+        while (expired != NULL) {
+            struct tftp_timer *timer = expired;
+            expired = timer->next;
+            if (expired != NULL) expired->pprev = &expired;
+            timer->next = NULL;
+            timer->pprev = NULL;
+
+            if (timer->expires > tick) {
+                // Timer longer than range of the wheel
+                wheelInsert(wheel, timer);
+            } else {
+                wheel->count--;
+                fired++;
+                timer->fn(timer, tick);
+            }
+        }
+
+        // Skip empty rest of the first level round
+        uint64_t ahead = slot == TIMER_WHEEL_MASK ? 0 : wheel->occupied[0] & (~0ULL << (slot + 1));
+        if (ahead == 0 && wheel->now <= now) {
+            long long round_end = (tick | TIMER_WHEEL_MASK) + 1;
+            wheel->now = round_end < now + 1 ? round_end : now + 1;
+        }
+    }
+
+    return fired;
+}
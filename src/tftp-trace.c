@@ -0,0 +1,135 @@
+/* tftp-trace.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-trace.h"
+
+// Write whole buffer, O_APPEND keeps lines of concurrent processes apart
+static void traceWrite(struct trace *trace, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(trace->fd, buffer, len);
+        if (written <= 0) return;
+        buffer += written;
+        len -= written;
+    }
+}
+
+// Copy string for JSON string literal, quotes, backslashes and control characters are replaced
+static void traceEscape(char *dst, size_t cap, const char *src) {
+    size_t len = 0;
+    for (; *src != '\0' && len < cap - 1; src++) {
+        unsigned char c = *src;
+        dst[len++] = (c == '"' || c == '\\' || c < 0x20) ? '_' : c;
+    }
+    dst[len] = '\0';
+}
+
+/**
+ * @brief Initialize trace with tracing turned off
+ *
+ * @param trace trace
+ */
+void traceInit(struct trace *trace) {
+    trace->fd = -1;
+    trace->enabled = false;
+    trace->count = 0;
+    trace->label[0] = '\0';
+    trace->label_written = false;
+}
+
+/**
+ * @brief Open trace file for appending, new file starts with opening bracket of JSON array.
+ * The closing bracket is optional in Chrome trace format, so processes only append events
+ *
+ * @param trace trace
+ * @param path path of trace file
+ *
+ * @return 0 on success, -1 if the file couldn't be opened
+ */
+int traceOpen(struct trace *trace, const char *path) {
+    traceInit(trace);
+
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace->fd < 0) return -1;
+
+    struct stat file_stat;
+    if (fstat(trace->fd, &file_stat) == 0 && file_stat.st_size == 0) traceWrite(trace, "[\n", 2);
+    return 0;
+}
+
+/**
+ * @brief Start tracing session of the current process
+ *
+ * @param trace opened trace
+ * @param program name of program
+ * @param filename transferred file
+ */
+void traceStart(struct trace *trace, const char *program, const char *filename) {
+    if (trace->fd < 0) return;
+
+    char name[TRACE_LABEL_LEN / 2];
+    traceEscape(name, sizeof(name), filename);
+    snprintf(trace->label, sizeof(trace->label), "%s %s", program, name);
+    trace->label_written = false;
+    trace->pid = getpid();
+    trace->count = 0;
+    trace->enabled = true;
+}
+
+/**
+ * @brief Format buffered events as JSON lines and append them to the trace file
+ *
+ * @param trace trace
+ */
+void traceFlush(struct trace *trace) {
+    if (!trace->enabled || trace->fd < 0) return;
+
+    static char buffer[TRACE_WRITE_SIZE];
+    size_t len = 0;
+
+    // Name of the process, the viewer shows it instead of pid
+    if (!trace->label_written) {
+        len += snprintf(buffer, sizeof(buffer), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+            trace->pid, trace->pid, trace->label);
+        trace->label_written = true;
+    }
+
+    for (size_t i = 0; i < trace->count; i++) {
+        const struct trace_event *event = &trace->events[i];
+
+        // Line is at most a few hundred bytes, write the buffer before it could overflow
+        if (len > sizeof(buffer) - 512) {
+            traceWrite(trace, buffer, len);
+            len = 0;
+        }
+
+        // Timestamps are in microseconds, fraction keeps nanoseconds
+        len += snprintf(&buffer[len], sizeof(buffer) - len, "{\"name\":\"%s\",\"cat\":\"tftp\",\"ph\":\"%c\",\"ts\":%lld.%03lld,",
+            event->name, event->phase, event->ts_ns / 1000, event->ts_ns % 1000);
+        if (event->phase == 'X') {
+            len += snprintf(&buffer[len], sizeof(buffer) - len, "\"dur\":%lld.%03lld,", event->dur_ns / 1000, event->dur_ns % 1000);
+        } else {
+            len += snprintf(&buffer[len], sizeof(buffer) - len, "\"s\":\"t\",");
+        }
+        len += snprintf(&buffer[len], sizeof(buffer) - len, "\"pid\":%d,\"tid\":%d", trace->pid, trace->pid);
+        if (event->block >= 0) len += snprintf(&buffer[len], sizeof(buffer) - len, ",\"args\":{\"block\":%ld}", event->block);
+        len += snprintf(&buffer[len], sizeof(buffer) - len, "},\n");
+    }
+
+    traceWrite(trace, buffer, len);
+    trace->count = 0;
+}
+
+/**
+ * @brief Write remaining events and close trace file
+ *
+ * @param trace trace
+ */
+void traceClose(struct trace *trace) {
+    traceFlush(trace);
+    if (trace->fd >= 0) close(trace->fd);
+    traceInit(trace);
+}
@@ -0,0 +1,369 @@
+/* tftp-vfile.c *********************************************************
+ * Name: Michal
+ * Surname: Ondrejka
+ * Login: xondre15
+ * **********************************************************************
+ */
+
+#include "../include/tftp-vfile.h"
+
+// Free rendered data of the entry and mark it empty
+static void vfileEvict(struct vfile_cache_entry *entry) {
+    free(entry->data);
+    entry->data = NULL;
+    entry->name[0] = '\0';
+}
+
+// Normalize MAC address with '-' or ':' separators (or none) to aa:bb:cc:dd:ee:ff
+static bool vfileNormalizeMac(const char *src, char *dst) {
+    int digits = 0;
+    for (; *src != '\0'; src++) {
+        if (*src == '-' || *src == ':') continue;
+        if (!isxdigit((unsigned char)*src) || digits == 12) return false;
+        if (digits > 0 && digits % 2 == 0) *dst++ = ':';
+        *dst++ = tolower((unsigned char)*src);
+        digits++;
+    }
+    *dst = '\0';
+    return digits == 12;
+}
+
+static bool vfileAddVar(struct vfile_var *vars, int *var_count, const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (*var_count == VFILE_MAX_VARS || name_len >= VFILE_VAR_NAME_LEN || value_len >= VFILE_VALUE_LEN) return false;
+
+    struct vfile_var *var = &vars[(*var_count)++];
+    memcpy(var->name, name, name_len);
+    var->name[name_len] = '\0';
+    memcpy(var->value, value, value_len);
+    var->value[value_len] = '\0';
+    return true;
+}
+
+static const char *vfileGetVar(const struct vfile_var *vars, int var_count, const char *name, size_t name_len) {
+    for (int i = 0; i < var_count; i++) {
+        if (strncmp(vars[i].name, name, name_len) == 0 && vars[i].name[name_len] == '\0') return vars[i].value;
+    }
+    return NULL;
+}
+
+// Match name against pattern, every {var} takes the part of name up to the next literal character of pattern
+static bool vfileMatch(const char *pattern, const char *name, struct vfile_var *vars, int *var_count) {
+    while (*pattern != '\0') {
+        if (*pattern != '{') {
+            if (*pattern++ != *name++) return false;
+            continue;
+        }
+
+        const char *close = strchr(pattern, '}');
+        if (close == NULL || close == pattern + 1) return false;
+        const char *end = name;
+        while (*end != '\0' && *end != '/' && *end != close[1]) end++;
+        if (end == name || !vfileAddVar(vars, var_count, pattern + 1, close - pattern - 1, name, end - name)) return false;
+
+        name = end;
+        pattern = close + 1;
+    }
+    return *name == '\0';
+}
+
+static int vfileCompareHosts(const void *a, const void *b) {
+    return strcmp(((const struct vfile_host *)a)->key, ((const struct vfile_host *)b)->key);
+}
+
+static int vfileCompareKey(const void *key, const void *host) {
+    return strcmp(key, ((const struct vfile_host *)host)->key);
+}
+
+// Add variables of the client from host table, found by MAC from the name or by IP address
+static void vfileAddHostVars(struct vfiles *vfiles, struct vfile_var *vars, int *var_count) {
+    const char *key = vfileGetVar(vars, *var_count, "mac", 3);
+    if (key == NULL) key = vfileGetVar(vars, *var_count, "ip", 2);
+    struct vfile_host *host = bsearch(key, vfiles->hosts, vfiles->host_count, sizeof(struct vfile_host), vfileCompareKey);
+    if (host == NULL) return;
+
+    const char *pos = host->vars;
+    while (*pos != '\0') {
+        while (isspace((unsigned char)*pos)) pos++;
+        const char *end = pos;
+        while (*end != '\0' && !isspace((unsigned char)*end)) end++;
+
+        const char *equals = memchr(pos, '=', end - pos);
+        if (equals != NULL && equals > pos) vfileAddVar(vars, var_count, pos, equals - pos, equals + 1, end - equals - 1);
+        pos = end;
+    }
+}
+
+// Read whole template from storage
+static char *vfileReadTemplate(struct storage *storage, const char *name, size_t *len, time_t *mtime) {
+    struct storage_stat stat;
+    struct storage_file file;
+    if (storageStat(storage, name, &stat) < 0) return NULL;
+    if (stat.size > VFILE_MAX_TEMPLATE) {
+        errno = EFBIG;
+        return NULL;
+    }
+    if (storageOpen(storage, name, STORAGE_READ, &file) < 0) return NULL;
+
+    char *data = malloc(stat.size + 1);
+    ssize_t bytes_read = data == NULL ? -1 : storageRead(&file, data, stat.size, 0);
+    storageClose(&file);
+    if (bytes_read < 0) {
+        free(data);
+        return NULL;
+    }
+
+    *len = bytes_read;
+    *mtime = stat.mtime;
+    return data;
+}
+
+/**
+ * @brief Initialize virtual files without rules, no file is virtual then
+ *
+ * @param vfiles virtual files
+ */
+void vfileInit(struct vfiles *vfiles) {
+    memset(vfiles, 0, sizeof(*vfiles));
+}
+
+/**
+ * @brief Load rules, every line is "pattern template", e.g. "pxelinux.cfg/01-{mac} templates/pxelinux.cfg".
+ * Empty lines and lines starting with '#' are skipped
+ *
+ * @param vfiles virtual files
+ * @param path file with rules
+ *
+ * @return 0 on success, -1 if the file can't be read or a rule is invalid
+ */
+int vfileLoadRules(struct vfiles *vfiles, const char *path) {
+    FILE *rules = fopen(path, "r");
+    if (rules == NULL) return -1;
+
+    char line[VFILE_LINE_LEN];
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), rules) != NULL) {
+        char pattern[VFILE_NAME_LEN], template_name[VFILE_NAME_LEN];
+        int fields = sscanf(line, "%255s %255s", pattern, template_name);
+        if (line[0] == '#' || fields < 1) continue;
+
+        if (vfiles->rule_count == VFILE_MAX_RULES || fields != 2) {
+            errno = EINVAL;
+            rc = -1;
+            break;
+        }
+        struct vfile_rule *rule = &vfiles->rules[vfiles->rule_count++];
+        snprintf(rule->pattern, sizeof(rule->pattern), "%s", fdCacheRelative(pattern));
+        snprintf(rule->template_name, sizeof(rule->template_name), "%s", template_name);
+    }
+
+    fclose(rules);
+    return rc;
+}
+
+/**
+ * @brief Load host table, every line is "key name=value ...", key is MAC or IP address of client.
+ * Empty lines and lines starting with '#' are skipped
+ *
+ * @param vfiles virtual files
+ * @param path file with host table
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int vfileLoadHosts(struct vfiles *vfiles, const char *path) {
+    FILE *hosts = fopen(path, "r");
+    if (hosts == NULL) return -1;
+
+    char line[VFILE_LINE_LEN];
+    size_t cap = vfiles->host_count;
+    while (fgets(line, sizeof(line), hosts) != NULL) {
+        char key[VFILE_VALUE_LEN];
+        int key_end = 0;
+        if (line[0] == '#' || sscanf(line, "%255s%n", key, &key_end) != 1) continue;
+
+        if (vfiles->host_count == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct vfile_host *grown = realloc(vfiles->hosts, cap * sizeof(struct vfile_host));
+            if (grown == NULL) break;
+            vfiles->hosts = grown;
+        }
+
+        struct vfile_host *host = &vfiles->hosts[vfiles->host_count];
+        if (!vfileNormalizeMac(key, host->key)) snprintf(host->key, sizeof(host->key), "%s", key);
+        line[strcspn(line, "\n")] = '\0';
+        host->vars = strdup(&line[key_end]);
+        if (host->vars == NULL) break;
+        vfiles->host_count++;
+    }
+
+    fclose(hosts);
+    qsort(vfiles->hosts, vfiles->host_count, sizeof(struct vfile_host), vfileCompareHosts);
+    return 0;
+}
+
+/**
+ * @brief Render template, ${name} is replaced by value of variable (unknown ones by nothing), $$ by $
+ *
+ * @param template template
+ * @param template_len length of template
+ * @param vars variables, the first one of a name is used
+ * @param var_count number of variables
+ * @param out rendered data, allocated
+ * @param out_len length of rendered data
+ *
+ * @return 0 on success, -1 if memory couldn't be allocated
+ */
+int vfileRender(const char *template, size_t template_len, const struct vfile_var *vars, int var_count, char **out, size_t *out_len) {
+    size_t cap = template_len + VFILE_VALUE_LEN;
+    size_t len = 0;
+    char *data = malloc(cap);
+    if (data == NULL) return -1;
+
+    for (size_t i = 0; i < template_len;) {
+        const char *value = NULL;
+        size_t value_len = 1;
+        size_t used = 1;
+
+        const char *close = NULL;
+        if (template[i] == '$' && i + 1 < template_len && template[i + 1] == '{') {
+            close = memchr(&template[i + 2], '}', template_len - i - 2);
+        }
+        if (close != NULL) {
+            size_t name_len = close - &template[i + 2];
+            value = vfileGetVar(vars, var_count, &template[i + 2], name_len);
+            if (value == NULL) value = "";
+            value_len = strlen(value);
+            used = name_len + 3;
+        } else if (template[i] == '$' && i + 1 < template_len && template[i + 1] == '$') {
+            value = "$";
+            used = 2;
+        } else {
+            value = &template[i];
+        }
+
+        if (len + value_len > cap) {
+            cap = (len + value_len) * 2;
+            char *grown = realloc(data, cap);
+            if (grown == NULL) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+        }
+        memcpy(&data[len], value, value_len);
+        len += value_len;
+        i += used;
+    }
+
+    *out = data;
+    *out_len = len;
+    return 0;
+}
+
+/**
+ * @brief Open virtual file if the name matches a rule. Rendered file is cached for the name and client
+ * address and revalidated against modification time of its template
+ *
+ * @param vfiles virtual files
+ * @param storage storage with templates
+ * @param filename filename from RQ packet
+ * @param addr address of client, variables ip and hexip
+ * @param now current time (s)
+ * @param file opened file, it refers to the cache and is valid until the next call
+ *
+ * @return 1 if the file is virtual and was opened, 0 if no rule matches, -1 if it couldn't be rendered (errno is set)
+ */
+int vfileOpen(struct vfiles *vfiles, struct storage *storage, const char *filename, struct in_addr addr, time_t now, struct storage_file *file) {
+    if (vfiles->rule_count == 0) return 0;
+    const char *name = fdCacheRelative(filename);
+    if (strlen(name) >= VFILE_NAME_LEN) return 0;
+
+    struct vfile_cache_entry *entry = NULL;
+    struct vfile_cache_entry *victim = &vfiles->entries[0];
+    for (int i = 0; i < VFILE_CACHE_SIZE; i++) {
+        struct vfile_cache_entry *candidate = &vfiles->entries[i];
+        if (candidate->data != NULL && candidate->addr.s_addr == addr.s_addr && strcmp(candidate->name, name) == 0) {
+            entry = candidate;
+            break;
+        }
+        // Empty entry is used first, otherwise the least recently used one
+        if (victim->data != NULL && (candidate->data == NULL || candidate->last_used < victim->last_used)) victim = candidate;
+    }
+
+    if (entry != NULL) {
+        entry->last_used = ++vfiles->uses;
+        struct storage_stat stat;
+        if (now - entry->checked < VFILE_REVALIDATE_SEC ||
+            (storageStat(storage, vfiles->rules[entry->rule].template_name, &stat) == 0 && stat.mtime == entry->template_mtime)) {
+            entry->checked = now;
+            vfiles->hits++;
+            storageFileFromBuffer(file, entry->data, entry->len);
+            return 1;
+        }
+
+        vfileEvict(entry);
+        victim = entry;
+    }
+
+    struct vfile_var vars[VFILE_MAX_VARS];
+    int var_count = 0;
+    int rule = 0;
+    for (; rule < vfiles->rule_count; rule++) {
+        var_count = 0;
+        if (!vfileMatch(vfiles->rules[rule].pattern, name, vars, &var_count)) continue;
+
+        // MAC from the name is normalized, so it matches keys of host table
+        char *mac = (char *)vfileGetVar(vars, var_count, "mac", 3);
+        char normalized[VFILE_VALUE_LEN];
+        if (mac == NULL) break;
+        if (vfileNormalizeMac(mac, normalized)) {
+            strcpy(mac, normalized);
+            break;
+        }
+    }
+    if (rule == vfiles->rule_count) return 0;
+
+    char value[VFILE_VALUE_LEN];
+    inet_ntop(AF_INET, &addr, value, sizeof(value));
+    vfileAddVar(vars, &var_count, "ip", 2, value, strlen(value));
+    snprintf(value, sizeof(value), "%08X", ntohl(addr.s_addr));
+    vfileAddVar(vars, &var_count, "hexip", 5, value, strlen(value));
+    vfileAddVar(vars, &var_count, "filename", 8, name, strlen(name));
+    vfileAddHostVars(vfiles, vars, &var_count);
+
+    size_t template_len;
+    time_t template_mtime;
+    char *template = vfileReadTemplate(storage, vfiles->rules[rule].template_name, &template_len, &template_mtime);
+    if (template == NULL) return -1;
+
+    char *data;
+    size_t len;
+    int rc = vfileRender(template, template_len, vars, var_count, &data, &len);
+    free(template);
+    if (rc < 0) return -1;
+
+    vfileEvict(victim);
+    snprintf(victim->name, sizeof(victim->name), "%s", name);
+    victim->addr = addr;
+    victim->data = data;
+    victim->len = len;
+    victim->rule = rule;
+    victim->template_mtime = template_mtime;
+    victim->checked = now;
+    victim->last_used = ++vfiles->uses;
+    vfiles->renders++;
+
+    storageFileFromBuffer(file, victim->data, victim->len);
+    return 1;
+}
+
+/**
+ * @brief Free cached files and host table
+ *
+ * @param vfiles virtual files
+ */
+void vfileDestroy(struct vfiles *vfiles) {
+    for (int i = 0; i < VFILE_CACHE_SIZE; i++) vfileEvict(&vfiles->entries[i]);
+    for (size_t i = 0; i < vfiles->host_count; i++) free(vfiles->hosts[i].vars);
+    free(vfiles->hosts);
+    vfileInit(vfiles);
+}